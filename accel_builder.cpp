@@ -0,0 +1,274 @@
+#include "accel_builder.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "nvh/alignment.hpp"
+#include "nvvk/buffers_vk.hpp"
+
+void AccelBuilder::init(VkDevice device, VkPhysicalDevice physicalDevice, nvvk::ResourceAllocator* alloc, uint32_t queueFamilyIndex)
+{
+    m_device = device;
+    m_alloc  = alloc;
+    vkGetDeviceQueue(m_device, queueFamilyIndex, 0, &m_queue);
+
+    VkPhysicalDeviceAccelerationStructurePropertiesKHR asProperties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR};
+    VkPhysicalDeviceProperties2 properties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
+    properties.pNext = &asProperties;
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+    m_scratchAlignment = asProperties.minAccelerationStructureScratchOffsetAlignment;
+
+    VkCommandPoolCreateInfo poolInfo{VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+    poolInfo.flags            = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
+    vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_cmdPool);
+
+    VkCommandBufferAllocateInfo allocInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+    allocInfo.commandPool        = m_cmdPool;
+    allocInfo.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+    vkAllocateCommandBuffers(m_device, &allocInfo, &m_cmdBuf);
+
+    VkSemaphoreTypeCreateInfo timelineInfo{VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+    timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    VkSemaphoreCreateInfo semInfo{VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+    semInfo.pNext = &timelineInfo;
+    vkCreateSemaphore(m_device, &semInfo, nullptr, &m_timeline);
+}
+
+void AccelBuilder::deinit()
+{
+    if (m_device == VK_NULL_HANDLE)
+        return;
+    clear();
+    vkDestroySemaphore(m_device, m_timeline, nullptr);
+    vkDestroyCommandPool(m_device, m_cmdPool, nullptr);
+    m_cmdBuf = VK_NULL_HANDLE;
+    m_device = VK_NULL_HANDLE;
+}
+
+void AccelBuilder::clear()
+{
+    waitIdle();
+    for (auto& blas : m_blas)
+        m_alloc->destroy(blas.as);
+    m_blas.clear();
+    m_builtCount     = 0;
+    m_submittedCount = 0;
+    m_alloc->destroy(m_scratch);
+    m_scratchSize = 0;
+
+    m_alloc->destroy(m_tlas);
+    m_alloc->destroy(m_tlasScratch);
+    if (m_instances != nullptr)
+        m_alloc->unmap(m_instanceBuffer);
+    m_alloc->destroy(m_instanceBuffer);
+    m_instances    = nullptr;
+    m_maxInstances = 0;
+    m_frameCount   = 0;
+}
+
+void AccelBuilder::waitIdle()
+{
+    if (m_submittedCount == m_builtCount)
+        return;
+    VkSemaphoreWaitInfo waitInfo{VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores    = &m_timeline;
+    waitInfo.pValues        = &m_timelineValue;
+    vkWaitSemaphores(m_device, &waitInfo, UINT64_MAX);
+    m_builtCount = m_submittedCount;
+}
+
+uint32_t AccelBuilder::addBlas(const BlasInput& input)
+{
+    Blas blas;
+    blas.input = input;
+    for (const auto& range : input.asBuildOffsetInfo)
+        blas.triangleCount += range.primitiveCount;
+    m_blas.push_back(blas);
+    return static_cast<uint32_t>(m_blas.size() - 1);
+}
+
+uint32_t AccelBuilder::buildBlas(uint64_t triangleBudget, VkBuildAccelerationStructureFlagsKHR flags)
+{
+    // The batch in flight is done once its value is signaled
+    uint32_t built = 0;
+    if (m_submittedCount > m_builtCount)
+    {
+        uint64_t completed = 0;
+        vkGetSemaphoreCounterValue(m_device, m_timeline, &completed);
+        if (completed < m_timelineValue)
+            return 0;
+        built        = m_submittedCount - m_builtCount;
+        m_builtCount = m_submittedCount;
+    }
+
+    // At least one BLAS per batch, however large it is
+    const uint32_t first     = m_submittedCount;
+    uint32_t       last      = first;
+    uint64_t       triangles = 0;
+    while (last < m_blas.size() && (last == first || triangles < triangleBudget))
+        triangles += m_blas[last++].triangleCount;
+    if (last == first)
+        return built;
+
+    // All BLASes of the batch are built by one command, each in its own part of the scratch buffer
+    std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildInfos(last - first);
+    std::vector<VkDeviceSize>                                scratchOffsets(last - first);
+    VkDeviceSize                                             scratchSize = 0;
+    for (uint32_t i = first; i < last; i++)
+    {
+        Blas& blas = m_blas[i];
+
+        VkAccelerationStructureBuildGeometryInfoKHR& buildInfo = buildInfos[i - first];
+        buildInfo               = {VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR};
+        buildInfo.type          = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+        buildInfo.mode          = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+        buildInfo.flags         = blas.input.flags | flags;
+        buildInfo.geometryCount = static_cast<uint32_t>(blas.input.asGeometry.size());
+        buildInfo.pGeometries   = blas.input.asGeometry.data();
+
+        std::vector<uint32_t> maxPrimitiveCounts;
+        for (const auto& range : blas.input.asBuildOffsetInfo)
+            maxPrimitiveCounts.push_back(range.primitiveCount);
+        VkAccelerationStructureBuildSizesInfoKHR sizes{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR};
+        vkGetAccelerationStructureBuildSizesKHR(m_device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo,
+                                                maxPrimitiveCounts.data(), &sizes);
+
+        VkAccelerationStructureCreateInfoKHR createInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR};
+        createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+        createInfo.size = sizes.accelerationStructureSize;
+        blas.as         = m_alloc->createAcceleration(createInfo);
+        buildInfo.dstAccelerationStructure = blas.as.accel;
+
+        scratchOffsets[i - first] = scratchSize;
+        scratchSize += nvh::align_up(sizes.buildScratchSize, m_scratchAlignment);
+    }
+
+    // Grown for larger batches only, no batch uses it now. Aligned for the first offset as well, the
+    // allocation alignment may be smaller
+    if (scratchSize > m_scratchSize)
+    {
+        m_alloc->destroy(m_scratch);
+        m_scratch     = m_alloc->createBuffer(scratchSize + m_scratchAlignment,
+                                              VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        m_scratchSize = scratchSize;
+    }
+    const VkDeviceAddress scratchAddress = nvh::align_up(nvvk::getBufferDeviceAddress(m_device, m_scratch.buffer), m_scratchAlignment);
+
+    std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> ranges;
+    for (uint32_t i = first; i < last; i++)
+    {
+        buildInfos[i - first].scratchData.deviceAddress = scratchAddress + scratchOffsets[i - first];
+        ranges.push_back(m_blas[i].input.asBuildOffsetInfo.data());
+    }
+
+    // The command buffer of the previous batch is done, begin resets it
+    VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(m_cmdBuf, &beginInfo);
+    vkCmdBuildAccelerationStructuresKHR(m_cmdBuf, static_cast<uint32_t>(buildInfos.size()), buildInfos.data(), ranges.data());
+    vkEndCommandBuffer(m_cmdBuf);
+
+    m_timelineValue++;
+    VkTimelineSemaphoreSubmitInfo timelineInfo{VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues    = &m_timelineValue;
+
+    VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    submitInfo.pNext                = &timelineInfo;
+    submitInfo.commandBufferCount   = 1;
+    submitInfo.pCommandBuffers      = &m_cmdBuf;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores    = &m_timeline;
+    vkQueueSubmit(m_queue, 1, &submitInfo, VK_NULL_HANDLE);
+
+    for (uint32_t i = first; i < last; i++)
+    {
+        VkAccelerationStructureDeviceAddressInfoKHR addressInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR};
+        addressInfo.accelerationStructure = m_blas[i].as.accel;
+        m_blas[i].address                 = vkGetAccelerationStructureDeviceAddressKHR(m_device, &addressInfo);
+    }
+    m_submittedCount = last;
+    return built;
+}
+
+void AccelBuilder::createTlas(uint32_t maxInstances, uint32_t frameCount, VkBuildAccelerationStructureFlagsKHR flags)
+{
+    m_maxInstances   = std::max(maxInstances, 1u);
+    m_frameCount     = std::max(frameCount, 1u);
+    m_tlasFlags      = flags;
+    m_instanceBuffer = m_alloc->createBuffer(VkDeviceSize(m_maxInstances) * m_frameCount * sizeof(VkAccelerationStructureInstanceKHR),
+                                             VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+                                                 | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                                             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    m_instances      = static_cast<VkAccelerationStructureInstanceKHR*>(m_alloc->map(m_instanceBuffer));
+
+    VkAccelerationStructureGeometryKHR geometry{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR};
+    geometry.geometryType       = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+    geometry.geometry.instances = {VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR};
+
+    VkAccelerationStructureBuildGeometryInfoKHR buildInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR};
+    buildInfo.type          = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+    buildInfo.mode          = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+    buildInfo.flags         = m_tlasFlags;
+    buildInfo.geometryCount = 1;
+    buildInfo.pGeometries   = &geometry;
+
+    // Sized for the largest instance count, any smaller count fits
+    VkAccelerationStructureBuildSizesInfoKHR sizes{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR};
+    vkGetAccelerationStructureBuildSizesKHR(m_device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo, &m_maxInstances, &sizes);
+
+    VkAccelerationStructureCreateInfoKHR createInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR};
+    createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+    createInfo.size = sizes.accelerationStructureSize;
+    m_tlas          = m_alloc->createAcceleration(createInfo);
+    m_tlasScratch   = m_alloc->createBuffer(sizes.buildScratchSize + m_scratchAlignment,
+                                            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+}
+
+void AccelBuilder::buildTlas(VkCommandBuffer cmdBuf, const std::vector<VkAccelerationStructureInstanceKHR>& instances, uint32_t frame)
+{
+    // The slice of this frame was read by its previous build, which is done
+    assert(instances.size() <= m_maxInstances);
+    const VkDeviceSize sliceOffset = VkDeviceSize(frame % m_frameCount) * m_maxInstances;
+    memcpy(m_instances + sliceOffset, instances.data(), instances.size() * sizeof(VkAccelerationStructureInstanceKHR));
+
+    VkAccelerationStructureGeometryInstancesDataKHR instancesData{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR};
+    instancesData.data.deviceAddress = nvvk::getBufferDeviceAddress(m_device, m_instanceBuffer.buffer)
+                                       + sliceOffset * sizeof(VkAccelerationStructureInstanceKHR);
+
+    VkAccelerationStructureGeometryKHR geometry{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR};
+    geometry.geometryType       = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+    geometry.geometry.instances = instancesData;
+
+    // A full build every time: instances are added, an update could only move existing ones
+    VkAccelerationStructureBuildGeometryInfoKHR buildInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR};
+    buildInfo.type                      = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+    buildInfo.mode                      = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+    buildInfo.flags                     = m_tlasFlags;
+    buildInfo.geometryCount             = 1;
+    buildInfo.pGeometries               = &geometry;
+    buildInfo.dstAccelerationStructure  = m_tlas.accel;
+    buildInfo.scratchData.deviceAddress = nvh::align_up(nvvk::getBufferDeviceAddress(m_device, m_tlasScratch.buffer), m_scratchAlignment);
+
+    VkAccelerationStructureBuildRangeInfoKHR        range{static_cast<uint32_t>(instances.size()), 0, 0, 0};
+    const VkAccelerationStructureBuildRangeInfoKHR* pRange = &range;
+
+    // The traces of the frames in flight are done with the TLAS, the previous TLAS build with the
+    // scratch, and the BLAS batches submitted before are visible
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBuildAccelerationStructuresKHR(cmdBuf, 1, &buildInfo, &pRange);
+
+    barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+}
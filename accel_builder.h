@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "nvvk/raytraceKHR_vk.hpp"
+#include "nvvk/resourceallocator_vk.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// Acceleration structures built a few at a time, so a scene can be traced while it loads
+// - BLASes are queued with addBlas() and built in order by buildBlas(). Each call submits a batch
+//   until its triangle budget is spent and returns without waiting; one batch is in flight at a
+//   time, and its BLASes count as built once its timeline value is signaled
+// - The batches share one command buffer and one scratch buffer, grown to the largest batch and
+//   kept until clear()
+// - The TLAS is created for a maximum instance count, and its rebuilds are recorded into the
+//   command buffer of a frame. Each frame in flight has its own slice of the instance buffer, an
+//   empty TLAS is valid
+//
+class AccelBuilder
+{
+public:
+    using BlasInput = nvvk::RaytracingBuilderKHR::BlasInput;
+
+    void init(VkDevice device, VkPhysicalDevice physicalDevice, nvvk::ResourceAllocator* alloc, uint32_t queueFamilyIndex);
+    void deinit();
+    // Destroys all acceleration structures, the builder can be reused for another scene
+    void clear();
+
+    // Returns the index of the BLAS, valid once isBlasBuilt()
+    uint32_t addBlas(const BlasInput& input);
+    // Retires the batch in flight if the device is done with it, then submits the next queued
+    // BLASes until at least 'triangleBudget' triangles, or the queue is empty. Never waits, returns
+    // the number of BLASes that became built
+    uint32_t buildBlas(uint64_t triangleBudget, VkBuildAccelerationStructureFlagsKHR flags);
+
+    bool            isBlasBuilt(uint32_t index) const { return index < m_builtCount; }
+    uint32_t        getBlasCount() const { return static_cast<uint32_t>(m_blas.size()); }
+    uint32_t        getBuiltBlasCount() const { return m_builtCount; }
+    VkDeviceAddress getBlasDeviceAddress(uint32_t index) const { return m_blas[index].address; }
+
+    // Empty TLAS for up to 'maxInstances', and 'frameCount' slices of instances
+    void createTlas(uint32_t maxInstances, uint32_t frameCount, VkBuildAccelerationStructureFlagsKHR flags);
+    // Records the rebuild of the TLAS in place into 'cmdBuf', from the slice 'frame' of the instance
+    // buffer. The barriers around it order the build after the traces and BLAS builds submitted
+    // before, and before the traces of the frame
+    void buildTlas(VkCommandBuffer cmdBuf, const std::vector<VkAccelerationStructureInstanceKHR>& instances, uint32_t frame);
+
+    VkAccelerationStructureKHR getTlas() const { return m_tlas.accel; }
+
+private:
+    struct Blas
+    {
+        BlasInput       input;
+        nvvk::AccelKHR  as;
+        VkDeviceAddress address{0};
+        uint64_t        triangleCount{0};
+    };
+
+    void waitIdle();
+
+    VkDevice                 m_device{VK_NULL_HANDLE};
+    VkQueue                  m_queue{VK_NULL_HANDLE};
+    nvvk::ResourceAllocator* m_alloc{nullptr};
+    VkDeviceSize             m_scratchAlignment{256};
+
+    VkCommandPool   m_cmdPool{VK_NULL_HANDLE};
+    VkCommandBuffer m_cmdBuf{VK_NULL_HANDLE};
+    VkSemaphore     m_timeline{VK_NULL_HANDLE};
+    uint64_t        m_timelineValue{0};  // Signaled when the batch in flight is done
+    nvvk::Buffer    m_scratch;
+    VkDeviceSize    m_scratchSize{0};
+
+    std::vector<Blas> m_blas;
+    uint32_t          m_builtCount{0};
+    uint32_t          m_submittedCount{0};  // Built, plus the batch in flight
+
+    nvvk::AccelKHR                       m_tlas;
+    nvvk::Buffer                         m_tlasScratch;
+    nvvk::Buffer                         m_instanceBuffer;  // Host visible, one slice per frame in flight
+    VkAccelerationStructureInstanceKHR*  m_instances{nullptr};
+    uint32_t                             m_maxInstances{0};
+    uint32_t                             m_frameCount{0};
+    VkBuildAccelerationStructureFlagsKHR m_tlasFlags{0};
+};
@@ -0,0 +1,55 @@
+#include "alias_table.h"
+
+#include <algorithm>
+
+std::vector<AliasEntry> buildAliasTable(const std::vector<float>& weights)
+{
+    double sum = 0.0;
+    for (float w : weights)
+        sum += std::max(w, 0.0f);
+    if (!(sum > 0.0))
+        return {};
+
+    // Weights scaled so the average is 1, split into the buckets below and above it
+    const size_t            n = weights.size();
+    std::vector<AliasEntry> table(n);
+    std::vector<double>     scaled(n);
+    std::vector<uint32_t>   small, large;
+    for (size_t i = 0; i < n; i++)
+    {
+        const double p = std::max(weights[i], 0.0f) / sum;
+        table[i].pdf   = static_cast<float>(p);
+        table[i].alias = static_cast<int>(i);
+        scaled[i]      = p * n;
+        (scaled[i] < 1.0 ? small : large).push_back(static_cast<uint32_t>(i));
+    }
+
+    while (!small.empty() && !large.empty())
+    {
+        const uint32_t s = small.back();
+        const uint32_t l = large.back();
+        small.pop_back();
+        large.pop_back();
+
+        table[s].threshold = static_cast<float>(scaled[s]);
+        table[s].alias     = static_cast<int>(l);
+        scaled[l]          = (scaled[l] + scaled[s]) - 1.0;
+        (scaled[l] < 1.0 ? small : large).push_back(l);
+    }
+    // What remains is 1 up to the rounding errors
+    for (uint32_t i : large)
+        table[i].threshold = 1.0f;
+    for (uint32_t i : small)
+        table[i].threshold = 1.0f;
+    return table;
+}
+
+uint32_t sampleAliasTable(const std::vector<AliasEntry>& table, float u, float& pdf)
+{
+    const float    scaled = u * table.size();
+    const uint32_t bucket = std::min(static_cast<uint32_t>(scaled), static_cast<uint32_t>(table.size() - 1));
+    const float    up     = scaled - bucket;
+    const uint32_t index  = up < table[bucket].threshold ? bucket : static_cast<uint32_t>(table[bucket].alias);
+    pdf                   = table[index].pdf;
+    return index;
+}
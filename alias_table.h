@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "shaders/host_device.h"
+
+//--------------------------------------------------------------------------------------------------
+// Walker alias table, to sample a discrete distribution in constant time
+// - Built with Vose's method: the outcomes below the average weight are paired with one above it,
+//   which fills the rest of their bucket
+// - Sampling picks a bucket with the integer part of u * n and keeps it or takes its alias with the
+//   fractional part; the shaders do the same (shaders/light_sampling.glsl)
+//
+
+// One entry per weight, empty when the weights do not sum to a positive value
+std::vector<AliasEntry> buildAliasTable(const std::vector<float>& weights);
+
+// Outcome for the uniform number u in [0, 1), with its probability
+uint32_t sampleAliasTable(const std::vector<AliasEntry>& table, float u, float& pdf);
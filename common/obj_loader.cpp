@@ -21,20 +21,397 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "obj_loader.h"
 #include "nvh/nvprint.hpp"
+#include "nvh/parallel_work.hpp"
+#include "nvh/timesampler.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+
+namespace {
+
+// Corner of a triangle, indices into the attributes of the whole file, -1 when absent
+struct ObjCorner
+{
+  int64_t v{-1};
+  int64_t vt{-1};
+  int64_t vn{-1};
+};
+
+// Lines [begin, end) of the file, parsed in two passes: counting the attributes gives the offset
+// of each chunk in the file's arrays, then the faces can be resolved while parsing
+struct ObjChunk
+{
+  const char* begin{nullptr};
+  const char* end{nullptr};
+
+  size_t positionCount{0};
+  size_t normalCount{0};
+  size_t texcoordCount{0};
+  size_t positionBase{0};
+  size_t normalBase{0};
+  size_t texcoordBase{0};
+
+  std::vector<ObjCorner>                      corners;           // 3 per triangle
+  std::vector<std::pair<size_t, std::string>> materialSwitches;  // First triangle and name of each 'usemtl'
+  std::vector<std::string>                    libraries;         // 'mtllib'
+  size_t                                      invalidFaces{0};
+
+  // Welded corners, before the chunks are merged
+  std::vector<VertexObj> vertices;
+  std::vector<uint32_t>  indices;
+};
+
+// Attributes of the whole file
+struct ObjAttributes
+{
+  std::vector<nvmath::vec3f> positions;
+  std::vector<nvmath::vec3f> colors;
+  std::vector<nvmath::vec3f> normals;
+  std::vector<nvmath::vec2f> texcoords;
+};
+
+struct VertexObjHash
+{
+  size_t operator()(const VertexObj& vertex) const
+  {
+    uint32_t words[sizeof(VertexObj) / sizeof(uint32_t)];
+    memcpy(words, &vertex, sizeof(VertexObj));
+    uint64_t hash = 14695981039346656037ull;
+    for(uint32_t word : words)
+      hash = (hash ^ word) * 1099511628211ull;
+    return static_cast<size_t>(hash ^ (hash >> 32));
+  }
+};
+
+struct VertexObjEqual
+{
+  bool operator()(const VertexObj& a, const VertexObj& b) const { return memcmp(&a, &b, sizeof(VertexObj)) == 0; }
+};
+
+using VertexMap = std::unordered_map<VertexObj, uint32_t, VertexObjHash, VertexObjEqual>;
+
+inline bool isBlank(char c)
+{
+  return c == ' ' || c == '\t';
+}
+
+inline bool isLineEnd(const char* p, const char* end)
+{
+  return p >= end || *p == '\n' || *p == '\r' || *p == '#';
+}
+
+inline const char* skipBlanks(const char* p, const char* end)
+{
+  while(p < end && isBlank(*p))
+    p++;
+  return p;
+}
+
+inline const char* nextLine(const char* p, const char* end)
+{
+  while(p < end && *p != '\n')
+    p++;
+  return p < end ? p + 1 : end;
+}
+
+// strtof() skips line breaks, the end of the line is checked first
+inline bool parseFloat(const char*& p, const char* end, float& value)
+{
+  p = skipBlanks(p, end);
+  if(isLineEnd(p, end))
+    return false;
+  char* next;
+  value = std::strtof(p, &next);
+  if(next == p)
+    return false;
+  p = next;
+  return true;
+}
+
+inline bool parseIndex(const char*& p, const char* end, int64_t& value)
+{
+  const bool negative = p < end && *p == '-';
+  if(negative)
+    p++;
+  if(p >= end || *p < '0' || *p > '9')
+    return false;
+  int64_t v = 0;
+  while(p < end && *p >= '0' && *p <= '9')
+    v = v * 10 + (*p++ - '0');
+  value = negative ? -v : v;
+  return true;
+}
+
+// 1-based, or relative to the attributes defined so far when negative. -1 when out of range
+inline int64_t resolveIndex(int64_t index, size_t definedCount, size_t totalCount)
+{
+  const int64_t resolved = index > 0 ? index - 1 : static_cast<int64_t>(definedCount) + index;
+  return resolved >= 0 && resolved < static_cast<int64_t>(totalCount) ? resolved : -1;
+}
+
+inline std::string parseName(const char* p, const char* end)
+{
+  p                = skipBlanks(p, end);
+  const char* last = p;
+  while(last < end && *last != '\n' && *last != '\r')
+    last++;
+  while(last > p && isBlank(last[-1]))
+    last--;
+  return std::string(p, last);
+}
+
+inline bool startsWith(const char* p, const char* end, const char* keyword)
+{
+  const size_t length = strlen(keyword);
+  return static_cast<size_t>(end - p) > length && memcmp(p, keyword, length) == 0 && isBlank(p[length]);
+}
+
+// Counts the attributes of the chunk, or parses it once the offsets are known
+void parseChunk(ObjChunk& chunk, ObjAttributes* attributes)
+{
+  const char* end = chunk.end;
+  size_t      positions = 0, normals = 0, texcoords = 0;
+  ObjCorner   polygon[3];
+  for(const char* p = chunk.begin; p < end; p = nextLine(p, end))
+  {
+    const char* line = skipBlanks(p, end);
+    if(line + 1 >= end)
+      break;
+
+    if(line[0] == 'v' && isBlank(line[1]))
+    {
+      if(attributes)
+      {
+        const char*   q = line + 1;
+        nvmath::vec3f position(0.0f), color(1.0f);
+        parseFloat(q, end, position.x);
+        parseFloat(q, end, position.y);
+        parseFloat(q, end, position.z);
+        if(parseFloat(q, end, color.x))
+        {
+          parseFloat(q, end, color.y);
+          parseFloat(q, end, color.z);
+        }
+        attributes->positions[chunk.positionBase + positions] = position;
+        attributes->colors[chunk.positionBase + positions]    = color;
+      }
+      positions++;
+    }
+    else if(line[0] == 'v' && line[1] == 'n' && line + 2 < end && isBlank(line[2]))
+    {
+      if(attributes)
+      {
+        const char*   q = line + 2;
+        nvmath::vec3f normal(0.0f);
+        parseFloat(q, end, normal.x);
+        parseFloat(q, end, normal.y);
+        parseFloat(q, end, normal.z);
+        attributes->normals[chunk.normalBase + normals] = normal;
+      }
+      normals++;
+    }
+    else if(line[0] == 'v' && line[1] == 't' && line + 2 < end && isBlank(line[2]))
+    {
+      if(attributes)
+      {
+        const char*   q = line + 2;
+        nvmath::vec2f texcoord(0.0f);
+        parseFloat(q, end, texcoord.x);
+        parseFloat(q, end, texcoord.y);
+        attributes->texcoords[chunk.texcoordBase + texcoords] = {texcoord.x, 1.0f - texcoord.y};
+      }
+      texcoords++;
+    }
+    else if(!attributes)
+    {
+      continue;
+    }
+    else if(line[0] == 'f' && isBlank(line[1]))
+    {
+      // Polygons are triangulated as fans
+      const char* q       = line + 1;
+      uint32_t    count   = 0;
+      bool        valid   = true;
+      const size_t first  = chunk.corners.size();
+      while(true)
+      {
+        q = skipBlanks(q, end);
+        if(isLineEnd(q, end))
+          break;
+
+        ObjCorner corner;
+        int64_t   index;
+        if(!parseIndex(q, end, index))
+        {
+          valid = false;
+          break;
+        }
+        corner.v = resolveIndex(index, chunk.positionBase + positions, attributes->positions.size());
+        if(q < end && *q == '/')
+        {
+          q++;
+          if(parseIndex(q, end, index))
+            corner.vt = resolveIndex(index, chunk.texcoordBase + texcoords, attributes->texcoords.size());
+          if(q < end && *q == '/')
+          {
+            q++;
+            if(parseIndex(q, end, index))
+              corner.vn = resolveIndex(index, chunk.normalBase + normals, attributes->normals.size());
+          }
+        }
+        while(q < end && !isBlank(*q) && *q != '\n' && *q != '\r')
+          q++;
+        valid = valid && corner.v >= 0;
+
+        if(count < 2)
+        {
+          polygon[count] = corner;
+        }
+        else
+        {
+          chunk.corners.push_back(polygon[0]);
+          chunk.corners.push_back(polygon[1]);
+          chunk.corners.push_back(corner);
+          polygon[1] = corner;
+        }
+        count++;
+      }
+      if(!valid || count < 3)
+      {
+        chunk.corners.resize(first);
+        chunk.invalidFaces++;
+      }
+    }
+    else if(startsWith(line, end, "usemtl"))
+    {
+      chunk.materialSwitches.emplace_back(chunk.corners.size() / 3, parseName(line + 6, end));
+    }
+    else if(startsWith(line, end, "mtllib"))
+    {
+      chunk.libraries.push_back(parseName(line + 6, end));
+    }
+  }
+
+  chunk.positionCount = positions;
+  chunk.normalCount   = normals;
+  chunk.texcoordCount = texcoords;
+}
+
+// Corners of the chunk with the same attributes share a vertex
+void weldChunk(ObjChunk& chunk, const ObjAttributes& attributes)
+{
+  VertexMap map;
+  map.reserve(chunk.corners.size() / 2);
+  chunk.indices.reserve(chunk.corners.size());
+  for(const ObjCorner& corner : chunk.corners)
+  {
+    VertexObj vertex;
+    vertex.pos      = attributes.positions[corner.v];
+    vertex.color    = attributes.colors[corner.v];
+    vertex.nrm      = corner.vn >= 0 ? attributes.normals[corner.vn] : nvmath::vec3f(0.0f);
+    vertex.texCoord = corner.vt >= 0 ? attributes.texcoords[corner.vt] : nvmath::vec2f(0.0f);
+
+    auto it = map.emplace(vertex, static_cast<uint32_t>(chunk.vertices.size()));
+    if(it.second)
+      chunk.vertices.push_back(vertex);
+    chunk.indices.push_back(it.first->second);
+  }
+  std::vector<ObjCorner>().swap(chunk.corners);
+}
+
+}  // namespace
 
 
 void ObjLoader::loadModel(const std::string& filename)
 {
-  tinyobj::ObjReader reader;
-  reader.ParseFromFile(filename);
-  if(!reader.Valid())
+  m_vertices.clear();
+  m_indices.clear();
+  m_materials.clear();
+  m_textures.clear();
+  m_matIndx.clear();
+
+  nvh::Stopwatch sw;
+  std::string    data;
+  {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if(!file)
+    {
+      LOGE("Cannot load %s\n", filename.c_str());
+      assert(!"Cannot open the OBJ file");
+      return;
+    }
+    data.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(&data[0], data.size());
+  }
+  const double readTime = sw.elapsed();
+
+  // Chunks of at least 1 MB start after a line break, a few per thread to balance the load
+  sw.reset();
+  const size_t          chunkSize  = std::max<size_t>(data.size() / (4 * size_t(nvh::get_thread_pool_size())), 1 << 20);
+  const char*           fileEnd    = data.data() + data.size();
+  std::vector<ObjChunk> chunks;
+  for(const char* p = data.data(); p < fileEnd;)
   {
-    LOGE("Cannot load %s: %s", filename.c_str(), reader.Error().c_str());
-    assert(reader.Valid());
+    ObjChunk chunk;
+    chunk.begin = p;
+    chunk.end   = static_cast<size_t>(fileEnd - p) > chunkSize ? nextLine(p + chunkSize - 1, fileEnd) : fileEnd;
+    p           = chunk.end;
+    chunks.push_back(std::move(chunk));
+  }
+
+  nvh::parallel_batches<1>(chunks.size(), [&](uint64_t i) { parseChunk(chunks[i], nullptr); });
+
+  ObjAttributes attributes;
+  size_t        positionCount = 0, normalCount = 0, texcoordCount = 0;
+  for(auto& chunk : chunks)
+  {
+    chunk.positionBase = positionCount;
+    chunk.normalBase   = normalCount;
+    chunk.texcoordBase = texcoordCount;
+    positionCount += chunk.positionCount;
+    normalCount += chunk.normalCount;
+    texcoordCount += chunk.texcoordCount;
+  }
+  attributes.positions.resize(positionCount);
+  attributes.colors.resize(positionCount);
+  attributes.normals.resize(normalCount);
+  attributes.texcoords.resize(texcoordCount);
+
+  nvh::parallel_batches<1>(chunks.size(), [&](uint64_t i) { parseChunk(chunks[i], &attributes); });
+  const double parseTime = sw.elapsed();
+  const size_t fileSize  = data.size();
+  std::string().swap(data);
+
+  // Materials, the names of 'usemtl' are resolved in file order
+  sw.reset();
+  std::vector<std::string> libraries;
+  for(const auto& chunk : chunks)
+    libraries.insert(libraries.end(), chunk.libraries.begin(), chunk.libraries.end());
+
+  const std::string              directory = filename.substr(0, filename.find_last_of("/\\") + 1);
+  std::map<std::string, int>     materialIds;
+  std::vector<tinyobj::material_t> materials;
+  for(const auto& library : libraries)
+  {
+    std::ifstream stream(directory + library);
+    if(!stream)
+    {
+      LOGW("Cannot open the material library %s\n", library.c_str());
+      continue;
+    }
+    std::string warning, error;
+    tinyobj::LoadMtl(&materialIds, &materials, &stream, &warning, &error);
+    if(!error.empty())
+      LOGW("%s: %s\n", library.c_str(), error.c_str());
   }
 
   // Collecting the material in the scene
-  for(const auto& material : reader.GetMaterials())
+  for(const auto& material : materials)
   {
     MaterialObj m;
     m.ambient       = nvmath::vec3f(material.ambient[0], material.ambient[1], material.ambient[2]);
@@ -59,64 +436,99 @@ void ObjLoader::loadModel(const std::string& filename)
   if(m_materials.empty())
     m_materials.emplace_back(MaterialObj());
 
-  const tinyobj::attrib_t& attrib = reader.GetAttrib();
-
-  for(const auto& shape : reader.GetShapes())
+  // Unknown names and faces before the first 'usemtl' use material 0
+  size_t triangleCount = 0;
+  for(const auto& chunk : chunks)
+    triangleCount += chunk.corners.size() / 3;
+  m_matIndx.resize(triangleCount);
+  int32_t material = 0;
+  size_t  triangle = 0;
+  for(const auto& chunk : chunks)
   {
-    m_vertices.reserve(shape.mesh.indices.size() + m_vertices.size());
-    m_indices.reserve(shape.mesh.indices.size() + m_indices.size());
-    m_matIndx.insert(m_matIndx.end(), shape.mesh.material_ids.begin(), shape.mesh.material_ids.end());
-
-    for(const auto& index : shape.mesh.indices)
+    size_t next = 0;
+    for(size_t t = 0; t < chunk.corners.size() / 3; t++)
     {
-      VertexObj    vertex = {};
-      const float* vp     = &attrib.vertices[3 * index.vertex_index];
-      vertex.pos          = {*(vp + 0), *(vp + 1), *(vp + 2)};
-
-      if(!attrib.normals.empty() && index.normal_index >= 0)
-      {
-        const float* np = &attrib.normals[3 * index.normal_index];
-        vertex.nrm      = {*(np + 0), *(np + 1), *(np + 2)};
-      }
-
-      if(!attrib.texcoords.empty() && index.texcoord_index >= 0)
+      while(next < chunk.materialSwitches.size() && chunk.materialSwitches[next].first == t)
       {
-        const float* tp = &attrib.texcoords[2 * index.texcoord_index + 0];
-        vertex.texCoord = {*tp, 1.0f - *(tp + 1)};
+        auto it  = materialIds.find(chunk.materialSwitches[next].second);
+        material = it != materialIds.end() && it->second < static_cast<int>(m_materials.size()) ? it->second : 0;
+        next++;
       }
+      m_matIndx[triangle++] = material;
+    }
+  }
+  const double materialTime = sw.elapsed();
 
-      if(!attrib.colors.empty())
-      {
-        const float* vc = &attrib.colors[3 * index.vertex_index];
-        vertex.color    = {*(vc + 0), *(vc + 1), *(vc + 2)};
-      }
+  // Welding: each chunk on its own, then the vertices of the chunks against each other
+  sw.reset();
+  size_t invalidFaces = 0;
+  for(const auto& chunk : chunks)
+    invalidFaces += chunk.invalidFaces;
+  nvh::parallel_batches<1>(chunks.size(), [&](uint64_t i) { weldChunk(chunks[i], attributes); });
+  const size_t attributeSize = positionCount * 2 * sizeof(nvmath::vec3f) + normalCount * sizeof(nvmath::vec3f)
+                               + texcoordCount * sizeof(nvmath::vec2f);
+  attributes = ObjAttributes();
 
-      m_vertices.push_back(vertex);
-      m_indices.push_back(static_cast<int>(m_indices.size()));
+  VertexMap                          map;
+  std::vector<std::vector<uint32_t>> remaps(chunks.size());
+  std::vector<size_t>                firstIndex(chunks.size());
+  for(size_t i = 0; i < chunks.size(); i++)
+  {
+    firstIndex[i] = i > 0 ? firstIndex[i - 1] + chunks[i - 1].indices.size() : 0;
+    remaps[i].reserve(chunks[i].vertices.size());
+    for(const VertexObj& vertex : chunks[i].vertices)
+    {
+      auto it = map.emplace(vertex, static_cast<uint32_t>(m_vertices.size()));
+      if(it.second)
+        m_vertices.push_back(vertex);
+      remaps[i].push_back(it.first->second);
     }
+    std::vector<VertexObj>().swap(chunks[i].vertices);
   }
+  m_indices.resize(triangleCount * 3);
+  nvh::parallel_batches<1>(chunks.size(), [&](uint64_t i) {
+    for(size_t c = 0; c < chunks[i].indices.size(); c++)
+      m_indices[firstIndex[i] + c] = remaps[i][chunks[i].indices[c]];
+  });
 
-  // Fixing material indices
-  for(auto& mi : m_matIndx)
+  // Area weighted normals for the vertices without one
+  auto isZero = [](const nvmath::vec3f& v) { return v.x == 0.0f && v.y == 0.0f && v.z == 0.0f; };
+  std::vector<nvmath::vec3f> normals(m_vertices.size(), nvmath::vec3f(0.0f));
+  bool                       missingNormals = false;
+  for(size_t i = 0; i < m_indices.size(); i += 3)
   {
-    if(mi < 0 || mi > m_materials.size())
-      mi = 0;
+    const VertexObj&    v0 = m_vertices[m_indices[i + 0]];
+    const VertexObj&    v1 = m_vertices[m_indices[i + 1]];
+    const VertexObj&    v2 = m_vertices[m_indices[i + 2]];
+    const nvmath::vec3f n  = nvmath::cross(v1.pos - v0.pos, v2.pos - v0.pos);
+    for(uint32_t c = 0; c < 3; c++)
+    {
+      const uint32_t index = m_indices[i + c];
+      if(isZero(m_vertices[index].nrm))
+      {
+        normals[index] += n;
+        missingNormals = true;
+      }
+    }
   }
-
-
-  // Compute normal when no normal were provided.
-  if(attrib.normals.empty())
+  if(missingNormals)
   {
-    for(size_t i = 0; i < m_indices.size(); i += 3)
+    for(size_t v = 0; v < m_vertices.size(); v++)
     {
-      VertexObj& v0 = m_vertices[m_indices[i + 0]];
-      VertexObj& v1 = m_vertices[m_indices[i + 1]];
-      VertexObj& v2 = m_vertices[m_indices[i + 2]];
-
-      nvmath::vec3f n = nvmath::normalize(nvmath::cross((v1.pos - v0.pos), (v2.pos - v0.pos)));
-      v0.nrm          = n;
-      v1.nrm          = n;
-      v2.nrm          = n;
+      if(isZero(m_vertices[v].nrm) && !isZero(normals[v]))
+        m_vertices[v].nrm = nvmath::normalize(normals[v]);
     }
   }
+  const double weldTime = sw.elapsed();
+
+  const size_t cornerCount = m_indices.size();
+  const size_t weldedSize  = m_vertices.size() * sizeof(VertexObj) + cornerCount * sizeof(uint32_t);
+  const size_t cornerSize  = cornerCount * (sizeof(VertexObj) + sizeof(uint32_t));
+  LOGI("OBJ %s: %.1f MB read in %.1f ms, parsed in %.1f ms (%zu chunks), materials in %.1f ms\n", filename.c_str(),
+       fileSize / (1024.0 * 1024.0), readTime, parseTime, chunks.size(), materialTime);
+  LOGI("OBJ welding: %zu corners -> %zu vertices in %.1f ms, %.1f MB of vertices and indices instead of %.1f MB, %.1f MB of attributes while parsing\n",
+       cornerCount, m_vertices.size(), weldTime, weldedSize / (1024.0 * 1024.0), cornerSize / (1024.0 * 1024.0),
+       attributeSize / (1024.0 * 1024.0));
+  if(invalidFaces > 0)
+    LOGW("OBJ %s: %zu faces with missing or out of range indices skipped\n", filename.c_str(), invalidFaces);
 }
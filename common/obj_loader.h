@@ -58,6 +58,12 @@ struct shapeObj
   uint32_t matIndex;
 };
 
+// Loads an OBJ file into a welded, indexed triangle list
+// - The file is read at once and parsed in chunks of lines on the thread pool, the materials of the
+//   'mtllib' files are read with tinyobj
+// - Corners with the same position, normal, uv and color share one vertex
+// - Vertices without a normal in the file get the area weighted normal of their triangles
+// - Load times, vertex counts and memory are logged
 class ObjLoader
 {
 public:
@@ -67,5 +73,5 @@ public:
   std::vector<uint32_t>    m_indices;
   std::vector<MaterialObj> m_materials;
   std::vector<std::string> m_textures;
-  std::vector<int32_t>     m_matIndx;
+  std::vector<int32_t>     m_matIndx;  // Material of each triangle
 };
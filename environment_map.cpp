@@ -0,0 +1,42 @@
+#include "environment_map.h"
+
+#include <cmath>
+#include <cstring>
+
+#include "alias_table.h"
+#include "light_bvh.h"
+#include "stb_image.h"
+
+bool loadEnvironmentMap(const std::string& filename, EnvironmentMap& map)
+{
+    int    width = 0, height = 0, comp = 0;
+    float* pixels = stbi_loadf(filename.c_str(), &width, &height, &comp, STBI_rgb_alpha);
+    if (pixels == nullptr)
+        return false;
+
+    map.width  = static_cast<uint32_t>(width);
+    map.height = static_cast<uint32_t>(height);
+    map.pixels.resize(size_t(width) * height * 4);
+    memcpy(map.pixels.data(), pixels, map.pixels.size() * sizeof(float));
+    stbi_image_free(pixels);
+    return true;
+}
+
+std::vector<AliasEntry> buildEnvironmentAliasTable(const EnvironmentMap& map)
+{
+    const float        pi = 3.14159265f;
+    std::vector<float> weights(size_t(map.width) * map.height);
+    for (uint32_t y = 0; y < map.height; y++)
+    {
+        // Solid angle of the row, up to a constant
+        const float sinTheta = std::sin(pi * (y + 0.5f) / map.height);
+        for (uint32_t x = 0; x < map.width; x++)
+        {
+            const size_t  texel     = size_t(y) * map.width + x;
+            const float*  rgba      = &map.pixels[texel * 4];
+            const float   luminance = getLuminance(nvmath::vec3f(rgba[0], rgba[1], rgba[2]));
+            weights[texel]          = std::isfinite(luminance) ? luminance * sinTheta : 0.0f;
+        }
+    }
+    return buildAliasTable(weights);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "shaders/host_device.h"
+
+//--------------------------------------------------------------------------------------------------
+// Equirectangular HDR environment, the light of the rays leaving the scene in the path tracer
+// - Texel (x, y) of a width x height map covers phi in [2 pi x / width, 2 pi (x + 1) / width] around
+//   +y, from -x towards -z, and theta in [pi y / height, pi (y + 1) / height] from +y, see
+//   shaders/environment.glsl
+// - Directions are importance sampled from an alias table over the texels, weighted by their
+//   luminance times sin(theta), the solid angle they cover. The shaders pick a texel in constant
+//   time and divide its probability by the solid angle of the texel
+//
+struct EnvironmentMap
+{
+    std::vector<float> pixels;  // RGBA, rows from +y down
+    uint32_t           width{0};
+    uint32_t           height{0};
+};
+
+// Radiance .hdr files, or any image stb_image reads. Returns false when it cannot be read
+bool loadEnvironmentMap(const std::string& filename, EnvironmentMap& map);
+
+// One entry per texel, row major. Empty when the map is black
+std::vector<AliasEntry> buildEnvironmentAliasTable(const EnvironmentMap& map);
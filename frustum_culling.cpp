@@ -0,0 +1,199 @@
+#include "frustum_culling.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "nvh/parallel_work.hpp"
+
+// AVX only when the compiler targets it (CULLING_AVX in CMakeLists.txt), SSE2 is part of every x64
+// target
+#if defined(__AVX__)
+#include <immintrin.h>
+#define CULLING_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CULLING_SSE2 1
+#endif
+
+void BoundsSoA::resize(size_t count)
+{
+    for (auto* v : {&minX, &minY, &minZ, &maxX, &maxY, &maxZ})
+        v->resize(count);
+}
+
+void BoundsSoA::set(size_t index, const nvmath::vec3f& bmin, const nvmath::vec3f& bmax)
+{
+    minX[index] = bmin.x;
+    minY[index] = bmin.y;
+    minZ[index] = bmin.z;
+    maxX[index] = bmax.x;
+    maxY[index] = bmax.y;
+    maxZ[index] = bmax.z;
+}
+
+Frustum makeFrustum(const nvmath::mat4f& viewProj)
+{
+    // Rows of the matrix, clip = (row0.p, row1.p, row2.p, row3.p)
+    nvmath::vec4f rows[4];
+    for (int r = 0; r < 4; r++)
+        rows[r] = nvmath::vec4f(viewProj(r, 0), viewProj(r, 1), viewProj(r, 2), viewProj(r, 3));
+
+    Frustum frustum;
+    frustum.planes[0] = rows[3] + rows[0];  // -w <= x
+    frustum.planes[1] = rows[3] - rows[0];  // x <= w
+    frustum.planes[2] = rows[3] + rows[1];
+    frustum.planes[3] = rows[3] - rows[1];
+    frustum.planes[4] = rows[2];            // 0 <= z
+    frustum.planes[5] = rows[3] - rows[2];  // z <= w
+    for (auto& plane : frustum.planes)
+    {
+        const float len = std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+        if (len > 0.0f)
+            plane = plane / len;
+    }
+    return frustum;
+}
+
+void transformBounds(const nvmath::mat4f& matrix, const nvmath::vec3f& bmin, const nvmath::vec3f& bmax, nvmath::vec3f& outMin, nvmath::vec3f& outMax)
+{
+    for (int r = 0; r < 3; r++)
+    {
+        outMin[r] = outMax[r] = matrix(r, 3);
+        for (int c = 0; c < 3; c++)
+        {
+            const float a = matrix(r, c) * bmin[c];
+            const float b = matrix(r, c) * bmax[c];
+            outMin[r] += std::min(a, b);
+            outMax[r] += std::max(a, b);
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// For each plane, only the box corner furthest along its normal is tested: picking it is a choice
+// between the min and max arrays, the same for all boxes
+//
+struct CullPlane
+{
+    float        n[3];
+    float        d;
+    const float* corner[3];
+};
+
+static void makeCullPlanes(const BoundsSoA& bounds, const Frustum& frustum, CullPlane planes[6])
+{
+    for (int p = 0; p < 6; p++)
+    {
+        const nvmath::vec4f& plane = frustum.planes[p];
+        planes[p].n[0]             = plane.x;
+        planes[p].n[1]             = plane.y;
+        planes[p].n[2]             = plane.z;
+        planes[p].d                = plane.w;
+        planes[p].corner[0]        = plane.x > 0.0f ? bounds.maxX.data() : bounds.minX.data();
+        planes[p].corner[1]        = plane.y > 0.0f ? bounds.maxY.data() : bounds.minY.data();
+        planes[p].corner[2]        = plane.z > 0.0f ? bounds.maxZ.data() : bounds.minZ.data();
+    }
+}
+
+// The distance is summed in the order of the SIMD paths, and the file is built without FMA
+// contraction, so every path rounds it the same and keeps the same boxes
+static void cullRangeScalar(const CullPlane planes[6], size_t begin, size_t end, std::vector<uint32_t>& visible)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; p++)
+        {
+            const CullPlane& plane = planes[p];
+            float            dist  = plane.d;
+            dist += plane.n[0] * plane.corner[0][i];
+            dist += plane.n[1] * plane.corner[1][i];
+            dist += plane.n[2] * plane.corner[2][i];
+            inside = dist >= 0.0f;
+        }
+        if (inside)
+            visible.push_back(static_cast<uint32_t>(i));
+    }
+}
+
+static void cullRangeSimd(const CullPlane planes[6], size_t begin, size_t end, std::vector<uint32_t>& visible)
+{
+    size_t i = begin;
+#if defined(CULLING_AVX)
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256 outside = _mm256_setzero_ps();
+        for (int p = 0; p < 6; p++)
+        {
+            const CullPlane& plane = planes[p];
+            __m256           dist  = _mm256_set1_ps(plane.d);
+            dist = _mm256_add_ps(dist, _mm256_mul_ps(_mm256_set1_ps(plane.n[0]), _mm256_loadu_ps(plane.corner[0] + i)));
+            dist = _mm256_add_ps(dist, _mm256_mul_ps(_mm256_set1_ps(plane.n[1]), _mm256_loadu_ps(plane.corner[1] + i)));
+            dist = _mm256_add_ps(dist, _mm256_mul_ps(_mm256_set1_ps(plane.n[2]), _mm256_loadu_ps(plane.corner[2] + i)));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(dist, _mm256_setzero_ps(), _CMP_LT_OQ));
+        }
+        const int mask = ~_mm256_movemask_ps(outside) & 0xff;
+        for (int b = 0; b < 8; b++)
+        {
+            if (mask & (1 << b))
+                visible.push_back(static_cast<uint32_t>(i + b));
+        }
+    }
+#elif defined(CULLING_SSE2)
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128 outside = _mm_setzero_ps();
+        for (int p = 0; p < 6; p++)
+        {
+            const CullPlane& plane = planes[p];
+            __m128           dist  = _mm_set1_ps(plane.d);
+            dist = _mm_add_ps(dist, _mm_mul_ps(_mm_set1_ps(plane.n[0]), _mm_loadu_ps(plane.corner[0] + i)));
+            dist = _mm_add_ps(dist, _mm_mul_ps(_mm_set1_ps(plane.n[1]), _mm_loadu_ps(plane.corner[1] + i)));
+            dist = _mm_add_ps(dist, _mm_mul_ps(_mm_set1_ps(plane.n[2]), _mm_loadu_ps(plane.corner[2] + i)));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(dist, _mm_setzero_ps()));
+        }
+        const int mask = ~_mm_movemask_ps(outside) & 0xf;
+        for (int b = 0; b < 4; b++)
+        {
+            if (mask & (1 << b))
+                visible.push_back(static_cast<uint32_t>(i + b));
+        }
+    }
+#endif
+    cullRangeScalar(planes, i, end, visible);
+}
+
+void cullBounds(const BoundsSoA& bounds, const Frustum& frustum, std::vector<uint32_t>& visible, CullingPath path, uint32_t threadCount)
+{
+    CullPlane planes[6];
+    makeCullPlanes(bounds, frustum, planes);
+    auto cullRange = path == CullingPath::eSimd ? cullRangeSimd : cullRangeScalar;
+
+    visible.clear();
+    if (threadCount == 0)
+        threadCount = nvh::get_thread_pool_size();
+    if (threadCount <= 1 || bounds.size() < kParallelCullingThreshold)
+    {
+        cullRange(planes, 0, bounds.size(), visible);
+        return;
+    }
+
+    // Each thread culls a contiguous range, the results are concatenated in thread order
+    std::vector<std::vector<uint32_t>> threadVisible(threadCount);
+    nvh::parallel_ranges(
+        bounds.size(), [&](uint64_t start, uint64_t end, uint32_t threadIdx) { cullRange(planes, start, end, threadVisible[threadIdx]); },
+        threadCount);
+    for (const auto& v : threadVisible)
+        visible.insert(visible.end(), v.begin(), v.end());
+}
+
+const char* getCullingSimdName()
+{
+#if defined(CULLING_AVX)
+    return "AVX";
+#elif defined(CULLING_SSE2)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "nvmath/nvmath.h"
+
+//--------------------------------------------------------------------------------------------------
+// CPU frustum culling of world space bounding boxes
+// - Boxes are stored as a struct of arrays and tested 8 (AVX) or 4 (SSE2) at a time against the
+//   6 planes, using the corner furthest along each plane normal
+// - Large sets are split over threads
+//
+struct BoundsSoA
+{
+    std::vector<float> minX, minY, minZ;
+    std::vector<float> maxX, maxY, maxZ;
+
+    size_t size() const { return minX.size(); }
+    void   resize(size_t count);
+    void   set(size_t index, const nvmath::vec3f& bmin, const nvmath::vec3f& bmax);
+};
+
+// Planes as (normal, distance), a point p is inside when dot(normal, p) + distance >= 0
+struct Frustum
+{
+    nvmath::vec4f planes[6];
+};
+
+// Planes of a Vulkan projection (depth in [0, 1]), in the space viewProj transforms from
+Frustum makeFrustum(const nvmath::mat4f& viewProj);
+
+// Bounds of a transformed box (Arvo, "Transforming Axis-Aligned Bounding Boxes")
+void transformBounds(const nvmath::mat4f& matrix, const nvmath::vec3f& bmin, const nvmath::vec3f& bmax, nvmath::vec3f& outMin, nvmath::vec3f& outMax);
+
+enum class CullingPath
+{
+    eScalar,
+    eSimd,
+};
+
+// Sets with at least this many boxes are culled in parallel
+constexpr size_t kParallelCullingThreshold = 16384;
+
+// Writes the indices of the boxes intersecting the frustum to 'visible'
+// 'threadCount' 0 uses the thread pool size, 1 stays on the calling thread
+void cullBounds(const BoundsSoA& bounds, const Frustum& frustum, std::vector<uint32_t>& visible, CullingPath path = CullingPath::eSimd,
+                uint32_t threadCount = 0);
+
+// Instruction set of CullingPath::eSimd in this build: "AVX", "SSE2" or "scalar"
+const char* getCullingSimdName();
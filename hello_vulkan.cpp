@@ -18,6 +18,10 @@
  */
 
 
+#include <algorithm>
+#include <array>
+#include <numeric>
+#include <random>
 #include <sstream>
 
 
@@ -29,10 +33,25 @@
 //#include "stb_image.h"
 
 #include "hello_vulkan.h"
+#include "alias_table.h"
+#include "environment_map.h"
+#include "frustum_culling.h"
+#include "image_metrics.h"
+#include "light_bvh.h"
+#include "light_sampling.h"
+#include "mesh_optimizer.h"
+#include "obj_import.h"
+#include "sampler.h"
+#include "scene_cache.h"
+#include "texture_decoder.h"
+#include "upload_service.h"
+#include "vertex_compression.h"
 #include "nvh/alignment.hpp"
 #include "nvh/gltfscene.hpp"
 #include "nvh/cameramanipulator.hpp"
 #include "nvh/fileoperations.hpp"
+#include "nvh/nvprint.hpp"
+#include "nvh/timesampler.hpp"
 #include "nvvk/commands_vk.hpp"
 #include "nvvk/descriptorsets_vk.hpp"
 #include "nvvk/images_vk.hpp"
@@ -51,29 +70,98 @@ void HelloVulkan::setup(const VkInstance& instance, const VkDevice& device, cons
 {
     AppBaseVk::setup(instance, device, physicalDevice, queueFamily);
     m_alloc.init(instance, device, physicalDevice);
+    m_upload.init(device, queueFamily, &m_alloc, VkDeviceSize(m_stagingBudgetMB) << 20);
+    m_textureStreamer.init(device, &m_alloc, &m_upload);
+    m_profiler.init(device, physicalDevice);
     m_debug.setup(m_device);
     m_offscreenDepthFormat = nvvk::findDepthFormat(physicalDevice);
 }
 
+//--------------------------------------------------------------------------------------------------
+// Projection of the camera, shared by the rendering and the culling so they see the same frustum
+//
+nvmath::mat4f HelloVulkan::getProjection() const
+{
+    const float aspectRatio = m_size.width / static_cast<float>(m_size.height);
+    // Y is already inverted for Vulkan by perspectiveVK
+    return nvmath::perspectiveVK(CameraManip.getFov(), aspectRatio, 0.1f, 1000.0f);
+}
+
+nvmath::mat4f HelloVulkan::getViewProj() const
+{
+    return getProjection() * CameraManip.getMatrix();
+}
+
 //--------------------------------------------------------------------------------------------------
 // Called at each frame to update the camera matrix
 //
 void HelloVulkan::updateUniformBuffer(const VkCommandBuffer& cmdBuf)
 {
     // Prepare new UBO contents on host.
-    const float    aspectRatio = m_size.width / static_cast<float>(m_size.height);
     GlobalUniforms hostUBO = {};
     const auto& view = CameraManip.getMatrix();
-    const auto& proj = nvmath::perspectiveVK(CameraManip.getFov(), aspectRatio, 0.1f, 1000.0f);
-    // proj[1][1] *= -1;  // Inverting Y for Vulkan (not needed with perspectiveVK).
+    const auto  proj = getProjection();
 
-    hostUBO.viewProj = proj * view;
+    hostUBO.viewProj = getViewProj();
     hostUBO.viewInverse = nvmath::invert(view);
     hostUBO.projInverse = nvmath::invert(proj);
 
+    // ReSTIR reservoirs: the two halves of each buffer swap each frame, the previous frame's are
+    // reprojected with its camera
+    hostUBO.prevViewProj = m_restirFrame == 0 ? hostUBO.viewProj : m_prevViewProj;
+    m_prevViewProj = hostUBO.viewProj;
+    const VkDeviceSize    pixelCount = VkDeviceSize(m_size.width) * m_size.height;
+    const VkDeviceSize    current = m_restirFrame & 1;
+    const VkDeviceAddress restirAddress = nvvk::getBufferDeviceAddress(m_device, m_restirBuffer.buffer);
+    hostUBO.restirAddress = restirAddress + current * pixelCount * sizeof(RestirReservoir);
+    hostUBO.restirPrevAddress = restirAddress + (1 - current) * pixelCount * sizeof(RestirReservoir);
+    const VkDeviceAddress restirGIAddress = nvvk::getBufferDeviceAddress(m_device, m_restirGIBuffer.buffer);
+    hostUBO.restirGIAddress = restirGIAddress + current * pixelCount * sizeof(RestirGIReservoir);
+    hostUBO.restirGIPrevAddress = restirGIAddress + (1 - current) * pixelCount * sizeof(RestirGIReservoir);
+    m_restirFrame++;
+    if (m_restirReset)
+    {
+        VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+        barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1,
+            &barrier, 0, nullptr, 0, nullptr);
+        vkCmdFillBuffer(cmdBuf, m_restirBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+        vkCmdFillBuffer(cmdBuf, m_restirGIBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 1,
+            &barrier, 0, nullptr, 0, nullptr);
+        m_restirReset = false;
+    }
+
+    // Probe volume: the ray directions turn at random with each update, so the probes do not keep
+    // the same directions. A uniform random rotation from a uniform quaternion (Shoemake)
+    hostUBO.probes = m_probeVolume;
+    {
+        std::mt19937                          rng(m_probeVolume.updates);
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        const float                           twoPi = 6.28318531f;
+        const float u0 = uniform(rng), u1 = uniform(rng), u2 = uniform(rng);
+        const float r1 = std::sqrt(1.0f - u0), r2 = std::sqrt(u0);
+        const float x = r1 * std::sin(twoPi * u1), y = r1 * std::cos(twoPi * u1);
+        const float z = r2 * std::sin(twoPi * u2), w = r2 * std::cos(twoPi * u2);
+        nvmath::mat4f& m = hostUBO.probes.rayRotation;
+        m = nvmath::mat4f(1);
+        m(0, 0) = 1 - 2 * (y * y + z * z);
+        m(0, 1) = 2 * (x * y - z * w);
+        m(0, 2) = 2 * (x * z + y * w);
+        m(1, 0) = 2 * (x * y + z * w);
+        m(1, 1) = 1 - 2 * (x * x + z * z);
+        m(1, 2) = 2 * (y * z - x * w);
+        m(2, 0) = 2 * (x * z - y * w);
+        m(2, 1) = 2 * (y * z + x * w);
+        m(2, 2) = 1 - 2 * (x * x + y * y);
+    }
+
     // UBO on the device, and what stages access it.
     VkBuffer deviceUBO = m_bGlobals.buffer;
-    auto     uboUsageStages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
+    auto     uboUsageStages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
 
     // Ensure that the modified UBO is not visible to previous frames.
     VkBufferMemoryBarrier beforeBarrier{ VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
@@ -106,11 +194,12 @@ void HelloVulkan::updateUniformBuffer(const VkCommandBuffer& cmdBuf)
 //
 void HelloVulkan::createDescriptorSetLayout()
 {
-    auto nbTxt = static_cast<uint32_t>(m_textures.size());
+    // Created before the scene is loaded, the textures of the scene fill the first slots
+    auto nbTxt = m_maxTextures;
 
     // Camera matrices
     m_descSetLayoutBind.addBinding(SceneBindings::eGlobals, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1,
-        VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR);
+        VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT);
     // Obj descriptions
     /*m_descSetLayoutBind.addBinding(SceneBindings::eObjDescs, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
                                    VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT
@@ -122,15 +211,24 @@ void HelloVulkan::createDescriptorSetLayout()
     // Scene
     m_descSetLayoutBind.addBinding(SceneBindings::eSceneDesc, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
         VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT |
-        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_ANY_HIT_BIT_KHR);
+        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_ANY_HIT_BIT_KHR |
+        VK_SHADER_STAGE_MISS_BIT_KHR);
 
+    // Environment map, seen by the misses and sampled at the hits
+    m_descSetLayoutBind.addBinding(SceneBindings::eEnvironment, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1,
+        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR);
+
+    // One set per swapchain image, the textures of a set change while the others are in flight
+    const uint32_t frameCount = getSwapChain().getImageCount();
     m_descSetLayout = m_descSetLayoutBind.createLayout(m_device);
-    m_descPool = m_descSetLayoutBind.createPool(m_device, 1);
-    m_descSet = nvvk::allocateDescriptorSet(m_device, m_descPool, m_descSetLayout);
+    m_descPool = m_descSetLayoutBind.createPool(m_device, frameCount);
+    nvvk::allocateDescriptorSets(m_device, m_descPool, m_descSetLayout, frameCount, m_descSets);
+    m_descSet = m_descSets[0];
+    m_textureSetDirty.assign(frameCount, 0);
 }
 
 //--------------------------------------------------------------------------------------------------
-// Setting up the buffers in the descriptor set
+// Setting up the buffers in the descriptor sets of all frames, none may be in flight
 //
 void HelloVulkan::updateDescriptorSet()
 {
@@ -138,26 +236,39 @@ void HelloVulkan::updateDescriptorSet()
 
     // Camera matrices and scene description
     VkDescriptorBufferInfo dbiUnif{ m_bGlobals.buffer, 0, VK_WHOLE_SIZE };
-    writes.emplace_back(m_descSetLayoutBind.makeWrite(m_descSet, SceneBindings::eGlobals, &dbiUnif));
-
-    /*VkDescriptorBufferInfo dbiSceneDesc{m_bObjDesc.buffer, 0, VK_WHOLE_SIZE};
-    writes.emplace_back(m_descSetLayoutBind.makeWrite(m_descSet, SceneBindings::eObjDescs, &dbiSceneDesc));*/
-
     VkDescriptorBufferInfo sceneDesc{ m_sceneDesc.buffer, 0, VK_WHOLE_SIZE };
-    writes.emplace_back(m_descSetLayoutBind.makeWrite(m_descSet, SceneBindings::eSceneDesc, &sceneDesc));
-
-    // All texture samplers
-    std::vector<VkDescriptorImageInfo> diit;
-    for (auto& texture : m_textures)
+    // All texture samplers, the default texture until the scene's images arrive
+    std::vector<VkDescriptorImageInfo> diit(m_maxTextures, m_defaultTexture.descriptor);
+    for (VkDescriptorSet set : m_descSets)
     {
-        diit.emplace_back(texture.descriptor);
+        writes.emplace_back(m_descSetLayoutBind.makeWrite(set, SceneBindings::eGlobals, &dbiUnif));
+
+        /*VkDescriptorBufferInfo dbiSceneDesc{m_bObjDesc.buffer, 0, VK_WHOLE_SIZE};
+        writes.emplace_back(m_descSetLayoutBind.makeWrite(set, SceneBindings::eObjDescs, &dbiSceneDesc));*/
+
+        writes.emplace_back(m_descSetLayoutBind.makeWrite(set, SceneBindings::eSceneDesc, &sceneDesc));
+        writes.emplace_back(m_descSetLayoutBind.makeWriteArray(set, SceneBindings::eTextures, diit.data()));
+        writes.emplace_back(m_descSetLayoutBind.makeWrite(set, SceneBindings::eEnvironment, &m_environmentTexture.descriptor));
     }
-    writes.emplace_back(m_descSetLayoutBind.makeWriteArray(m_descSet, SceneBindings::eTextures, diit.data()));
 
     // Writing the information
     vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
+//--------------------------------------------------------------------------------------------------
+// Textures of the scene with their mips done on the GPU, into the set of the current frame. The
+// frame of the set is not in flight, see updateSceneFrame()
+//
+void HelloVulkan::updateTextureDescriptors()
+{
+    if (m_textureDescriptors.empty())
+        return;
+
+    VkWriteDescriptorSet write = m_descSetLayoutBind.makeWriteArray(m_descSet, SceneBindings::eTextures, m_textureDescriptors.data());
+    write.descriptorCount = static_cast<uint32_t>(m_textureDescriptors.size());
+    vkUpdateDescriptorSets(m_device, 1, &write, 0, nullptr);
+}
+
 
 //--------------------------------------------------------------------------------------------------
 // Creating the pipeline layout
@@ -192,24 +303,40 @@ void HelloVulkan::createGraphicsPipeline()
 
     gpb.addShader(nvh::loadFile("spv/vert_shader.vert.spv", true, paths, true), VK_SHADER_STAGE_VERTEX_BIT);
     gpb.addShader(nvh::loadFile("spv/frag_shader.frag.spv", true, paths, true), VK_SHADER_STAGE_FRAGMENT_BIT);
-    gpb.addBindingDescriptions({ {0, sizeof(nvmath::vec3f)}, {1, sizeof(nvmath::vec3f)}, {2, sizeof(nvmath::vec4f)}, {3, sizeof(nvmath::vec2f)} });
-    gpb.addAttributeDescriptions({
-      {0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0},
-      {1, 1, VK_FORMAT_R32G32B32_SFLOAT, 0},
-      {2, 2, VK_FORMAT_R32G32B32A32_SFLOAT, 0},
-      {3, 3, VK_FORMAT_R32G32_SFLOAT, 0},
-        });
+    // The scene is not loaded yet, its layout follows from the options
+    const uint32_t vertexFlags = getVertexFlags();
+    if (vertexFlags & VERTEX_COMPRESSED)
+    {
+        const bool quantized = (vertexFlags & VERTEX_QUANTIZED_POSITIONS) != 0;
+        gpb.addBindingDescriptions({ {0, quantized ? 4 * sizeof(int16_t) : sizeof(nvmath::vec3f)}, {1, sizeof(uint32_t)}, {2, sizeof(uint32_t)}, {3, sizeof(uint32_t)} });
+        gpb.addAttributeDescriptions({
+          {0, 0, quantized ? VK_FORMAT_R16G16B16A16_SNORM : VK_FORMAT_R32G32B32_SFLOAT, 0},
+          {1, 1, VK_FORMAT_R16G16_SNORM, 0},
+          {2, 2, VK_FORMAT_R16G16_SNORM, 0},
+          {3, 3, VK_FORMAT_R16G16_SFLOAT, 0},
+            });
+    }
+    else
+    {
+        gpb.addBindingDescriptions({ {0, sizeof(nvmath::vec3f)}, {1, sizeof(nvmath::vec3f)}, {2, sizeof(nvmath::vec4f)}, {3, sizeof(nvmath::vec2f)} });
+        gpb.addAttributeDescriptions({
+          {0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0},
+          {1, 1, VK_FORMAT_R32G32B32_SFLOAT, 0},
+          {2, 2, VK_FORMAT_R32G32B32A32_SFLOAT, 0},
+          {3, 3, VK_FORMAT_R32G32_SFLOAT, 0},
+            });
+    }
 
     m_graphicsPipeline = gpb.createPipeline();
     m_debug.setObjectName(m_graphicsPipeline, "Graphics");
 }
 
-void HelloVulkan::loadGltfMaterials(const VkCommandBuffer& cmdBuf, VkBufferUsageFlags flags)
+void HelloVulkan::loadGltfMaterials()
 {
-    std::vector<GltfPBRMaterial> shadeMaterials;
+    m_pbrMaterials.clear();
     for (auto& m : m_gltfScene.m_materials)
     {
-        shadeMaterials.emplace_back(GltfPBRMaterial{
+        m_pbrMaterials.emplace_back(GltfPBRMaterial{
             m.baseColorFactor,
             m.baseColorTexture,
             m.metallicFactor,
@@ -220,12 +347,11 @@ void HelloVulkan::loadGltfMaterials(const VkCommandBuffer& cmdBuf, VkBufferUsage
             m.emissiveTexture 
         });
     }
-    m_materialBuffer = m_alloc.createBuffer(cmdBuf, shadeMaterials, flags);
 }
 
-void HelloVulkan::loadGltfLights(const VkCommandBuffer& cmdBuf, VkBufferUsageFlags flags)
+void HelloVulkan::loadGltfLights()
 {
-    std::vector<GltfLight> lights;
+    m_lights.clear();
     std::map<std::string, int> tinygltfToInt;
     // TODO: check why { std::string, int } does not work
     tinygltfToInt.emplace(std::make_pair("point", 0));
@@ -235,7 +361,7 @@ void HelloVulkan::loadGltfLights(const VkCommandBuffer& cmdBuf, VkBufferUsageFla
     for (auto& l : m_gltfScene.m_lights)
     {
         nvmath::vec3f color(l.light.color[0], l.light.color[1], l.light.color[2]);
-        lights.emplace_back(GltfLight{
+        m_lights.emplace_back(GltfLight{
             nvmath::vec3f(l.worldMatrix.col(3)),
             color,
             static_cast<float>(l.light.intensity),
@@ -244,128 +370,263 @@ void HelloVulkan::loadGltfLights(const VkCommandBuffer& cmdBuf, VkBufferUsageFla
     }
      
     // Allocate a dummy light since buffer should not be empty
-    if (lights.empty())
+    if (m_lights.empty())
+        m_lights = makeFallbackLights();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Vertex and index buffers, in the float layout of the glTF importer or compressed (vertex_compression.h)
+// - The sizes of both layouts are logged to compare them
+//
+void HelloVulkan::createGeometryBuffers()
+{
+    VkBufferUsageFlags flags = VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    VkBufferUsageFlags rayTracingFlags = flags | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+
+    const uint64_t floatSize = getFloatGeometrySize(m_gltfScene);
+    m_primMeshInfos.clear();
+    if (!m_compressVertices)
     {
-        //lights.emplace_back(GltfLight{
-        //    nvmath::vec3f(9.5f, 5.0f, 3.0f),    // position
-        //    nvmath::vec3f(1.0f),    // color
-        //    10.0f,                  // intensity
-        //    0                       // type, default point light
-        //});
-        lights.emplace_back(GltfLight{
-            nvmath::vec3f(1.0f, 5.0f, -1.33f),    // position
-            nvmath::vec3f(1.0f),    // color
-            50.0f,                  // intensity
-            0                       // type, default point light
-            });
-        //lights.emplace_back(GltfLight{
-        //    nvmath::vec3f(-9.3, 6.4, -4),    // position
-        //    nvmath::vec3f(1.0f),    // color
-        //    10.0f,                  // intensity
-        //    0                       // type, default point light
-        //    });
-        //lights.emplace_back(GltfLight{
-        //    nvmath::vec3f(-10.5, 0.75, -4.64),    // position
-        //    nvmath::vec3f(1.0f),    // color
-        //    10.0f,                  // intensity
-        //    0                       // type, default point light
-        //    });
-        //lights.emplace_back(GltfLight{
-        //    nvmath::vec3f(8.63, 1.11, 1.71),    // position
-        //    nvmath::vec3f(1.0f),    // color
-        //    10.0f,                  // intensity
-        //    0                       // type, default point light
-        //    });
-        lights.emplace_back(GltfLight{
-            nvmath::vec3f(0, 3, 67),    // position
-            nvmath::vec3f(1.0f, 0.01f, 0.1f),    // color
-            50.0f,                  // intensity
-            0                       // type, default point light
-            });
-        lights.emplace_back(GltfLight{
-            nvmath::vec3f(-1.3, 7.62, 59),    // position
-            nvmath::vec3f(1.0f),    // color
-            50.0f,                  // intensity
-            0                       // type, default point light
-            });
-        lights.emplace_back(GltfLight{
-            nvmath::vec3f(2.4, 2.05, 40.6),    // position
-            nvmath::vec3f(1.0f),    // color
-            50.0f,                  // intensity
-            0                       // type, default point light
-            });
-        lights.emplace_back(GltfLight{
-            nvmath::vec3f(-0.33, 6.85, 30),    // position
-            nvmath::vec3f(1.0f),    // color
-            50.0f,                  // intensity
-            0                       // type, default point light
-            });
-        lights.emplace_back(GltfLight{
-            nvmath::vec3f(-6.2, 9.6, 20.18),    // position
-            nvmath::vec3f(1.0f),    // color
-            50.0f,                  // intensity
-            0                       // type, default point light
-            });
-        lights.emplace_back(GltfLight{
-            nvmath::vec3f(-0.23, 6.93, 12.21),    // position
-            nvmath::vec3f(1.0, 1.0f, 0.0f),    // color
-            50.0f,                  // intensity
-            0                       // type, default point light
-            });
-        lights.emplace_back(GltfLight{
-            nvmath::vec3f(0.24, 3.03, 49.94),    // position
-            nvmath::vec3f(0.0f, 0.0f, 1.0f),    // color
-            50.0f,                  // intensity
-            0                       // type, default point light
-            });
+        m_vertexFlags = 0;
+        m_vertexBuffer = m_upload.createBuffer(m_gltfScene.m_positions, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | rayTracingFlags);
+        m_indexBuffer = m_upload.createBuffer(m_gltfScene.m_indices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | rayTracingFlags);
+        m_normalBuffer = m_upload.createBuffer(m_gltfScene.m_normals, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | flags);
+        m_tangentBuffer = m_upload.createBuffer(m_gltfScene.m_tangents, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | flags);
+        m_uvBuffer = m_upload.createBuffer(m_gltfScene.m_texcoords0, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | flags);
+        for (const auto& primMesh : m_gltfScene.m_primMeshes)
+            m_primMeshInfos.push_back(makePrimMeshInfo(primMesh));
+
+        LOGI("Geometry: %.1f MB, float layout (48 bytes per vertex)\n", floatSize / (1024.0 * 1024.0));
+        return;
     }
-    m_lightBuffer = m_alloc.createBuffer(cmdBuf, lights, flags);
-    m_pcRaster.lightsCount = lights.size();
-    m_pcRay.lightsCount = lights.size();
+
+    nvh::Stopwatch           sw;
+    const CompressedGeometry geometry = compressGeometry(m_gltfScene, m_quantizePositions);
+    m_vertexFlags = VERTEX_COMPRESSED | (geometry.quantizedPositions ? VERTEX_QUANTIZED_POSITIONS : 0);
+    m_vertexBuffer = m_upload.createBuffer(geometry.positions, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | rayTracingFlags);
+    m_indexBuffer = m_upload.createBuffer(geometry.indices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | rayTracingFlags);
+    m_normalBuffer = m_upload.createBuffer(geometry.normals, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | flags);
+    m_tangentBuffer = m_upload.createBuffer(geometry.tangents, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | flags);
+    m_uvBuffer = m_upload.createBuffer(geometry.texcoords, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | flags);
+    m_primMeshInfos = geometry.primInfos;
+
+    // The BLAS are built in the original object space, the dequantization is applied as the geometry transform
+    if (geometry.quantizedPositions)
+    {
+        std::vector<VkTransformMatrixKHR> transforms;
+        for (const auto& info : m_primMeshInfos)
+        {
+            VkTransformMatrixKHR t{};
+            for (int r = 0; r < 3; r++)
+            {
+                t.matrix[r][r] = info.posScale[r];
+                t.matrix[r][3] = info.posOffset[r];
+            }
+            transforms.push_back(t);
+        }
+        m_blasTransforms = m_upload.createBuffer(transforms, rayTracingFlags);
+    }
+
+    const size_t indexCount = m_gltfScene.m_indices.size();
+    LOGI("Geometry: %.1f MB compressed in %.1f ms (%u bytes per vertex, %.0f%% of the indices 16-bit), %.1f MB with the float layout (48 bytes per vertex)\n",
+         geometry.getSize() / (1024.0 * 1024.0), sw.elapsed(), geometry.getPositionStride() + 3 * uint32_t(sizeof(uint32_t)),
+         indexCount > 0 ? 100.0 * geometry.index16Count / indexCount : 0.0, floatSize / (1024.0 * 1024.0));
+}
+
+//--------------------------------------------------------------------------------------------------
+// Starts loading a scene in the background, the render loop runs meanwhile
+// - The import runs on its own thread, updateSceneLoad() takes over once it is done
+//
+void HelloVulkan::startSceneLoad(const std::string& filename)
+{
+    m_load           = std::make_unique<SceneLoad>();
+    m_load->filename = filename;
+    // The cache holds the optimized geometry, it is only valid for the same options
+    m_load->importFlags = (m_optimizeMeshes ? 1u : 0u) | (m_optimizeOverdraw ? 2u : 0u) | (m_generateLods ? 4u : 0u);
+    // Only applies to this load
+    m_load->refreshCache = m_refreshSceneCache;
+    m_refreshSceneCache  = false;
+
+    m_loadStage        = eLoadImporting;
+    m_timeToFirstFrame = -1.0f;
+    m_fullLoadTime     = -1.0f;
+    m_loadTimer.reset();
+    m_load->thread = std::thread([this]() { importScene(*m_load); });
 }
 
-void HelloVulkan::loadGltfScene(const std::string& filename)
+//--------------------------------------------------------------------------------------------------
+// Importing the scene on the load thread, either from its binary cache (warm) or from the glTF (cold)
+// - The render loop does not touch the scene before load.imported is set
+// - A cold load writes the cache for the next run once every image is decoded, while the render
+//   loop already streams them
+//
+void HelloVulkan::importScene(SceneLoad& load)
 {
-    tinygltf::Model    tmodel;
-    tinygltf::TinyGLTF tcontext;
-    std::string        warn, error;
+    nvh::Stopwatch sw;
 
-    if (nvh::endsWith(filename, ".gltf"))
+    load.warm = m_useSceneCache && !load.refreshCache && load.cache.open(load.filename, load.importFlags);
+    if (load.warm)
     {
-        if (!tcontext.LoadASCIIFromFile(&tmodel, &error, &warn, filename))
-            assert(!"Error while loading gltf scene");
+        load.cache.restoreScene(m_gltfScene);
+        m_pbrMaterials      = load.cache.read<GltfPBRMaterial>(SceneCache::eMaterials);
+        m_lights            = load.cache.read<GltfLight>(SceneCache::eLights);
+        m_lodChains         = load.cache.read<LodChain>(SceneCache::eLods);
+        load.textureSources = load.cache.read<int32_t>(SceneCache::eTextures);
+        load.images         = load.cache.getImages();
+        load.imageCount     = load.images.size();
     }
     else
     {
-        if (!tcontext.LoadBinaryFromFile(&tmodel, &error, &warn, filename))
-            assert(!"Error while loading binary scene");
-    }
+        if (nvh::endsWith(load.filename, ".obj"))
+        {
+            // Geometry and material colors only, no textures
+            ObjLoader obj;
+            obj.loadModel(load.filename);
+            importObjScene(obj, m_gltfScene);
+            loadGltfMaterials();
+            loadGltfLights();
+        }
+        else
+        {
+            tinygltf::Model    tmodel;
+            tinygltf::TinyGLTF tcontext;
+            std::string        warn, error;
 
-    m_gltfScene.importMaterials(tmodel);
-    m_gltfScene.importDrawableNodes(tmodel,
-        nvh::GltfAttributes::Normal | nvh::GltfAttributes::Texcoord_0 | nvh::GltfAttributes::Tangent);
+            // Images are only read here and decoded in parallel afterwards
+            tcontext.SetImageLoader(&TextureDecoder::deferImageLoad, &load.decoder);
 
-    nvvk::CommandPool cmdBufGet(m_device, m_graphicsQueueIndex);
-    VkCommandBuffer   cmdBuf = cmdBufGet.createCommandBuffer();
+            if (nvh::endsWith(load.filename, ".gltf"))
+            {
+                if (!tcontext.LoadASCIIFromFile(&tmodel, &error, &warn, load.filename))
+                    assert(!"Error while loading gltf scene");
+            }
+            else
+            {
+                if (!tcontext.LoadBinaryFromFile(&tmodel, &error, &warn, load.filename))
+                    assert(!"Error while loading binary scene");
+            }
 
-    VkBufferUsageFlags flags = VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-    VkBufferUsageFlags rayTracingFlags = flags | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
-    m_vertexBuffer = m_alloc.createBuffer(cmdBuf, m_gltfScene.m_positions, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | rayTracingFlags);
-    m_indexBuffer = m_alloc.createBuffer(cmdBuf, m_gltfScene.m_indices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | rayTracingFlags);
-    m_normalBuffer = m_alloc.createBuffer(cmdBuf, m_gltfScene.m_normals, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | flags);
-    m_tangentBuffer = m_alloc.createBuffer(cmdBuf, m_gltfScene.m_tangents, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | flags);
-    m_uvBuffer = m_alloc.createBuffer(cmdBuf, m_gltfScene.m_texcoords0, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | flags);
-
-    // Load the materials
-    loadGltfMaterials(cmdBuf, flags);
-    loadGltfLights(cmdBuf, flags);
-
-    std::vector<PrimMeshInfo> primLookup;
-    for (auto& primMesh : m_gltfScene.m_primMeshes)
+            m_gltfScene.importMaterials(tmodel);
+            m_gltfScene.importDrawableNodes(tmodel,
+                nvh::GltfAttributes::Normal | nvh::GltfAttributes::Texcoord_0 | nvh::GltfAttributes::Tangent);
+
+            loadGltfMaterials();
+            loadGltfLights();
+
+            load.textureSources = load.decoder.selectTextureSources(tmodel);
+
+            // Mips are baked into the cache, otherwise they are generated on the GPU
+            load.decoder.start(getImageFormats(tmodel), m_useSceneCache);
+            load.imageCount = tmodel.images.size();
+        }
+
+        // Runs while the textures decode
+        if (m_optimizeMeshes)
+        {
+            nvh::Stopwatch     swOptimize;
+            MeshOptimizerStats before, after;
+            optimizeMeshes(m_gltfScene, m_optimizeOverdraw, before, after);
+            LOGI("Mesh optimization: %llu degenerate triangles removed, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f in %.1f ms\n",
+                 (unsigned long long)after.degenerates, before.getAcmr(), after.getAcmr(), before.getAtvr(), after.getAtvr(),
+                 swOptimize.elapsed());
+        }
+
+        // After the optimization: each level is reordered for the vertex cache on its own
+        if (m_generateLods)
+        {
+            nvh::Stopwatch swLods;
+            const size_t   indexCount = m_gltfScene.m_indices.size();
+            m_lodChains               = generateLods(m_gltfScene);
+            uint32_t       simplified = 0, levels = 0;
+            for (const auto& chain : m_lodChains)
+            {
+                simplified += chain.levelCount > 1 ? 1 : 0;
+                levels += chain.levelCount - 1;
+            }
+            LOGI("LOD generation: %u / %zu meshes simplified, %u levels, %.1f MB of indices added in %.1f ms\n", simplified,
+                 m_lodChains.size(), levels, (m_gltfScene.m_indices.size() - indexCount) * sizeof(uint32_t) / (1024.0 * 1024.0),
+                 swLods.elapsed());
+        }
+        else
+        {
+            m_lodChains = makeBaseLodChains(m_gltfScene);
+        }
+    }
+
+    // After the optimization, which may drop degenerate triangles
+    nvh::Stopwatch swLights;
+    m_emissivePower = buildEmissiveTriangles(m_gltfScene, m_pbrMaterials, m_emissiveTriangles);
+    LOGI("Emissive lights: %zu triangles, total power %.2f in %.1f ms\n", m_emissiveTriangles.size(), m_emissivePower,
+         swLights.elapsed());
+    // A warm load must light the scene as the cold import that wrote the cache
+    if (load.warm && m_emissiveTriangles.size() != load.cache.getEmissiveTriangleCount())
+        LOGW("Emissive lights: %zu triangles from the cache, the cold import had %u\n", m_emissiveTriangles.size(),
+             load.cache.getEmissiveTriangleCount());
+    swLights.reset();
+    m_lightBvh = buildLightBvh(m_lights);
+    LOGI("Light BVH: %zu lights, %zu nodes in %.1f ms\n", m_lights.size(), m_lightBvh.size(), swLights.elapsed());
+    std::vector<float> lightPowers;
+    for (const auto& light : m_lights)
+        lightPowers.push_back(getLightPower(light));
+    m_lightAliasTable = buildAliasTable(lightPowers);
+
+    LOGI("Scene %s imported (%s) in %.1f ms\n", load.filename.c_str(), load.warm ? "warm, from cache" : "cold", sw.elapsed());
+    load.imported = true;
+
+    if (!load.warm && m_useSceneCache)
     {
-        primLookup.push_back({ primMesh.firstIndex, primMesh.vertexOffset, primMesh.materialIndex });
+        // The render loop keeps the pixels while the cache is enabled
+        load.decoder.wait();
+
+        nvh::Stopwatch           swCache;
+        std::vector<TextureView> images;
+        for (const auto& texture : load.decoder.getImages())
+            images.emplace_back(makeTextureView(texture));
+
+        SceneCache::Contents contents;
+        contents.scene                 = &m_gltfScene;
+        contents.materials             = &m_pbrMaterials;
+        contents.lights                = &m_lights;
+        contents.lods                  = &m_lodChains;
+        contents.textureSources        = &load.textureSources;
+        contents.images                = &images;
+        contents.importFlags           = load.importFlags;
+        contents.emissiveTriangleCount = static_cast<uint32_t>(m_emissiveTriangles.size());
+        if (SceneCache::write(load.filename, contents))
+            LOGI("Scene cache %s written in %.1f ms\n", SceneCache::getCachePath(load.filename).c_str(), swCache.elapsed());
     }
-    m_primInfo = m_alloc.createBuffer(cmdBuf, primLookup, flags);
+    load.finished = true;
+}
+
+//--------------------------------------------------------------------------------------------------
+// GPU buffers of the imported scene, an empty TLAS and the queue of BLASes to build
+// - Called by updateSceneLoad() once, the frames before it did not draw the scene
+//
+void HelloVulkan::createSceneResources()
+{
+    nvh::Stopwatch sw;
+    vkDeviceWaitIdle(m_device);
+
+    m_pcRaster.lightsCount = static_cast<int>(m_lights.size());
+    m_pcRay.lightsCount    = static_cast<int>(m_lights.size());
+
+    VkBufferUsageFlags flags = VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    createGeometryBuffers();
+    createInstances();
+    createClusterCulling();
+
+    // Materials and lights
+    m_materialBuffer = m_upload.createBuffer(m_pbrMaterials, flags);
+    m_lightBuffer = m_upload.createBuffer(m_lights, flags);
+    // Never empty, the shaders only read emissiveTriangleCount of them
+    const std::vector<EmissiveTriangle> noTriangle(1);
+    m_emissiveBuffer = m_upload.createBuffer(m_emissiveTriangles.empty() ? noTriangle : m_emissiveTriangles, flags);
+    const std::vector<LightBvhNode> noNode(1);
+    m_lightBvhBuffer = m_upload.createBuffer(m_lightBvh.empty() ? noNode : m_lightBvh, flags);
+    const std::vector<AliasEntry> noEntry(1);
+    m_lightAliasBuffer = m_upload.createBuffer(m_lightAliasTable.empty() ? noEntry : m_lightAliasTable, flags);
+
+    m_primInfo = m_upload.createBuffer(m_primMeshInfos, flags);
 
     SceneDesc sceneDesc;
     sceneDesc.vertexAddress = nvvk::getBufferDeviceAddress(m_device, m_vertexBuffer.buffer);
@@ -376,11 +637,21 @@ void HelloVulkan::loadGltfScene(const std::string& filename)
     sceneDesc.materialAddress = nvvk::getBufferDeviceAddress(m_device, m_materialBuffer.buffer);
     sceneDesc.lightAddress = nvvk::getBufferDeviceAddress(m_device, m_lightBuffer.buffer);
     sceneDesc.primInfoAddress = nvvk::getBufferDeviceAddress(m_device, m_primInfo.buffer);
-    m_sceneDesc = m_alloc.createBuffer(cmdBuf, sizeof(SceneDesc), &sceneDesc, flags);
-
-    createTextureImages(cmdBuf, tmodel);
-    cmdBufGet.submitAndWait(cmdBuf);
-    m_alloc.finalizeAndReleaseStaging();
+    sceneDesc.instanceAddress = nvvk::getBufferDeviceAddress(m_device, m_instanceBuffer.buffer);
+    sceneDesc.emissiveTriangleAddress = nvvk::getBufferDeviceAddress(m_device, m_emissiveBuffer.buffer);
+    sceneDesc.lightBvhAddress = nvvk::getBufferDeviceAddress(m_device, m_lightBvhBuffer.buffer);
+    sceneDesc.lightAliasAddress = nvvk::getBufferDeviceAddress(m_device, m_lightAliasBuffer.buffer);
+    sceneDesc.environmentAliasAddress = nvvk::getBufferDeviceAddress(m_device, m_environmentAliasBuffer.buffer);
+    sceneDesc.vertexFlags = m_vertexFlags;
+    sceneDesc.emissiveTriangleCount = static_cast<uint32_t>(m_emissiveTriangles.size());
+    sceneDesc.lightBvhNodeCount = static_cast<uint32_t>(m_lightBvh.size());
+    sceneDesc.lightAliasCount = static_cast<uint32_t>(m_lightAliasTable.size());
+    sceneDesc.environmentWidth = m_environmentWidth;
+    sceneDesc.environmentHeight = m_environmentHeight;
+    sceneDesc.environmentAliasCount = m_environmentAliasCount;
+    sceneDesc.emissivePower = m_emissivePower;
+    m_upload.uploadBuffer(m_sceneDesc.buffer, 0, sizeof(SceneDesc), &sceneDesc);
+    m_upload.waitIdle();
 
     NAME_VK(m_vertexBuffer.buffer);
     NAME_VK(m_indexBuffer.buffer);
@@ -389,164 +660,439 @@ void HelloVulkan::loadGltfScene(const std::string& filename)
     NAME_VK(m_uvBuffer.buffer);
     NAME_VK(m_materialBuffer.buffer);
     NAME_VK(m_lightBuffer.buffer);
+    NAME_VK(m_emissiveBuffer.buffer);
+    NAME_VK(m_lightBvhBuffer.buffer);
+    NAME_VK(m_lightAliasBuffer.buffer);
     NAME_VK(m_primInfo.buffer);
-    NAME_VK(m_sceneDesc.buffer);
+    NAME_VK(m_instanceBuffer.buffer);
+    NAME_VK(m_nodeDrawBuffer.buffer);
+    NAME_VK(m_meshletBuffer.buffer);
+    NAME_VK(m_cullNodeBuffer.buffer);
+    NAME_VK(m_meshLodBuffer.buffer);
+    NAME_VK(m_drawBuffer.buffer);
+    NAME_VK(m_drawCountBuffer.buffer);
+    NAME_VK(m_cullUniformBuffer.buffer);
+    NAME_VK(m_occludedBuffer.buffer);
+
+    // Textures keep the default one until their image arrives, the cache has all of them already
+    if (m_load->textureSources.size() > m_maxTextures)
+        LOGW("The scene has %zu textures, only the first %u are bound (maxTextures)\n", m_load->textureSources.size(), m_maxTextures);
+    m_textureStreamer.setTextures(m_load->textureSources, m_load->imageCount);
+    for (size_t i = 0; i < m_load->images.size(); i++)
+        m_textureStreamer.addImage(i, m_load->images[i]);
+
+    // No node is ready until its BLASes are built
+    m_nodeReady.assign(m_gltfScene.m_nodes.size(), 0);
+    m_readyNodeCount = 0;
+    createBottomLevelASGltf();
+    createTopLevelAsGltf();
+    m_tlasDirty = true;
+    updateRtSceneDescriptorSet();
+    createProbeVolume();
+
+    LOGI("Scene buffers created in %.1f ms, %.1f ms after the load started\n", sw.elapsed(), m_loadTimer.elapsed());
+    LOGI("Uploaded %.1f MB in %u batches, peak staging %.1f / %.1f MB\n", m_upload.getTotalUploaded() / (1024.0 * 1024.0),
+         m_upload.getBatchCount(), m_upload.getPeakUsage() / (1024.0 * 1024.0), m_upload.getBudget() / (1024.0 * 1024.0));
 }
 
-
 //--------------------------------------------------------------------------------------------------
-// Creating the uniform buffer holding the camera matrices
-// - Buffer is host visible
+// Called at the start of each frame, before prepareFrame()
+// - Creates the GPU scene once the import is done, then submits BLAS batches and texture mips
+//   within the per-frame budgets
+// - Nothing is waited for: a BLAS batch counts once its timeline value is signaled, and the new
+//   mips once their upload batch is, no more mips are streamed until then
+// - The changes reach the frames through updateSceneFrame()
 //
-void HelloVulkan::createUniformBuffer()
+void HelloVulkan::updateSceneLoad()
 {
-    m_bGlobals = m_alloc.createBuffer(sizeof(GlobalUniforms), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    m_debug.setObjectName(m_bGlobals.buffer, "Globals");
-}
-
-
-//--------------------------------------------------------------------------------------------------
-// Creating all textures and samplers
-//
+    if (!m_load)
+        return;
 
+    if (m_loadStage == eLoadImporting)
+    {
+        if (!m_load->imported)
+            return;
+        createSceneResources();
+        m_loadStage = eLoadStreaming;
+    }
 
-// Albedo and Emissive maps should be in SRGB, searches for correspondence between gltf image-texture-material
-// TODO: make this function more efficient and more robust
-// There is already a function in nvpro (gltf_scene_vk.cpp) that does this
-VkFormat getImageFormat(size_t i, const tinygltf::Model& gltfModel)
-{
-    VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
-    int texId = -1;
-    for (size_t j = 0; j < gltfModel.textures.size(); j++)
+    if (m_loadStage == eLoadStreaming)
     {
-        if (gltfModel.textures[j].source == i)
+        // Images decoded since the last frame
+        size_t index;
+        while (!m_load->warm && m_load->decoder.tryNext(index))
+            m_textureStreamer.addImage(index, makeTextureView(m_load->decoder.getImages()[index]));
+
+        // The mips of the previous frames are shown once their copies are done. Their descriptors
+        // are taken now, the views of the next steps are not done yet
+        if (m_texturesPending && m_upload.isComplete(m_textureUploadValue))
         {
-            texId = j;
-            break;
+            m_texturesPending = false;
+            m_textureStreamer.getDescriptors(m_defaultTexture.descriptor, m_textureDescriptors);
+            m_textureDescriptors.resize(std::min<size_t>(m_textureDescriptors.size(), m_maxTextures));
+            m_unboundViewCount = m_textureStreamer.getRetiredViewCount();
+            std::fill(m_textureSetDirty.begin(), m_textureSetDirty.end(), 1);
         }
-    }
-    if (texId > -1)
-    {
-        for (const auto& material : gltfModel.materials)
+
+        if (!m_texturesPending)
         {
-            if (material.pbrMetallicRoughness.baseColorTexture.index == texId ||
-                material.emissiveTexture.index == texId)
+            std::vector<size_t> completed;
+            m_texturesPending = m_textureStreamer.update(VkDeviceSize(m_textureUploadMBPerFrame) << 20, completed);
+            // Without the cache the pixels are not needed once they are in the staging ring
+            if (!m_load->warm && !m_useSceneCache)
             {
-                format = VK_FORMAT_R8G8B8A8_SRGB;
-                break;
+                for (size_t image : completed)
+                    m_load->decoder.release(image);
             }
         }
-    }
+        m_textureUploadValue = std::max(m_textureUploadValue, m_upload.flush());
 
-    return format;
-}
-
-void HelloVulkan::createTextureImages(const VkCommandBuffer& cmdBuf, tinygltf::Model& gltfModel)
-{
-    // TODO: sampler data should be take from gltfModel
-    VkSamplerCreateInfo samplerCreateInfo{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
-    samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
-    samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
-    samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-    samplerCreateInfo.anisotropyEnable = VK_TRUE;
-    samplerCreateInfo.maxAnisotropy = 4;
-    samplerCreateInfo.maxLod = FLT_MAX;
+        if (m_accel.buildBlas(m_blasTrianglesPerFrame, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR) > 0 && updateReadyNodes())
+            m_tlasDirty = true;
 
-    VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
-
-    auto addDefaultTexture = [this]() {
-        // Make dummy image(1,1), needed as we cannot have an empty array
-        nvvk::ScopeCommandBuffer cmdBuf(m_device, m_graphicsQueueIndex);
-        std::array<uint8_t, 4>   white = { 255, 255, 255, 255 };
+        // This frame is the first to show geometry
+        if (m_timeToFirstFrame < 0.0f && (m_readyNodeCount > 0 || m_nodeReady.empty()))
+        {
+            m_timeToFirstFrame = static_cast<float>(m_loadTimer.elapsed());
+            LOGI("First interactive frame %.1f ms after the load started\n", m_timeToFirstFrame);
+        }
 
-        VkSamplerCreateInfo sampler{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
-        m_textures.emplace_back(m_alloc.createTexture(cmdBuf, 4, white.data(), nvvk::makeImage2DCreateInfo(VkExtent2D{ 1, 1 }), sampler));
-        m_debug.setObjectName(m_textures.back().image, "dummy");
-    };
+        if (m_textureStreamer.isComplete() && !m_texturesPending && m_accel.getBuiltBlasCount() == m_accel.getBlasCount())
+        {
+            m_fullLoadTime = static_cast<float>(m_loadTimer.elapsed());
+            m_loadStage    = eLoadDone;
+            LOGI("Scene fully loaded in %.1f ms (%u BLAS)\n", m_fullLoadTime, m_accel.getBlasCount());
+            LOGI("Textures: %.1f MB of VRAM, %.1f MB as uncompressed RGBA8\n", m_textureStreamer.getMemory() / (1024.0 * 1024.0),
+                 m_textureStreamer.getRgba8Memory() / (1024.0 * 1024.0));
+        }
+    }
 
-    if (gltfModel.images.empty())
+    // The cache may still be written after everything is on the GPU
+    if (m_loadStage == eLoadDone && m_load->finished)
     {
-        addDefaultTexture();
-        return;
+        m_load->thread.join();
+        m_load.reset();
     }
+}
 
-    //m_textures.reserve(gltfModel.images.size());
-    std::vector<nvvk::Image> images;
-    std::vector<VkImageViewCreateInfo> imageViewInfos;
+//--------------------------------------------------------------------------------------------------
+// Called after prepareFrame(), before anything else is recorded into the frame
+// - The scene set of this frame takes the texture descriptors of updateSceneLoad(), the sets of the
+//   frames in flight get them on their turn. The replaced views are destroyed once no set has them
+// - The TLAS rebuild is recorded into the frame, see AccelBuilder::buildTlas()
+//
+void HelloVulkan::updateSceneFrame(const VkCommandBuffer& cmdBuf)
+{
+    const uint32_t frame = getCurFrame();
+    m_descSet            = m_descSets[frame];
+    if (m_textureSetDirty[frame])
+    {
+        updateTextureDescriptors();
+        m_textureSetDirty[frame] = 0;
+        resetFrame();
+    }
+    // The frames that used the old sets are done, prepareFrame() waited for each before its set changed
+    if (m_unboundViewCount > 0 && std::find(m_textureSetDirty.begin(), m_textureSetDirty.end(), 1) == m_textureSetDirty.end())
+    {
+        m_textureStreamer.destroyRetiredViews(m_unboundViewCount);
+        m_unboundViewCount = 0;
+    }
 
-    images.reserve(gltfModel.images.size());
-    imageViewInfos.reserve(gltfModel.images.size());
-    for (size_t i = 0; i < gltfModel.images.size(); i++)
+    if (m_tlasDirty)
     {
-        auto& gltfimage = gltfModel.images[i];
-        void* buffer = &gltfimage.image[0];
-        VkDeviceSize bufferSize = gltfimage.image.size();
-        auto         imgSize = VkExtent2D{ (uint32_t)gltfimage.width, (uint32_t)gltfimage.height };
+        updateTopLevelAsGltf(cmdBuf);
+        m_tlasDirty = false;
+        resetFrame();
+    }
+}
 
-        if (bufferSize == 0 || gltfimage.width == -1 || gltfimage.height == -1)
-        {
-            addDefaultTexture();
+//--------------------------------------------------------------------------------------------------
+// A node is drawn and traced once the BLASes of its full and proxy geometry are built
+// - Returns true when nodes became ready
+//
+bool HelloVulkan::updateReadyNodes()
+{
+    const uint32_t previous = m_readyNodeCount;
+    for (size_t n = 0; n < m_gltfScene.m_nodes.size(); n++)
+    {
+        if (m_nodeReady[n])
             continue;
+        const uint32_t  primMesh = static_cast<uint32_t>(m_gltfScene.m_nodes[n].primMesh);
+        const LodChain& chain    = m_lodChains[primMesh];
+        const uint32_t  proxy    = chain.primMeshes[std::min(m_proxyLodLevel, chain.levelCount - 1)];
+        if (m_accel.isBlasBuilt(m_primBlas[primMesh]) && m_accel.isBlasBuilt(m_primBlas[proxy]))
+        {
+            m_nodeReady[n] = 1;
+            m_readyNodeCount++;
         }
+    }
+    return m_readyNodeCount != previous;
+}
 
-        format = getImageFormat(i, gltfModel);
+const char* HelloVulkan::getLoadStageName() const
+{
+    switch (m_loadStage)
+    {
+        case eLoadImporting:
+            return "importing";
+        case eLoadStreaming:
+            return "streaming";
+        case eLoadDone:
+            return "loaded";
+        default:
+            return "none";
+    }
+}
 
-        VkImageCreateInfo imageCreateInfo = nvvk::makeImage2DCreateInfo(imgSize, format, VK_IMAGE_USAGE_SAMPLED_BIT, true);
+//--------------------------------------------------------------------------------------------------
+// Creating the uniform buffer holding the camera matrices, and the scene description
+// - The scene description is filled when the scene is created
+//
+void HelloVulkan::createUniformBuffer()
+{
+    m_bGlobals = m_alloc.createBuffer(sizeof(GlobalUniforms), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_debug.setObjectName(m_bGlobals.buffer, "Globals");
 
-        //nvvk::Image image = m_alloc.createImage(cmdBuf, bufferSize, buffer, imageCreateInfo);
-        images.emplace_back(m_alloc.createImage(cmdBuf, bufferSize, buffer, imageCreateInfo));
-        nvvk::cmdGenerateMipmaps(cmdBuf, images[i].image, format, imgSize, imageCreateInfo.mipLevels);
-        //VkImageViewCreateInfo ivInfo = nvvk::makeImageViewCreateInfo(image.image, imageCreateInfo);
-        
-        imageViewInfos.emplace_back(nvvk::makeImageViewCreateInfo(images[i].image, imageCreateInfo));
-    }
+    m_sceneDesc = m_upload.createBuffer(sizeof(SceneDesc), nullptr, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    NAME_VK(m_sceneDesc.buffer);
+}
 
-    m_textures.reserve(gltfModel.textures.size());
-    for (size_t i = 0; i < gltfModel.textures.size(); i++)
-    {
-        int imgIdx = gltfModel.textures[i].source;
-        m_textures.emplace_back(m_alloc.createTexture(images[imgIdx], imageViewInfos[imgIdx], samplerCreateInfo));
 
-        m_debug.setObjectName(m_textures[i].image, std::string("Txt" + std::to_string(i)));
+//--------------------------------------------------------------------------------------------------
+// Texture bound to the whole texture array until the images of the scene arrive
+//
+void HelloVulkan::createDefaultTexture()
+{
+    // Make dummy image(1,1), needed as we cannot have an empty array
+    std::array<uint8_t, 4>  white = { 255, 255, 255, 255 };
+    VkImageCreateInfo       imageCreateInfo = nvvk::makeImage2DCreateInfo(VkExtent2D{ 1, 1 });
+    VkImageSubresourceRange range{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    nvvk::Image             image = m_alloc.createImage(imageCreateInfo);
+
+    nvvk::cmdBarrierImageLayout(m_upload.getCommandBuffer(), image.image, VK_IMAGE_LAYOUT_UNDEFINED,
+                                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, range);
+    m_upload.uploadImage(image.image, VkOffset3D{}, VkExtent3D{ 1, 1, 1 }, VkImageSubresourceLayers{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+                         white.size(), white.data());
+    nvvk::cmdBarrierImageLayout(m_upload.getCommandBuffer(), image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, range);
+    m_upload.waitIdle();
+
+    VkSamplerCreateInfo sampler{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+    m_defaultTexture = m_alloc.createTexture(image, nvvk::makeImageViewCreateInfo(image.image, imageCreateInfo), sampler);
+    m_debug.setObjectName(m_defaultTexture.image, "dummy");
+}
+
+//--------------------------------------------------------------------------------------------------
+// Environment map of the path tracer and its alias table (environment_map.h), kept across scenes
+// - Without a file, or when it cannot be read, a black texel is bound and the misses keep the
+//   clear color
+//
+void HelloVulkan::createEnvironment(const std::string& filename)
+{
+    nvh::Stopwatch sw;
+    EnvironmentMap map;
+    if (!filename.empty() && !loadEnvironmentMap(filename, map))
+        LOGW("Cannot read the environment map %s\n", filename.c_str());
+    if (map.pixels.empty())
+    {
+        map.pixels = { 0.0f, 0.0f, 0.0f, 1.0f };
+        map.width  = 0;
+        map.height = 0;
     }
+    const std::vector<AliasEntry> aliasTable = buildEnvironmentAliasTable(map);
+    m_environmentWidth      = map.width;
+    m_environmentHeight     = map.height;
+    m_environmentAliasCount = static_cast<uint32_t>(aliasTable.size());
+
+    const VkExtent2D        extent{ std::max(map.width, 1u), std::max(map.height, 1u) };
+    VkImageCreateInfo       imageCreateInfo = nvvk::makeImage2DCreateInfo(extent, VK_FORMAT_R32G32B32A32_SFLOAT);
+    VkImageSubresourceRange range{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    nvvk::Image             image = m_alloc.createImage(imageCreateInfo);
+
+    nvvk::cmdBarrierImageLayout(m_upload.getCommandBuffer(), image.image, VK_IMAGE_LAYOUT_UNDEFINED,
+                                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, range);
+    m_upload.uploadImage(image.image, VkOffset3D{}, VkExtent3D{ extent.width, extent.height, 1 },
+                         VkImageSubresourceLayers{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 }, map.pixels.size() * sizeof(float),
+                         map.pixels.data());
+    nvvk::cmdBarrierImageLayout(m_upload.getCommandBuffer(), image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, range);
+
+    // Wraps around in phi, clamped at the poles
+    VkSamplerCreateInfo sampler{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+    sampler.magFilter    = VK_FILTER_LINEAR;
+    sampler.minFilter    = VK_FILTER_LINEAR;
+    sampler.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    sampler.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    m_environmentTexture = m_alloc.createTexture(image, nvvk::makeImageViewCreateInfo(image.image, imageCreateInfo), sampler);
+    m_debug.setObjectName(m_environmentTexture.image, "environment");
+
+    const std::vector<AliasEntry> noEntry(1);
+    m_environmentAliasBuffer = m_upload.createBuffer(aliasTable.empty() ? noEntry : aliasTable,
+                                                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+    NAME_VK(m_environmentAliasBuffer.buffer);
+    m_upload.waitIdle();
+
+    if (m_environmentWidth > 0)
+        LOGI("Environment map %s: %ux%u, sampled from %u texels in %.1f ms\n", filename.c_str(), m_environmentWidth,
+             m_environmentHeight, m_environmentAliasCount, sw.elapsed());
 }
 
 //--------------------------------------------------------------------------------------------------
-// Destroying all allocations
+// Tables of the low-discrepancy samplers of the path tracer (sampler.h), kept across scenes
 //
-void HelloVulkan::destroyResources()
+void HelloVulkan::createSampler()
 {
-    vkDestroyPipeline(m_device, m_graphicsPipeline, nullptr);
-    vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
-    vkDestroyDescriptorPool(m_device, m_descPool, nullptr);
-    vkDestroyDescriptorSetLayout(m_device, m_descSetLayout, nullptr);
+    nvh::Stopwatch              sw;
+    const std::vector<uint32_t> tables = buildSamplerTables();
+    m_samplerBuffer = m_upload.createBuffer(tables, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+    NAME_VK(m_samplerBuffer.buffer);
+    m_upload.waitIdle();
+    m_pcRay.samplerAddress = nvvk::getBufferDeviceAddress(m_device, m_samplerBuffer.buffer);
+    LOGI("Sampler tables: %u Sobol dimensions, %ux%u blue noise in %.1f ms\n", SOBOL_DIMENSIONS, BLUE_NOISE_SIZE,
+         BLUE_NOISE_SIZE, sw.elapsed());
+}
 
-    m_alloc.destroy(m_bGlobals);
+//--------------------------------------------------------------------------------------------------
+// Frees the current scene, the renderer is left as before startSceneLoad()
+// - Pipelines, layouts, descriptor sets, render targets, the uniform buffers, the staging ring and
+//   the memory blocks of the allocator are kept for the next scene
+// - An import still running is waited for, it cannot be interrupted
+//
+void HelloVulkan::destroyScene()
+{
+    if (m_load && m_load->thread.joinable())
+        m_load->thread.join();
+    m_load.reset();
+    vkDeviceWaitIdle(m_device);
 
     m_alloc.destroy(m_vertexBuffer);
     m_alloc.destroy(m_normalBuffer);
     m_alloc.destroy(m_tangentBuffer);
     m_alloc.destroy(m_uvBuffer);
     m_alloc.destroy(m_indexBuffer);
+    m_alloc.destroy(m_blasTransforms);
     m_alloc.destroy(m_materialBuffer);
     m_alloc.destroy(m_lightBuffer);
+    m_alloc.destroy(m_emissiveBuffer);
+    m_alloc.destroy(m_lightBvhBuffer);
+    m_alloc.destroy(m_lightAliasBuffer);
     m_alloc.destroy(m_primInfo);
+    m_alloc.destroy(m_instanceBuffer);
+    m_alloc.destroy(m_nodeDrawBuffer);
+    if (m_frameDrawData != nullptr)
+        m_alloc.unmap(m_frameDrawBuffer);
+    m_alloc.destroy(m_frameDrawBuffer);
+    m_frameDrawData = nullptr;
+    m_alloc.destroy(m_meshletBuffer);
+    m_alloc.destroy(m_cullNodeBuffer);
+    m_alloc.destroy(m_meshLodBuffer);
+    m_alloc.destroy(m_drawBuffer);
+    m_alloc.destroy(m_drawCountBuffer);
+    m_alloc.destroy(m_cullUniformBuffer);
+    m_alloc.destroy(m_occludedBuffer);
+    m_alloc.destroy(m_probeRayBuffer);
+    m_alloc.destroy(m_probeIrradianceBuffer);
+    m_alloc.destroy(m_probeDepthBuffer);
+    m_probeVolume = {};
+
+    m_accel.clear();
+    m_textureStreamer.clear();
+
+    m_gltfScene.destroy();
+    m_pbrMaterials.clear();
+    m_lights.clear();
+    m_emissiveTriangles.clear();
+    m_emissivePower = 0.0f;
+    m_lightBvh.clear();
+    m_lightAliasTable.clear();
+    m_primMeshInfos.clear();
+    m_instances.clear();
+    m_nodeBounds.resize(0);
+    m_visibleNodes.clear();
+    m_visibleLods.clear();
+    m_lodChains.clear();
+    m_meshLods.clear();
+    m_firstMeshLod.clear();
+    m_primBlas.clear();
+    m_meshletRanges.clear();
+    m_cullNodes.clear();
+    m_meshletCount = 0;
+    m_drawCount    = 0;
+    m_nodeReady.clear();
+    m_textureDescriptors.clear();
+    std::fill(m_textureSetDirty.begin(), m_textureSetDirty.end(), 0);
+    m_readyNodeCount     = 0;
+    m_textureUploadValue = 0;
+    m_texturesPending    = false;
+    m_unboundViewCount   = 0;
+    m_tlasDirty          = false;
+    m_hizHistory         = false;
+    m_loadStage          = eLoadIdle;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Replaces the scene without recreating the renderer, see destroyScene()
+// - The load runs in the background like the first one, the textures are bound to the default
+//   texture again until the new images arrive
+//
+void HelloVulkan::switchScene(const std::string& filename)
+{
+    nvh::Stopwatch sw;
+    destroyScene();
+    updateDescriptorSet();
+    resetFrame();
+    m_unloadTime = static_cast<float>(sw.elapsed());
+    LOGI("Scene unloaded in %.1f ms\n", m_unloadTime);
+    startSceneLoad(filename);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Destroying all allocations
+//
+void HelloVulkan::destroyResources()
+{
+    destroyScene();
+
+    vkDestroyPipeline(m_device, m_graphicsPipeline, nullptr);
+    vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
+    vkDestroyDescriptorPool(m_device, m_descPool, nullptr);
+    vkDestroyDescriptorSetLayout(m_device, m_descSetLayout, nullptr);
+
+    m_alloc.destroy(m_bGlobals);
     m_alloc.destroy(m_sceneDesc);
 
-    for (auto& t : m_textures)
-    {
-        m_alloc.destroy(t);
-    }
+    vkDestroyPipeline(m_device, m_cullPipeline, nullptr);
+    vkDestroyPipelineLayout(m_device, m_cullPipelineLayout, nullptr);
+    vkDestroyPipeline(m_device, m_hizPipeline, nullptr);
+    vkDestroyPipelineLayout(m_device, m_hizPipelineLayout, nullptr);
+    vkDestroyDescriptorPool(m_device, m_hizDescPool, nullptr);
+    vkDestroyDescriptorSetLayout(m_device, m_hizDescSetLayout, nullptr);
+
+    m_textureStreamer.deinit();
+    m_alloc.destroy(m_defaultTexture);
+    m_alloc.destroy(m_environmentTexture);
+    m_alloc.destroy(m_environmentAliasBuffer);
+    m_alloc.destroy(m_samplerBuffer);
 
     //#Post
     m_alloc.destroy(m_offscreenColor);
     m_alloc.destroy(m_offscreenDepth);
+    m_alloc.destroy(m_hiz);
+    for (VkImageView view : m_hizMipViews)
+        vkDestroyImageView(m_device, view, nullptr);
     //BUFFER: destroy here
     m_alloc.destroy(m_positionTexture);
     m_alloc.destroy(m_normalTexture);
     m_alloc.destroy(m_accumulatedTexture);
     m_alloc.destroy(m_roughnessMap);
+    m_alloc.destroy(m_sampleSum);
+    m_alloc.destroy(m_sampleSumSq);
+    m_alloc.destroy(m_sampleCount);
+    m_alloc.destroy(m_tileBuffer);
+    m_alloc.destroy(m_restirBuffer);
+    m_alloc.destroy(m_restirGIBuffer);
     // Denoiser
     m_alloc.destroy(m_inMV.texture);
     m_alloc.destroy(m_inNormalRoughness.texture);
@@ -559,9 +1105,10 @@ void HelloVulkan::destroyResources()
     vkDestroyDescriptorPool(m_device, m_postDescPool, nullptr);
     vkDestroyDescriptorSetLayout(m_device, m_postDescSetLayout, nullptr);
     vkDestroyRenderPass(m_device, m_offscreenRenderPass, nullptr);
+    vkDestroyRenderPass(m_device, m_offscreenLoadRenderPass, nullptr);
     vkDestroyFramebuffer(m_device, m_offscreenFramebuffer, nullptr);
 
-    m_rtBuilder.destroy();
+    m_accel.deinit();
     vkDestroyDescriptorPool(m_device, m_rtDescPool, nullptr);
     vkDestroyDescriptorSetLayout(m_device, m_rtDescSetLayout, nullptr);
     vkDestroyPipeline(m_device, m_rtPipeline, nullptr);
@@ -570,21 +1117,34 @@ void HelloVulkan::destroyResources()
     vkDestroyPipeline(m_device, m_rtPipeline2, nullptr);
     vkDestroyPipelineLayout(m_device, m_rtPipelineLayout2, nullptr);
 
+    vkDestroyPipeline(m_device, m_adaptivePipeline, nullptr);
+    vkDestroyPipelineLayout(m_device, m_adaptivePipelineLayout, nullptr);
+    vkDestroyPipeline(m_device, m_probeRtPipeline, nullptr);
+    vkDestroyPipeline(m_device, m_probeUpdatePipeline, nullptr);
+    vkDestroyPipelineLayout(m_device, m_probeUpdatePipelineLayout, nullptr);
+    if (m_adaptiveCountData != nullptr)
+        m_alloc.unmap(m_adaptiveCountBuffer);
+    m_alloc.destroy(m_adaptiveCountBuffer);
+
     //m_alloc.destroy(m_rtSBTBuffer);
     m_sbtWrapper.destroy();
     m_sbtWrapper2.destroy();
+    m_probeSbtWrapper.destroy();
 
+    m_profiler.deinit();
+    m_upload.deinit();
     m_alloc.deinit();
 }
 
 //--------------------------------------------------------------------------------------------------
 // Drawing the scene in raster mode
 //
-void HelloVulkan::rasterizeGltf(const VkCommandBuffer& cmdBuf)
+void HelloVulkan::rasterizeGltf(const VkCommandBuffer& cmdBuf, uint32_t phase)
 {
     std::vector<VkDeviceSize> offsets = { 0, 0, 0, 0 };
 
-    m_debug.beginLabel(cmdBuf, "Rasterize");
+    m_debug.beginLabel(cmdBuf, phase == 0 ? "Rasterize" : "Rasterize (occluded)");
+    auto section = m_profiler.timeRecurring(phase == 0 ? "Raster" : "Raster (occluded)", cmdBuf);
 
     // Dynamic Viewport
     setViewport(cmdBuf);
@@ -595,22 +1155,461 @@ void HelloVulkan::rasterizeGltf(const VkCommandBuffer& cmdBuf)
 
     std::vector<VkBuffer> vertexBuffers = { m_vertexBuffer.buffer, m_normalBuffer.buffer, m_tangentBuffer.buffer, m_uvBuffer.buffer };
     vkCmdBindVertexBuffers(cmdBuf, 0, static_cast<uint32_t>(vertexBuffers.size()), vertexBuffers.data(), offsets.data());
-    vkCmdBindIndexBuffer(cmdBuf, m_indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
 
     m_pcRaster.viewMatrix = CameraManip.getMatrix();
-    for (auto& node : m_gltfScene.m_nodes)
+    // ReSTIR shades the punctual lights in the hybrid ray tracing pass instead
+    m_pcRaster.lightsCount = m_pcRay.restirDI ? 0 : static_cast<int>(m_lights.size());
+    vkCmdPushConstants(cmdBuf, m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+        sizeof(PushConstantRaster), &m_pcRaster);
+
+    // One indirect draw per index type, the shaders find the node of each command from its firstInstance
+    const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+    for (uint32_t list : { DRAW_LIST_INDEX16, DRAW_LIST_INDEX32 })
+    {
+        const DrawList& draws = m_clusterCulling ? m_meshletDrawLists[list] : m_frameNodeList ? m_frameNodeDrawLists[list] : m_nodeDrawLists[list];
+        if (draws.count == 0)
+            continue;
+
+        vkCmdBindIndexBuffer(cmdBuf, m_indexBuffer.buffer, 0, list == DRAW_LIST_INDEX16 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32);
+        if (m_clusterCulling)
+            vkCmdDrawIndexedIndirectCount(cmdBuf, m_drawBuffer.buffer, VkDeviceSize(phase * m_drawCount + draws.offset) * stride,
+                m_drawCountBuffer.buffer, offsetof(CullCounts, drawCounts) + (phase * 2 + list) * sizeof(uint32_t), draws.count, stride);
+        else if (m_frameNodeList)
+            vkCmdDrawIndexedIndirect(cmdBuf, m_frameDrawBuffer.buffer, m_frameDrawOffset + VkDeviceSize(draws.offset) * stride, draws.count, stride);
+        else
+            vkCmdDrawIndexedIndirect(cmdBuf, m_nodeDrawBuffer.buffer, VkDeviceSize(draws.offset) * stride, draws.count, stride);
+    }
+
+    m_debug.endLabel(cmdBuf);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Raster data of every node, and one indirect command drawing each node whole
+// - The matrices and world bounds only change with the scene, they are not recomputed per frame
+//
+void HelloVulkan::createInstances()
+{
+    m_instances.clear();
+    m_nodeBounds.resize(m_gltfScene.m_nodes.size());
+    std::vector<VkDrawIndexedIndirectCommand> draws[2];
+    for (size_t n = 0; n < m_gltfScene.m_nodes.size(); n++)
+    {
+        const auto&         node      = m_gltfScene.m_nodes[n];
+        const auto&         primitive = m_gltfScene.m_primMeshes[node.primMesh];
+        const PrimMeshInfo& info      = m_primMeshInfos[node.primMesh];
+
+        nvmath::mat4f dequantize(1);
+        if (m_vertexFlags & VERTEX_QUANTIZED_POSITIONS)
+            dequantize = nvmath::translation_mat4(nvmath::vec3f(info.posOffset.x, info.posOffset.y, info.posOffset.z))
+                         * nvmath::scale_mat4(nvmath::vec3f(info.posScale.x, info.posScale.y, info.posScale.z));
+
+        InstanceInfo instance;
+        instance.modelMatrix = node.worldMatrix * dequantize;
+        instance.normalMatrix = nvmath::transpose(nvmath::inverse(node.worldMatrix));
+        instance.primMesh = static_cast<uint32_t>(node.primMesh);
+        instance.materialId = primitive.materialIndex;
+        m_instances.push_back(instance);
+
+        // indexOffset is in units of the index size
+        const uint32_t list = info.indexSize == sizeof(uint16_t) ? DRAW_LIST_INDEX16 : DRAW_LIST_INDEX32;
+        draws[list].push_back({ primitive.indexCount, 1, info.indexOffset, static_cast<int32_t>(primitive.vertexOffset), static_cast<uint32_t>(n) });
+
+        nvmath::vec3f bmin, bmax;
+        transformBounds(node.worldMatrix, primitive.posMin, primitive.posMax, bmin, bmax);
+        m_nodeBounds.set(n, bmin, bmax);
+    }
+
+    m_nodeDrawLists[DRAW_LIST_INDEX16] = { 0, static_cast<uint32_t>(draws[DRAW_LIST_INDEX16].size()) };
+    m_nodeDrawLists[DRAW_LIST_INDEX32] = { static_cast<uint32_t>(draws[DRAW_LIST_INDEX16].size()), static_cast<uint32_t>(draws[DRAW_LIST_INDEX32].size()) };
+    draws[DRAW_LIST_INDEX16].insert(draws[DRAW_LIST_INDEX16].end(), draws[DRAW_LIST_INDEX32].begin(), draws[DRAW_LIST_INDEX32].end());
+
+    m_instanceBuffer = m_upload.createBuffer(m_instances, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    m_nodeDrawBuffer = m_upload.createBuffer(draws[DRAW_LIST_INDEX16], VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+
+    // Written by the CPU node culling, one slice per swapchain image
+    const uint32_t frameCount = getSwapChain().getImageCount();
+    m_frameDrawStride = std::max<VkDeviceSize>(m_gltfScene.m_nodes.size(), 1) * (sizeof(VkDrawIndexedIndirectCommand) + sizeof(uint32_t));
+    m_frameDrawBuffer = m_alloc.createBuffer(m_frameDrawStride * frameCount,
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    m_frameDrawData = static_cast<uint8_t*>(m_alloc.map(m_frameDrawBuffer));
+}
+
+//--------------------------------------------------------------------------------------------------
+// Meshlets of the scene, the LOD levels of each primitive mesh and one culling instance per node
+// - Visible meshlets go to the draw list of their index type, each list can hold the meshlets of the
+//   largest level of every node in it
+//
+void HelloVulkan::createClusterCulling()
+{
+    std::vector<Meshlet> meshlets = buildMeshlets(m_gltfScene, m_primMeshInfos, m_meshletRanges);
+    m_meshletCount = static_cast<uint32_t>(meshlets.size());
+
+    // Meshlets of each level in each draw list, a level of a 32-bit mesh can have 16-bit indices
+    m_meshLods.clear();
+    m_firstMeshLod.clear();
+    std::vector<std::array<uint32_t, 2>> lodListCounts;
+    for (const auto& chain : m_lodChains)
+    {
+        m_firstMeshLod.push_back(static_cast<uint32_t>(m_meshLods.size()));
+        for (uint32_t level = 0; level < chain.levelCount; level++)
+        {
+            const MeshletRange& range = m_meshletRanges[chain.primMeshes[level]];
+            m_meshLods.push_back({ range.firstMeshlet, range.meshletCount, chain.errors[level], chain.primMeshes[level] });
+            std::array<uint32_t, 2> counts = { 0, 0 };
+            for (uint32_t m = range.firstMeshlet; m < range.firstMeshlet + range.meshletCount; m++)
+                counts[meshlets[m].drawList]++;
+            lodListCounts.push_back(counts);
+        }
+    }
+
+    // The 32-bit list starts after the largest possible 16-bit one
+    m_cullNodes.clear();
+    uint32_t capacity[2] = { 0, 0 };
+    for (const auto& node : m_gltfScene.m_nodes)
+    {
+        const LodChain& chain = m_lodChains[node.primMesh];
+        const uint32_t  list  = m_primMeshInfos[node.primMesh].indexSize == sizeof(uint16_t) ? DRAW_LIST_INDEX16 : DRAW_LIST_INDEX32;
+
+        nvmath::vec3f bmin, bmax;
+        transformBounds(node.worldMatrix, m_gltfScene.m_primMeshes[node.primMesh].posMin, m_gltfScene.m_primMeshes[node.primMesh].posMax, bmin, bmax);
+        const nvmath::vec3f center = (bmin + bmax) * 0.5f;
+        const nvmath::vec4f sphere(center.x, center.y, center.z, nvmath::length(bmax - bmin) * 0.5f);
+        m_cullNodes.push_back(makeCullNode(node.worldMatrix, sphere, m_firstMeshLod[node.primMesh], chain.levelCount, list));
+
+        uint32_t largest[2] = { 0, 0 };
+        for (uint32_t level = 0; level < chain.levelCount; level++)
+        {
+            for (uint32_t l : { DRAW_LIST_INDEX16, DRAW_LIST_INDEX32 })
+                largest[l] = std::max(largest[l], lodListCounts[m_firstMeshLod[node.primMesh] + level][l]);
+        }
+        capacity[DRAW_LIST_INDEX16] += largest[DRAW_LIST_INDEX16];
+        capacity[DRAW_LIST_INDEX32] += largest[DRAW_LIST_INDEX32];
+    }
+    m_meshletDrawLists[DRAW_LIST_INDEX16] = { 0, capacity[DRAW_LIST_INDEX16] };
+    m_meshletDrawLists[DRAW_LIST_INDEX32] = { capacity[DRAW_LIST_INDEX16], capacity[DRAW_LIST_INDEX32] };
+    m_drawCount = capacity[DRAW_LIST_INDEX16] + capacity[DRAW_LIST_INDEX32];
+
+    VkBufferUsageFlags flags = VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    m_meshletBuffer = m_upload.createBuffer(meshlets, flags);
+    m_cullNodeBuffer = m_upload.createBuffer(m_cullNodes, flags);
+    m_meshLodBuffer = m_upload.createBuffer(m_meshLods, flags);
+    // The second phase of the occlusion culling has lists of the same capacity after the first one
+    m_drawBuffer = m_alloc.createBuffer(2 * std::max(m_drawCount, 1u) * sizeof(VkDrawIndexedIndirectCommand), flags | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+    m_drawCountBuffer = m_alloc.createBuffer(sizeof(CullCounts), flags | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    m_cullUniformBuffer = m_alloc.createBuffer(sizeof(CullUniforms), flags | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    m_occludedBuffer = m_alloc.createBuffer(std::max(m_drawCount, 1u) * 2 * sizeof(uint32_t), flags);
+    m_hizHistory = false;
+
+    LOGI("Cluster culling: %u meshlets in %zu LOD levels, up to %u meshlet instances in %zu nodes\n", m_meshletCount, m_meshLods.size(),
+         m_drawCount, m_cullNodes.size());
+}
+
+//--------------------------------------------------------------------------------------------------
+// Compute pipelines of the cluster culling and of the Hi-Z pyramid build
+// - The culling accesses everything but the pyramid through buffer addresses
+//
+void HelloVulkan::createCullPipeline()
+{
+    m_hizDescSetLayoutBind.addBinding(eHizDepth, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    m_hizDescSetLayoutBind.addBinding(eHizPyramid, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    m_hizDescSetLayoutBind.addBinding(eHizMips, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, HIZ_MAX_LEVELS, VK_SHADER_STAGE_COMPUTE_BIT);
+    m_hizDescSetLayout = m_hizDescSetLayoutBind.createLayout(m_device);
+    m_hizDescPool = m_hizDescSetLayoutBind.createPool(m_device);
+    m_hizDescSet = nvvk::allocateDescriptorSet(m_device, m_hizDescPool, m_hizDescSetLayout);
+    updateHizDescriptorSet();
+
+    VkPushConstantRange pushConstantRange = { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantCull) };
+
+    VkPipelineLayoutCreateInfo createInfo{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+    createInfo.setLayoutCount = 1;
+    createInfo.pSetLayouts = &m_hizDescSetLayout;
+    createInfo.pushConstantRangeCount = 1;
+    createInfo.pPushConstantRanges = &pushConstantRange;
+    vkCreatePipelineLayout(m_device, &createInfo, nullptr, &m_cullPipelineLayout);
+
+    VkComputePipelineCreateInfo pipelineInfo{ VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = nvvk::createShaderModule(m_device, nvh::loadFile("spv/cluster_cull.comp.spv", true, defaultSearchPaths, true));
+    pipelineInfo.layout = m_cullPipelineLayout;
+    vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_cullPipeline);
+    vkDestroyShaderModule(m_device, pipelineInfo.stage.module, nullptr);
+    m_debug.setObjectName(m_cullPipeline, "ClusterCull");
+
+    pushConstantRange.size = sizeof(PushConstantHiz);
+    vkCreatePipelineLayout(m_device, &createInfo, nullptr, &m_hizPipelineLayout);
+
+    pipelineInfo.stage.module = nvvk::createShaderModule(m_device, nvh::loadFile("spv/hiz_build.comp.spv", true, defaultSearchPaths, true));
+    pipelineInfo.layout = m_hizPipelineLayout;
+    vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_hizPipeline);
+    vkDestroyShaderModule(m_device, pipelineInfo.stage.module, nullptr);
+    m_debug.setObjectName(m_hizPipeline, "HizBuild");
+}
+
+//--------------------------------------------------------------------------------------------------
+// The depth buffer and the pyramid change with the window size
+// - Storage bindings past the last mip repeat it, they are never accessed
+//
+void HelloVulkan::updateHizDescriptorSet()
+{
+    VkDescriptorImageInfo depthInfo{ m_hiz.descriptor.sampler, m_offscreenDepth.descriptor.imageView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+    std::vector<VkDescriptorImageInfo> mipInfos;
+    for (uint32_t level = 0; level < HIZ_MAX_LEVELS; level++)
+        mipInfos.push_back({ VK_NULL_HANDLE, m_hizMipViews[std::min(level, m_hizLevels - 1)], VK_IMAGE_LAYOUT_GENERAL });
+
+    std::vector<VkWriteDescriptorSet> writeDescriptorSets;
+    writeDescriptorSets.emplace_back(m_hizDescSetLayoutBind.makeWrite(m_hizDescSet, eHizDepth, &depthInfo));
+    writeDescriptorSets.emplace_back(m_hizDescSetLayoutBind.makeWrite(m_hizDescSet, eHizPyramid, &m_hiz.descriptor));
+    writeDescriptorSets.emplace_back(m_hizDescSetLayoutBind.makeWriteArray(m_hizDescSet, eHizMips, mipInfos.data()));
+    vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Culling of the scene against the camera, before the raster render pass
+// - Nodes are frustum culled on the CPU, then the meshlets of the visible ones on the GPU
+// - Without cluster culling, the visible nodes are drawn whole from this frame's commands
+// - While the scene loads, the nodes whose BLASes are not built yet are left out
+//
+void HelloVulkan::cullScene(const VkCommandBuffer& cmdBuf)
+{
+    const nvmath::mat4f viewProj = getViewProj();
+    m_lodPixelsPerRadian = m_size.height / (2.0f * std::tan(nvmath::nv_to_rad * CameraManip.getFov() * 0.5f));
+
+    const bool allReady = m_readyNodeCount == m_cullNodes.size();
+    m_frameNodeList     = (m_nodeCulling || !allReady) && !m_cullNodes.empty();
+    if (m_frameNodeList)
     {
-        auto& primitive = m_gltfScene.m_primMeshes[node.primMesh];
-
-        m_pcRaster.modelMatrix = nvmath::scale_mat4(nvmath::vec3f(1.0f)) * node.worldMatrix;
-        m_pcRaster.inverseTransposeMatrix = nvmath::transpose(nvmath::inverse(nvmath::scale_mat4(nvmath::vec3f(1.0f)) * node.worldMatrix));
-        m_pcRaster.objIndex = node.primMesh;
-        m_pcRaster.materialId = primitive.materialIndex;
-        vkCmdPushConstants(cmdBuf, m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
-            sizeof(PushConstantRaster), &m_pcRaster);
-        vkCmdDrawIndexed(cmdBuf, primitive.indexCount, 1, primitive.firstIndex, primitive.vertexOffset, 0);
+        nvh::Stopwatch sw;
+        if (m_nodeCulling)
+            cullBounds(m_nodeBounds, makeFrustum(viewProj), m_visibleNodes);
+        else
+        {
+            m_visibleNodes.resize(m_cullNodes.size());
+            std::iota(m_visibleNodes.begin(), m_visibleNodes.end(), 0u);
+        }
+        if (!allReady)
+            m_visibleNodes.erase(std::remove_if(m_visibleNodes.begin(), m_visibleNodes.end(), [this](uint32_t n) { return !m_nodeReady[n]; }),
+                                 m_visibleNodes.end());
+
+        // This swapchain image's slice: commands of the visible nodes by index type, then their indices
+        const size_t nodeCount = m_cullNodes.size();
+        m_frameDrawOffset = getCurFrame() * m_frameDrawStride;
+        auto* draws = reinterpret_cast<VkDrawIndexedIndirectCommand*>(m_frameDrawData + m_frameDrawOffset);
+        auto* nodes = reinterpret_cast<uint32_t*>(m_frameDrawData + m_frameDrawOffset + nodeCount * sizeof(VkDrawIndexedIndirectCommand));
+
+        // Without cluster culling the nodes are drawn whole, at the level selected here
+        nvmath::vec3f eye, center, up;
+        CameraManip.getLookat(eye, center, up);
+        m_visibleLods.resize(m_visibleNodes.size());
+        uint32_t counts[2] = { 0, 0 };
+        for (size_t i = 0; i < m_visibleNodes.size(); i++)
+        {
+            const CullNode& node = m_cullNodes[m_visibleNodes[i]];
+            m_visibleLods[i] = node.firstLod + (m_clusterCulling ? 0 : selectLod(node, eye));
+            counts[m_primMeshInfos[m_meshLods[m_visibleLods[i]].primMesh].indexSize == sizeof(uint16_t) ? DRAW_LIST_INDEX16 : DRAW_LIST_INDEX32]++;
+        }
+        m_frameNodeDrawLists[DRAW_LIST_INDEX16] = { 0, counts[DRAW_LIST_INDEX16] };
+        m_frameNodeDrawLists[DRAW_LIST_INDEX32] = { counts[DRAW_LIST_INDEX16], counts[DRAW_LIST_INDEX32] };
+
+        uint32_t next[2] = { 0, counts[DRAW_LIST_INDEX16] };
+        for (size_t i = 0; i < m_visibleNodes.size(); i++)
+        {
+            const uint32_t           n        = m_visibleNodes[i];
+            const uint32_t           primMesh = m_meshLods[m_visibleLods[i]].primMesh;
+            const nvh::GltfPrimMesh& prim     = m_gltfScene.m_primMeshes[primMesh];
+            const PrimMeshInfo&      info     = m_primMeshInfos[primMesh];
+            const uint32_t           list     = info.indexSize == sizeof(uint16_t) ? DRAW_LIST_INDEX16 : DRAW_LIST_INDEX32;
+            nodes[i] = n;
+            draws[next[list]++] = { prim.indexCount, 1, info.indexOffset, static_cast<int32_t>(prim.vertexOffset), n };
+        }
+        m_nodeCullTime = static_cast<float>(sw.elapsed());
     }
 
+    cullClusters(cmdBuf, viewProj);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Coarsest LOD level of a node whose error stays under m_lodPixelError, as cluster_cull.comp does
+// - The distance is the one of the nearest point of the node's bounding sphere
+//
+uint32_t HelloVulkan::selectLod(const CullNode& node, const nvmath::vec3f& eye) const
+{
+    if (!m_lodSelection)
+        return 0;
+    const nvmath::vec3f center(node.boundingSphere.x, node.boundingSphere.y, node.boundingSphere.z);
+    const float         distance = std::max(nvmath::length(center - eye) - node.boundingSphere.w, 0.1f);
+    const float         scale = std::max(nvmath::length(nvmath::vec3f(node.worldMatrix.col(0))),
+                                 std::max(nvmath::length(nvmath::vec3f(node.worldMatrix.col(1))), nvmath::length(nvmath::vec3f(node.worldMatrix.col(2)))));
+    uint32_t level = node.lodCount - 1;
+    for (; level > 0; level--)
+    {
+        if (getLodPixelError(m_meshLods[node.firstLod + level].error, scale, distance, m_lodPixelsPerRadian) <= m_lodPixelError)
+            break;
+    }
+    return level;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Culling the meshlets of the nodes against the camera, first phase of the occlusion culling
+// - The counters are reset here, the previous frame's draws must be done reading them
+//
+void HelloVulkan::cullClusters(const VkCommandBuffer& cmdBuf, const nvmath::mat4f& viewProj)
+{
+    if (!m_clusterCulling || m_cullNodes.empty())
+        return;
+
+    m_debug.beginLabel(cmdBuf, "Cluster culling");
+    auto section = m_profiler.timeRecurring("Cluster culling", cmdBuf);
+
+    nvmath::vec3f eye, center, up;
+    CameraManip.getLookat(eye, center, up);
+    m_cullViewProj = viewProj;
+
+    CullUniforms uniforms{};
+    uniforms.viewProj = viewProj;
+    uniforms.hizViewProj = m_hizViewProj;
+    uniforms.cameraPosition = eye;
+    uniforms.nodeCount = static_cast<uint32_t>(m_cullNodes.size());
+    if (m_frameNodeList)
+    {
+        // Only the nodes that passed the CPU frustum test and are ready
+        uniforms.nodeCount = static_cast<uint32_t>(m_visibleNodes.size());
+        uniforms.nodeListAddress = nvvk::getBufferDeviceAddress(m_device, m_frameDrawBuffer.buffer) + m_frameDrawOffset
+                                   + m_cullNodes.size() * sizeof(VkDrawIndexedIndirectCommand);
+    }
+    uniforms.meshletAddress = nvvk::getBufferDeviceAddress(m_device, m_meshletBuffer.buffer);
+    uniforms.nodeAddress = nvvk::getBufferDeviceAddress(m_device, m_cullNodeBuffer.buffer);
+    uniforms.drawAddress = nvvk::getBufferDeviceAddress(m_device, m_drawBuffer.buffer);
+    uniforms.countAddress = nvvk::getBufferDeviceAddress(m_device, m_drawCountBuffer.buffer);
+    uniforms.occludedAddress = nvvk::getBufferDeviceAddress(m_device, m_occludedBuffer.buffer);
+    uniforms.flags = m_cullFlags;
+    if (useOcclusionCulling())
+        uniforms.flags |= CULL_OCCLUSION | (m_hizHistory ? CULL_HIZ_HISTORY : 0);
+    uniforms.drawList32Offset = m_meshletDrawLists[DRAW_LIST_INDEX32].offset;
+    uniforms.drawPhaseOffset = m_drawCount;
+    uniforms.occludedCapacity = m_drawCount;
+    uniforms.hizWidth = m_size.width;
+    uniforms.hizHeight = m_size.height;
+    uniforms.hizLevels = m_hizLevels;
+    if (m_lodSelection)
+        uniforms.flags |= CULL_LOD;
+    uniforms.lodPixelError = m_lodPixelError;
+    uniforms.lodAddress = nvvk::getBufferDeviceAddress(m_device, m_meshLodBuffer.buffer);
+    uniforms.lodPixelsPerRadian = m_lodPixelsPerRadian;
+
+    CullCounts counts{};
+    counts.dispatch[1] = 1;
+    counts.dispatch[2] = 1;
+
+    VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+    vkCmdUpdateBuffer(cmdBuf, m_cullUniformBuffer.buffer, 0, sizeof(CullUniforms), &uniforms);
+    vkCmdUpdateBuffer(cmdBuf, m_drawCountBuffer.buffer, 0, sizeof(CullCounts), &counts);
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    PushConstantCull pcCull{};
+    pcCull.uniformAddress = nvvk::getBufferDeviceAddress(m_device, m_cullUniformBuffer.buffer);
+    pcCull.phase = 0;
+
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullPipeline);
+    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullPipelineLayout, 0, 1, &m_hizDescSet, 0, nullptr);
+    vkCmdPushConstants(cmdBuf, m_cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantCull), &pcCull);
+
+    // One workgroup per node, wrapped in rows of 65535 groups
+    const uint32_t maxGroups = 65535;
+    vkCmdDispatch(cmdBuf, std::min(uniforms.nodeCount, maxGroups), (uniforms.nodeCount + maxGroups - 1) / maxGroups, 1);
+
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    m_debug.endLabel(cmdBuf);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Building the Hi-Z pyramid from the depth of the raster pass, one dispatch per mip
+// - Called after each raster phase: the second build is the history of the next frame
+//
+void HelloVulkan::buildHiz(const VkCommandBuffer& cmdBuf)
+{
+    m_debug.beginLabel(cmdBuf, "Hi-Z");
+    auto section = m_profiler.timeRecurring("Hi-Z", cmdBuf);
+
+    // The depth is sampled, and the culling must be done reading the previous pyramid
+    VkImageMemoryBarrier depthBarrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+    depthBarrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    depthBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    depthBarrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depthBarrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    depthBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    depthBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    depthBarrier.image = m_offscreenDepth.image;
+    depthBarrier.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+    if (m_offscreenDepthFormat == VK_FORMAT_D24_UNORM_S8_UINT || m_offscreenDepthFormat == VK_FORMAT_D32_SFLOAT_S8_UINT)
+        depthBarrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+    VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 1, &depthBarrier);
+
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_hizPipeline);
+    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_hizPipelineLayout, 0, 1, &m_hizDescSet, 0, nullptr);
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    for (uint32_t level = 0; level < m_hizLevels; level++)
+    {
+        if (level > 0)
+            vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        PushConstantHiz pcHiz{ level };
+        vkCmdPushConstants(cmdBuf, m_hizPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantHiz), &pcHiz);
+        const uint32_t width = std::max(m_size.width >> level, 1u);
+        const uint32_t height = std::max(m_size.height >> level, 1u);
+        vkCmdDispatch(cmdBuf, (width + 7) / 8, (height + 7) / 8, 1);
+    }
+
+    // Back to the attachment layout of the render passes, the pyramid is read by the culling
+    std::swap(depthBarrier.oldLayout, depthBarrier.newLayout);
+    depthBarrier.srcAccessMask = 0;
+    depthBarrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, 0, 1,
+        &barrier, 0, nullptr, 1, &depthBarrier);
+
+    m_hizViewProj = m_cullViewProj;
+    m_hizHistory = true;
+    m_debug.endLabel(cmdBuf);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Second phase of the occlusion culling: the meshlets the first phase found hidden, against the
+// pyramid of what it drew. Dispatched indirectly, the first phase sized the dispatch
+//
+void HelloVulkan::cullOccludedClusters(const VkCommandBuffer& cmdBuf)
+{
+    m_debug.beginLabel(cmdBuf, "Occlusion culling");
+    auto section = m_profiler.timeRecurring("Occlusion culling", cmdBuf);
+
+    PushConstantCull pcCull{};
+    pcCull.uniformAddress = nvvk::getBufferDeviceAddress(m_device, m_cullUniformBuffer.buffer);
+    pcCull.phase = 1;
+
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullPipeline);
+    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullPipelineLayout, 0, 1, &m_hizDescSet, 0, nullptr);
+    vkCmdPushConstants(cmdBuf, m_cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantCull), &pcCull);
+    vkCmdDispatchIndirect(cmdBuf, m_drawCountBuffer.buffer, offsetof(CullCounts, dispatch));
+
+    VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
     m_debug.endLabel(cmdBuf);
 }
 
@@ -623,6 +1622,7 @@ void HelloVulkan::onResize(int /*w*/, int /*h*/)
     createOffscreenRender();
     updatePostDescriptorSet();
     updateRtDescriptorSet();
+    updateHizDescriptorSet();
 }
 
 
@@ -638,11 +1638,21 @@ void HelloVulkan::createOffscreenRender()
 {
     m_alloc.destroy(m_offscreenColor);
     m_alloc.destroy(m_offscreenDepth);
+    m_alloc.destroy(m_hiz);
+    for (VkImageView view : m_hizMipViews)
+        vkDestroyImageView(m_device, view, nullptr);
+    m_hizMipViews.clear();
     // BUFFER: DESTROY HERE
     m_alloc.destroy(m_positionTexture);
     m_alloc.destroy(m_normalTexture);
     m_alloc.destroy(m_accumulatedTexture);
     m_alloc.destroy(m_roughnessMap);
+    m_alloc.destroy(m_sampleSum);
+    m_alloc.destroy(m_sampleSumSq);
+    m_alloc.destroy(m_sampleCount);
+    m_alloc.destroy(m_tileBuffer);
+    m_alloc.destroy(m_restirBuffer);
+    m_alloc.destroy(m_restirGIBuffer);
     // Denoising buffers
     m_alloc.destroy(m_inMV.texture);
     m_alloc.destroy(m_inNormalRoughness.texture);
@@ -654,7 +1664,7 @@ void HelloVulkan::createOffscreenRender()
     {
         auto colorCreateInfo = nvvk::makeImage2DCreateInfo(m_size, m_offscreenColorFormat,
             VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
-            | VK_IMAGE_USAGE_STORAGE_BIT);
+            | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);  // Read back by readOffscreenImage()
 
 
         nvvk::Image           image = m_alloc.createImage(colorCreateInfo);
@@ -664,11 +1674,11 @@ void HelloVulkan::createOffscreenRender()
         m_offscreenColor.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
     }
 
-    // Additional color images for GBuffer
+    // Additional color images for GBuffer, the accumulated image of the hybrid is also read back
     {
         auto colorCreateInfo = nvvk::makeImage2DCreateInfo(m_size, m_offscreenColorFormat,
             VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
-            | VK_IMAGE_USAGE_STORAGE_BIT);
+            | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
 
         //BUFFER: ADD HERE
         nvvk::Image           image = m_alloc.createImage(colorCreateInfo);
@@ -697,6 +1707,40 @@ void HelloVulkan::createOffscreenRender()
         m_roughnessMap.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
     }
 
+    // Sample accumulation of the path tracer and the tiles of the adaptive sampling
+    {
+        auto sumCreateInfo = nvvk::makeImage2DCreateInfo(m_size, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT);
+        nvvk::Image           image = m_alloc.createImage(sumCreateInfo);
+        VkImageViewCreateInfo ivInfo = nvvk::makeImageViewCreateInfo(image.image, sumCreateInfo);
+        VkSamplerCreateInfo   sampler{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+        m_sampleSum = m_alloc.createTexture(image, ivInfo, sampler);
+        m_sampleSum.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        image = m_alloc.createImage(sumCreateInfo);
+        ivInfo = nvvk::makeImageViewCreateInfo(image.image, sumCreateInfo);
+        m_sampleSumSq = m_alloc.createTexture(image, ivInfo, sampler);
+        m_sampleSumSq.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        // Also sampled by the heatmap of the post pass, with the nearest filter of the default sampler
+        auto countCreateInfo = nvvk::makeImage2DCreateInfo(m_size, VK_FORMAT_R32_UINT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+        image = m_alloc.createImage(countCreateInfo);
+        ivInfo = nvvk::makeImageViewCreateInfo(image.image, countCreateInfo);
+        m_sampleCount = m_alloc.createTexture(image, ivInfo, sampler);
+        m_sampleCount.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        m_tileCountX = (m_size.width + ADAPTIVE_TILE_SIZE - 1) / ADAPTIVE_TILE_SIZE;
+        m_tileCountY = (m_size.height + ADAPTIVE_TILE_SIZE - 1) / ADAPTIVE_TILE_SIZE;
+        m_tileBuffer = m_alloc.createBuffer(VkDeviceSize(m_tileCountX) * m_tileCountY * sizeof(AdaptiveTile),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+    }
+
+    // ReSTIR reservoirs of this frame and of the previous one, cleared so none is reused at first
+    m_restirBuffer = m_alloc.createBuffer(2 * VkDeviceSize(m_size.width) * m_size.height * sizeof(RestirReservoir),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    m_restirGIBuffer = m_alloc.createBuffer(2 * VkDeviceSize(m_size.width) * m_size.height * sizeof(RestirGIReservoir),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    m_restirFrame = 0;
+
     // denoiser:
     VkSamplerCreateInfo   sampler{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
     // Denoising buffers
@@ -753,7 +1797,7 @@ void HelloVulkan::createOffscreenRender()
     
 
     // Creating the depth buffer
-    auto depthCreateInfo = nvvk::makeImage2DCreateInfo(m_size, m_offscreenDepthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
+    auto depthCreateInfo = nvvk::makeImage2DCreateInfo(m_size, m_offscreenDepthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
     {
         nvvk::Image image = m_alloc.createImage(depthCreateInfo);
 
@@ -767,6 +1811,30 @@ void HelloVulkan::createOffscreenRender()
         m_offscreenDepth = m_alloc.createTexture(image, depthStencilView);
     }
 
+    // Hi-Z pyramid of the occlusion culling, a full mip chain from the size of the depth buffer
+    {
+        auto hizCreateInfo = nvvk::makeImage2DCreateInfo(m_size, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, true);
+        hizCreateInfo.mipLevels = std::min(hizCreateInfo.mipLevels, uint32_t(HIZ_MAX_LEVELS));
+        m_hizLevels = hizCreateInfo.mipLevels;
+
+        nvvk::Image           image = m_alloc.createImage(hizCreateInfo);
+        VkImageViewCreateInfo ivInfo = nvvk::makeImageViewCreateInfo(image.image, hizCreateInfo);
+        VkSamplerCreateInfo   sampler{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+        sampler.maxLod = VK_LOD_CLAMP_NONE;
+        m_hiz = m_alloc.createTexture(image, ivInfo, sampler);
+        m_hiz.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        for (uint32_t level = 0; level < m_hizLevels; level++)
+        {
+            ivInfo.subresourceRange.baseMipLevel = level;
+            ivInfo.subresourceRange.levelCount = 1;
+            VkImageView view;
+            vkCreateImageView(m_device, &ivInfo, nullptr, &view);
+            m_hizMipViews.push_back(view);
+        }
+        m_hizHistory = false;
+    }
+
     // Setting the image layout for both color and depth
     {
         nvvk::CommandPool genCmdBuf(m_device, m_graphicsQueueIndex);
@@ -774,17 +1842,23 @@ void HelloVulkan::createOffscreenRender()
         nvvk::cmdBarrierImageLayout(cmdBuf, m_offscreenColor.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
         nvvk::cmdBarrierImageLayout(cmdBuf, m_offscreenDepth.image, VK_IMAGE_LAYOUT_UNDEFINED,
             VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT);
+        nvvk::cmdBarrierImageLayout(cmdBuf, m_hiz.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
         // BUFFER: ADD HERE
         nvvk::cmdBarrierImageLayout(cmdBuf, m_positionTexture.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
         nvvk::cmdBarrierImageLayout(cmdBuf, m_normalTexture.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
         nvvk::cmdBarrierImageLayout(cmdBuf, m_accumulatedTexture.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
         nvvk::cmdBarrierImageLayout(cmdBuf, m_roughnessMap.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+        nvvk::cmdBarrierImageLayout(cmdBuf, m_sampleSum.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+        nvvk::cmdBarrierImageLayout(cmdBuf, m_sampleSumSq.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+        nvvk::cmdBarrierImageLayout(cmdBuf, m_sampleCount.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
         // DENOISER:
         nvvk::cmdBarrierImageLayout(cmdBuf, m_inMV.texture.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
         nvvk::cmdBarrierImageLayout(cmdBuf, m_inNormalRoughness.texture.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
         nvvk::cmdBarrierImageLayout(cmdBuf, m_inViewZ.texture.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
         nvvk::cmdBarrierImageLayout(cmdBuf, m_inDiffRadianceHitDist.texture.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
         //nvvk::cmdBarrierImageLayout(cmdBuf, m_outDiffRadianceHitDist.texture.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+        vkCmdFillBuffer(cmdBuf, m_restirBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+        vkCmdFillBuffer(cmdBuf, m_restirGIBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
 
         genCmdBuf.submitAndWait(cmdBuf);
     }
@@ -798,6 +1872,15 @@ void HelloVulkan::createOffscreenRender()
             m_offscreenDepthFormat, 1, true,
             true, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL);
     }
+    // Same attachments, loaded: the second raster phase draws over the first one
+    if (!m_offscreenLoadRenderPass)
+    {
+        m_offscreenLoadRenderPass = nvvk::createRenderPass(m_device,
+            { m_offscreenColorFormat, m_offscreenColorFormat, m_offscreenColorFormat, VK_FORMAT_R16G16_SFLOAT,
+            m_inMV.ivInfo.format, m_inNormalRoughness.ivInfo.format, m_inViewZ.ivInfo.format, m_inDiffRadianceHitDist.ivInfo.format },
+            m_offscreenDepthFormat, 1, false,
+            false, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL);
+    }
 
 
     // Creating the frame buffer for offscreen
@@ -859,6 +1942,7 @@ void HelloVulkan::createPostDescriptor()
 {
     m_postDescSetLayoutBind.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT);
     m_postDescSetLayoutBind.addBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT);
+    m_postDescSetLayoutBind.addBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT);  // Samples per pixel
     m_postDescSetLayout = m_postDescSetLayoutBind.createLayout(m_device);
     m_postDescPool = m_postDescSetLayoutBind.createPool(m_device);
     m_postDescSet = nvvk::allocateDescriptorSet(m_device, m_postDescPool, m_postDescSetLayout);
@@ -873,6 +1957,7 @@ void HelloVulkan::updatePostDescriptorSet()
     std::vector<VkWriteDescriptorSet> writeDescriptorSets;
     writeDescriptorSets.emplace_back(m_postDescSetLayoutBind.makeWrite(m_postDescSet, 0, &m_offscreenColor.descriptor));
     writeDescriptorSets.emplace_back(m_postDescSetLayoutBind.makeWrite(m_postDescSet, 1, &m_accumulatedTexture.descriptor));
+    writeDescriptorSets.emplace_back(m_postDescSetLayoutBind.makeWrite(m_postDescSet, 2, &m_sampleCount.descriptor));
     vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
 }
 
@@ -887,6 +1972,7 @@ void HelloVulkan::drawPost(VkCommandBuffer cmdBuf)
 
     m_pcPost.aspectRatio = static_cast<float>(m_size.width) / static_cast<float>(m_size.height);
     m_pcPost.useGI = m_pcRay.useGI;
+    m_pcPost.maxSampleCount = static_cast<float>(m_pcRay.adaptiveSampling != 0 ? m_adaptiveMaxSamples : std::max(getAccumulatedSamples(), 1));
     vkCmdPushConstants(cmdBuf, m_postPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstantPost), &m_pcPost.aspectRatio);
     vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_postPipeline);
     vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_postPipelineLayout, 0, 1, &m_postDescSet, 0, nullptr);
@@ -904,16 +1990,29 @@ void HelloVulkan::initRayTracing()
     prop2.pNext = &m_rtProperties;
     vkGetPhysicalDeviceProperties2(m_physicalDevice, &prop2);
 
-    m_rtBuilder.setup(m_device, &m_alloc, m_graphicsQueueIndex);
+    m_accel.init(m_device, m_physicalDevice, &m_alloc, m_graphicsQueueIndex);
     m_sbtWrapper.setup(m_device, m_graphicsQueueIndex, &m_alloc, m_rtProperties);
     m_sbtWrapper2.setup(m_device, m_graphicsQueueIndex, &m_alloc, m_rtProperties);
+    m_probeSbtWrapper.setup(m_device, m_graphicsQueueIndex, &m_alloc, m_rtProperties);
 
     m_pcRay.samples = 1;
     m_pcRay.depth = 3;
     m_pcRay.useShadows = true;
     m_pcRay.useAO = true;
     m_pcRay.useGI = false;
+    m_pcRay.emissiveLights = true;
+    m_pcRay.lightSampling = LIGHT_SAMPLING_BVH;
+    m_pcRay.environmentIntensity = 1.0f;
+    m_pcRay.environmentLights = true;
+    m_pcRay.rouletteDepth = 2;
+    m_pcRay.adaptiveSampling = true;
+    m_pcRay.sampler = SAMPLER_SOBOL;
+    m_pcRay.restirDI = false;
+    m_pcRay.restirCandidates = 32;
+    m_pcRay.restirGI = false;
+    m_pcRay.probeGI = false;
     m_pcPost.viewAccumulated = false;
+    m_pcPost.viewSampleCount = false;
     m_pcPost.rtMode = 0;
     m_pcPost.useGI = m_pcRay.useGI;
 }
@@ -952,20 +2051,24 @@ void HelloVulkan::initRayTracing()
 //  return input;
 //}
 
-auto HelloVulkan::primitiveToGeometry(const nvh::GltfPrimMesh& prim)
+auto HelloVulkan::primitiveToGeometry(const nvh::GltfPrimMesh& prim, uint32_t primIndex)
 {
     VkDeviceAddress vertexAddress = nvvk::getBufferDeviceAddress(m_device, m_vertexBuffer.buffer);
     VkDeviceAddress indexAddress = nvvk::getBufferDeviceAddress(m_device, m_indexBuffer.buffer);
+    const PrimMeshInfo& info = m_primMeshInfos[primIndex];
+    const bool quantized = (m_vertexFlags & VERTEX_QUANTIZED_POSITIONS) != 0;
 
     uint32_t maxPrimitiveCount = prim.indexCount / 3;
 
     VkAccelerationStructureGeometryTrianglesDataKHR triangles{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR };
-    triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+    triangles.vertexFormat = quantized ? VK_FORMAT_R16G16B16A16_SNORM : VK_FORMAT_R32G32B32_SFLOAT;
     triangles.vertexData.deviceAddress = vertexAddress;
-    triangles.vertexStride = sizeof(nvmath::vec3f);
-    triangles.indexType = VK_INDEX_TYPE_UINT32;
+    triangles.vertexStride = quantized ? 4 * sizeof(int16_t) : sizeof(nvmath::vec3f);
+    triangles.indexType = info.indexSize == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
     triangles.indexData.deviceAddress = indexAddress;
     triangles.transformData = {};
+    if (quantized)
+        triangles.transformData.deviceAddress = nvvk::getBufferDeviceAddress(m_device, m_blasTransforms.buffer);
     triangles.maxVertex = prim.vertexCount;
 
     VkAccelerationStructureGeometryKHR asGeom{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
@@ -976,8 +2079,8 @@ auto HelloVulkan::primitiveToGeometry(const nvh::GltfPrimMesh& prim)
     VkAccelerationStructureBuildRangeInfoKHR offset;
     offset.firstVertex = prim.vertexOffset;
     offset.primitiveCount = maxPrimitiveCount;
-    offset.primitiveOffset = prim.firstIndex * sizeof(uint32_t);
-    offset.transformOffset = 0;
+    offset.primitiveOffset = info.indexOffset * info.indexSize;
+    offset.transformOffset = quantized ? primIndex * sizeof(VkTransformMatrixKHR) : 0;
 
     nvvk::RaytracingBuilderKHR::BlasInput input;
     input.asGeometry.emplace_back(asGeom);
@@ -998,16 +2101,25 @@ auto HelloVulkan::primitiveToGeometry(const nvh::GltfPrimMesh& prim)
 //   m_rtBuilder.buildBlas(allBlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
 // }
 
+//--------------------------------------------------------------------------------------------------
+// One BLAS per primitive mesh referenced by the nodes, and one for the proxy level of each of them
+// - The other LOD levels are only rasterized
+// - Only queued here, updateSceneLoad() builds them a few per frame: the proxy follows its mesh so
+//   the nodes using it become ready one mesh at a time
+//
 void HelloVulkan::createBottomLevelASGltf()
 {
-    std::vector<nvvk::RaytracingBuilderKHR::BlasInput> allBlas;
-    allBlas.reserve(m_gltfScene.m_primMeshes.size());
-    for (const auto& primMesh : m_gltfScene.m_primMeshes)
+    m_primBlas.assign(m_gltfScene.m_primMeshes.size(), ~0u);
+    auto addBlas = [&](uint32_t primMesh) {
+        if (m_primBlas[primMesh] != ~0u)
+            return;
+        m_primBlas[primMesh] = m_accel.addBlas(primitiveToGeometry(m_gltfScene.m_primMeshes[primMesh], primMesh));
+    };
+    for (const auto& chain : m_lodChains)
     {
-        auto geo = primitiveToGeometry(primMesh);
-        allBlas.emplace_back(geo);
+        addBlas(chain.primMeshes[0]);
+        addBlas(chain.primMeshes[std::min(m_proxyLodLevel, chain.levelCount - 1)]);
     }
-    m_rtBuilder.buildBlas(allBlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
 }
 
 //void HelloVulkan::createTopLevelAs() 
@@ -1028,22 +2140,58 @@ void HelloVulkan::createBottomLevelASGltf()
 //   m_rtBuilder.buildTlas(tlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
 // }
 
+//--------------------------------------------------------------------------------------------------
+// Empty TLAS sized for every node and its proxy, with one slice of instances per swapchain image.
+// updateTopLevelAsGltf() rebuilds it in place as nodes become ready
+//
 void HelloVulkan::createTopLevelAsGltf()
+{
+    uint32_t maxInstances = 0;
+    for (const auto& node : m_gltfScene.m_nodes)
+    {
+        const LodChain& chain = m_lodChains[node.primMesh];
+        const uint32_t  proxy = chain.primMeshes[std::min(m_proxyLodLevel, chain.levelCount - 1)];
+        maxInstances += proxy != static_cast<uint32_t>(node.primMesh) ? 2 : 1;
+    }
+    m_accel.createTlas(maxInstances, getSwapChain().getImageCount(), VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+}
+
+//--------------------------------------------------------------------------------------------------
+// The full geometry of each ready node, and a proxy instance when its mesh has a coarser level,
+// recorded into the frame
+// - Primary and GI rays only see the full geometry, shadow and AO rays see it or the proxies
+//   (RAY_MASK_* in host_device.h)
+//
+void HelloVulkan::updateTopLevelAsGltf(const VkCommandBuffer& cmdBuf)
 {
     std::vector<VkAccelerationStructureInstanceKHR> tlas;
-    tlas.reserve(m_gltfScene.m_nodes.size());
-    for (auto& node : m_gltfScene.m_nodes)
+    tlas.reserve(m_gltfScene.m_nodes.size() * 2);
+    for (size_t n = 0; n < m_gltfScene.m_nodes.size(); n++)
     {
+        if (!m_nodeReady[n])
+            continue;
+        const auto&     node  = m_gltfScene.m_nodes[n];
+        const LodChain& chain = m_lodChains[node.primMesh];
+        const uint32_t  proxy = chain.primMeshes[std::min(m_proxyLodLevel, chain.levelCount - 1)];
+
         VkAccelerationStructureInstanceKHR rayInst{};
         rayInst.transform = nvvk::toTransformMatrixKHR(node.worldMatrix);
         rayInst.instanceCustomIndex = node.primMesh;
-        rayInst.accelerationStructureReference = m_rtBuilder.getBlasDeviceAddress(node.primMesh);
+        rayInst.accelerationStructureReference = m_accel.getBlasDeviceAddress(m_primBlas[node.primMesh]);
         rayInst.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-        rayInst.mask = 0xFF;
+        rayInst.mask = RAY_MASK_PRIMARY | RAY_MASK_SHADOW_FULL | (proxy == static_cast<uint32_t>(node.primMesh) ? RAY_MASK_SHADOW_PROXY : 0);
         rayInst.instanceShaderBindingTableRecordOffset = 0;
         tlas.emplace_back(rayInst);
+
+        if (proxy != static_cast<uint32_t>(node.primMesh))
+        {
+            rayInst.instanceCustomIndex = proxy;
+            rayInst.accelerationStructureReference = m_accel.getBlasDeviceAddress(m_primBlas[proxy]);
+            rayInst.mask = RAY_MASK_SHADOW_PROXY;
+            tlas.emplace_back(rayInst);
+        }
     }
-    m_rtBuilder.buildTlas(tlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+    m_accel.buildTlas(cmdBuf, tlas, getCurFrame());
 }
 
 void HelloVulkan::createRtDescriptorSet()
@@ -1075,6 +2223,13 @@ void HelloVulkan::createRtDescriptorSet()
         VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
     m_rtDescSetLayoutBind.addBinding(RtxBindings::eInRadHitD, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
         VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
+    // Sample accumulation, also read by the tile scheduling of the adaptive sampling
+    m_rtDescSetLayoutBind.addBinding(RtxBindings::eSampleSum, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
+        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT);
+    m_rtDescSetLayoutBind.addBinding(RtxBindings::eSampleSumSq, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
+        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT);
+    m_rtDescSetLayoutBind.addBinding(RtxBindings::eSampleCount, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
+        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT);
 
     m_rtDescPool = m_rtDescSetLayoutBind.createPool(m_device);
     m_rtDescSetLayout = m_rtDescSetLayoutBind.createLayout(m_device);
@@ -1085,10 +2240,7 @@ void HelloVulkan::createRtDescriptorSet()
     allocateInfo.pSetLayouts = &m_rtDescSetLayout;
     vkAllocateDescriptorSets(m_device, &allocateInfo, &m_rtDescSet);
 
-    VkAccelerationStructureKHR tlas = m_rtBuilder.getAccelerationStructure();
-    VkWriteDescriptorSetAccelerationStructureKHR descASInfo{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR };
-    descASInfo.accelerationStructureCount = 1;
-    descASInfo.pAccelerationStructures = &tlas;
+    // The TLAS and the primitive infos are written with the scene, see updateRtSceneDescriptorSet()
     VkDescriptorImageInfo imageInfo{ {}, m_offscreenColor.descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL };
     // BUFFER: ADD HERE
     VkDescriptorImageInfo posImageInfo{ {}, m_positionTexture.descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL };
@@ -1100,14 +2252,13 @@ void HelloVulkan::createRtDescriptorSet()
     VkDescriptorImageInfo nrImageInfo{ {}, m_inNormalRoughness.texture.descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL };
     VkDescriptorImageInfo vzImageInfo{ {}, m_inViewZ.texture.descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL };
     VkDescriptorImageInfo rhImageInfo{ {}, m_inDiffRadianceHitDist.texture.descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL };
-
-    VkDescriptorBufferInfo primitiveInfoDesc{ m_primInfo.buffer, 0, VK_WHOLE_SIZE };
+    VkDescriptorImageInfo sumImageInfo{ {}, m_sampleSum.descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL };
+    VkDescriptorImageInfo sumSqImageInfo{ {}, m_sampleSumSq.descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL };
+    VkDescriptorImageInfo countImageInfo{ {}, m_sampleCount.descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL };
 
 
     std::vector<VkWriteDescriptorSet> writes;
-    writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eTlas, &descASInfo));
     writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eOutImage, &imageInfo));
-    writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::ePrimLookup, &primitiveInfoDesc));
     // BUFFER: ADD HERE
     writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::ePosMap, &posImageInfo));
     writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eNormMap, &normImageInfo));
@@ -1118,6 +2269,9 @@ void HelloVulkan::createRtDescriptorSet()
     writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eInNormRough, &nrImageInfo));
     writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eInViewZ, &vzImageInfo));
     writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eInRadHitD, &rhImageInfo));
+    writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eSampleSum, &sumImageInfo));
+    writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eSampleSumSq, &sumSqImageInfo));
+    writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eSampleCount, &countImageInfo));
     vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
@@ -1134,6 +2288,9 @@ void HelloVulkan::updateRtDescriptorSet()
     VkDescriptorImageInfo nrImageInfo{ {}, m_inNormalRoughness.texture.descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL };
     VkDescriptorImageInfo vzImageInfo{ {}, m_inViewZ.texture.descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL };
     VkDescriptorImageInfo rhImageInfo{ {}, m_inDiffRadianceHitDist.texture.descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL };
+    VkDescriptorImageInfo sumImageInfo{ {}, m_sampleSum.descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL };
+    VkDescriptorImageInfo sumSqImageInfo{ {}, m_sampleSumSq.descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL };
+    VkDescriptorImageInfo countImageInfo{ {}, m_sampleCount.descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL };
 
     std::vector<VkWriteDescriptorSet> writes;
     writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eOutImage, &imageInfo));
@@ -1146,6 +2303,27 @@ void HelloVulkan::updateRtDescriptorSet()
     writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eInNormRough, &nrImageInfo));
     writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eInViewZ, &vzImageInfo));
     writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eInRadHitD, &rhImageInfo));
+    writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eSampleSum, &sumImageInfo));
+    writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eSampleSumSq, &sumSqImageInfo));
+    writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eSampleCount, &countImageInfo));
+    vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+//--------------------------------------------------------------------------------------------------
+// The TLAS and the primitive infos of the scene, once it is created. The TLAS is rebuilt in place
+// while the scene loads, its handle does not change
+//
+void HelloVulkan::updateRtSceneDescriptorSet()
+{
+    VkAccelerationStructureKHR tlas = m_accel.getTlas();
+    VkWriteDescriptorSetAccelerationStructureKHR descASInfo{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR };
+    descASInfo.accelerationStructureCount = 1;
+    descASInfo.pAccelerationStructures = &tlas;
+    VkDescriptorBufferInfo primitiveInfoDesc{ m_primInfo.buffer, 0, VK_WHOLE_SIZE };
+
+    std::vector<VkWriteDescriptorSet> writes;
+    writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::eTlas, &descASInfo));
+    writes.emplace_back(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, RtxBindings::ePrimLookup, &primitiveInfoDesc));
     vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
@@ -1423,15 +2601,22 @@ void HelloVulkan::createHybridRtPipeline()
 void HelloVulkan::pathtrace(const VkCommandBuffer& cmdBuf, const nvmath::vec4f& clearColor)
 {
     //updateFrame();
-    if (m_stopAtMaxFrames && m_pcRay.frame >= m_maxFrames)
+    // Adaptive sampling: nothing left to trace once every tile converged
+    readAdaptiveCounts();
+    if (m_pcRay.frame == 0)
+        m_accumulationTimer.reset();
+    if (isPathTraceDone())
     { 
         //m_pcRay.frame = 0;
         return;
     }
 
     m_debug.beginLabel(cmdBuf, "Path trace");
+    auto section = m_profiler.timeRecurring("Path trace", cmdBuf);
 
     m_pcRay.clearColor = clearColor;
+    m_pcRay.shadowMask = RAY_MASK_SHADOW_FULL;  // The reference keeps the full geometry
+    m_pcRay.tileAddress = nvvk::getBufferDeviceAddress(m_device, m_tileBuffer.buffer);
 
     std::vector<VkDescriptorSet> descSets{m_descSet, m_rtDescSet};
     vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, m_rtPipeline);
@@ -1457,6 +2642,9 @@ void HelloVulkan::raytraceRasterizedScene(const VkCommandBuffer& cmdBuf)
     }
 
     m_debug.beginLabel(cmdBuf, "Ray trace (hybrid)");
+    auto section = m_profiler.timeRecurring("Ray trace (hybrid)", cmdBuf);
+
+    m_pcRay.shadowMask = m_proxyShadows ? RAY_MASK_SHADOW_PROXY : RAY_MASK_SHADOW_FULL;
 
     // HYBRID: set other descriptors
     std::vector<VkDescriptorSet> descSets{m_descSet, m_rtDescSet};
@@ -1472,12 +2660,198 @@ void HelloVulkan::raytraceRasterizedScene(const VkCommandBuffer& cmdBuf)
     m_debug.endLabel(cmdBuf);
 }
 
+//--------------------------------------------------------------------------------------------------
+// Grid of the probe volume over the scene bounds, m_probeCountMax probes along the longest side and
+// the same spacing on the others
+//
+void HelloVulkan::createProbeVolume()
+{
+    const nvmath::vec3f size = m_gltfScene.m_dimensions.size;
+    const float spacing = std::max(std::max(size.x, std::max(size.y, size.z)), 1e-3f) / float(std::max(m_probeCountMax - 1, 1));
+    const auto  getCount = [&](float extent) { return std::clamp(int(std::ceil(extent / spacing)) + 1, 2, std::max(m_probeCountMax, 2)); };
+
+    m_probeVolume = {};
+    m_probeVolume.countX = getCount(size.x);
+    m_probeVolume.countY = getCount(size.y);
+    m_probeVolume.countZ = getCount(size.z);
+    const nvmath::vec3f extent = nvmath::vec3f(float(m_probeVolume.countX - 1), float(m_probeVolume.countY - 1),
+                                               float(m_probeVolume.countZ - 1)) * spacing;
+    const nvmath::vec3f origin = m_gltfScene.m_dimensions.center - extent * 0.5f;
+    m_probeVolume.origin = nvmath::vec4f(origin.x, origin.y, origin.z, spacing);
+    m_probeVolume.hysteresis = PROBE_HYSTERESIS;
+    m_probeVolume.maxDistance = 1.5f * spacing * std::sqrt(3.0f);
+
+    const VkDeviceSize probeCount = VkDeviceSize(m_probeVolume.countX) * m_probeVolume.countY * m_probeVolume.countZ;
+    const VkDeviceSize irradianceTexels = (PROBE_IRRADIANCE_TEXELS + 2) * (PROBE_IRRADIANCE_TEXELS + 2);
+    const VkDeviceSize depthTexels = (PROBE_DEPTH_TEXELS + 2) * (PROBE_DEPTH_TEXELS + 2);
+    const VkBufferUsageFlags flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    m_probeRayBuffer = m_alloc.createBuffer(probeCount * PROBE_RAYS * sizeof(ProbeRay), flags);
+    m_probeIrradianceBuffer = m_alloc.createBuffer(probeCount * irradianceTexels * sizeof(nvmath::vec4f), flags);
+    m_probeDepthBuffer = m_alloc.createBuffer(probeCount * depthTexels * sizeof(nvmath::vec2f), flags);
+    m_probeVolume.rayAddress = nvvk::getBufferDeviceAddress(m_device, m_probeRayBuffer.buffer);
+    m_probeVolume.irradianceAddress = nvvk::getBufferDeviceAddress(m_device, m_probeIrradianceBuffer.buffer);
+    m_probeVolume.depthAddress = nvvk::getBufferDeviceAddress(m_device, m_probeDepthBuffer.buffer);
+    NAME_VK(m_probeRayBuffer.buffer);
+    NAME_VK(m_probeIrradianceBuffer.buffer);
+    NAME_VK(m_probeDepthBuffer.buffer);
+
+    LOGI("Probe volume: %d x %d x %d probes, %.3f apart\n", m_probeVolume.countX, m_probeVolume.countY,
+         m_probeVolume.countZ, spacing);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Ray tracing pipeline of the probe rays, with the hit and miss shaders and the layout of the hybrid
+// one, and the compute pipeline that blends them into the maps
+//
+void HelloVulkan::createProbePipelines()
+{
+    enum StageIndices
+    {
+        eRaygen,
+        eMiss,
+        eMiss2,
+        eClosestHit,
+        eShaderGroupCount
+    };
+
+    std::array<VkPipelineShaderStageCreateInfo, eShaderGroupCount> stages{};
+    VkPipelineShaderStageCreateInfo stage{ VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
+    stage.pName = "main";
+
+    stage.module = nvvk::createShaderModule(m_device, nvh::loadFile("spv/probe_trace.rgen.spv", true, defaultSearchPaths, true));
+    stage.stage = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
+    stages[eRaygen] = stage;
+
+    stage.module = nvvk::createShaderModule(m_device, nvh::loadFile("spv/raytrace.rmiss.spv", true, defaultSearchPaths, true));
+    stage.stage = VK_SHADER_STAGE_MISS_BIT_KHR;
+    stages[eMiss] = stage;
+
+    stage.module = nvvk::createShaderModule(m_device, nvh::loadFile("spv/raytraceShadow.rmiss.spv", true, defaultSearchPaths, true));
+    stage.stage = VK_SHADER_STAGE_MISS_BIT_KHR;
+    stages[eMiss2] = stage;
+
+    stage.module = nvvk::createShaderModule(m_device, nvh::loadFile("spv/raytrace.rchit.spv", true, defaultSearchPaths, true));
+    stage.stage = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
+    stages[eClosestHit] = stage;
+
+    std::vector<VkRayTracingShaderGroupCreateInfoKHR> groups;
+    VkRayTracingShaderGroupCreateInfoKHR group{ VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR };
+    group.anyHitShader = VK_SHADER_UNUSED_KHR;
+    group.closestHitShader = VK_SHADER_UNUSED_KHR;
+    group.generalShader = VK_SHADER_UNUSED_KHR;
+    group.intersectionShader = VK_SHADER_UNUSED_KHR;
+
+    group.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR;
+    group.generalShader = eRaygen;
+    groups.push_back(group);
+
+    group.generalShader = eMiss;
+    groups.push_back(group);
+
+    group.generalShader = eMiss2;
+    groups.push_back(group);
+
+    group.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_KHR;
+    group.generalShader = VK_SHADER_UNUSED_KHR;
+    group.closestHitShader = eClosestHit;
+    groups.push_back(group);
+
+    VkRayTracingPipelineCreateInfoKHR rayPipelineInfo{ VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR };
+    rayPipelineInfo.stageCount = static_cast<uint32_t>(stages.size());
+    rayPipelineInfo.pStages = stages.data();
+    rayPipelineInfo.groupCount = static_cast<uint32_t>(groups.size());
+    rayPipelineInfo.pGroups = groups.data();
+    rayPipelineInfo.maxPipelineRayRecursionDepth = 1;  // The shadow rays are traced from the ray generation
+    rayPipelineInfo.layout = m_rtPipelineLayout2;
+    vkCreateRayTracingPipelinesKHR(m_device, {}, {}, 1, &rayPipelineInfo, nullptr, &m_probeRtPipeline);
+    m_probeSbtWrapper.create(m_probeRtPipeline, rayPipelineInfo);
+    m_debug.setObjectName(m_probeRtPipeline, "ProbeTrace");
+
+    for (auto& s : stages)
+        vkDestroyShaderModule(m_device, s.module, nullptr);
+
+    std::vector<VkDescriptorSetLayout> setLayouts = { m_descSetLayout, m_rtDescSetLayout };
+    VkPipelineLayoutCreateInfo createInfo{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+    createInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+    createInfo.pSetLayouts = setLayouts.data();
+    vkCreatePipelineLayout(m_device, &createInfo, nullptr, &m_probeUpdatePipelineLayout);
+
+    VkComputePipelineCreateInfo pipelineInfo{ VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = nvvk::createShaderModule(m_device, nvh::loadFile("spv/probe_update.comp.spv", true, defaultSearchPaths, true));
+    pipelineInfo.layout = m_probeUpdatePipelineLayout;
+    vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_probeUpdatePipeline);
+    vkDestroyShaderModule(m_device, pipelineInfo.stage.module, nullptr);
+    m_debug.setObjectName(m_probeUpdatePipeline, "ProbeUpdate");
+}
+
+//--------------------------------------------------------------------------------------------------
+// One update of the probe volume before the hybrid rays read it: PROBE_RAYS rays per probe, then
+// one workgroup per probe blends them into its maps
+//
+void HelloVulkan::updateProbeVolume(const VkCommandBuffer& cmdBuf)
+{
+    if (m_pcRay.useGI == 0 || m_pcRay.probeGI == 0 || m_probeVolume.countX == 0)
+        return;
+    if (m_stopAtMaxFrames && m_pcRay.frame >= m_maxFrames)
+        return;
+
+    m_debug.beginLabel(cmdBuf, "Probe volume");
+    auto section = m_profiler.timeRecurring("Probe volume", cmdBuf);
+
+    const uint32_t probeCount = uint32_t(m_probeVolume.countX * m_probeVolume.countY * m_probeVolume.countZ);
+    m_pcRay.shadowMask = m_proxyShadows ? RAY_MASK_SHADOW_PROXY : RAY_MASK_SHADOW_FULL;
+
+    // The maps of the previous update may still be read by the hybrid rays of the previous frame
+    VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    // The probe rays see the emissive surfaces and the environment whole, and the volume brings their
+    // light to the hits: the next event estimation there only samples the punctual lights
+    PushConstantRay pcProbe = m_pcRay;
+    pcProbe.emissiveLights    = 0;
+    pcProbe.environmentLights = 0;
+
+    std::vector<VkDescriptorSet> descSets{ m_descSet, m_rtDescSet };
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, m_probeRtPipeline);
+    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, m_rtPipelineLayout2, 0,
+        static_cast<uint32_t>(descSets.size()), descSets.data(), 0, nullptr);
+    vkCmdPushConstants(cmdBuf, m_rtPipelineLayout2,
+        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR,
+        0, sizeof(PushConstantRay), &pcProbe);
+    auto& regions = m_probeSbtWrapper.getRegions();
+    vkCmdTraceRaysKHR(cmdBuf, &regions[0], &regions[1], &regions[2], &regions[3], PROBE_RAYS, probeCount, 1);
+
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+        &barrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_probeUpdatePipeline);
+    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_probeUpdatePipelineLayout, 0,
+        static_cast<uint32_t>(descSets.size()), descSets.data(), 0, nullptr);
+    vkCmdDispatch(cmdBuf, probeCount, 1, 1);
+
+    // The maps are read by the hybrid rays of this frame and the probe rays of the next update
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 1,
+        &barrier, 0, nullptr, 0, nullptr);
+
+    m_probeVolume.updates++;
+    m_debug.endLabel(cmdBuf);
+}
+
 void HelloVulkan::populateCommonSettings(nrd::CommonSettings& commonSettings)
 {
     size_t matSize = 16 * sizeof(float);
-    const float    aspectRatio = m_size.width / static_cast<float>(m_size.height);
     const auto& view = CameraManip.getMatrix();
-    const auto& proj = nvmath::perspectiveVK(CameraManip.getFov(), aspectRatio, 0.1f, 1000.0f);
+    const auto  proj = getProjection();
     memcpy(commonSettings.viewToClipMatrixPrev, commonSettings.viewToClipMatrix, matSize);
     memcpy(commonSettings.viewToClipMatrix, proj.get_value(), matSize);
     
@@ -1501,6 +2875,10 @@ void HelloVulkan::populateReblurSettings(nrd::ReblurSettings& reblurSettings)
 void HelloVulkan::resetFrame()
 {
     m_pcRay.frame = -1;
+    m_activeTiles = ~0u;
+    m_averageSamples = 0.0f;
+    m_convergedTime = -1.0f;
+    std::fill(m_adaptiveCountFrames.begin(), m_adaptiveCountFrames.end(), -1);
 }
 
 void HelloVulkan::updateFrame()
@@ -1519,3 +2897,199 @@ void HelloVulkan::updateFrame()
     }
     m_pcRay.frame++;
 }
+
+// Samples per pixel in the accumulated image, pathtrace() stops at m_maxFrames. With adaptive
+// sampling, the average over the tiles of the last counts read back. The hybrid traces one per frame
+int HelloVulkan::getAccumulatedSamples() const
+{
+    const bool pathTracing = m_pcPost.rtMode != 0;
+    if (pathTracing && m_pcRay.adaptiveSampling != 0 && m_averageSamples > 0.0f)
+        return static_cast<int>(m_averageSamples + 0.5f);
+    int frames = m_pcRay.frame + 1;
+    if (m_stopAtMaxFrames)
+        frames = std::min(frames, m_maxFrames);
+    return std::max(frames, 0) * (pathTracing ? m_pcRay.samples : 1);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Compute pipeline of the tile scheduling, with the descriptor sets of the path tracer, and the
+// host visible counters it writes
+//
+void HelloVulkan::createAdaptivePipeline()
+{
+    VkPushConstantRange pushConstantRange = { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantAdaptive) };
+    std::vector<VkDescriptorSetLayout> setLayouts = { m_descSetLayout, m_rtDescSetLayout };
+
+    VkPipelineLayoutCreateInfo createInfo{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+    createInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+    createInfo.pSetLayouts = setLayouts.data();
+    createInfo.pushConstantRangeCount = 1;
+    createInfo.pPushConstantRanges = &pushConstantRange;
+    vkCreatePipelineLayout(m_device, &createInfo, nullptr, &m_adaptivePipelineLayout);
+
+    VkComputePipelineCreateInfo pipelineInfo{ VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = nvvk::createShaderModule(m_device, nvh::loadFile("spv/adaptive_sampling.comp.spv", true, defaultSearchPaths, true));
+    pipelineInfo.layout = m_adaptivePipelineLayout;
+    vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_adaptivePipeline);
+    vkDestroyShaderModule(m_device, pipelineInfo.stage.module, nullptr);
+    m_debug.setObjectName(m_adaptivePipeline, "AdaptiveSampling");
+
+    // One slice per swapchain image, read once its fence is waited
+    const uint32_t frameCount = getSwapChain().getImageCount();
+    m_adaptiveCountBuffer = m_alloc.createBuffer(frameCount * sizeof(AdaptiveCounts),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    m_adaptiveCountData = static_cast<AdaptiveCounts*>(m_alloc.map(m_adaptiveCountBuffer));
+    m_adaptiveCountFrames.assign(frameCount, -1);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Tile scheduling after the path tracing of a frame: the error of each tile from the samples
+// accumulated so far sets its samples in the next frame
+// - The counters of this frame go to the slice of the swapchain image, readAdaptiveCounts() reads
+//   them the next time the image comes around
+//
+void HelloVulkan::updateAdaptiveSampling(const VkCommandBuffer& cmdBuf)
+{
+    if (m_pcRay.adaptiveSampling == 0 || isPathTraceDone())
+        return;
+
+    m_debug.beginLabel(cmdBuf, "Adaptive sampling");
+    auto section = m_profiler.timeRecurring("Adaptive sampling", cmdBuf);
+
+    const uint32_t     slice  = getCurFrame();
+    const VkDeviceSize offset = slice * sizeof(AdaptiveCounts);
+
+    VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+    vkCmdFillBuffer(cmdBuf, m_adaptiveCountBuffer.buffer, offset, sizeof(AdaptiveCounts), 0);
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    PushConstantAdaptive pcAdaptive{};
+    pcAdaptive.tileAddress = nvvk::getBufferDeviceAddress(m_device, m_tileBuffer.buffer);
+    pcAdaptive.countAddress = nvvk::getBufferDeviceAddress(m_device, m_adaptiveCountBuffer.buffer) + offset;
+    pcAdaptive.threshold = m_adaptiveThreshold;
+    pcAdaptive.minSamples = static_cast<uint32_t>(std::max(m_adaptiveMinSamples, 2));
+    pcAdaptive.maxSamples = static_cast<uint32_t>(std::max(m_adaptiveMaxSamples, m_adaptiveMinSamples));
+    pcAdaptive.samples = static_cast<uint32_t>(m_pcRay.samples);
+    pcAdaptive.tileCountX = m_tileCountX;
+
+    std::vector<VkDescriptorSet> descSets{ m_descSet, m_rtDescSet };
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_adaptivePipeline);
+    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_adaptivePipelineLayout, 0,
+        static_cast<uint32_t>(descSets.size()), descSets.data(), 0, nullptr);
+    vkCmdPushConstants(cmdBuf, m_adaptivePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantAdaptive), &pcAdaptive);
+    vkCmdDispatch(cmdBuf, m_tileCountX, m_tileCountY, 1);
+
+    // The tiles are read by the next frame's rays, the counters by the host
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_HOST_BIT,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    m_adaptiveCountFrames[slice] = m_pcRay.frame;
+    m_debug.endLabel(cmdBuf);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Counters of the frame last rendered to the current swapchain image, after prepareFrame() waited
+// its fence. The convergence is seen here, up to a swapchain of frames after the GPU
+//
+void HelloVulkan::readAdaptiveCounts()
+{
+    if (m_adaptiveCountFrames.empty())
+        return;
+    const uint32_t slice = getCurFrame();
+    const int      frame = m_adaptiveCountFrames[slice];
+    if (frame < 0)
+        return;
+    m_adaptiveCountFrames[slice] = -1;
+
+    const AdaptiveCounts& counts = m_adaptiveCountData[slice];
+    m_activeTiles = counts.activeTiles;
+    m_averageSamples = static_cast<float>(counts.sampleSum) / std::max(m_tileCountX * m_tileCountY, 1u);
+    if (m_activeTiles == 0 && m_convergedTime < 0.0f)
+    {
+        m_convergedTime = static_cast<float>(m_accumulationTimer.elapsed());
+        m_convergedFrames = frame + 1;
+        LOGI("Converged in %.1f ms, %d frames, %.1f samples per pixel on average (threshold %.3f)\n", m_convergedTime,
+             m_convergedFrames, m_averageSamples, m_adaptiveThreshold);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Copies the accumulated image to the host: the offscreen color image, radiance of the path tracer,
+// or the ray traced effects of the hybrid (direct and indirect light, visibility in alpha)
+//
+void HelloVulkan::readOffscreenImage(std::vector<nvmath::vec4f>& pixels)
+{
+    vkDeviceWaitIdle(m_device);
+
+    const VkDeviceSize size    = VkDeviceSize(m_size.width) * m_size.height * sizeof(nvmath::vec4f);
+    nvvk::Buffer       staging = m_alloc.createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    nvvk::CommandPool cmdPool(m_device, m_graphicsQueueIndex);
+    VkCommandBuffer   cmdBuf = cmdPool.createCommandBuffer();
+    VkBufferImageCopy region{};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageExtent      = {m_size.width, m_size.height, 1};
+    const VkImage     source = m_pcPost.rtMode != 0 ? m_offscreenColor.image : m_accumulatedTexture.image;
+    vkCmdCopyImageToBuffer(cmdBuf, source, VK_IMAGE_LAYOUT_GENERAL, staging.buffer, 1, &region);
+    cmdPool.submitAndWait(cmdBuf);
+
+    pixels.resize(size_t(m_size.width) * m_size.height);
+    memcpy(pixels.data(), m_alloc.map(staging), size);
+    m_alloc.unmap(staging);
+    m_alloc.destroy(staging);
+}
+
+void HelloVulkan::storeReferenceImage()
+{
+    readOffscreenImage(m_referenceImage);
+    m_referenceSamples = getAccumulatedSamples();
+    m_referenceMse     = -1.0;
+    LOGI("Reference image stored, %d samples per pixel\n", m_referenceSamples);
+}
+
+void HelloVulkan::compareToReference()
+{
+    std::vector<nvmath::vec4f> pixels;
+    readOffscreenImage(pixels);
+    if (pixels.size() != m_referenceImage.size())
+    {
+        LOGW("The reference image was stored at another size\n");
+        return;
+    }
+    m_referenceMse    = computeMse(pixels, m_referenceImage);
+    m_comparedSamples = getAccumulatedSamples();
+
+    // GPU time of the accumulated frames, from the average of the last ones
+    const bool               pathTracing = m_pcPost.rtMode != 0;
+    nvh::Profiler::TimerInfo info;
+    m_comparedTime = 0.0;
+    if (m_profiler.getTimerInfo(pathTracing ? "Path trace" : "Ray trace (hybrid)", info))
+        m_comparedTime = info.gpu.average / 1000.0 * m_comparedSamples / (pathTracing ? std::max(m_pcRay.samples, 1) : 1);
+    // The probe updates are part of the cost of the hybrid frames that read them
+    if (!pathTracing && m_pcRay.useGI != 0 && m_pcRay.probeGI != 0 && m_profiler.getTimerInfo("Probe volume", info))
+        m_comparedTime += info.gpu.average / 1000.0 * m_comparedSamples;
+    if (pathTracing)
+        LOGI("MSE %.4e at %d samples per pixel in %.1f ms, MSE x time %.4e (emissive lights %s, environment lights %s, "
+             "roulette from depth %d), reference %d samples per pixel\n",
+             m_referenceMse, m_comparedSamples, m_comparedTime, m_referenceMse * m_comparedTime, m_pcRay.emissiveLights ? "on" : "off",
+             m_pcRay.environmentLights ? "on" : "off", m_pcRay.rouletteDepth, m_referenceSamples);
+    else
+        LOGI("Hybrid MSE %.4e after %d frames in %.1f ms, MSE x time %.4e (ReSTIR direct %s, GI %s, ReSTIR GI %s, probes %s), "
+             "reference %d frames\n",
+             m_referenceMse, m_comparedSamples, m_comparedTime, m_referenceMse * m_comparedTime, m_pcRay.restirDI ? "on" : "off",
+             m_pcRay.useGI ? "on" : "off", m_pcRay.restirGI ? "on" : "off",
+             m_pcRay.probeGI ? "on" : "off", m_referenceSamples);
+}
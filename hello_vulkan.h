@@ -19,16 +19,31 @@
 
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <thread>
+
 #include "nvvkhl/appbase_vk.hpp"
 #include "nvvk/debug_util_vk.hpp"
 #include "nvvk/descriptorsets_vk.hpp"
 #include "nvvk/memallocator_dma_vk.hpp"
+#include "nvvk/profiler_vk.hpp"
 #include "nvvk/resourceallocator_vk.hpp"
 #include "shaders/host_device.h"
 
 #include "nvh/gltfscene.hpp"
+#include "nvh/timesampler.hpp"
 #include "nvvk/raytraceKHR_vk.hpp"
 #include "nvvk/sbtwrapper_vk.hpp"
+#include "accel_builder.h"
+#include "frustum_culling.h"
+#include "mesh_simplifier.h"
+#include "meshlet_builder.h"
+#include "scene_cache.h"
+#include "texture_decoder.h"
+#include "texture_streamer.h"
+#include "texture_utils.h"
+#include "upload_service.h"
 
 #include <NRI.h>
 #include <NRIDescs.h>
@@ -59,24 +74,51 @@ public:
   void setup(const VkInstance& instance, const VkDevice& device, const VkPhysicalDevice& physicalDevice, uint32_t queueFamily) override;
   void createDescriptorSetLayout();
   void createGraphicsPipeline();
-  void loadGltfMaterials(const VkCommandBuffer& cmdBuf, VkBufferUsageFlags flags);
-  void loadGltfLights(const VkCommandBuffer& cmdBuf, VkBufferUsageFlags flags);
-  void loadGltfScene(const std::string& filename);
+  void loadGltfMaterials();
+  void loadGltfLights();
+  void startSceneLoad(const std::string& filename);
+  void updateSceneLoad();
+  void updateSceneFrame(const VkCommandBuffer& cmdBuf);
+  void destroyScene();
+  void switchScene(const std::string& filename);
+  bool isSceneCreated() const { return m_loadStage == eLoadStreaming || m_loadStage == eLoadDone; }
+  const char* getLoadStageName() const;
+  void createGeometryBuffers();
+  void createInstances();
   void updateDescriptorSet();
+  void updateTextureDescriptors();
   void createUniformBuffer();
-  void createTextureImages(const VkCommandBuffer& cmdBuf, tinygltf::Model& gltfModel);
+  void createDefaultTexture();
+  void createEnvironment(const std::string& filename);
+  void createSampler();
   void updateUniformBuffer(const VkCommandBuffer& cmdBuf);
+  nvmath::mat4f getProjection() const;
+  nvmath::mat4f getViewProj() const;
   void onResize(int /*w*/, int /*h*/) override;
   void destroyResources();
-  void rasterizeGltf(const VkCommandBuffer& cmdBuf);
+  void rasterizeGltf(const VkCommandBuffer& cmdBuf, uint32_t phase = 0);
+  void createClusterCulling();
+  void createCullPipeline();
+  void updateHizDescriptorSet();
+  void cullScene(const VkCommandBuffer& cmdBuf);
+  void cullClusters(const VkCommandBuffer& cmdBuf, const nvmath::mat4f& viewProj);
+  void buildHiz(const VkCommandBuffer& cmdBuf);
+  void cullOccludedClusters(const VkCommandBuffer& cmdBuf);
+  bool useOcclusionCulling() const { return m_occlusionCulling && m_clusterCulling && !m_cullNodes.empty(); }
+  uint32_t selectLod(const CullNode& node, const nvmath::vec3f& eye) const;
 
 
-  // Information pushed at each draw call
+  // Information pushed once per raster pass
   PushConstantRaster m_pcRaster{
       {1},                // Identity matrix
-      {1},                // Identity matrix
-      0,                  // instance Id
-      0                   // material id  
+      0                   // lights count
+  };
+
+  // Range of an indirect buffer drawn with one index type
+  struct DrawList
+  {
+      uint32_t offset{0};  // In commands
+      uint32_t count{0};   // Maximum count when drawn with a count buffer
   };
 
   // Scene info and buffers
@@ -90,30 +132,192 @@ public:
   nvvk::Buffer   m_primInfo;
   nvvk::Buffer   m_sceneDesc;
   nvvk::Buffer   m_lightBuffer;
+  nvvk::Buffer   m_blasTransforms;  // Position dequantization of each primitive mesh, for the BLAS builds
+
+  // Per-node raster data, computed at load. Without cluster culling, each node is drawn whole by
+  // one command of m_nodeDrawBuffer
+  std::vector<InstanceInfo> m_instances;
+  nvvk::Buffer              m_instanceBuffer;
+  nvvk::Buffer              m_nodeDrawBuffer;
+  DrawList                  m_nodeDrawLists[2];  // DRAW_LIST_INDEX16, DRAW_LIST_INDEX32
+
+  // CPU frustum culling of the nodes, see frustum_culling.h
+  bool                                      m_nodeCulling{true};
+  bool                                      m_frameNodeList{false};  // This frame draws m_visibleNodes, culled or not all ready
+  BoundsSoA                                 m_nodeBounds;  // World space
+  std::vector<uint32_t>                     m_visibleNodes;
+  float                                     m_nodeCullTime{0.0f};  // ms
+  nvvk::Buffer                              m_frameDrawBuffer;     // Host visible, a slice per swapchain image
+  uint8_t*                                  m_frameDrawData{nullptr};
+  VkDeviceSize                              m_frameDrawStride{0};
+  VkDeviceSize                              m_frameDrawOffset{0};  // Slice of the current frame
+  DrawList                                  m_frameNodeDrawLists[2];
+
+  // Vertex layout, see vertex_compression.h
+  bool                      m_compressVertices{false};   // Set before createGraphicsPipeline()
+  bool                      m_quantizePositions{false};  // Also quantize the positions when compressing
+  uint32_t                  m_vertexFlags{0};            // VERTEX_COMPRESSED | VERTEX_QUANTIZED_POSITIONS
+  std::vector<PrimMeshInfo> m_primMeshInfos;             // Index size, first index and dequantization per primitive mesh
+  // Known before the scene is loaded, so the pipelines can be created first
+  uint32_t getVertexFlags() const { return m_compressVertices ? VERTEX_COMPRESSED | (m_quantizePositions ? VERTEX_QUANTIZED_POSITIONS : 0) : 0; }
+
+  // Import-time mesh reordering, see mesh_optimizer.h. Set before startSceneLoad()
+  bool m_optimizeMeshes{true};
+  bool m_optimizeOverdraw{false};
+
+  // LOD levels of the primitive meshes, see mesh_simplifier.h. m_generateLods and m_proxyLodLevel
+  // are set before startSceneLoad()
+  bool                  m_generateLods{true};
+  std::vector<LodChain> m_lodChains;           // Of each primitive mesh referenced by the nodes
+  std::vector<MeshLod>  m_meshLods;            // Levels of each chain, in order
+  std::vector<uint32_t> m_firstMeshLod;        // First MeshLod of each chain
+  nvvk::Buffer          m_meshLodBuffer;
+  bool                  m_lodSelection{true};  // Otherwise level 0 is always drawn
+  float                 m_lodPixelError{1.0f};
+  float                 m_lodPixelsPerRadian{1.0f};  // Of the current frame
+  uint32_t              m_proxyLodLevel{2};          // Level traced by shadow and AO rays
+  bool                  m_proxyShadows{true};        // Hybrid shadow and AO rays trace the proxies
+  std::vector<uint32_t> m_primBlas;                  // BLAS of each primitive mesh, ~0u without one
+  std::vector<uint32_t> m_visibleLods;               // MeshLod of each visible node, CPU node culling
+
+  // Cluster culling of the raster pass, see meshlet_builder.h
+  bool                      m_clusterCulling{true};
+  uint32_t                  m_cullFlags{CULL_FRUSTUM};  // CULL_BACKFACE drops back faces the pipeline would draw
+  std::vector<MeshletRange> m_meshletRanges;            // Meshlets of each primitive mesh
+  std::vector<CullNode>     m_cullNodes;                // LOD levels and draw list of each node
+  uint32_t                  m_meshletCount{0};
+  uint32_t                  m_drawCount{0};             // Meshlet instances, the capacity of the draw lists
+  DrawList                  m_meshletDrawLists[2];      // DRAW_LIST_INDEX16, DRAW_LIST_INDEX32
+  nvvk::Buffer              m_meshletBuffer;
+  nvvk::Buffer              m_cullNodeBuffer;
+  nvvk::Buffer              m_drawBuffer;           // VkDrawIndexedIndirectCommand, the lists of both phases
+  nvvk::Buffer              m_drawCountBuffer;      // CullCounts
+  nvvk::Buffer              m_cullUniformBuffer;    // CullUniforms
+  nvvk::Buffer              m_occludedBuffer;       // Meshlet instances left to the second phase
+  VkPipelineLayout          m_cullPipelineLayout{VK_NULL_HANDLE};
+  VkPipeline                m_cullPipeline{VK_NULL_HANDLE};
+
+  // Two-phase occlusion culling: the meshlets hidden by the previous frame's Hi-Z pyramid are
+  // tested again against the pyramid of what the first phase drew, and drawn in a second pass
+  bool                        m_occlusionCulling{true};
+  nvvk::Texture               m_hiz;          // Farthest depth, R32, size of the depth buffer at mip 0
+  uint32_t                    m_hizLevels{0};
+  std::vector<VkImageView>    m_hizMipViews;  // Storage view of each mip
+  bool                        m_hizHistory{false};  // m_hiz holds a frame seen from m_hizViewProj
+  nvmath::mat4f               m_hizViewProj{1};
+  nvmath::mat4f               m_cullViewProj{1};    // Camera of the current frame's culling
+  nvvk::DescriptorSetBindings m_hizDescSetLayoutBind;
+  VkDescriptorPool            m_hizDescPool{VK_NULL_HANDLE};
+  VkDescriptorSetLayout       m_hizDescSetLayout{VK_NULL_HANDLE};
+  VkDescriptorSet             m_hizDescSet{VK_NULL_HANDLE};
+  VkPipelineLayout            m_hizPipelineLayout{VK_NULL_HANDLE};
+  VkPipeline                  m_hizPipeline{VK_NULL_HANDLE};
+
+  // Shading data uploaded to the GPU, kept on the host to be written to the scene cache
+  std::vector<GltfPBRMaterial> m_pbrMaterials;
+  std::vector<GltfLight>       m_lights;
+  bool                         m_useSceneCache{true};       // Load from / write to <scene>.vkcache
+  bool                         m_refreshSceneCache{false};  // The next load imports the glTF and rewrites the cache
+
+  // Emissive triangles sampled by the path tracer next to the punctual lights (light_sampling.h),
+  // built on the load thread
+  std::vector<EmissiveTriangle> m_emissiveTriangles;
+  nvvk::Buffer                  m_emissiveBuffer;
+  float                         m_emissivePower{0.0f};  // Sum of luminance times area
+
+  // Light BVH over m_lights for the selection of the punctual light (light_bvh.h), built on the
+  // load thread
+  std::vector<LightBvhNode> m_lightBvh;
+  nvvk::Buffer              m_lightBvhBuffer;
+  // Alias table over the power of m_lights (alias_table.h)
+  std::vector<AliasEntry> m_lightAliasTable;
+  nvvk::Buffer            m_lightAliasBuffer;
+
+  // Background scene loading: the import runs on its own thread while the render loop keeps
+  // running, then updateSceneLoad() creates the GPU scene and streams the BLASes and textures in
+  // at the start of each frame, within the budgets below
+  enum LoadStage : uint32_t
+  {
+      eLoadIdle,
+      eLoadImporting,  // On m_load->thread
+      eLoadStreaming,  // Buffers created, BLASes and textures arriving
+      eLoadDone,
+  };
+  struct SceneLoad
+  {
+      std::string              filename;
+      uint32_t                 importFlags{0};
+      bool                     refreshCache{false};
+      bool                     warm{false};
+      SceneCache               cache;    // Warm loads stream the textures from its mapping
+      TextureDecoder           decoder;  // Cold loads stream the textures as they are decoded
+      std::vector<TextureView> images;   // Of the cache
+      std::vector<int32_t>     textureSources;
+      size_t                   imageCount{0};
+      std::atomic<bool>        imported{false};  // The scene can be read by the render loop
+      std::atomic<bool>        finished{false};  // The thread is done, the cache written
+      std::thread              thread;
+  };
+  void importScene(SceneLoad& load);
+  void createSceneResources();
+  bool updateReadyNodes();
+
+  std::unique_ptr<SceneLoad> m_load;
+  LoadStage                  m_loadStage{eLoadIdle};
+  nvh::Stopwatch             m_loadTimer;
+  float                      m_timeToFirstFrame{-1.0f};  // ms from startSceneLoad() to the first frame showing geometry
+  float                      m_fullLoadTime{-1.0f};      // ms until every BLAS and mip is on the GPU
+  float                      m_unloadTime{0.0f};         // ms switchScene() took to free the previous scene
+  uint64_t                   m_blasTrianglesPerFrame{1000000};
+  uint32_t                   m_textureUploadMBPerFrame{16};
+  uint32_t                   m_maxTextures{1024};  // Size of the texture binding, set before createDescriptorSetLayout()
+  std::vector<uint8_t>       m_nodeReady;          // The BLASes of the node are built, it is drawn and traced
+  uint32_t                   m_readyNodeCount{0};
+  uint64_t                   m_textureUploadValue{0};  // Upload batch of the mips not yet in the descriptors
+  bool                       m_texturesPending{false};  // The streamer views changed since the descriptors were written
+
+  // Changes of the load that updateSceneFrame() applies to the frames
+  std::vector<VkDescriptorImageInfo> m_textureDescriptors;    // Textures with their mips done on the GPU
+  std::vector<uint8_t>               m_textureSetDirty;       // The scene set of the frame lacks m_textureDescriptors
+  size_t                             m_unboundViewCount{0};   // Retired streamer views no longer in m_textureDescriptors
+  bool                               m_tlasDirty{false};      // Nodes became ready, the next frame rebuilds the TLAS
 
   // Graphic pipeline
-  VkPipelineLayout            m_pipelineLayout;
-  VkPipeline                  m_graphicsPipeline;
-  nvvk::DescriptorSetBindings m_descSetLayoutBind;
-  VkDescriptorPool            m_descPool;
-  VkDescriptorSetLayout       m_descSetLayout;
-  VkDescriptorSet             m_descSet;
+  VkPipelineLayout             m_pipelineLayout;
+  VkPipeline                   m_graphicsPipeline;
+  nvvk::DescriptorSetBindings  m_descSetLayoutBind;
+  VkDescriptorPool             m_descPool;
+  VkDescriptorSetLayout        m_descSetLayout;
+  VkDescriptorSet              m_descSet;   // The one of the current frame, see updateSceneFrame()
+  std::vector<VkDescriptorSet> m_descSets;  // One per swapchain image
 
   nvvk::Buffer m_bGlobals;  // Device-Host of the camera matrices
   nvvk::Buffer m_bObjDesc;  // Device buffer of the OBJ descriptions
 
-  std::vector<nvvk::Texture> m_textures;  // vector of all textures of the scene
+  TextureStreamer m_textureStreamer;  // Images of the scene textures
+  nvvk::Texture   m_defaultTexture;   // White, bound to the textures without a resident image
+
+  // Environment map of the path tracer (environment_map.h), a black texel without one
+  nvvk::Texture m_environmentTexture;
+  nvvk::Buffer  m_environmentAliasBuffer;    // AliasEntry per texel, one dummy entry when black
+  uint32_t      m_environmentWidth{0};       // 0 without environment map
+  uint32_t      m_environmentHeight{0};
+  uint32_t      m_environmentAliasCount{0};  // 0 when not sampled
+
+  nvvk::Buffer m_samplerBuffer;  // Sobol direction numbers and blue-noise tile (sampler.h)
 
   // Ray tracing
   void initRayTracing();
   // auto objectToVkGeometryKHR(const ObjModel& model);
-  auto primitiveToGeometry(const nvh::GltfPrimMesh& prim);
+  auto primitiveToGeometry(const nvh::GltfPrimMesh& prim, uint32_t primIndex);
   // void createBottomLevelAS();
   void createBottomLevelASGltf();
   // void createTopLevelAs();
   void createTopLevelAsGltf();
+  void updateTopLevelAsGltf(const VkCommandBuffer& cmdBuf);
   void createRtDescriptorSet();
   void updateRtDescriptorSet();
+  void updateRtSceneDescriptorSet();
   void createRtPipeline();
   void createHybridRtPipeline();
   // void createRtShaderBindingTable();
@@ -126,9 +330,73 @@ public:
 
   void resetFrame();
   void updateFrame();
+  int  getAccumulatedSamples() const;
+
+  // Adaptive sampling of the path tracer: the samples of each pixel are accumulated in sum, sum of
+  // squares and count images, and after each frame adaptive_sampling.comp estimates the error of
+  // every tile and sets its samples for the next one. Converged tiles are no longer traced, the
+  // path tracer stops once all are
+  void createAdaptivePipeline();
+  void updateAdaptiveSampling(const VkCommandBuffer& cmdBuf);
+  void readAdaptiveCounts();
+  bool isConverged() const { return m_pcRay.adaptiveSampling != 0 && m_activeTiles == 0; }
+  bool isPathTraceDone() const { return (m_stopAtMaxFrames && m_pcRay.frame >= m_maxFrames) || isConverged(); }
+  float            m_adaptiveThreshold{0.01f};    // Relative standard error of a converged tile
+  int              m_adaptiveMinSamples{16};      // Per pixel before a tile can converge
+  int              m_adaptiveMaxSamples{4096};    // Per pixel, where a tile stops even above the threshold
+  nvvk::Texture    m_sampleSum;                   // RGB sum of the samples
+  nvvk::Texture    m_sampleSumSq;                 // RGB sum of their squares
+  nvvk::Texture    m_sampleCount;                 // R32_UINT
+  nvvk::Buffer     m_tileBuffer;                  // AdaptiveTile, the size of the image in tiles
+  uint32_t         m_tileCountX{0};
+  uint32_t         m_tileCountY{0};
+  nvvk::Buffer     m_adaptiveCountBuffer;         // Host visible, AdaptiveCounts per swapchain image
+  AdaptiveCounts*  m_adaptiveCountData{nullptr};
+  std::vector<int> m_adaptiveCountFrames;         // Accumulated frame whose counts each slice holds, -1 when none
+  uint32_t         m_activeTiles{~0u};            // Of the last counts read, ~0u before any
+  float            m_averageSamples{0.0f};        // Samples per pixel, average over the tiles
+  float            m_convergedTime{-1.0f};        // ms from the first accumulated frame until all tiles converged
+  int              m_convergedFrames{0};
+  nvh::Stopwatch   m_accumulationTimer;           // Since the first accumulated frame
+  VkPipelineLayout m_adaptivePipelineLayout{VK_NULL_HANDLE};
+  VkPipeline       m_adaptivePipeline{VK_NULL_HANDLE};
+
+  // ReSTIR direct and indirect lighting of the hybrid renderer, see shaders/restir.glsl and
+  // shaders/restir_gi.glsl
+  nvvk::Buffer  m_restirBuffer;        // RestirReservoir per pixel, of this frame then of the previous one
+  nvvk::Buffer  m_restirGIBuffer;      // RestirGIReservoir per pixel, the same for ReSTIR GI
+  uint32_t      m_restirFrame{0};      // Frames since the buffers were cleared, its parity picks the halves
+  nvmath::mat4f m_prevViewProj;        // Of the previous frame, to reproject its reservoirs
+  bool          m_restirReset{false};  // Clears the reservoirs left by the frames ReSTIR was off
+
+  // Probe volume of the hybrid GI, see shaders/probe_volume.glsl. Each update traces PROBE_RAYS
+  // rays per probe with probe_trace.rgen, then probe_update.comp blends them into the maps
+  void createProbeVolume();
+  void createProbePipelines();
+  void updateProbeVolume(const VkCommandBuffer& cmdBuf);
+  int              m_probeCountMax{16};                // Probes along the longest side of the scene bounds
+  ProbeVolume      m_probeVolume{};                    // Without the ray rotation, set per update
+  nvvk::Buffer     m_probeRayBuffer;                   // ProbeRay, PROBE_RAYS per probe
+  nvvk::Buffer     m_probeIrradianceBuffer;            // Irradiance maps, with their border
+  nvvk::Buffer     m_probeDepthBuffer;                 // Depth moment maps, with their border
+  VkPipeline       m_probeRtPipeline{VK_NULL_HANDLE};  // Layout of the hybrid pipeline
+  nvvk::SBTWrapper m_probeSbtWrapper;
+  VkPipelineLayout m_probeUpdatePipelineLayout{VK_NULL_HANDLE};
+  VkPipeline       m_probeUpdatePipeline{VK_NULL_HANDLE};
+
+  // Noise of the path tracer: the accumulated image is read back and compared to a stored
+  // reference, usually rendered with many more samples
+  void readOffscreenImage(std::vector<nvmath::vec4f>& pixels);
+  void storeReferenceImage();
+  void compareToReference();
+  std::vector<nvmath::vec4f> m_referenceImage;
+  int                        m_referenceSamples{0};  // Samples per pixel of the reference
+  double                     m_referenceMse{-1.0};   // Of the last comparison, negative before any
+  int                        m_comparedSamples{0};
+  double                     m_comparedTime{0.0};  // Estimated GPU ms of path tracing of the compared image
 
   VkPhysicalDeviceRayTracingPipelinePropertiesKHR m_rtProperties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR};
-  nvvk::RaytracingBuilderKHR  m_rtBuilder;
+  AccelBuilder                m_accel;
 
   nvvk::DescriptorSetBindings m_rtDescSetLayoutBind;
   VkDescriptorPool            m_rtDescPool;
@@ -158,6 +426,9 @@ public:
 
   nvvk::ResourceAllocatorDma m_alloc;  // Allocator for buffer, images, acceleration structures
   nvvk::DebugUtil            m_debug;  // Utility to name objects
+  UploadService              m_upload;  // Staging ring for all scene uploads
+  nvvk::ProfilerVK           m_profiler;  // GPU times of the render passes, shown in the UI
+  uint32_t                   m_stagingBudgetMB{256};  // Size of the staging ring, set before setup()
 
 
   // #Post - Draw the rendered image on a quad using a tonemapper
@@ -173,6 +444,8 @@ public:
       int rtMode;
       int viewAccumulated;
       int useGI;
+      int viewSampleCount;  // Heatmap of the samples per pixel of the path tracer
+      float maxSampleCount;  // Top of the heatmap scale
   };
 
   PushConstantPost m_pcPost;
@@ -184,6 +457,7 @@ public:
   VkPipeline                  m_postPipeline{VK_NULL_HANDLE};
   VkPipelineLayout            m_postPipelineLayout{VK_NULL_HANDLE};
   VkRenderPass                m_offscreenRenderPass{VK_NULL_HANDLE};
+  VkRenderPass                m_offscreenLoadRenderPass{VK_NULL_HANDLE};  // Keeps the attachments, for the second raster phase
   VkFramebuffer               m_offscreenFramebuffer{VK_NULL_HANDLE};
   nvvk::Texture               m_offscreenColor;
   nvvk::Texture               m_offscreenDepth;
@@ -0,0 +1,269 @@
+#include "image_metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+double computeMse(const std::vector<nvmath::vec4f>& image, const std::vector<nvmath::vec4f>& reference)
+{
+    const size_t count = std::min(image.size(), reference.size());
+    double       sum   = 0.0;
+    size_t       used  = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        double error = 0.0;
+        for (int c = 0; c < 3; c++)
+        {
+            const double d = double(image[i][c]) - double(reference[i][c]);
+            error += d * d;
+        }
+        if (!std::isfinite(error))
+            continue;
+        sum += error / 3.0;
+        used++;
+    }
+    return used > 0 ? sum / used : 0.0;
+}
+
+double computeRelativeRmse(const std::vector<nvmath::vec4f>& image, const std::vector<nvmath::vec4f>& reference)
+{
+    const size_t count = std::min(image.size(), reference.size());
+    double       sum   = 0.0;
+    size_t       used  = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        double error = 0.0;
+        for (int c = 0; c < 3; c++)
+        {
+            const double d = double(image[i][c]) - double(reference[i][c]);
+            error += d * d / (double(reference[i][c]) * reference[i][c] + 0.01);
+        }
+        if (!std::isfinite(error))
+            continue;
+        sum += error / 3.0;
+        used++;
+    }
+    return used > 0 ? std::sqrt(sum / used) : 0.0;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Color spaces of the FLIP error, linear sRGB primaries and the D65 white point
+//
+static const nvmath::vec3f kWhiteXyz(0.950428545f, 1.0f, 1.088900371f);
+
+static nvmath::vec3f linearRgbToXyz(const nvmath::vec3f& c)
+{
+    return nvmath::vec3f(0.4124564f * c.x + 0.3575761f * c.y + 0.1804375f * c.z,
+                         0.2126729f * c.x + 0.7151522f * c.y + 0.0721750f * c.z,
+                         0.0193339f * c.x + 0.1191920f * c.y + 0.9503041f * c.z);
+}
+
+static nvmath::vec3f xyzToLinearRgb(const nvmath::vec3f& c)
+{
+    return nvmath::vec3f(3.2404542f * c.x - 1.5371385f * c.y - 0.4985314f * c.z,
+                         -0.9692660f * c.x + 1.8760108f * c.y + 0.0415560f * c.z,
+                         0.0556434f * c.x - 0.2040259f * c.y + 1.0572252f * c.z);
+}
+
+static nvmath::vec3f xyzToYCxCz(const nvmath::vec3f& c)
+{
+    const float x = c.x / kWhiteXyz.x;
+    const float y = c.y / kWhiteXyz.y;
+    const float z = c.z / kWhiteXyz.z;
+    return nvmath::vec3f(116.0f * y - 16.0f, 500.0f * (x - y), 200.0f * (y - z));
+}
+
+static nvmath::vec3f yCxCzToXyz(const nvmath::vec3f& c)
+{
+    const float y = (c.x + 16.0f) / 116.0f;
+    const float x = y + c.y / 500.0f;
+    const float z = y - c.z / 200.0f;
+    return nvmath::vec3f(x * kWhiteXyz.x, y * kWhiteXyz.y, z * kWhiteXyz.z);
+}
+
+static nvmath::vec3f xyzToLab(const nvmath::vec3f& c)
+{
+    const float delta = 6.0f / 29.0f;
+    auto        f     = [delta](float t) {
+        return t > delta * delta * delta ? std::cbrt(t) : t / (3.0f * delta * delta) + 4.0f / 29.0f;
+    };
+    const float fx = f(c.x / kWhiteXyz.x);
+    const float fy = f(c.y / kWhiteXyz.y);
+    const float fz = f(c.z / kWhiteXyz.z);
+    return nvmath::vec3f(116.0f * fy - 16.0f, 500.0f * (fx - fy), 200.0f * (fy - fz));
+}
+
+static float hyab(const nvmath::vec3f& a, const nvmath::vec3f& b)
+{
+    const float da = a.y - b.y;
+    const float db = a.z - b.z;
+    return std::abs(a.x - b.x) + std::sqrt(da * da + db * db);
+}
+
+// Separable Gaussian of one channel of the YCxCz image, clamped at the borders
+static void blurChannel(std::vector<nvmath::vec3f>& image, uint32_t width, uint32_t height, int channel, float sigma)
+{
+    const int          radius = static_cast<int>(std::ceil(3.0f * sigma));
+    std::vector<float> kernel(2 * radius + 1);
+    float              total = 0.0f;
+    for (int i = -radius; i <= radius; i++)
+    {
+        kernel[i + radius] = std::exp(-float(i * i) / (2.0f * sigma * sigma));
+        total += kernel[i + radius];
+    }
+    for (float& k : kernel)
+        k /= total;
+
+    const int          w = static_cast<int>(width);
+    const int          h = static_cast<int>(height);
+    std::vector<float> pass(image.size());
+    for (int y = 0; y < h; y++)
+    {
+        for (int x = 0; x < w; x++)
+        {
+            float sum = 0.0f;
+            for (int i = -radius; i <= radius; i++)
+                sum += kernel[i + radius] * image[size_t(y) * w + std::clamp(x + i, 0, w - 1)][channel];
+            pass[size_t(y) * w + x] = sum;
+        }
+    }
+    for (int y = 0; y < h; y++)
+    {
+        for (int x = 0; x < w; x++)
+        {
+            float sum = 0.0f;
+            for (int i = -radius; i <= radius; i++)
+                sum += kernel[i + radius] * pass[size_t(std::clamp(y + i, 0, h - 1)) * w + x];
+            image[size_t(y) * w + x][channel] = sum;
+        }
+    }
+}
+
+// Tone mapped, filtered L*a*b* of an image for the FLIP error
+static std::vector<nvmath::vec3f> getFlipLab(const std::vector<nvmath::vec4f>& image, uint32_t width, uint32_t height)
+{
+    // Blur of the achromatic and the two chromatic channels, in pixels: the contrast sensitivity
+    // of FLIP at 67 pixels per degree, approximated by a Gaussian each
+    const float sigmas[3] = {1.0f, 2.0f, 2.0f};
+
+    std::vector<nvmath::vec3f> ycxcz(size_t(width) * height);
+    for (size_t i = 0; i < ycxcz.size(); i++)
+    {
+        nvmath::vec3f c(image[i].x, image[i].y, image[i].z);
+        for (int k = 0; k < 3; k++)
+            c[k] = std::isfinite(c[k]) ? std::max(c[k], 0.0f) / (1.0f + std::max(c[k], 0.0f)) : 1.0f;  // Reinhard
+        ycxcz[i] = xyzToYCxCz(linearRgbToXyz(c));
+    }
+    for (int k = 0; k < 3; k++)
+        blurChannel(ycxcz, width, height, k, sigmas[k]);
+
+    for (auto& c : ycxcz)
+    {
+        nvmath::vec3f rgb = xyzToLinearRgb(yCxCzToXyz(c));
+        for (int k = 0; k < 3; k++)
+            rgb[k] = std::clamp(rgb[k], 0.0f, 1.0f);
+        c = xyzToLab(linearRgbToXyz(rgb));
+    }
+    return ycxcz;
+}
+
+double computeFlipError(const std::vector<nvmath::vec4f>& image, const std::vector<nvmath::vec4f>& reference,
+                        uint32_t width, uint32_t height)
+{
+    const size_t count = size_t(width) * height;
+    if (count == 0 || image.size() < count || reference.size() < count)
+        return 0.0;
+
+    const std::vector<nvmath::vec3f> a = getFlipLab(image, width, height);
+    const std::vector<nvmath::vec3f> b = getFlipLab(reference, width, height);
+
+    // Compression and remapping of the distance, the largest one being between pure green and blue
+    const float qc     = 0.7f;
+    const float pc     = 0.4f;
+    const float pt     = 0.95f;
+    const float cmax   = std::pow(hyab(xyzToLab(linearRgbToXyz(nvmath::vec3f(0.0f, 1.0f, 0.0f))),
+                                       xyzToLab(linearRgbToXyz(nvmath::vec3f(0.0f, 0.0f, 1.0f)))),
+                                  qc);
+    const float pccmax = pc * cmax;
+
+    double sum = 0.0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const float d = std::pow(hyab(a[i], b[i]), qc);
+        sum += d < pccmax ? pt / pccmax * d : pt + (d - pccmax) / (cmax - pccmax) * (1.0f - pt);
+    }
+    return sum / count;
+}
+
+bool writePfm(const std::string& filename, uint32_t width, uint32_t height, const std::vector<nvmath::vec4f>& pixels)
+{
+    if (pixels.size() < size_t(width) * height)
+        return false;
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (!file)
+        return false;
+
+    // A negative scale is little endian
+    fprintf(file, "PF\n%u %u\n-1.0\n", width, height);
+    std::vector<float> row(size_t(width) * 3);
+    for (uint32_t y = height; y-- > 0;)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            const nvmath::vec4f& p = pixels[size_t(y) * width + x];
+            row[x * 3 + 0]         = p.x;
+            row[x * 3 + 1]         = p.y;
+            row[x * 3 + 2]         = p.z;
+        }
+        fwrite(row.data(), sizeof(float), row.size(), file);
+    }
+    const bool ok = ferror(file) == 0;
+    fclose(file);
+    return ok;
+}
+
+bool readPfm(const std::string& filename, uint32_t& width, uint32_t& height, std::vector<nvmath::vec4f>& pixels)
+{
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (!file)
+        return false;
+
+    char  type[3] = {};
+    float scale   = 0.0f;
+    if (fscanf(file, "%2s %u %u %f", type, &width, &height, &scale) != 4 || type[0] != 'P' || (type[1] != 'F' && type[1] != 'f')
+        || fgetc(file) == EOF)
+    {
+        fclose(file);
+        return false;
+    }
+
+    const uint32_t     channels = type[1] == 'F' ? 3 : 1;
+    std::vector<float> row(size_t(width) * channels);
+    pixels.assign(size_t(width) * height, nvmath::vec4f(0.0f, 0.0f, 0.0f, 1.0f));
+    for (uint32_t y = height; y-- > 0;)
+    {
+        if (fread(row.data(), sizeof(float), row.size(), file) != row.size())
+        {
+            fclose(file);
+            return false;
+        }
+        for (uint32_t x = 0; x < width; x++)
+        {
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                float v = row[x * channels + (channels == 3 ? c : 0)];
+                if (scale > 0.0f)  // Big endian
+                {
+                    uint32_t bits;
+                    memcpy(&bits, &v, sizeof(bits));
+                    bits = (bits >> 24) | ((bits >> 8) & 0xff00u) | ((bits << 8) & 0xff0000u) | (bits << 24);
+                    memcpy(&v, &bits, sizeof(v));
+                }
+                pixels[size_t(y) * width + x][c] = v;
+            }
+        }
+    }
+    fclose(file);
+    return true;
+}
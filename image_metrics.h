@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "nvmath/nvmath.h"
+
+//--------------------------------------------------------------------------------------------------
+// Error of a rendered image against a reference of the same size, to compare the noise of
+// sampling strategies at the same sample count, and the float images of the regression tests
+//
+
+// Mean squared error of the RGB channels, pixels that are not finite in either image are skipped
+double computeMse(const std::vector<nvmath::vec4f>& image, const std::vector<nvmath::vec4f>& reference);
+
+// Root of the relative MSE, (image - reference)^2 / (reference^2 + 0.01) per channel, so the
+// dark and the bright regions weigh the same
+double computeRelativeRmse(const std::vector<nvmath::vec4f>& image, const std::vector<nvmath::vec4f>& reference);
+
+// Mean perceptual difference in [0, 1], after the color pipeline of FLIP (Andersson et al., "FLIP:
+// A Difference Evaluator for Alternating Images", HPG 2020): both images are tone mapped, blurred
+// in the opponent space YCxCz as the eye does at a normal viewing distance, and compared with the
+// HyAB distance in L*a*b*, compressed and normalized as FLIP does. The edge and point feature
+// term is left out, noise shows in the color term already
+double computeFlipError(const std::vector<nvmath::vec4f>& image, const std::vector<nvmath::vec4f>& reference,
+                        uint32_t width, uint32_t height);
+
+// Portable float map, RGB, rows from the bottom. Alpha is dropped, and is 1 when read
+bool writePfm(const std::string& filename, uint32_t width, uint32_t height, const std::vector<nvmath::vec4f>& pixels);
+bool readPfm(const std::string& filename, uint32_t& width, uint32_t& height, std::vector<nvmath::vec4f>& pixels);
@@ -0,0 +1,276 @@
+#include "ktx2.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+static const uint8_t kKtx2Identifier[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+
+struct Ktx2Header
+{
+    uint8_t  identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+static_assert(sizeof(Ktx2Header) == 80, "KTX2 header layout");
+
+struct Ktx2Level
+{
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+
+// Data Format Descriptor values, see the Khronos Data Format specification
+enum
+{
+    KHR_DF_MODEL_RGBSDA = 1,
+    KHR_DF_MODEL_BC4    = 131,
+    KHR_DF_MODEL_BC5    = 132,
+    KHR_DF_MODEL_BC7    = 134,
+
+    KHR_DF_PRIMARIES_BT709 = 1,
+    KHR_DF_TRANSFER_LINEAR = 1,
+    KHR_DF_TRANSFER_SRGB   = 2,
+
+    KHR_DF_CHANNEL_RED     = 0,
+    KHR_DF_CHANNEL_GREEN   = 1,
+    KHR_DF_CHANNEL_BLUE    = 2,
+    KHR_DF_CHANNEL_ALPHA   = 15,
+    KHR_DF_SAMPLE_LINEAR   = 0x10,
+};
+
+static bool isSupportedFormat(VkFormat format)
+{
+    return format == VK_FORMAT_R8G8B8A8_UNORM || format == VK_FORMAT_R8G8B8A8_SRGB || isBlockCompressed(format);
+}
+
+static VkComponentSwizzle toSwizzle(char c, VkComponentSwizzle identity)
+{
+    VkComponentSwizzle swizzle = VK_COMPONENT_SWIZZLE_IDENTITY;
+    switch (c)
+    {
+    case 'r': swizzle = VK_COMPONENT_SWIZZLE_R; break;
+    case 'g': swizzle = VK_COMPONENT_SWIZZLE_G; break;
+    case 'b': swizzle = VK_COMPONENT_SWIZZLE_B; break;
+    case 'a': swizzle = VK_COMPONENT_SWIZZLE_A; break;
+    case '0': swizzle = VK_COMPONENT_SWIZZLE_ZERO; break;
+    case '1': swizzle = VK_COMPONENT_SWIZZLE_ONE; break;
+    default: break;
+    }
+    return swizzle == identity ? VK_COMPONENT_SWIZZLE_IDENTITY : swizzle;
+}
+
+bool isKtx2(const uint8_t* data, size_t size)
+{
+    return size >= sizeof(Ktx2Header) && memcmp(data, kKtx2Identifier, sizeof(kKtx2Identifier)) == 0;
+}
+
+bool isKtx2Supported(const uint8_t* data, size_t size, std::string* reason)
+{
+    std::string error;
+    if (!isKtx2(data, size))
+        error = "not a KTX2 file";
+    else
+    {
+        Ktx2Header header;
+        memcpy(&header, data, sizeof(header));
+        if (header.supercompressionScheme != 0 || header.vkFormat == VK_FORMAT_UNDEFINED)
+            error = "Basis Universal payloads need a transcoder";
+        else if (!isSupportedFormat(static_cast<VkFormat>(header.vkFormat)))
+            error = "unsupported format " + std::to_string(header.vkFormat);
+        else if (header.pixelDepth > 1 || header.layerCount > 1 || header.faceCount != 1)
+            error = "only 2D textures are supported";
+    }
+    if (reason)
+        *reason = error;
+    return error.empty();
+}
+
+bool loadKtx2(const uint8_t* data, size_t size, TextureData& texture, std::string& error)
+{
+    if (!isKtx2Supported(data, size, &error))
+        return false;
+
+    Ktx2Header header;
+    memcpy(&header, data, sizeof(header));
+    const uint32_t levelCount = std::max(header.levelCount, 1u);
+    if (sizeof(Ktx2Header) + levelCount * sizeof(Ktx2Level) > size)
+    {
+        error = "truncated level index";
+        return false;
+    }
+
+    texture.width     = header.pixelWidth;
+    texture.height    = header.pixelHeight;
+    texture.mipLevels = levelCount;
+    texture.format    = static_cast<VkFormat>(header.vkFormat);
+    texture.swizzle   = {};
+    texture.pixels.resize(getMipLevelOffset(texture.format, texture.width, texture.height, levelCount));
+
+    for (uint32_t level = 0; level < levelCount; level++)
+    {
+        Ktx2Level index;
+        memcpy(&index, data + sizeof(Ktx2Header) + level * sizeof(Ktx2Level), sizeof(index));
+        const VkDeviceSize levelSize = getMipLevelSize(texture.format, texture.width, texture.height, level);
+        if (index.byteLength != levelSize || index.byteOffset + index.byteLength > size)
+        {
+            error = "invalid level " + std::to_string(level);
+            return false;
+        }
+        memcpy(texture.pixels.data() + getMipLevelOffset(texture.format, texture.width, texture.height, level),
+               data + index.byteOffset, levelSize);
+    }
+
+    // Key/value data: uint32 length, then "key\0value", padded to 4 bytes
+    uint64_t offset = header.kvdByteOffset;
+    uint64_t end    = std::min<uint64_t>(uint64_t(header.kvdByteOffset) + header.kvdByteLength, size);
+    while (offset + 4 <= end)
+    {
+        uint32_t length;
+        memcpy(&length, data + offset, 4);
+        const char* key = reinterpret_cast<const char*>(data + offset + 4);
+        if (offset + 4 + length > end)
+            break;
+        if (length >= sizeof("KTXswizzle") + 4 && strcmp(key, "KTXswizzle") == 0)
+        {
+            const char* value = key + sizeof("KTXswizzle");
+            texture.swizzle   = {toSwizzle(value[0], VK_COMPONENT_SWIZZLE_R), toSwizzle(value[1], VK_COMPONENT_SWIZZLE_G),
+                                 toSwizzle(value[2], VK_COMPONENT_SWIZZLE_B), toSwizzle(value[3], VK_COMPONENT_SWIZZLE_A)};
+        }
+        offset += (4 + length + 3) & ~3ull;
+    }
+    return true;
+}
+
+bool writeKtx2(const std::string& filename, const TextureData& texture, const char* swizzle)
+{
+    // Basic data format descriptor
+    uint32_t colorModel  = 0;
+    uint32_t bytesPlane0 = getBlockByteSize(texture.format);
+    uint32_t blockDim    = isBlockCompressed(texture.format) ? 3 | (3 << 8) : 0;
+    bool     isSrgb      = false;
+    struct Sample
+    {
+        uint32_t bitOffset, bitLength, channel, lower, upper;
+    };
+    std::vector<Sample> samples;
+    switch (texture.format)
+    {
+    case VK_FORMAT_R8G8B8A8_SRGB:
+        isSrgb = true;
+        // fall through
+    case VK_FORMAT_R8G8B8A8_UNORM:
+        colorModel = KHR_DF_MODEL_RGBSDA;
+        samples    = {{0, 7, KHR_DF_CHANNEL_RED, 0, 255},
+                      {8, 7, KHR_DF_CHANNEL_GREEN, 0, 255},
+                      {16, 7, KHR_DF_CHANNEL_BLUE, 0, 255},
+                      {24, 7, KHR_DF_CHANNEL_ALPHA | (isSrgb ? uint32_t(KHR_DF_SAMPLE_LINEAR) : 0u), 0, 255}};
+        break;
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+        colorModel = KHR_DF_MODEL_BC4;
+        samples    = {{0, 63, KHR_DF_CHANNEL_RED, 0, 0xFFFFFFFF}};
+        break;
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+        colorModel = KHR_DF_MODEL_BC5;
+        samples    = {{0, 63, KHR_DF_CHANNEL_RED, 0, 0xFFFFFFFF}, {64, 63, KHR_DF_CHANNEL_GREEN, 0, 0xFFFFFFFF}};
+        break;
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+        isSrgb = true;
+        // fall through
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+        colorModel = KHR_DF_MODEL_BC7;
+        samples    = {{0, 127, KHR_DF_CHANNEL_RED, 0, 0xFFFFFFFF}};
+        break;
+    default:
+        return false;
+    }
+
+    std::vector<uint32_t> dfd;
+    dfd.push_back(0);  // Total size, patched below
+    dfd.push_back(0);  // Khronos vendor, basic descriptor type
+    dfd.push_back(2 | ((24 + 16 * uint32_t(samples.size())) << 16));
+    dfd.push_back(colorModel | (KHR_DF_PRIMARIES_BT709 << 8)
+                  | ((isSrgb ? KHR_DF_TRANSFER_SRGB : KHR_DF_TRANSFER_LINEAR) << 16));
+    dfd.push_back(blockDim);
+    dfd.push_back(bytesPlane0);
+    dfd.push_back(0);
+    for (const Sample& s : samples)
+    {
+        dfd.push_back(s.bitOffset | (s.bitLength << 16) | (s.channel << 24));
+        dfd.push_back(0);
+        dfd.push_back(s.lower);
+        dfd.push_back(s.upper);
+    }
+    dfd[0] = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+
+    // Key/value data, keys sorted
+    std::vector<uint8_t> kvd;
+    auto addKeyValue = [&](const std::string& key, const std::string& value) {
+        uint32_t length = static_cast<uint32_t>(key.size() + 1 + value.size() + 1);
+        kvd.insert(kvd.end(), reinterpret_cast<uint8_t*>(&length), reinterpret_cast<uint8_t*>(&length) + 4);
+        kvd.insert(kvd.end(), key.c_str(), key.c_str() + key.size() + 1);
+        kvd.insert(kvd.end(), value.c_str(), value.c_str() + value.size() + 1);
+        kvd.resize((kvd.size() + 3) & ~size_t(3), 0);
+    };
+    if (strcmp(swizzle, "rgba") != 0)
+        addKeyValue("KTXswizzle", swizzle);
+    addKeyValue("KTXwriter", "vk-rt-engine texture_compressor");
+
+    Ktx2Header header{};
+    memcpy(header.identifier, kKtx2Identifier, sizeof(kKtx2Identifier));
+    header.vkFormat      = texture.format;
+    header.typeSize      = 1;
+    header.pixelWidth    = texture.width;
+    header.pixelHeight   = texture.height;
+    header.faceCount     = 1;
+    header.levelCount    = texture.mipLevels;
+    header.dfdByteOffset = static_cast<uint32_t>(sizeof(Ktx2Header) + texture.mipLevels * sizeof(Ktx2Level));
+    header.dfdByteLength = dfd[0];
+    header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+    header.kvdByteLength = static_cast<uint32_t>(kvd.size());
+
+    // Levels are stored smallest first, each aligned to the block size
+    const uint64_t         alignment = std::max<uint64_t>(bytesPlane0, 4);
+    std::vector<Ktx2Level> levels(texture.mipLevels);
+    uint64_t               offset = header.kvdByteOffset + header.kvdByteLength;
+    for (uint32_t level = texture.mipLevels; level-- > 0;)
+    {
+        offset                   = (offset + alignment - 1) / alignment * alignment;
+        levels[level].byteOffset = offset;
+        levels[level].byteLength = getMipLevelSize(texture.format, texture.width, texture.height, level);
+        levels[level].uncompressedByteLength = levels[level].byteLength;
+        offset += levels[level].byteLength;
+    }
+
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out)
+        return false;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(levels.data()), levels.size() * sizeof(Ktx2Level));
+    out.write(reinterpret_cast<const char*>(dfd.data()), dfd.size() * sizeof(uint32_t));
+    out.write(reinterpret_cast<const char*>(kvd.data()), kvd.size());
+    for (uint32_t level = texture.mipLevels; level-- > 0;)
+    {
+        static const char zeros[16] = {};
+        out.write(zeros, static_cast<std::streamsize>(levels[level].byteOffset - static_cast<uint64_t>(out.tellp())));
+        out.write(reinterpret_cast<const char*>(texture.pixels.data())
+                      + getMipLevelOffset(texture.format, texture.width, texture.height, level),
+                  static_cast<std::streamsize>(levels[level].byteLength));
+    }
+    return static_cast<bool>(out);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+
+#include "texture_utils.h"
+
+//--------------------------------------------------------------------------------------------------
+// Minimal KTX2 container support
+// - 2D textures with any number of mip levels, RGBA8 or BC1-BC7 payloads
+// - No supercompression: Basis Universal (BasisLZ/UASTC) files need a transcoder that is not part
+//   of this project, they are reported as unsupported
+// - The KTXswizzle key is turned into the component mapping of the texture
+//
+bool isKtx2(const uint8_t* data, size_t size);
+// True for a KTX2 this reader can load, 'reason' tells why otherwise
+bool isKtx2Supported(const uint8_t* data, size_t size, std::string* reason = nullptr);
+
+bool loadKtx2(const uint8_t* data, size_t size, TextureData& texture, std::string& error);
+bool writeKtx2(const std::string& filename, const TextureData& texture, const char* swizzle = "rgba");
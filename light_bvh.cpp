@@ -0,0 +1,421 @@
+#include "light_bvh.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+constexpr float kPi      = 3.14159265358979f;
+constexpr int   kBuckets = 12;
+
+float safeSqrt(float x)
+{
+    return std::sqrt(std::max(x, 0.0f));
+}
+
+// cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines of the angles a and b
+float cosSubClamped(float sinA, float cosA, float sinB, float cosB)
+{
+    if (cosA > cosB)
+        return 1.0f;
+    return cosA * cosB + sinA * sinB;
+}
+
+float sinSubClamped(float sinA, float cosA, float sinB, float cosB)
+{
+    if (cosA > cosB)
+        return 0.0f;
+    return sinA * cosB - cosA * sinB;
+}
+
+// Bounds, cone and power of a set of lights
+struct LightBounds
+{
+    nvmath::vec3f boundsMin{1e30f};
+    nvmath::vec3f boundsMax{-1e30f};
+    nvmath::vec3f axis{0.0f, 0.0f, 1.0f};
+    float         cosTheta_o{1.0f};
+    float         cosTheta_e{1.0f};
+    float         power{0.0f};
+
+    bool isEmpty() const { return power <= 0.0f; }
+};
+
+// Smallest cone holding both cones
+void mergeCones(const LightBounds& a, const LightBounds& b, nvmath::vec3f& axis, float& cosTheta_o)
+{
+    const float theta_a = std::acos(std::clamp(a.cosTheta_o, -1.0f, 1.0f));
+    const float theta_b = std::acos(std::clamp(b.cosTheta_o, -1.0f, 1.0f));
+    const float theta_d = std::acos(std::clamp(nvmath::dot(a.axis, b.axis), -1.0f, 1.0f));
+    if (std::min(theta_d + theta_b, kPi) <= theta_a)
+    {
+        axis       = a.axis;
+        cosTheta_o = a.cosTheta_o;
+        return;
+    }
+    if (std::min(theta_d + theta_a, kPi) <= theta_b)
+    {
+        axis       = b.axis;
+        cosTheta_o = b.cosTheta_o;
+        return;
+    }
+
+    const float theta_o = (theta_a + theta_d + theta_b) / 2.0f;
+    if (theta_o >= kPi)
+    {
+        axis       = a.axis;
+        cosTheta_o = -1.0f;
+        return;
+    }
+
+    // Rotates the axis of a towards the one of b
+    const float         theta_r = theta_o - theta_a;
+    const nvmath::vec3f w       = nvmath::cross(a.axis, b.axis);
+    if (nvmath::dot(w, w) < 1e-12f)
+    {
+        axis       = a.axis;
+        cosTheta_o = -1.0f;
+        return;
+    }
+    const nvmath::vec3f u = nvmath::normalize(w);
+    // Rodrigues' rotation of a.axis around u by theta_r
+    axis = a.axis * std::cos(theta_r) + nvmath::cross(u, a.axis) * std::sin(theta_r)
+           + u * (nvmath::dot(u, a.axis) * (1.0f - std::cos(theta_r)));
+    axis       = nvmath::normalize(axis);
+    cosTheta_o = std::cos(theta_o);
+}
+
+LightBounds merge(const LightBounds& a, const LightBounds& b)
+{
+    if (a.isEmpty())
+        return b;
+    if (b.isEmpty())
+        return a;
+    LightBounds result;
+    result.boundsMin  = nvmath::nv_min(a.boundsMin, b.boundsMin);
+    result.boundsMax  = nvmath::nv_max(a.boundsMax, b.boundsMax);
+    result.power      = a.power + b.power;
+    result.cosTheta_e = std::min(a.cosTheta_e, b.cosTheta_e);
+    mergeCones(a, b, result.axis, result.cosTheta_o);
+    return result;
+}
+
+float getSurfaceArea(const LightBounds& b)
+{
+    const nvmath::vec3f d = b.boundsMax - b.boundsMin;
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+// Solid angle measure of the directions a cone of lights emits to
+float getOrientationMeasure(const LightBounds& b)
+{
+    const float theta_o = std::acos(std::clamp(b.cosTheta_o, -1.0f, 1.0f));
+    const float theta_e = std::acos(std::clamp(b.cosTheta_e, -1.0f, 1.0f));
+    const float theta_w = std::min(theta_o + theta_e, kPi);
+    const float sin_o   = std::sin(theta_o);
+    return 2.0f * kPi * (1.0f - b.cosTheta_o)
+           + kPi / 2.0f * (2.0f * theta_w * sin_o - std::cos(theta_o - 2.0f * theta_w) - 2.0f * theta_o * sin_o + b.cosTheta_o);
+}
+
+struct BuildLight
+{
+    LightBounds   bounds;
+    nvmath::vec3f centroid;
+    int           index{0};
+};
+
+class LightBvhBuilder
+{
+public:
+    explicit LightBvhBuilder(std::vector<LightBvhNode>& nodes)
+        : m_nodes(nodes)
+    {
+    }
+
+    // Nodes are written top-down without recursion, the children of a node always come after it.
+    // The bounds of the interior nodes are merged bottom-up once the tree is complete
+    void build(std::vector<BuildLight>& lights)
+    {
+        struct Range
+        {
+            size_t first, last, node;
+        };
+        std::vector<Range> stack{{0, lights.size(), 0}};
+        m_nodes.resize(1);
+        while (!stack.empty())
+        {
+            const Range range = stack.back();
+            stack.pop_back();
+            if (range.last - range.first == 1)
+            {
+                const BuildLight& light = lights[range.first];
+                setNode(range.node, light.bounds, -1, light.index);
+                continue;
+            }
+
+            const size_t middle = split(lights, range.first, range.last);
+            const size_t child  = m_nodes.size();
+            m_nodes.resize(m_nodes.size() + 2);
+            m_nodes[range.node].child = static_cast<int>(child);
+            m_nodes[range.node].light = -1;
+            stack.push_back({range.first, middle, child});
+            stack.push_back({middle, range.last, child + 1});
+        }
+
+        for (size_t i = m_nodes.size(); i-- > 0;)
+        {
+            const int child = m_nodes[i].child;
+            if (child >= 0)
+                setNode(i, merge(getBounds(m_nodes[child]), getBounds(m_nodes[child + 1])), child, -1);
+        }
+    }
+
+private:
+    static LightBounds getBounds(const LightBvhNode& node)
+    {
+        LightBounds b;
+        b.boundsMin  = node.boundsMin;
+        b.boundsMax  = node.boundsMax;
+        b.power      = node.power;
+        b.axis       = node.axis;
+        b.cosTheta_o = node.cosTheta_o;
+        b.cosTheta_e = node.cosTheta_e;
+        return b;
+    }
+
+    void setNode(size_t index, const LightBounds& b, int child, int light)
+    {
+        LightBvhNode& node = m_nodes[index];
+        node.boundsMin     = b.boundsMin;
+        node.boundsMax     = b.boundsMax;
+        node.power         = b.power;
+        node.axis          = b.axis;
+        node.cosTheta_o    = b.cosTheta_o;
+        node.cosTheta_e    = b.cosTheta_e;
+        node.child         = child;
+        node.light         = light;
+    }
+
+    // Surface area orientation heuristic over buckets of centroids, along each axis. Returns the
+    // first light of the second child
+    size_t split(std::vector<BuildLight>& lights, size_t first, size_t last)
+    {
+        LightBounds   all;
+        nvmath::vec3f centroidMin(1e30f), centroidMax(-1e30f);
+        for (size_t i = first; i < last; i++)
+        {
+            all         = merge(all, lights[i].bounds);
+            centroidMin = nvmath::nv_min(centroidMin, lights[i].centroid);
+            centroidMax = nvmath::nv_max(centroidMax, lights[i].centroid);
+        }
+        const nvmath::vec3f extent    = all.boundsMax - all.boundsMin;
+        const float         maxExtent = std::max(extent.x, std::max(extent.y, extent.z));
+
+        float bestCost   = 1e30f;
+        int   bestAxis   = -1;
+        int   bestBucket = 0;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const float range = centroidMax[axis] - centroidMin[axis];
+            if (range <= 0.0f)
+                continue;
+
+            LightBounds buckets[kBuckets];
+            for (size_t i = first; i < last; i++)
+            {
+                const int b = getBucket(lights[i].centroid[axis], centroidMin[axis], range);
+                buckets[b]  = merge(buckets[b], lights[i].bounds);
+            }
+
+            // Costs of the splits after each bucket, the thinner axes are penalized
+            const float regularization = maxExtent / std::max(extent[axis], 1e-6f);
+            for (int split = 0; split < kBuckets - 1; split++)
+            {
+                LightBounds below, above;
+                for (int b = 0; b <= split; b++)
+                    below = merge(below, buckets[b]);
+                for (int b = split + 1; b < kBuckets; b++)
+                    above = merge(above, buckets[b]);
+                const float cost = regularization * (getCost(below) + getCost(above));
+                if (cost > 0.0f && cost < bestCost)
+                {
+                    bestCost   = cost;
+                    bestAxis   = axis;
+                    bestBucket = split;
+                }
+            }
+        }
+
+        size_t middle = first;
+        if (bestAxis >= 0)
+        {
+            const float range = centroidMax[bestAxis] - centroidMin[bestAxis];
+            middle            = std::partition(lights.begin() + first, lights.begin() + last,
+                                               [&](const BuildLight& light) {
+                                        return getBucket(light.centroid[bestAxis], centroidMin[bestAxis], range) <= bestBucket;
+                                    })
+                     - lights.begin();
+        }
+        // Coincident lights, or all on one side: halves by count
+        if (middle == first || middle == last)
+        {
+            middle = (first + last) / 2;
+            std::nth_element(lights.begin() + first, lights.begin() + middle, lights.begin() + last,
+                             [](const BuildLight& a, const BuildLight& b) { return a.index < b.index; });
+        }
+        return middle;
+    }
+
+    static int getBucket(float value, float minValue, float range)
+    {
+        return std::min(static_cast<int>(kBuckets * (value - minValue) / range), kBuckets - 1);
+    }
+
+    static float getCost(const LightBounds& b)
+    {
+        if (b.isEmpty())
+            return 0.0f;
+        // The surface area of a single point is 0, the tiny term still orders such splits by power
+        return b.power * getOrientationMeasure(b) * std::max(getSurfaceArea(b), 1e-6f);
+    }
+
+    std::vector<LightBvhNode>& m_nodes;
+};
+
+}  // namespace
+
+float getLightPower(const GltfLight& light)
+{
+    // Only the point lights are shaded
+    if (light.type != 0)
+        return 0.0f;
+    return std::max(light.intensity * getLuminance(light.color), 0.0f);
+}
+
+std::vector<LightBvhNode> buildLightBvh(const std::vector<GltfLight>& lights)
+{
+    std::vector<BuildLight> buildLights;
+    for (size_t i = 0; i < lights.size(); i++)
+    {
+        const float power = getLightPower(lights[i]);
+        if (!(power > 0.0f))
+            continue;
+        BuildLight light;
+        light.bounds.boundsMin  = lights[i].position;
+        light.bounds.boundsMax  = lights[i].position;
+        light.bounds.power      = power;
+        light.bounds.cosTheta_o = -1.0f;  // Omnidirectional
+        light.bounds.cosTheta_e = 0.0f;
+        light.centroid          = lights[i].position;
+        light.index             = static_cast<int>(i);
+        buildLights.push_back(light);
+    }
+
+    std::vector<LightBvhNode> nodes;
+    if (buildLights.empty())
+        return nodes;
+    nodes.reserve(2 * buildLights.size() - 1);
+    LightBvhBuilder(nodes).build(buildLights);
+    return nodes;
+}
+
+float getLightBvhImportance(const LightBvhNode& node, const nvmath::vec3f& p, const nvmath::vec3f& n)
+{
+    const nvmath::vec3f center = (node.boundsMin + node.boundsMax) * 0.5f;
+    const nvmath::vec3f diag   = node.boundsMax - node.boundsMin;
+    const nvmath::vec3f toP    = p - center;
+    // Not below half the size of the node, so the lights close to p do not take all the samples
+    const float d2 = std::max(nvmath::dot(toP, toP), nvmath::length(diag) / 2.0f);
+    if (!(d2 > 0.0f))
+        return 0.0f;
+    const nvmath::vec3f wi = toP / std::sqrt(std::max(nvmath::dot(toP, toP), 1e-12f));
+
+    // Angle of the bounds seen from p, the whole sphere when p is inside their bounding sphere
+    float       cosTheta_b = -1.0f;
+    const float radius2    = nvmath::dot(diag, diag) / 4.0f;
+    if (nvmath::dot(toP, toP) > radius2)
+        cosTheta_b = safeSqrt(1.0f - radius2 / nvmath::dot(toP, toP));
+    const float sinTheta_b = safeSqrt(1.0f - cosTheta_b * cosTheta_b);
+
+    // Smallest angle between the direction to p and the emission of the lights
+    const float cosTheta_w = nvmath::dot(node.axis, wi);
+    const float sinTheta_w = safeSqrt(1.0f - cosTheta_w * cosTheta_w);
+    const float sinTheta_o = safeSqrt(1.0f - node.cosTheta_o * node.cosTheta_o);
+    const float cosTheta_x = cosSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, node.cosTheta_o);
+    const float sinTheta_x = sinSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, node.cosTheta_o);
+    const float cosThetap  = cosSubClamped(sinTheta_x, cosTheta_x, sinTheta_b, cosTheta_b);
+    if (cosThetap <= node.cosTheta_e)
+        return 0.0f;
+
+    float importance = node.power * cosThetap / d2;
+
+    // Smallest incident angle at the receiver
+    if (nvmath::dot(n, n) > 0.0f)
+    {
+        const float cosTheta_i  = std::abs(nvmath::dot(wi, n));
+        const float sinTheta_i  = safeSqrt(1.0f - cosTheta_i * cosTheta_i);
+        const float cosThetap_i = cosSubClamped(sinTheta_i, cosTheta_i, sinTheta_b, cosTheta_b);
+        importance *= cosThetap_i;
+    }
+    return std::max(importance, 0.0f);
+}
+
+bool sampleLightBvh(const std::vector<LightBvhNode>& nodes, const nvmath::vec3f& p, const nvmath::vec3f& n, float u,
+                    uint32_t& light, float& pmf)
+{
+    if (nodes.empty())
+        return false;
+    int index = 0;
+    pmf       = 1.0f;
+    while (nodes[index].child >= 0)
+    {
+        const int   child = nodes[index].child;
+        const float left  = getLightBvhImportance(nodes[child], p, n);
+        const float right = getLightBvhImportance(nodes[child + 1], p, n);
+        if (!(left + right > 0.0f))
+            return false;
+
+        const float pLeft = left / (left + right);
+        if (u < pLeft)
+        {
+            index = child;
+            u     = std::min(u / pLeft, 0.99999994f);
+            pmf *= pLeft;
+        }
+        else
+        {
+            index = child + 1;
+            u     = std::min((u - pLeft) / (1.0f - pLeft), 0.99999994f);
+            pmf *= 1.0f - pLeft;
+        }
+    }
+    light = static_cast<uint32_t>(nodes[index].light);
+    return pmf > 0.0f;
+}
+
+static void accumulatePmfs(const std::vector<LightBvhNode>& nodes, int index, float pmf, const nvmath::vec3f& p,
+                           const nvmath::vec3f& n, std::vector<float>& pmfs)
+{
+    const LightBvhNode& node = nodes[index];
+    if (node.child < 0)
+    {
+        pmfs[node.light] += pmf;
+        return;
+    }
+    const float left  = getLightBvhImportance(nodes[node.child], p, n);
+    const float right = getLightBvhImportance(nodes[node.child + 1], p, n);
+    if (!(left + right > 0.0f))
+        return;
+    if (left > 0.0f)
+        accumulatePmfs(nodes, node.child, pmf * left / (left + right), p, n, pmfs);
+    if (right > 0.0f)
+        accumulatePmfs(nodes, node.child + 1, pmf * right / (left + right), p, n, pmfs);
+}
+
+void getLightBvhPmfs(const std::vector<LightBvhNode>& nodes, const nvmath::vec3f& p, const nvmath::vec3f& n,
+                     size_t lightCount, std::vector<float>& pmfs)
+{
+    pmfs.assign(lightCount, 0.0f);
+    if (!nodes.empty())
+        accumulatePmfs(nodes, 0, 1.0f, p, n, pmfs);
+}
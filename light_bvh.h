@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "shaders/host_device.h"
+
+//--------------------------------------------------------------------------------------------------
+// Light BVH over the punctual lights, to pick the light of the next event estimation with a
+// probability proportional to its estimated contribution (Conty Estevez and Kulla, "Importance
+// Sampling of Many Lights with Adaptive Tree Splitting", as in pbrt-v4)
+// - Each node bounds the positions, the emission directions (a cone) and the power of its lights.
+//   The importance of a node at a shading point is its power over the squared distance, reduced by
+//   the angles between the cone, the receiver normal and the bounds as seen from the point
+// - The traversal descends from the root, picking a child with a probability proportional to its
+//   importance; the product of these probabilities is the pmf of the light reached
+// - Built on the CPU with the surface area orientation heuristic, traversed by the shaders
+//   (shaders/light_sampling.glsl) and by sampleLightBvh() below, which matches them
+// - The lights only have a position: point lights, and the other types, which the shaders do not
+//   shade yet, have no power. Their cones cover the whole sphere
+//
+
+// Luminance of a linear RGB color
+inline float getLuminance(const nvmath::vec3f& color)
+{
+    return 0.2126f * color.x + 0.7152f * color.y + 0.0722f * color.z;
+}
+
+// Power of a light as seen by the light selection, intensity times the luminance of its color
+float getLightPower(const GltfLight& light);
+
+// Nodes of the BVH, the root first. Empty when no light has power
+std::vector<LightBvhNode> buildLightBvh(const std::vector<GltfLight>& lights);
+
+// Importance of a node at the shading point p with the normal n, 0 when none of its lights can
+// reach p. A zero normal skips the receiver term
+float getLightBvhImportance(const LightBvhNode& node, const nvmath::vec3f& p, const nvmath::vec3f& n);
+
+// Traversal with the uniform number u in [0, 1). Returns false when no light has importance
+bool sampleLightBvh(const std::vector<LightBvhNode>& nodes, const nvmath::vec3f& p, const nvmath::vec3f& n, float u,
+                    uint32_t& light, float& pmf);
+
+// Probability of each light to be picked at p, indexed like the light buffer; sums to 1 when
+// sampleLightBvh() can succeed
+void getLightBvhPmfs(const std::vector<LightBvhNode>& nodes, const nvmath::vec3f& p, const nvmath::vec3f& n,
+                     size_t lightCount, std::vector<float>& pmfs);
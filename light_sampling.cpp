@@ -0,0 +1,70 @@
+#include "light_sampling.h"
+
+#include "light_bvh.h"
+
+float buildEmissiveTriangles(const nvh::GltfScene& scene, const std::vector<GltfPBRMaterial>& materials,
+                             std::vector<EmissiveTriangle>& triangles)
+{
+    triangles.clear();
+    std::vector<float> power;
+    for (const auto& node : scene.m_nodes)
+    {
+        const nvh::GltfPrimMesh& primMesh = scene.m_primMeshes[node.primMesh];
+        if (primMesh.materialIndex < 0 || primMesh.materialIndex >= static_cast<int>(materials.size()))
+            continue;
+        const float luminance = getLuminance(materials[primMesh.materialIndex].emissiveFactor);
+        if (luminance <= 0.0f)
+            continue;
+
+        for (uint32_t i = 0; i + 2 < primMesh.indexCount; i += 3)
+        {
+            EmissiveTriangle triangle{};
+            nvmath::vec3f*   positions[3] = {&triangle.v0, &triangle.v1, &triangle.v2};
+            nvmath::vec2f*   texcoords[3] = {&triangle.uv0, &triangle.uv1, &triangle.uv2};
+            for (int k = 0; k < 3; k++)
+            {
+                const uint32_t index = primMesh.vertexOffset + scene.m_indices[primMesh.firstIndex + i + k];
+                *positions[k]        = nvmath::vec3f(node.worldMatrix * nvmath::vec4f(scene.m_positions[index], 1.0f));
+                if (!scene.m_texcoords0.empty())
+                    *texcoords[k] = scene.m_texcoords0[index];
+            }
+            triangle.area = 0.5f * nvmath::length(nvmath::cross(triangle.v1 - triangle.v0, triangle.v2 - triangle.v0));
+            if (!(triangle.area > 0.0f))
+                continue;
+            triangle.materialIndex = primMesh.materialIndex;
+            triangles.push_back(triangle);
+            power.push_back(luminance * triangle.area);
+        }
+    }
+
+    double total = 0.0;
+    for (float p : power)
+        total += p;
+    double sum = 0.0;
+    for (size_t i = 0; i < power.size(); i++)
+    {
+        sum += power[i];
+        EmissiveTriangle& triangle = triangles[i];
+        triangle.pdf               = static_cast<float>(power[i] / total);
+        triangle.cdf               = static_cast<float>(sum / total);
+    }
+    // The binary search must always stop on a triangle
+    if (!power.empty())
+        triangles.back().cdf = 1.0f;
+    return static_cast<float>(total);
+}
+
+std::vector<GltfLight> makeFallbackLights()
+{
+    // Position, color, intensity, type (point)
+    return {
+        {nvmath::vec3f(1.0f, 5.0f, -1.33f), nvmath::vec3f(1.0f), 50.0f, 0},
+        {nvmath::vec3f(0.0f, 3.0f, 67.0f), nvmath::vec3f(1.0f, 0.01f, 0.1f), 50.0f, 0},
+        {nvmath::vec3f(-1.3f, 7.62f, 59.0f), nvmath::vec3f(1.0f), 50.0f, 0},
+        {nvmath::vec3f(2.4f, 2.05f, 40.6f), nvmath::vec3f(1.0f), 50.0f, 0},
+        {nvmath::vec3f(-0.33f, 6.85f, 30.0f), nvmath::vec3f(1.0f), 50.0f, 0},
+        {nvmath::vec3f(-6.2f, 9.6f, 20.18f), nvmath::vec3f(1.0f), 50.0f, 0},
+        {nvmath::vec3f(-0.23f, 6.93f, 12.21f), nvmath::vec3f(1.0f, 1.0f, 0.0f), 50.0f, 0},
+        {nvmath::vec3f(0.24f, 3.03f, 49.94f), nvmath::vec3f(0.0f, 0.0f, 1.0f), 50.0f, 0},
+    };
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <vector>
+
+#include "nvh/gltfscene.hpp"
+#include "shaders/host_device.h"
+
+//--------------------------------------------------------------------------------------------------
+// Light sources sampled by the next event estimation of the path tracer
+// - Emissive triangles: every triangle of a node whose material has an emissive factor, in world
+//   space. A triangle is picked with a probability proportional to its power (luminance of the
+//   emissive factor times its area), by a binary search of the cumulative distribution in the
+//   shader (shaders/light_sampling.glsl)
+//
+
+// The emissive triangles of 'scene' with their pdf and cdf, from the shading materials of its
+// prim meshes: a warm load restores those but not the glTF materials. Returns their total power
+float buildEmissiveTriangles(const nvh::GltfScene& scene, const std::vector<GltfPBRMaterial>& materials,
+                             std::vector<EmissiveTriangle>& triangles);
+
+// The point lights of the scenes without any
+std::vector<GltfLight> makeFallbackLights();
@@ -29,6 +29,8 @@
 #include "imgui.h"
 
 #include "hello_vulkan.h"
+#include "regression.h"
+#include "scene_manager.h"
 #include "imgui/imgui_camera_widget.h"
 #include "nvh/cameramanipulator.hpp"
 #include "nvh/fileoperations.hpp"
@@ -64,26 +66,173 @@ static void onErrorCallback(int error, const char* description)
 }
 
 // Extra UI
-void renderUI(HelloVulkan& helloVk)
+void renderUI(HelloVulkan& helloVk, SceneManager& sceneManager, RegressionHarness& regression, uint32_t sweepFrames)
 {
   bool changed = false;
+
+  // The scenes of config.json, loaded in place of the current one
+  if (ImGui::BeginCombo("Scene", sceneManager.getSceneName(sceneManager.getCurrent()).c_str()))
+  {
+    for (size_t i = 0; i < sceneManager.getSceneCount(); i++)
+    {
+      if (ImGui::Selectable(sceneManager.getSceneName(i).c_str(), i == sceneManager.getCurrent()))
+        sceneManager.load(i);
+    }
+    ImGui::EndCombo();
+  }
+  if (sceneManager.isSweeping())
+  {
+    ImGui::Text("Sweep: scene %zu / %zu", sceneManager.getCurrent() + 1, sceneManager.getSceneCount());
+    if (ImGui::Button("Stop sweep"))
+      sceneManager.stopSweep();
+  }
+  else if (ImGui::Button("Sweep all scenes"))
+  {
+    sceneManager.startSweep(sweepFrames);
+  }
+  for (const auto& result : sceneManager.getResults())
+    ImGui::Text("%s: %.0f / %.0f ms, %.3f ms/frame", result.name.c_str(), result.firstFrameTime, result.fullLoadTime, result.frameTime);
+
+  // Golden images of the regression cases of config.json, and the camera files they use
+  if (regression.isRunning())
+  {
+    ImGui::Text("Regression: case %zu / %zu", regression.getCurrent() + 1, regression.getCaseCount());
+  }
+  else
+  {
+    if (ImGui::Button("Run regression"))
+      regression.start(false);
+    ImGui::SameLine();
+    if (ImGui::Button("Update references"))
+      regression.start(true);
+  }
+  for (const auto& result : regression.getResults())
+    ImGui::Text("%s: %s, rel. RMSE %.5f, FLIP %.5f", result.name.c_str(), result.passed ? "pass" : "FAIL", result.relativeRmse, result.flipError);
+  if (ImGui::Button("Save camera"))
+    saveCamera("camera.json");
+  ImGui::SameLine();
+  if (ImGui::Button("Load camera"))
+    changed |= loadCamera("camera.json");
+
+  ImGui::Separator();
+
   changed |= ImGui::Checkbox("Limit Max Frames", &helloVk.m_stopAtMaxFrames);
   if (helloVk.m_stopAtMaxFrames)
       changed |= ImGui::SliderInt("Max Frames", &helloVk.m_maxFrames, 1, 100);
   changed |= ImGui::SliderInt("Bounces", &helloVk.m_pcRay.depth, 1, 30, "%d", ImGuiSliderFlags_Logarithmic);
+  changed |= ImGui::SliderInt("Russian roulette from", &helloVk.m_pcRay.rouletteDepth, 0, 30, helloVk.m_pcRay.rouletteDepth > 0 ? "bounce %d" : "off");
+
+  // Selection of the punctual light sampled at each bounce, and by the hybrid shadow rays
+  const char* lightSamplings[] = {"Uniform", "Light BVH", "Power (alias table)"};
+  int         lightSampling    = static_cast<int>(helloVk.m_pcRay.lightSampling);
+  if (ImGui::Combo("Light selection", &lightSampling, lightSamplings, IM_ARRAYSIZE(lightSamplings)))
+  {
+    helloVk.m_pcRay.lightSampling = static_cast<uint32_t>(lightSampling);
+    changed                       = true;
+  }
+  ImGui::Text("%zu lights, %zu BVH nodes", helloVk.m_lights.size(), helloVk.m_lightBvh.size());
+
+  // Random numbers of the paths, SAMPLER_*
+  const char* samplers[] = {"Random (LCG)", "Sobol (Owen-scrambled)", "Blue noise"};
+  int         sampler    = static_cast<int>(helloVk.m_pcRay.sampler);
+  if (ImGui::Combo("Sampler", &sampler, samplers, IM_ARRAYSIZE(samplers)))
+  {
+    helloVk.m_pcRay.sampler = static_cast<uint32_t>(sampler);
+    changed                 = true;
+  }
 
   ImGui::Separator();
 
   if (helloVk.m_pcPost.rtMode)
   {
       changed |= ImGui::SliderInt("Samples per pixel", &helloVk.m_pcRay.samples, 1, 100, "%d", ImGuiSliderFlags_Logarithmic);
+      changed |= ImGui::Checkbox("Emissive triangle lights", reinterpret_cast<bool*>(&helloVk.m_pcRay.emissiveLights));
+      ImGui::Text("%zu emissive triangles, %d spp accumulated", helloVk.m_emissiveTriangles.size(), helloVk.getAccumulatedSamples());
+
+      // Samples concentrated on the tiles with the highest error, until all are under the threshold
+      changed |= ImGui::Checkbox("Adaptive sampling", reinterpret_cast<bool*>(&helloVk.m_pcRay.adaptiveSampling));
+      if (helloVk.m_pcRay.adaptiveSampling)
+      {
+        changed |= ImGui::SliderFloat("Error threshold", &helloVk.m_adaptiveThreshold, 0.001f, 0.1f, "%.3f", ImGuiSliderFlags_Logarithmic);
+        changed |= ImGui::SliderInt("Min samples", &helloVk.m_adaptiveMinSamples, 2, 256, "%d", ImGuiSliderFlags_Logarithmic);
+        changed |= ImGui::SliderInt("Max samples", &helloVk.m_adaptiveMaxSamples, 16, 65536, "%d", ImGuiSliderFlags_Logarithmic);
+        const uint32_t tileCount = helloVk.m_tileCountX * helloVk.m_tileCountY;
+        if (helloVk.m_convergedTime >= 0.0f)
+          ImGui::Text("Converged at %.0f ms, %d frames, %.1f spp", helloVk.m_convergedTime, helloVk.m_convergedFrames, helloVk.m_averageSamples);
+        else if (helloVk.m_activeTiles <= tileCount)
+          ImGui::Text("%u / %u tiles active, %.1f spp", helloVk.m_activeTiles, tileCount, helloVk.m_averageSamples);
+      }
+      ImGui::Checkbox("View samples per pixel", reinterpret_cast<bool*>(&helloVk.m_pcPost.viewSampleCount));
+      if (helloVk.m_environmentWidth > 0)
+      {
+        changed |= ImGui::Checkbox("Environment lights", reinterpret_cast<bool*>(&helloVk.m_pcRay.environmentLights));
+        changed |= ImGui::SliderFloat("Environment intensity", &helloVk.m_pcRay.environmentIntensity, 0.0f, 10.0f, "%.2f",
+                                      ImGuiSliderFlags_Logarithmic);
+        ImGui::Text("Environment %ux%u", helloVk.m_environmentWidth, helloVk.m_environmentHeight);
+      }
+
+      // Noise at a given sample count, against an image accumulated with many more
+      if (ImGui::Button("Store reference"))
+        helloVk.storeReferenceImage();
+      if (!helloVk.m_referenceImage.empty())
+      {
+        ImGui::SameLine();
+        if (ImGui::Button("Compare"))
+          helloVk.compareToReference();
+        ImGui::Text("Reference: %d spp", helloVk.m_referenceSamples);
+      }
+      if (helloVk.m_referenceMse >= 0.0)
+        ImGui::Text("MSE %.4e at %d spp, %.0f ms (MSE x ms %.3e)", helloVk.m_referenceMse, helloVk.m_comparedSamples,
+                    helloVk.m_comparedTime, helloVk.m_referenceMse * helloVk.m_comparedTime);
   }
   else
   {
-      changed |= ImGui::Checkbox("Shadow Rays", reinterpret_cast<bool*>(&helloVk.m_pcRay.useShadows));
+      // ReSTIR replaces the unshadowed lights of the raster and the shadow ray to one light
+      if (ImGui::Checkbox("ReSTIR direct lighting", reinterpret_cast<bool*>(&helloVk.m_pcRay.restirDI)))
+      {
+        helloVk.m_restirReset = true;
+        changed               = true;
+      }
+      if (helloVk.m_pcRay.restirDI)
+      {
+        int candidates = static_cast<int>(helloVk.m_pcRay.restirCandidates);
+        if (ImGui::SliderInt("Light candidates", &candidates, 1, 64))
+        {
+          helloVk.m_pcRay.restirCandidates = static_cast<uint32_t>(candidates);
+          changed                          = true;
+        }
+      }
+      else
+        changed |= ImGui::Checkbox("Shadow Rays", reinterpret_cast<bool*>(&helloVk.m_pcRay.useShadows));
       changed |= ImGui::Checkbox("Ambient Occlusion", reinterpret_cast<bool*>(&helloVk.m_pcRay.useAO));
       changed |= ImGui::Checkbox("Global Illumination", reinterpret_cast<bool*>(&helloVk.m_pcRay.useGI));
+      if (helloVk.m_pcRay.useGI && ImGui::Checkbox("ReSTIR GI", reinterpret_cast<bool*>(&helloVk.m_pcRay.restirGI)))
+      {
+        helloVk.m_restirReset = true;
+        changed               = true;
+      }
+      // The probes start over from the current lights and geometry
+      if (helloVk.m_pcRay.useGI && ImGui::Checkbox("Probe volume GI", reinterpret_cast<bool*>(&helloVk.m_pcRay.probeGI)))
+      {
+        helloVk.m_probeVolume.updates = 0;
+        helloVk.m_restirReset         = true;
+        changed                       = true;
+      }
       changed |= ImGui::Checkbox("View Ray Traced effects", reinterpret_cast<bool*>(&helloVk.m_pcPost.viewAccumulated));
+
+      // Noise of the ray traced effects after some frames, against many more of plain accumulation
+      if (ImGui::Button("Store reference"))
+        helloVk.storeReferenceImage();
+      if (!helloVk.m_referenceImage.empty())
+      {
+        ImGui::SameLine();
+        if (ImGui::Button("Compare"))
+          helloVk.compareToReference();
+        ImGui::Text("Reference: %d frames", helloVk.m_referenceSamples);
+      }
+      if (helloVk.m_referenceMse >= 0.0)
+        ImGui::Text("MSE %.4e after %d frames, %.1f ms (MSE x ms %.3e)", helloVk.m_referenceMse, helloVk.m_comparedSamples,
+                    helloVk.m_comparedTime, helloVk.m_referenceMse * helloVk.m_comparedTime);
   }
 
   // TODO: change to work correctly with light buffers
@@ -98,6 +247,53 @@ void renderUI(HelloVulkan& helloVk)
   //}
   ImGui::Separator();
 
+  // Nodes outside the frustum are culled on the CPU, then the meshlets of the others on the GPU
+  ImGui::Checkbox("Node frustum culling", &helloVk.m_nodeCulling);
+  if (helloVk.m_nodeCulling)
+    ImGui::Text("%zu / %zu nodes visible, %.3f ms (%s)", helloVk.m_visibleNodes.size(), helloVk.m_cullNodes.size(),
+                helloVk.m_nodeCullTime, getCullingSimdName());
+  ImGui::Checkbox("Cluster culling", &helloVk.m_clusterCulling);
+  if (helloVk.m_clusterCulling)
+  {
+    bool backface = (helloVk.m_cullFlags & CULL_BACKFACE) != 0;
+    if (ImGui::Checkbox("Cull back facing clusters", &backface))
+      helloVk.m_cullFlags = backface ? (helloVk.m_cullFlags | CULL_BACKFACE) : (helloVk.m_cullFlags & ~CULL_BACKFACE);
+    ImGui::Checkbox("Occlusion culling (Hi-Z)", &helloVk.m_occlusionCulling);
+  }
+  ImGui::Text("%u meshlets, %u instances", helloVk.m_meshletCount, helloVk.m_drawCount);
+
+  // LOD levels of the raster, and the proxy level traced by the hybrid shadow and AO rays
+  ImGui::Checkbox("LOD selection", &helloVk.m_lodSelection);
+  if (helloVk.m_lodSelection)
+    ImGui::SliderFloat("LOD pixel error", &helloVk.m_lodPixelError, 0.25f, 16.0f, "%.2f", ImGuiSliderFlags_Logarithmic);
+  changed |= ImGui::Checkbox("Proxy geometry for shadow/AO rays", &helloVk.m_proxyShadows);
+
+  // GPU times, to compare the vertex layouts and other settings
+  for (const char* name : {"Cluster culling", "Raster", "Hi-Z", "Occlusion culling", "Raster (occluded)", "Probe volume", "Ray trace (hybrid)", "Path trace", "Adaptive sampling"})
+  {
+    nvh::Profiler::TimerInfo info;
+    if (helloVk.m_profiler.getTimerInfo(name, info))
+      ImGui::Text("%s: %.3f ms", name, info.gpu.average / 1000.0);
+  }
+  ImGui::Text("Vertex layout: %s", (helloVk.m_vertexFlags & VERTEX_QUANTIZED_POSITIONS) ? "compressed, quantized positions" :
+                                   (helloVk.m_vertexFlags & VERTEX_COMPRESSED)          ? "compressed" :
+                                                                                          "float");
+
+  ImGui::Separator();
+
+  // Background load: nodes are traced once their BLASes are built, textures sharpen as mips arrive
+  ImGui::Text("Scene: %s", helloVk.getLoadStageName());
+  ImGui::Text("BLAS %u / %u, nodes %u / %zu", helloVk.m_accel.getBuiltBlasCount(), helloVk.m_accel.getBlasCount(),
+              helloVk.m_readyNodeCount, helloVk.m_nodeReady.size());
+  ImGui::Text("Textures %zu / %zu", helloVk.m_textureStreamer.getCompleteCount(), helloVk.m_textureStreamer.getImageCount());
+  if (helloVk.m_timeToFirstFrame >= 0)
+    ImGui::Text("First interactive frame: %.1f ms", helloVk.m_timeToFirstFrame);
+  if (helloVk.m_fullLoadTime >= 0)
+    ImGui::Text("Fully loaded: %.1f ms", helloVk.m_fullLoadTime);
+  ImGui::Text("Previous scene freed in %.1f ms", helloVk.m_unloadTime);
+
+  ImGui::Separator();
+
   changed |= ImGuiH::CameraWidget();
 
   if(changed)
@@ -116,7 +312,18 @@ void renderUI(HelloVulkan& helloVk)
 //
 int main(int argc, char** argv)
 {
-  UNUSED(argc);
+  // --regression renders the cases of config.json and compares them to their references,
+  // --update-references writes them. Both exit once done, with 1 if a case failed
+  bool runRegression    = false;
+  bool updateReferences = false;
+  for(int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    if(arg == "--regression")
+      runRegression = true;
+    else if(arg == "--update-references")
+      updateReferences = true;
+  }
 
   // setup some basic things for the sample, logging file for example
   NVPSystem system(PROJECT_NAME);
@@ -129,19 +336,72 @@ int main(int argc, char** argv)
   };
 
   // Read configuration file
-  std::string path;
+  std::vector<std::string> scenes;
+  size_t sceneId;
   bool vsync;
+  bool sceneCache;
+  bool compressVertices;
+  bool quantizePositions;
+  bool optimizeMeshes;
+  bool optimizeOverdraw;
+  bool generateLods;
+  uint32_t proxyLodLevel;
+  uint32_t stagingBudgetMB;
+  uint32_t maxTextures;
+  uint32_t blasTrianglesPerFrame;
+  uint32_t textureUploadMBPerFrame;
+  uint32_t sweepFrames;
+  std::string environment;
+  float environmentIntensity;
+  std::vector<RegressionCase> regressionCases;
+  std::string referenceDir;
+  double rmseTolerance;
+  double flipTolerance;
   int SAMPLE_WIDTH;
   int SAMPLE_HEIGHT;
   {
       using json = nlohmann::json;
-      std::ifstream f(nvh::findFile("config.json", defaultSearchPaths, true));
+      const std::string configFile = nvh::findFile("config.json", defaultSearchPaths, true);
+      std::ifstream f(configFile);
       json data = json::parse(f);
-      int id = data["scene"];
-      path = data["scenes"][id];
+      scenes = data["scenes"].get<std::vector<std::string>>();
+      sceneId = data["scene"];
       vsync = data["vsync"];
       SAMPLE_WIDTH = data["width"];
       SAMPLE_HEIGHT = data["height"];
+      sceneCache = data.value("sceneCache", true);
+      stagingBudgetMB = data.value("stagingBudgetMB", 256u);
+      compressVertices = data.value("compressVertices", false);
+      quantizePositions = data.value("quantizePositions", false);
+      optimizeMeshes = data.value("optimizeMeshes", true);
+      optimizeOverdraw = data.value("optimizeOverdraw", false);
+      generateLods = data.value("generateLods", true);
+      proxyLodLevel = data.value("proxyLodLevel", 2u);
+      maxTextures = data.value("maxTextures", 1024u);
+      blasTrianglesPerFrame = data.value("blasTrianglesPerFrame", 1000000u);
+      textureUploadMBPerFrame = data.value("textureUploadMBPerFrame", 16u);
+      sweepFrames = data.value("sweepFrames", 256u);
+      environment = data.value("environment", std::string());
+      environmentIntensity = data.value("environmentIntensity", 1.0f);
+
+      // Paths of the regression section are relative to config.json
+      const size_t      slash     = configFile.find_last_of("/\\");
+      const std::string configDir = slash == std::string::npos ? std::string() : configFile.substr(0, slash + 1);
+      const json regression = data.value("regression", json::object());
+      referenceDir = configDir + regression.value("references", std::string("media/references"));
+      rmseTolerance = regression.value("rmseTolerance", 0.02);
+      flipTolerance = regression.value("flipTolerance", 0.01);
+      for (const auto& entry : regression.value("cases", json::array()))
+      {
+          RegressionCase rc;
+          rc.name = entry.at("name").get<std::string>();
+          rc.scene = entry.value("scene", size_t(0));
+          rc.camera = configDir + entry.value("camera", std::string());
+          rc.frames = entry.value("frames", rc.frames);
+          rc.samples = entry.value("samples", rc.samples);
+          rc.sampler = entry.value("sampler", rc.sampler);
+          regressionCases.push_back(rc);
+      }
   }
 
   // Setup GLFW window
@@ -186,8 +446,6 @@ int main(int argc, char** argv)
   vk::PhysicalDeviceRayTracingPipelineFeaturesKHR rtPipelineFeature{};
   contextInfo.addDeviceExtension(VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME, false, &rtPipelineFeature);
   contextInfo.addDeviceExtension(VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME);
-  VkPhysicalDeviceShaderClockFeaturesKHR clockFeature{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_CLOCK_FEATURES_KHR};
-  contextInfo.addDeviceExtension(VK_KHR_SHADER_CLOCK_EXTENSION_NAME, false, &clockFeature);
   contextInfo.addDeviceExtension(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME);
 
   // Creating Vulkan base application
@@ -206,6 +464,7 @@ int main(int argc, char** argv)
   const VkSurfaceKHR surface = helloVk.getVkSurface(vkctx.m_instance, window);
   vkctx.setGCTQueueWithPresent(surface);
 
+  helloVk.m_stagingBudgetMB = stagingBudgetMB;
   helloVk.setup(vkctx.m_instance, vkctx.m_device, vkctx.m_physicalDevice, vkctx.m_queueGCT.familyIndex);
   helloVk.createSwapchain(surface, SAMPLE_WIDTH, SAMPLE_HEIGHT, VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_UNDEFINED, vsync/* vsync true*/);
   helloVk.createDepthBuffer();
@@ -223,27 +482,55 @@ int main(int argc, char** argv)
   //helloVk.loadModel(nvh::findFile("media/scenes/sphere.obj", defaultSearchPaths, true),
                     //nvmath::scale_mat4(nvmath::vec3f(1.5f)) * nvmath::translation_mat4(nvmath::vec3f(0.0f, 1.0f, 0.0f)));
   //helloVk.loadScene(nvh::findFile("media/scenes/Sponza.gltf", defaultSearchPaths, true));
-  helloVk.loadGltfScene(nvh::findFile(path, defaultSearchPaths, true));
-
+  helloVk.m_useSceneCache = sceneCache;
+  helloVk.m_compressVertices = compressVertices;
+  helloVk.m_quantizePositions = quantizePositions;
+  helloVk.m_optimizeMeshes = optimizeMeshes;
+  helloVk.m_optimizeOverdraw = optimizeOverdraw;
+  helloVk.m_generateLods = generateLods;
+  helloVk.m_proxyLodLevel = proxyLodLevel;
+  helloVk.m_maxTextures = maxTextures;
+  helloVk.m_blasTrianglesPerFrame = blasTrianglesPerFrame;
+  helloVk.m_textureUploadMBPerFrame = textureUploadMBPerFrame;
+
+  // Everything but the scene, the window renders while it loads
   helloVk.createOffscreenRender();
   helloVk.createDescriptorSetLayout();
   helloVk.createGraphicsPipeline();
+  helloVk.createCullPipeline();
   helloVk.createUniformBuffer();
+  helloVk.createDefaultTexture();
+  helloVk.createEnvironment(environment.empty() ? environment : nvh::findFile(environment, defaultSearchPaths, true));
+  helloVk.createSampler();
   // helloVk.createObjDescriptionBuffer();
   helloVk.updateDescriptorSet();
 
   helloVk.initRayTracing();
-  helloVk.createBottomLevelASGltf();
-  helloVk.createTopLevelAsGltf();
+  helloVk.m_pcRay.environmentIntensity = environmentIntensity;
   helloVk.createRtDescriptorSet();
   helloVk.createRtPipeline();
+  helloVk.createAdaptivePipeline();
   helloVk.createHybridRtPipeline();
+  helloVk.createProbePipelines();
   //helloVk.createRtShaderBindingTable();
 
   helloVk.createPostDescriptor();
   helloVk.createPostPipeline();
   helloVk.updatePostDescriptorSet();
 
+  // Imported on a thread, then its acceleration structures and textures streamed in by updateSceneLoad().
+  // The other scenes of the list replace it from the UI
+  for (auto& scene : scenes)
+    scene = nvh::findFile(scene, defaultSearchPaths, true);
+  SceneManager sceneManager;
+  sceneManager.init(&helloVk, scenes);
+  sceneManager.load(sceneId);
+
+  RegressionHarness regression;
+  regression.init(&helloVk, &sceneManager, regressionCases, referenceDir, rmseTolerance, flipTolerance);
+  if(runRegression || updateReferences)
+    regression.start(updateReferences);
+
   nvmath::vec4f clearColor = nvmath::vec4f(1, 1, 1, 1.00f);
 
 
@@ -440,14 +727,23 @@ int main(int argc, char** argv)
   // Main loop
   while(!glfwWindowShouldClose(window))
   {
+    if((runRegression || updateReferences) && regression.isDone())
+      break;
     glfwPollEvents();
     if(helloVk.isMinimized())
       continue;
 
+    helloVk.m_profiler.beginFrame();
+
     // Start the Dear ImGui frame
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
 
+    // Scene buffers once imported, then a few BLASes and texture mips per frame
+    helloVk.updateSceneLoad();
+    sceneManager.update();
+    regression.update();
+
     // Show UI window.
     if(helloVk.showGui())
     {
@@ -455,7 +751,7 @@ int main(int argc, char** argv)
       ImGuiH::Panel::Begin();
       changed |= ImGui::ColorEdit3("Clear color", reinterpret_cast<float*>(&clearColor));
       changed |= ImGui::Checkbox("Path Tracer mode", reinterpret_cast<bool*>(&helloVk.m_pcPost.rtMode));
-      renderUI(helloVk);
+      renderUI(helloVk, sceneManager, regression, sweepFrames);
       ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
       ImGuiH::Control::Info("", "", "(F11) Toggle Pane", ImGuiH::Control::Flags::Disabled);
       ImGuiH::Panel::End();
@@ -475,6 +771,9 @@ int main(int argc, char** argv)
     beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     vkBeginCommandBuffer(cmdBuf, &beginInfo);
 
+    // TLAS rebuild and texture descriptors of the load, before anything uses them
+    helloVk.updateSceneFrame(cmdBuf);
+
     // Updating camera buffer
     helloVk.updateUniformBuffer(cmdBuf);
 
@@ -503,16 +802,35 @@ int main(int argc, char** argv)
 
       helloVk.updateFrame();
 
-      if(helloVk.m_pcPost.rtMode == 1)
+      if(!helloVk.isSceneCreated())
+      {
+        // Still importing, only clear
+        vkCmdBeginRenderPass(cmdBuf, &offscreenRenderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+        vkCmdEndRenderPass(cmdBuf);
+      }
+      else if(helloVk.m_pcPost.rtMode == 1)
       {
         helloVk.pathtrace(cmdBuf, clearColor);
+        helloVk.updateAdaptiveSampling(cmdBuf);
       }
       else
       {
         // Rendering Scene
+        helloVk.cullScene(cmdBuf);
         vkCmdBeginRenderPass(cmdBuf, &offscreenRenderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
         helloVk.rasterizeGltf(cmdBuf);
         vkCmdEndRenderPass(cmdBuf);
+        if(helloVk.useOcclusionCulling())
+        {
+          // What the first phase found hidden, against the depth it drew, then the next frame's pyramid
+          helloVk.buildHiz(cmdBuf);
+          helloVk.cullOccludedClusters(cmdBuf);
+          offscreenRenderPassBeginInfo.renderPass = helloVk.m_offscreenLoadRenderPass;
+          vkCmdBeginRenderPass(cmdBuf, &offscreenRenderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+          helloVk.rasterizeGltf(cmdBuf, 1);
+          vkCmdEndRenderPass(cmdBuf);
+          helloVk.buildHiz(cmdBuf);
+        }
 
         std::vector<VkImageMemoryBarrier> imageMemoryBarriers;
         VkImageMemoryBarrier barrier = {};
@@ -544,6 +862,7 @@ int main(int argc, char** argv)
             static_cast<uint32_t>(imageMemoryBarriers.size()), imageMemoryBarriers.data()
         );
 
+        helloVk.updateProbeVolume(cmdBuf);
         helloVk.raytraceRasterizedScene(cmdBuf);
 
         barrier.image = helloVk.m_accumulatedTexture.image;
@@ -627,6 +946,7 @@ int main(int argc, char** argv)
     // Submit for display
     vkEndCommandBuffer(cmdBuf);
     helloVk.submitFrame();
+    helloVk.m_profiler.endFrame();
   }
 
   // Cleanup
@@ -648,5 +968,6 @@ int main(int argc, char** argv)
   glfwDestroyWindow(window);
   glfwTerminate();
 
-  return 0;
+  // Closing the window before the last case is a failure too
+  return (runRegression || updateReferences) && (!regression.isDone() || regression.hasFailed()) ? 1 : 0;
 }
@@ -0,0 +1,408 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <numeric>
+
+#include "nvh/parallel_work.hpp"
+
+void MeshOptimizerStats::add(const MeshOptimizerStats& other)
+{
+    triangles += other.triangles;
+    vertices += other.vertices;
+    cacheMisses += other.cacheMisses;
+    degenerates += other.degenerates;
+}
+
+//--------------------------------------------------------------------------------------------------
+// FIFO cache simulation with timestamps: a vertex is cached if it missed less than 'cacheSize' misses ago
+//
+struct FifoCache
+{
+    std::vector<uint32_t> missTime;
+    uint32_t              cacheSize;
+    uint32_t              time;
+
+    FifoCache(uint32_t vertexCount, uint32_t size)
+        : missTime(vertexCount, 0)
+        , cacheSize(size)
+        , time(size + 1)
+    {
+    }
+
+    uint32_t access(uint32_t v)
+    {
+        if (time - missTime[v] <= cacheSize)
+            return 0;
+        missTime[v] = time++;
+        return 1;
+    }
+    uint32_t accessTriangle(const uint32_t* tri) { return access(tri[0]) + access(tri[1]) + access(tri[2]); }
+    void     flush() { time += cacheSize + 1; }
+};
+
+uint64_t simulateVertexCache(const std::vector<uint32_t>& indices, uint32_t vertexCount, uint32_t cacheSize)
+{
+    FifoCache cache(vertexCount, cacheSize);
+    uint64_t  misses = 0;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+        misses += cache.accessTriangle(&indices[i]);
+    return misses;
+}
+
+size_t removeDegenerateTriangles(std::vector<uint32_t>& indices, const nvmath::vec3f* positions)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        const uint32_t a = indices[i], b = indices[i + 1], c = indices[i + 2];
+        if (a == b || b == c || a == c)
+            continue;
+        if (positions[a] == positions[b] || positions[b] == positions[c] || positions[a] == positions[c])
+            continue;
+        indices[kept++] = a;
+        indices[kept++] = b;
+        indices[kept++] = c;
+    }
+    const size_t removed = (indices.size() - kept) / 3;
+    indices.resize(kept);
+    return removed;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Forsyth vertex cache optimization
+// - Vertices are scored on their position in a simulated LRU cache and on their number of
+//   remaining triangles, the next triangle is the best scored one sharing a vertex with the cache
+//
+static constexpr int   kMaxCacheSize      = 32;
+static constexpr float kCacheDecayPower   = 1.5f;
+static constexpr float kLastTriScore      = 0.75f;
+static constexpr float kValenceBoostScale = 2.0f;
+static constexpr float kValenceBoostPower = 0.5f;
+
+static float vertexScore(int cachePosition, uint32_t remainingTriangles)
+{
+    if (remainingTriangles == 0)
+        return -1.0f;
+
+    float score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        // The vertices of the last triangle get a fixed score, so it is not simply reused
+        if (cachePosition < 3)
+            score = kLastTriScore;
+        else
+            score = std::pow(1.0f - float(cachePosition - 3) / float(kMaxCacheSize - 3), kCacheDecayPower);
+    }
+    // Vertices with few triangles left are finished first, to avoid leaving isolated triangles
+    return score + kValenceBoostScale * std::pow(float(remainingTriangles), -kValenceBoostPower);
+}
+
+void optimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertexCount)
+{
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // Remaining triangles of each vertex, as a compact adjacency list
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    std::vector<uint32_t> remaining(vertexCount, 0);
+    for (uint32_t v : indices)
+        remaining[v]++;
+    for (uint32_t v = 0; v < vertexCount; v++)
+        offsets[v + 1] = offsets[v] + remaining[v];
+    std::vector<uint32_t> adjacency(indices.size());
+    {
+        std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+        for (size_t t = 0; t < triangleCount; t++)
+            for (int k = 0; k < 3; k++)
+                adjacency[cursor[indices[t * 3 + k]]++] = static_cast<uint32_t>(t);
+    }
+
+    std::vector<int>   cachePosition(vertexCount, -1);
+    std::vector<float> vScore(vertexCount);
+    for (uint32_t v = 0; v < vertexCount; v++)
+        vScore[v] = vertexScore(-1, remaining[v]);
+    std::vector<float> tScore(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++)
+        tScore[t] = vScore[indices[t * 3]] + vScore[indices[t * 3 + 1]] + vScore[indices[t * 3 + 2]];
+
+    std::vector<bool>     emitted(triangleCount, false);
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    std::vector<uint32_t> cache, newCache, touched;
+    cache.reserve(kMaxCacheSize + 3);
+
+    int64_t best     = std::max_element(tScore.begin(), tScore.end()) - tScore.begin();
+    size_t  fallback = 0;
+    for (size_t n = 0; n < triangleCount; n++)
+    {
+        if (best < 0)
+        {
+            // Nothing left around the cache, continue with the next triangle in input order
+            while (emitted[fallback])
+                fallback++;
+            best = static_cast<int64_t>(fallback);
+        }
+
+        const uint32_t* tri = &indices[best * 3];
+        emitted[best]       = true;
+        result.insert(result.end(), tri, tri + 3);
+
+        for (int k = 0; k < 3; k++)
+        {
+            const uint32_t v     = tri[k];
+            uint32_t*      first = adjacency.data() + offsets[v];
+            uint32_t*      last  = first + remaining[v] - 1;
+            std::iter_swap(std::find(first, last + 1, static_cast<uint32_t>(best)), last);
+            remaining[v]--;
+        }
+
+        // LRU update, the triangle's vertices move to the front
+        newCache.assign(tri, tri + 3);
+        for (uint32_t v : cache)
+        {
+            if (v != tri[0] && v != tri[1] && v != tri[2])
+                newCache.push_back(v);
+        }
+        touched.clear();
+        for (size_t i = 0; i < newCache.size(); i++)
+        {
+            cachePosition[newCache[i]] = i < kMaxCacheSize ? static_cast<int>(i) : -1;
+            touched.push_back(newCache[i]);
+        }
+        if (newCache.size() > kMaxCacheSize)
+            newCache.resize(kMaxCacheSize);
+        std::swap(cache, newCache);
+
+        for (uint32_t v : touched)
+            vScore[v] = vertexScore(cachePosition[v], remaining[v]);
+
+        best            = -1;
+        float bestScore = -1.0f;
+        for (uint32_t v : touched)
+        {
+            for (uint32_t i = 0; i < remaining[v]; i++)
+            {
+                const uint32_t  t    = adjacency[offsets[v] + i];
+                const uint32_t* tv   = &indices[t * 3];
+                tScore[t]            = vScore[tv[0]] + vScore[tv[1]] + vScore[tv[2]];
+                if (cachePosition[v] >= 0 && tScore[t] > bestScore)
+                {
+                    bestScore = tScore[t];
+                    best      = t;
+                }
+            }
+        }
+    }
+
+    indices = std::move(result);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Overdraw reduction on a cache optimized index buffer
+// - Clusters are split where the cache restarts (hard boundaries) and, inside them, wherever the
+//   running miss rate is already within 'threshold' of the whole cluster (soft boundaries)
+// - Clusters facing away from the mesh center are drawn first, they are more likely to occlude
+//
+void optimizeOverdraw(std::vector<uint32_t>& indices, const nvmath::vec3f* positions, uint32_t vertexCount, float threshold)
+{
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount < 2)
+        return;
+
+    FifoCache             cache(vertexCount, kStatsCacheSize);
+    std::vector<uint32_t> hard;
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        if (cache.accessTriangle(&indices[t * 3]) == 3)
+            hard.push_back(static_cast<uint32_t>(t));
+    }
+    hard.push_back(static_cast<uint32_t>(triangleCount));
+
+    std::vector<uint32_t> clusters;
+    for (size_t h = 0; h + 1 < hard.size(); h++)
+    {
+        const uint32_t start = hard[h], end = hard[h + 1];
+
+        cache.flush();
+        uint32_t clusterMisses = 0;
+        for (uint32_t t = start; t < end; t++)
+            clusterMisses += cache.accessTriangle(&indices[t * 3]);
+        const float clusterThreshold = threshold * float(clusterMisses) / float(end - start);
+
+        cache.flush();
+        clusters.push_back(start);
+        uint32_t runningMisses = 0, runningTriangles = 0;
+        for (uint32_t t = start; t < end; t++)
+        {
+            runningMisses += cache.accessTriangle(&indices[t * 3]);
+            runningTriangles++;
+            if (t + 1 < end && float(runningMisses) <= clusterThreshold * float(runningTriangles))
+            {
+                clusters.push_back(t + 1);
+                cache.flush();
+                runningMisses = runningTriangles = 0;
+            }
+        }
+    }
+    clusters.push_back(static_cast<uint32_t>(triangleCount));
+
+    // Area weighted centroid and normal of every cluster
+    const size_t               clusterCount = clusters.size() - 1;
+    std::vector<nvmath::vec3f> centroids(clusterCount, nvmath::vec3f(0.0f));
+    std::vector<nvmath::vec3f> normals(clusterCount, nvmath::vec3f(0.0f));
+    std::vector<float>         areas(clusterCount, 0.0f);
+    nvmath::vec3f              meshCentroid(0.0f);
+    float                      meshArea = 0.0f;
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        for (uint32_t t = clusters[c]; t < clusters[c + 1]; t++)
+        {
+            const nvmath::vec3f& p0 = positions[indices[t * 3]];
+            const nvmath::vec3f& p1 = positions[indices[t * 3 + 1]];
+            const nvmath::vec3f& p2 = positions[indices[t * 3 + 2]];
+            const nvmath::vec3f  n  = nvmath::cross(p1 - p0, p2 - p0);
+            const float          a  = nvmath::length(n);
+            centroids[c] += (p0 + p1 + p2) * (a / 3.0f);
+            normals[c] += n;
+            areas[c] += a;
+        }
+        meshCentroid += centroids[c];
+        meshArea += areas[c];
+        if (areas[c] > 0.0f)
+            centroids[c] /= areas[c];
+    }
+    if (meshArea > 0.0f)
+        meshCentroid /= meshArea;
+
+    std::vector<float> keys(clusterCount, 0.0f);
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        const float len = nvmath::length(normals[c]);
+        if (len > 0.0f)
+            keys[c] = nvmath::dot(centroids[c] - meshCentroid, normals[c] / len);
+    }
+
+    std::vector<uint32_t> order(clusterCount);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    for (uint32_t c : order)
+        result.insert(result.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+    indices = std::move(result);
+}
+
+std::vector<uint32_t> optimizeVertexFetch(std::vector<uint32_t>& indices, uint32_t vertexCount)
+{
+    std::vector<uint32_t> remap(vertexCount, ~0u);
+    uint32_t              next = 0;
+    for (uint32_t& v : indices)
+    {
+        if (remap[v] == ~0u)
+            remap[v] = next++;
+        v = remap[v];
+    }
+    for (uint32_t& r : remap)
+    {
+        if (r == ~0u)
+            r = next++;
+    }
+    return remap;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+//
+struct MeshJob
+{
+    uint32_t              firstIndex;
+    uint32_t              indexCount;
+    uint32_t              vertexOffset;
+    uint32_t              vertexCount;
+    bool                  ownsVertices;  // False when another job uses the same vertices with other indices
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> remap;
+    MeshOptimizerStats    before;
+    MeshOptimizerStats    after;
+};
+
+template <typename T>
+static void remapVertices(std::vector<T>& attribute, const MeshJob& job)
+{
+    if (job.remap.empty() || attribute.size() < size_t(job.vertexOffset) + job.vertexCount)
+        return;
+    std::vector<T> reordered(job.vertexCount);
+    for (uint32_t v = 0; v < job.vertexCount; v++)
+        reordered[job.remap[v]] = attribute[job.vertexOffset + v];
+    std::copy(reordered.begin(), reordered.end(), attribute.begin() + job.vertexOffset);
+}
+
+void optimizeMeshes(nvh::GltfScene& scene, bool reduceOverdraw, MeshOptimizerStats& before, MeshOptimizerStats& after)
+{
+    std::vector<MeshJob>                            jobs;
+    std::vector<size_t>                             primJobs;
+    std::map<std::pair<uint32_t, uint32_t>, size_t> jobOfRange;
+    std::map<uint32_t, uint32_t>                    jobsPerVertexRange;
+    for (const auto& primMesh : scene.m_primMeshes)
+    {
+        auto inserted = jobOfRange.insert({{primMesh.firstIndex, primMesh.vertexOffset}, jobs.size()});
+        if (inserted.second)
+        {
+            jobs.push_back({primMesh.firstIndex, primMesh.indexCount, primMesh.vertexOffset, primMesh.vertexCount, true});
+            jobsPerVertexRange[primMesh.vertexOffset]++;
+        }
+        primJobs.push_back(inserted.first->second);
+    }
+    for (auto& job : jobs)
+        job.ownsVertices = jobsPerVertexRange[job.vertexOffset] == 1;
+
+    nvh::parallel_batches<1>(jobs.size(), [&](uint64_t i) {
+        MeshJob&             job       = jobs[i];
+        const nvmath::vec3f* positions = scene.m_positions.data() + job.vertexOffset;
+        job.indices.assign(scene.m_indices.begin() + job.firstIndex, scene.m_indices.begin() + job.firstIndex + job.indexCount);
+
+        job.before.triangles   = job.indices.size() / 3;
+        job.before.vertices    = job.vertexCount;
+        job.before.cacheMisses = simulateVertexCache(job.indices, job.vertexCount, kStatsCacheSize);
+
+        job.after.degenerates = removeDegenerateTriangles(job.indices, positions);
+        optimizeVertexCache(job.indices, job.vertexCount);
+        if (reduceOverdraw)
+            optimizeOverdraw(job.indices, positions, job.vertexCount);
+        if (job.ownsVertices)
+            job.remap = optimizeVertexFetch(job.indices, job.vertexCount);
+
+        job.after.triangles   = job.indices.size() / 3;
+        job.after.vertices    = job.vertexCount;
+        job.after.cacheMisses = simulateVertexCache(job.indices, job.vertexCount, kStatsCacheSize);
+    });
+
+    // Indices are repacked since degenerate triangles were removed, vertices are permuted in place
+    std::vector<uint32_t> indices;
+    indices.reserve(scene.m_indices.size());
+    for (auto& job : jobs)
+    {
+        job.firstIndex = static_cast<uint32_t>(indices.size());
+        job.indexCount = static_cast<uint32_t>(job.indices.size());
+        indices.insert(indices.end(), job.indices.begin(), job.indices.end());
+
+        remapVertices(scene.m_positions, job);
+        remapVertices(scene.m_normals, job);
+        remapVertices(scene.m_tangents, job);
+        remapVertices(scene.m_texcoords0, job);
+
+        before.add(job.before);
+        after.add(job.after);
+    }
+    scene.m_indices = std::move(indices);
+
+    for (size_t p = 0; p < scene.m_primMeshes.size(); p++)
+    {
+        scene.m_primMeshes[p].firstIndex = jobs[primJobs[p]].firstIndex;
+        scene.m_primMeshes[p].indexCount = jobs[primJobs[p]].indexCount;
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "nvh/gltfscene.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// Import-time reordering of the primitive meshes of a scene
+// - Degenerate triangles (repeated index or position) are removed
+// - Triangles are reordered for the post-transform vertex cache (Forsyth, "Linear-Speed Vertex
+//   Cache Optimisation")
+// - Optionally, clusters of triangles are then sorted to draw the outer surfaces first (Sander et al.,
+//   "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw")
+// - Vertices are renumbered in order of first use, for fetch locality in the vertex and hit shaders
+// Indices are local to their primitive mesh, as in nvh::GltfScene
+//
+struct MeshOptimizerStats
+{
+    uint64_t triangles{0};
+    uint64_t vertices{0};
+    uint64_t cacheMisses{0};  // Simulated FIFO cache of kStatsCacheSize entries
+    uint64_t degenerates{0};
+
+    double getAcmr() const { return triangles > 0 ? double(cacheMisses) / triangles : 0.0; }  // Misses per triangle
+    double getAtvr() const { return vertices > 0 ? double(cacheMisses) / vertices : 0.0; }    // Misses per vertex, 1 is ideal
+
+    void add(const MeshOptimizerStats& other);
+};
+
+constexpr uint32_t kStatsCacheSize = 16;
+
+// Optimizes all primitive meshes in parallel. Meshes sharing their vertices and indices are processed once.
+void optimizeMeshes(nvh::GltfScene& scene, bool reduceOverdraw, MeshOptimizerStats& before, MeshOptimizerStats& after);
+
+// Building blocks, on the indices of one primitive mesh
+size_t   removeDegenerateTriangles(std::vector<uint32_t>& indices, const nvmath::vec3f* positions);
+void     optimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertexCount);
+void     optimizeOverdraw(std::vector<uint32_t>& indices, const nvmath::vec3f* positions, uint32_t vertexCount, float threshold = 1.05f);
+uint64_t simulateVertexCache(const std::vector<uint32_t>& indices, uint32_t vertexCount, uint32_t cacheSize);
+// Renumbers the vertices in order of first use, returns the new index of each old vertex (unused ones go last)
+std::vector<uint32_t> optimizeVertexFetch(std::vector<uint32_t>& indices, uint32_t vertexCount);
@@ -0,0 +1,348 @@
+#include "mesh_simplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+
+#include "mesh_optimizer.h"
+#include "nvh/parallel_work.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// Symmetric 4x4 matrix of a sum of plane quadrics, with the total area it was weighted with
+//
+struct Quadric
+{
+    double a00{0}, a01{0}, a02{0}, a03{0};
+    double a11{0}, a12{0}, a13{0};
+    double a22{0}, a23{0};
+    double a33{0};
+    double weight{0};
+
+    void addPlane(double x, double y, double z, double d, double w)
+    {
+        a00 += w * x * x, a01 += w * x * y, a02 += w * x * z, a03 += w * x * d;
+        a11 += w * y * y, a12 += w * y * z, a13 += w * y * d;
+        a22 += w * z * z, a23 += w * z * d;
+        a33 += w * d * d;
+        weight += w;
+    }
+
+    void add(const Quadric& q)
+    {
+        a00 += q.a00, a01 += q.a01, a02 += q.a02, a03 += q.a03;
+        a11 += q.a11, a12 += q.a12, a13 += q.a13;
+        a22 += q.a22, a23 += q.a23;
+        a33 += q.a33;
+        weight += q.weight;
+    }
+
+    // Mean squared distance of p to the planes
+    double evaluate(const nvmath::vec3f& p) const
+    {
+        const double x = p.x, y = p.y, z = p.z;
+        const double e = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x + a11 * y * y + 2 * a12 * y * z
+                         + 2 * a13 * y + a22 * z * z + 2 * a23 * z + a33;
+        return weight > 0 ? std::max(e, 0.0) / weight : 0.0;
+    }
+};
+
+static float collapseError(const Quadric& from, const Quadric& to, const nvmath::vec3f& p)
+{
+    Quadric q = from;
+    q.add(to);
+    return static_cast<float>(std::sqrt(q.evaluate(p)));
+}
+
+//--------------------------------------------------------------------------------------------------
+// Vertices that must not move: on an open border or an attribute seam. Both are found on the
+// vertices welded by position
+//
+static std::vector<uint8_t> findLockedVertices(const std::vector<uint32_t>& indices, const nvmath::vec3f* positions, uint32_t vertexCount)
+{
+    struct PositionHash
+    {
+        size_t operator()(const nvmath::vec3f& p) const
+        {
+            uint32_t bits[3];
+            memcpy(bits, &p.x, sizeof(bits));
+            return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+        }
+    };
+    struct PositionEqual
+    {
+        bool operator()(const nvmath::vec3f& a, const nvmath::vec3f& b) const { return a.x == b.x && a.y == b.y && a.z == b.z; }
+    };
+
+    std::vector<uint32_t> welded(vertexCount);
+    std::vector<uint32_t> weldCount(vertexCount, 0);
+    std::unordered_map<nvmath::vec3f, uint32_t, PositionHash, PositionEqual> first;
+    for (uint32_t v = 0; v < vertexCount; v++)
+    {
+        welded[v] = first.insert({positions[v], v}).first->second;
+        weldCount[welded[v]]++;
+    }
+
+    // An edge used by a single triangle is on a border
+    std::unordered_map<uint64_t, uint32_t> edgeUses;
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+        for (int e = 0; e < 3; e++)
+        {
+            uint32_t a = welded[indices[i + e]];
+            uint32_t b = welded[indices[i + (e + 1) % 3]];
+            if (a > b)
+                std::swap(a, b);
+            edgeUses[(uint64_t(a) << 32) | b]++;
+        }
+    }
+
+    std::vector<uint8_t> lockedWeld(vertexCount, 0);
+    for (const auto& edge : edgeUses)
+    {
+        if (edge.second == 1)
+        {
+            lockedWeld[edge.first >> 32]        = 1;
+            lockedWeld[edge.first & 0xffffffff] = 1;
+        }
+    }
+
+    std::vector<uint8_t> locked(vertexCount);
+    for (uint32_t v = 0; v < vertexCount; v++)
+        locked[v] = lockedWeld[welded[v]] || weldCount[welded[v]] > 1;
+    return locked;
+}
+
+static nvmath::vec3f triangleNormal(const nvmath::vec3f& p0, const nvmath::vec3f& p1, const nvmath::vec3f& p2)
+{
+    return nvmath::cross(p1 - p0, p2 - p0);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Each pass sorts the cheapest collapse of every free vertex and applies them in order, skipping
+// the ones next to a vertex already changed in the pass, until the target or the error limit
+//
+float simplifyMesh(std::vector<uint32_t>& indices, const nvmath::vec3f* positions, uint32_t vertexCount, size_t targetIndexCount, float maxError)
+{
+    const std::vector<uint8_t> locked = findLockedVertices(indices, positions, vertexCount);
+
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+        const nvmath::vec3f& p0   = positions[indices[i]];
+        nvmath::vec3f        n    = triangleNormal(p0, positions[indices[i + 1]], positions[indices[i + 2]]);
+        const float          area = nvmath::length(n);
+        if (area == 0.0f)
+            continue;
+        n /= area;
+        for (int k = 0; k < 3; k++)
+            quadrics[indices[i + k]].addPlane(n.x, n.y, n.z, -nvmath::dot(n, p0), area);
+    }
+
+    struct Collapse
+    {
+        uint32_t from;
+        uint32_t to;
+        float    error;
+    };
+
+    float                 error = 0.0f;
+    std::vector<uint32_t> firstTriangle(vertexCount + 1);
+    std::vector<uint32_t> vertexTriangles;
+    std::vector<uint32_t> remap(vertexCount);
+    std::vector<uint8_t>  touched(vertexCount);
+    std::vector<Collapse> collapses;
+    while (indices.size() > targetIndexCount)
+    {
+        // Triangles around each vertex
+        std::fill(firstTriangle.begin(), firstTriangle.end(), 0);
+        for (uint32_t index : indices)
+            firstTriangle[index + 1]++;
+        for (uint32_t v = 0; v < vertexCount; v++)
+            firstTriangle[v + 1] += firstTriangle[v];
+        vertexTriangles.resize(indices.size());
+        std::vector<uint32_t> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++)
+            vertexTriangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+
+        // Cheapest collapse of each free vertex along its edges
+        collapses.clear();
+        std::vector<Collapse> best(vertexCount, {~0u, ~0u, 0.0f});
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            for (int e = 0; e < 3; e++)
+            {
+                const uint32_t a = indices[i + e];
+                const uint32_t b = indices[i + (e + 1) % 3];
+                for (const auto& edge : {std::make_pair(a, b), std::make_pair(b, a)})
+                {
+                    if (locked[edge.first])
+                        continue;
+                    const float cost = collapseError(quadrics[edge.first], quadrics[edge.second], positions[edge.second]);
+                    Collapse&   c    = best[edge.first];
+                    if (c.from == ~0u || cost < c.error)
+                        c = {edge.first, edge.second, cost};
+                }
+            }
+        }
+        for (const auto& c : best)
+        {
+            if (c.from != ~0u && c.error <= maxError)
+                collapses.push_back(c);
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+        for (uint32_t v = 0; v < vertexCount; v++)
+            remap[v] = v;
+        std::fill(touched.begin(), touched.end(), 0);
+        size_t triangleCount = indices.size() / 3;
+        size_t collapsed     = 0;
+        for (const auto& c : collapses)
+        {
+            if (triangleCount * 3 <= targetIndexCount)
+                break;
+            if (touched[c.from] || touched[c.to])
+                continue;
+
+            // The triangles that stay must not flip
+            bool   flips   = false;
+            size_t removed = 0;
+            for (uint32_t t = firstTriangle[c.from]; t < firstTriangle[c.from + 1] && !flips; t++)
+            {
+                const uint32_t* tri = &indices[size_t(vertexTriangles[t]) * 3];
+                if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to)
+                {
+                    removed++;
+                    continue;
+                }
+                nvmath::vec3f p[3], moved[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    p[k]     = positions[tri[k]];
+                    moved[k] = tri[k] == c.from ? positions[c.to] : p[k];
+                }
+                flips = nvmath::dot(triangleNormal(p[0], p[1], p[2]), triangleNormal(moved[0], moved[1], moved[2])) <= 0.0f;
+            }
+            if (flips)
+                continue;
+
+            for (uint32_t t = firstTriangle[c.from]; t < firstTriangle[c.from + 1]; t++)
+            {
+                const uint32_t* tri = &indices[size_t(vertexTriangles[t]) * 3];
+                touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+            }
+            remap[c.from] = c.to;
+            quadrics[c.to].add(quadrics[c.from]);
+            error = std::max(error, c.error);
+            triangleCount -= removed;
+            collapsed++;
+        }
+        if (collapsed == 0)
+            break;
+
+        // Triangles that lost a vertex are dropped
+        size_t write = 0;
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            const uint32_t a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+            if (a == b || b == c || a == c)
+                continue;
+            indices[write++] = a;
+            indices[write++] = b;
+            indices[write++] = c;
+        }
+        indices.resize(write);
+    }
+    return error;
+}
+
+std::vector<LodChain> makeBaseLodChains(const nvh::GltfScene& scene)
+{
+    std::vector<LodChain> chains(scene.m_primMeshes.size());
+    for (size_t p = 0; p < chains.size(); p++)
+    {
+        chains[p].primMeshes[0] = static_cast<uint32_t>(p);
+        chains[p].errors[0]     = 0.0f;
+    }
+    return chains;
+}
+
+//--------------------------------------------------------------------------------------------------
+// A level stops the chain when it does not reach 3/4 of the previous triangles, or when the
+// mesh would need to move by more than a tenth of its size
+//
+std::vector<LodChain> generateLods(nvh::GltfScene& scene)
+{
+    struct LodJob
+    {
+        uint32_t                           firstIndex;
+        uint32_t                           indexCount;
+        uint32_t                           vertexOffset;
+        uint32_t                           vertexCount;
+        float                              maxError;
+        std::vector<std::vector<uint32_t>> levels;  // Indices of levels 1 and up
+        std::vector<float>                 errors;
+        std::vector<uint32_t>              firstIndices;  // Of each level in the scene
+    };
+
+    const size_t                                     primCount = scene.m_primMeshes.size();
+    std::vector<LodJob>                              jobs;
+    std::vector<size_t>                              primJobs;
+    std::map<std::pair<uint32_t, uint32_t>, size_t> jobOfRange;
+    for (const auto& primMesh : scene.m_primMeshes)
+    {
+        auto inserted = jobOfRange.insert({{primMesh.firstIndex, primMesh.vertexOffset}, jobs.size()});
+        if (inserted.second)
+        {
+            LodJob job{primMesh.firstIndex, primMesh.indexCount, primMesh.vertexOffset, primMesh.vertexCount};
+            job.maxError = 0.1f * nvmath::length(primMesh.posMax - primMesh.posMin);
+            jobs.push_back(job);
+        }
+        primJobs.push_back(inserted.first->second);
+    }
+
+    nvh::parallel_batches<1>(jobs.size(), [&](uint64_t i) {
+        LodJob&               job       = jobs[i];
+        const nvmath::vec3f*  positions = scene.m_positions.data() + job.vertexOffset;
+        std::vector<uint32_t> indices(scene.m_indices.begin() + job.firstIndex, scene.m_indices.begin() + job.firstIndex + job.indexCount);
+        while (job.levels.size() + 1 < kMaxLodLevels && indices.size() >= 3 * 64)
+        {
+            const size_t previous = indices.size();
+            const float  error    = simplifyMesh(indices, positions, job.vertexCount, (previous / 6) * 3, job.maxError);
+            if (indices.size() * 4 > previous * 3)
+                break;
+            optimizeVertexCache(indices, job.vertexCount);
+            job.levels.push_back(indices);
+            job.errors.push_back(std::max(error, job.errors.empty() ? 0.0f : job.errors.back()));
+        }
+    });
+
+    for (auto& job : jobs)
+    {
+        for (const auto& level : job.levels)
+        {
+            job.firstIndices.push_back(static_cast<uint32_t>(scene.m_indices.size()));
+            scene.m_indices.insert(scene.m_indices.end(), level.begin(), level.end());
+        }
+    }
+
+    // Every primitive mesh gets its own levels, with its material, over the indices of its job
+    std::vector<LodChain> chains = makeBaseLodChains(scene);
+    for (size_t p = 0; p < primCount; p++)
+    {
+        const LodJob& job   = jobs[primJobs[p]];
+        LodChain&     chain = chains[p];
+        for (size_t l = 0; l < job.levels.size(); l++)
+        {
+            nvh::GltfPrimMesh level = scene.m_primMeshes[p];
+            level.firstIndex        = job.firstIndices[l];
+            level.indexCount        = static_cast<uint32_t>(job.levels[l].size());
+            chain.primMeshes[chain.levelCount] = static_cast<uint32_t>(scene.m_primMeshes.size());
+            chain.errors[chain.levelCount]     = job.errors[l];
+            chain.levelCount++;
+            scene.m_primMeshes.push_back(level);
+        }
+    }
+    return chains;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "nvh/gltfscene.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// Import-time level of detail chains
+// - Each level simplifies the previous one to about half its triangles with quadric error metrics
+//   (Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics"), by collapsing
+//   vertices onto a neighbor: every level reuses the vertices of its primitive mesh and only adds
+//   indices
+// - Vertices on open borders and on attribute seams (several vertices at one position) never move,
+//   so the levels keep their silhouette and UV layout
+// - The levels are appended to the scene as primitive meshes that no node references
+//
+constexpr uint32_t kMaxLodLevels = 5;
+
+struct LodChain
+{
+    uint32_t levelCount{1};              // Level 0, the primitive mesh itself, included
+    uint32_t primMeshes[kMaxLodLevels];  // Primitive mesh of each level
+    float    errors[kMaxLodLevels];      // Object space error of each level, 0 for level 0
+};
+
+// Chains of a single level, for scenes imported without simplification
+std::vector<LodChain> makeBaseLodChains(const nvh::GltfScene& scene);
+
+// Simplifies all primitive meshes in parallel and appends their levels to the scene, returns the
+// chain of each original primitive mesh. Meshes sharing their vertices and indices are processed once.
+std::vector<LodChain> generateLods(nvh::GltfScene& scene);
+
+// Collapses vertices of 'indices' until at most 'targetIndexCount' remain or the next collapse
+// would move the surface by more than 'maxError'. Returns the largest error of the collapses done.
+float simplifyMesh(std::vector<uint32_t>& indices, const nvmath::vec3f* positions, uint32_t vertexCount, size_t targetIndexCount, float maxError);
+
+// Pixels covered by an object space error seen from 'distance' in a view of 'pixelsPerRadian'
+// (height / (2 tan(fovy / 2))), for a node of the given scale
+inline float getLodPixelError(float error, float scale, float distance, float pixelsPerRadian)
+{
+    return error * scale * pixelsPerRadian / distance;
+}
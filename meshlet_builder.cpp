@@ -0,0 +1,145 @@
+#include "meshlet_builder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+static Meshlet makeMeshlet(const uint32_t* indices, const nvmath::vec3f* positions, uint32_t firstTriangle, uint32_t endTriangle)
+{
+    nvmath::vec3f bmin = positions[indices[firstTriangle * 3]];
+    nvmath::vec3f bmax = bmin;
+    for (uint32_t i = firstTriangle * 3; i < endTriangle * 3; i++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            bmin[c] = std::min(bmin[c], positions[indices[i]][c]);
+            bmax[c] = std::max(bmax[c], positions[indices[i]][c]);
+        }
+    }
+    const nvmath::vec3f center = (bmin + bmax) * 0.5f;
+    float               radius = 0.0f;
+    for (uint32_t i = firstTriangle * 3; i < endTriangle * 3; i++)
+        radius = std::max(radius, nvmath::length(positions[indices[i]] - center));
+
+    // Normal cone: average of the face normals, opened to the one furthest from it
+    std::vector<nvmath::vec3f> normals;
+    nvmath::vec3f              axis(0.0f);
+    for (uint32_t t = firstTriangle; t < endTriangle; t++)
+    {
+        const nvmath::vec3f& p0  = positions[indices[t * 3]];
+        const nvmath::vec3f  n   = nvmath::cross(positions[indices[t * 3 + 1]] - p0, positions[indices[t * 3 + 2]] - p0);
+        const float          len = nvmath::length(n);
+        if (len == 0.0f)
+            continue;
+        normals.push_back(n / len);
+        axis += normals.back();
+    }
+
+    float cutoff = 1.0f;
+    if (nvmath::length(axis) > 0.0f)
+    {
+        axis         = nvmath::normalize(axis);
+        float minDot = 1.0f;
+        for (const auto& n : normals)
+            minDot = std::min(minDot, nvmath::dot(axis, n));
+        // Cones wider than ~85 degrees would almost never cull
+        if (minDot > 0.1f)
+            cutoff = std::sqrt(1.0f - minDot * minDot);
+    }
+
+    Meshlet meshlet{};
+    meshlet.boundingSphere = nvmath::vec4f(center.x, center.y, center.z, radius);
+    meshlet.cone           = nvmath::vec4f(axis.x, axis.y, axis.z, cutoff);
+    return meshlet;
+}
+
+std::vector<Meshlet> buildMeshlets(const nvh::GltfScene& scene, const std::vector<PrimMeshInfo>& primInfos, std::vector<MeshletRange>& primRanges)
+{
+    std::vector<Meshlet> meshlets;
+    primRanges.assign(scene.m_primMeshes.size(), {});
+
+    // Primitive meshes sharing their indices and vertices share their meshlets
+    std::map<std::pair<uint32_t, uint32_t>, size_t> built;
+    std::vector<uint32_t>                           lastMeshlet;  // Last meshlet using each vertex
+    for (size_t p = 0; p < scene.m_primMeshes.size(); p++)
+    {
+        const nvh::GltfPrimMesh& primMesh = scene.m_primMeshes[p];
+        auto                     inserted = built.insert({{primMesh.firstIndex, primMesh.vertexOffset}, p});
+        if (!inserted.second)
+        {
+            primRanges[p] = primRanges[inserted.first->second];
+            continue;
+        }
+
+        const uint32_t*      indices       = scene.m_indices.data() + primMesh.firstIndex;
+        const nvmath::vec3f* positions     = scene.m_positions.data() + primMesh.vertexOffset;
+        const uint32_t       triangleCount = primMesh.indexCount / 3;
+        const uint32_t       firstMeshlet  = static_cast<uint32_t>(meshlets.size());
+
+        auto addMeshlet = [&](uint32_t firstTriangle, uint32_t endTriangle) {
+            Meshlet meshlet      = makeMeshlet(indices, positions, firstTriangle, endTriangle);
+            meshlet.firstIndex   = primInfos[p].indexOffset + firstTriangle * 3;
+            meshlet.indexCount   = (endTriangle - firstTriangle) * 3;
+            meshlet.vertexOffset = static_cast<int>(primMesh.vertexOffset);
+            meshlet.drawList     = primInfos[p].indexSize == sizeof(uint16_t) ? DRAW_LIST_INDEX16 : DRAW_LIST_INDEX32;
+            meshlets.push_back(meshlet);
+        };
+
+        lastMeshlet.assign(primMesh.vertexCount, ~0u);
+        uint32_t firstTriangle = 0;
+        uint32_t vertexCount   = 0;
+        for (uint32_t t = 0; t < triangleCount; t++)
+        {
+            const uint32_t* tri     = indices + t * 3;
+            uint32_t        current = static_cast<uint32_t>(meshlets.size());
+            uint32_t        added   = 0;
+            for (int k = 0; k < 3; k++)
+                added += lastMeshlet[tri[k]] != current ? 1 : 0;
+
+            if (t > firstTriangle && (vertexCount + added > kMaxMeshletVertices || t - firstTriangle == kMaxMeshletTriangles))
+            {
+                addMeshlet(firstTriangle, t);
+                firstTriangle = t;
+                vertexCount   = 0;
+                current++;
+            }
+            for (int k = 0; k < 3; k++)
+            {
+                if (lastMeshlet[tri[k]] != current)
+                {
+                    lastMeshlet[tri[k]] = current;
+                    vertexCount++;
+                }
+            }
+        }
+        if (firstTriangle < triangleCount)
+            addMeshlet(firstTriangle, triangleCount);
+
+        primRanges[p] = {firstMeshlet, static_cast<uint32_t>(meshlets.size()) - firstMeshlet};
+    }
+    return meshlets;
+}
+
+CullNode makeCullNode(const nvmath::mat4f& worldMatrix, const nvmath::vec4f& boundingSphere, uint32_t firstLod, uint32_t lodCount, uint32_t drawList)
+{
+    CullNode node{};
+    node.worldMatrix    = worldMatrix;
+    node.boundingSphere = boundingSphere;
+    node.firstLod       = firstLod;
+    node.lodCount       = lodCount;
+    node.drawList       = drawList;
+
+    // Normal cones survive rotations and uniform scales, not shears or mirrors
+    nvmath::vec3f axes[3];
+    for (int c = 0; c < 3; c++)
+        axes[c] = nvmath::vec3f(worldMatrix(0, c), worldMatrix(1, c), worldMatrix(2, c));
+    const float l0 = nvmath::length(axes[0]), l1 = nvmath::length(axes[1]), l2 = nvmath::length(axes[2]);
+    const float lmin = std::min(l0, std::min(l1, l2)), lmax = std::max(l0, std::max(l1, l2));
+    const float det  = nvmath::dot(axes[0], nvmath::cross(axes[1], axes[2]));
+    const bool  orthogonal = std::fabs(nvmath::dot(axes[0], axes[1])) <= 1e-3f * l0 * l1
+                            && std::fabs(nvmath::dot(axes[1], axes[2])) <= 1e-3f * l1 * l2
+                            && std::fabs(nvmath::dot(axes[0], axes[2])) <= 1e-3f * l0 * l2;
+    if (lmin > 0.0f && lmax <= lmin * 1.001f && det > 0.0f && orthogonal)
+        node.flags |= CULL_NODE_CONE;
+    return node;
+}
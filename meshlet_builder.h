@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "nvh/gltfscene.hpp"
+#include "shaders/host_device.h"
+
+//--------------------------------------------------------------------------------------------------
+// Meshlets for the cluster culling of the raster pass
+// - The index range of each primitive mesh is cut into runs of consecutive triangles, so a visible
+//   meshlet is drawn straight from the scene index buffer. The runs follow the vertex cache order
+//   of mesh_optimizer.h, which keeps them spatially coherent
+// - Each meshlet has a bounding sphere and a normal cone (Meshlet in shaders/host_device.h)
+//
+constexpr uint32_t kMaxMeshletVertices  = 64;
+constexpr uint32_t kMaxMeshletTriangles = 124;
+
+struct MeshletRange
+{
+    uint32_t firstMeshlet{0};
+    uint32_t meshletCount{0};
+};
+
+// 'primInfos' gives the index offset of each primitive mesh in the uploaded index buffer,
+// 'primRanges' receives the meshlets of each primitive mesh
+std::vector<Meshlet> buildMeshlets(const nvh::GltfScene&            scene,
+                                   const std::vector<PrimMeshInfo>& primInfos,
+                                   std::vector<MeshletRange>&       primRanges);
+
+// Cluster culling instance of a node with its LOD levels (MeshLod) and world bounding sphere, its
+// cones are only tested when its matrix preserves them
+CullNode makeCullNode(const nvmath::mat4f& worldMatrix, const nvmath::vec4f& boundingSphere, uint32_t firstLod, uint32_t lodCount, uint32_t drawList);
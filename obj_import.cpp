@@ -0,0 +1,142 @@
+#include "obj_import.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+//--------------------------------------------------------------------------------------------------
+// Per-vertex tangents of one primitive mesh from its uv derivatives, orthogonalized against the
+// normals. w is the handedness of the bitangent
+//
+static void computeTangents(nvh::GltfScene& scene, const nvh::GltfPrimMesh& primMesh)
+{
+    std::vector<nvmath::vec3f> tangents(primMesh.vertexCount, nvmath::vec3f(0.0f));
+    std::vector<nvmath::vec3f> bitangents(primMesh.vertexCount, nvmath::vec3f(0.0f));
+    const uint32_t*            indices   = scene.m_indices.data() + primMesh.firstIndex;
+    const nvmath::vec3f*       positions = scene.m_positions.data() + primMesh.vertexOffset;
+    const nvmath::vec2f*       uvs       = scene.m_texcoords0.data() + primMesh.vertexOffset;
+    for (uint32_t i = 0; i < primMesh.indexCount; i += 3)
+    {
+        const uint32_t      i0 = indices[i], i1 = indices[i + 1], i2 = indices[i + 2];
+        const nvmath::vec3f e1 = positions[i1] - positions[i0];
+        const nvmath::vec3f e2 = positions[i2] - positions[i0];
+        const nvmath::vec2f d1 = uvs[i1] - uvs[i0];
+        const nvmath::vec2f d2 = uvs[i2] - uvs[i0];
+        const float         det = d1.x * d2.y - d2.x * d1.y;
+        if (std::fabs(det) < 1e-12f)
+            continue;
+        const float         r = 1.0f / det;
+        const nvmath::vec3f t = (e1 * d2.y - e2 * d1.y) * r;
+        const nvmath::vec3f b = (e2 * d1.x - e1 * d2.x) * r;
+        for (uint32_t v : {i0, i1, i2})
+        {
+            tangents[v] += t;
+            bitangents[v] += b;
+        }
+    }
+
+    for (uint32_t v = 0; v < primMesh.vertexCount; v++)
+    {
+        const nvmath::vec3f& n = scene.m_normals[primMesh.vertexOffset + v];
+        nvmath::vec3f        t = tangents[v] - n * nvmath::dot(n, tangents[v]);
+        if (nvmath::dot(t, t) < 1e-12f)
+        {
+            // No usable uvs, any direction orthogonal to the normal
+            t = std::fabs(n.x) < 0.9f ? nvmath::cross(n, nvmath::vec3f(1, 0, 0)) : nvmath::cross(n, nvmath::vec3f(0, 1, 0));
+        }
+        t               = nvmath::normalize(t);
+        const float w   = nvmath::dot(nvmath::cross(n, t), bitangents[v]) < 0.0f ? -1.0f : 1.0f;
+        scene.m_tangents[primMesh.vertexOffset + v] = nvmath::vec4f(t.x, t.y, t.z, w);
+    }
+}
+
+void importObjScene(const ObjLoader& obj, nvh::GltfScene& scene)
+{
+    // Triangles of each material, in file order
+    const size_t                       triangleCount = obj.m_indices.size() / 3;
+    std::vector<std::vector<uint32_t>> materialTriangles(obj.m_materials.size());
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        const int32_t material = t < obj.m_matIndx.size() ? obj.m_matIndx[t] : 0;
+        materialTriangles[material].push_back(static_cast<uint32_t>(t));
+    }
+
+    scene.m_materials.clear();
+    for (const auto& m : obj.m_materials)
+    {
+        nvh::GltfMaterial material;
+        material.baseColorFactor          = nvmath::vec4f(m.diffuse.x, m.diffuse.y, m.diffuse.z, m.dissolve);
+        material.baseColorTexture         = -1;
+        material.metallicFactor           = 0.0f;
+        material.roughnessFactor          = std::sqrt(2.0f / (std::max(m.shininess, 0.0f) + 2.0f));
+        material.metallicRoughnessTexture = -1;
+        material.normalTexture            = -1;
+        material.emissiveFactor           = m.emission;
+        material.emissiveTexture          = -1;
+        scene.m_materials.push_back(material);
+    }
+
+    // The vertices of each primitive mesh in order of first use
+    std::vector<uint32_t> remap(obj.m_vertices.size(), ~0u);
+    for (size_t material = 0; material < materialTriangles.size(); material++)
+    {
+        const auto& triangles = materialTriangles[material];
+        if (triangles.empty())
+            continue;
+
+        nvh::GltfPrimMesh primMesh;
+        primMesh.firstIndex    = static_cast<uint32_t>(scene.m_indices.size());
+        primMesh.indexCount    = static_cast<uint32_t>(triangles.size() * 3);
+        primMesh.vertexOffset  = static_cast<uint32_t>(scene.m_positions.size());
+        primMesh.materialIndex = static_cast<int>(material);
+        primMesh.posMin        = nvmath::vec3f(FLT_MAX);
+        primMesh.posMax        = nvmath::vec3f(-FLT_MAX);
+
+        std::vector<uint32_t> used;
+        for (uint32_t t : triangles)
+        {
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                const uint32_t index = obj.m_indices[t * 3 + c];
+                if (remap[index] == ~0u)
+                {
+                    remap[index] = static_cast<uint32_t>(used.size());
+                    used.push_back(index);
+
+                    const VertexObj& vertex = obj.m_vertices[index];
+                    scene.m_positions.push_back(vertex.pos);
+                    scene.m_normals.push_back(vertex.nrm);
+                    scene.m_texcoords0.push_back(vertex.texCoord);
+                    primMesh.posMin = nvmath::nv_min(primMesh.posMin, vertex.pos);
+                    primMesh.posMax = nvmath::nv_max(primMesh.posMax, vertex.pos);
+                }
+                scene.m_indices.push_back(remap[index]);
+            }
+        }
+        for (uint32_t index : used)
+            remap[index] = ~0u;
+        primMesh.vertexCount = static_cast<uint32_t>(used.size());
+        scene.m_tangents.resize(scene.m_positions.size());
+        computeTangents(scene, primMesh);
+
+        nvh::GltfNode node;
+        node.worldMatrix = nvmath::mat4f(1);
+        node.primMesh    = static_cast<int>(scene.m_primMeshes.size());
+        scene.m_nodes.push_back(node);
+        scene.m_primMeshes.push_back(primMesh);
+    }
+
+    nvmath::vec3f sceneMin(FLT_MAX), sceneMax(-FLT_MAX);
+    for (const auto& primMesh : scene.m_primMeshes)
+    {
+        sceneMin = nvmath::nv_min(sceneMin, primMesh.posMin);
+        sceneMax = nvmath::nv_max(sceneMax, primMesh.posMax);
+    }
+    if (scene.m_primMeshes.empty())
+        sceneMin = sceneMax = nvmath::vec3f(0.0f);
+    scene.m_dimensions.min    = sceneMin;
+    scene.m_dimensions.max    = sceneMax;
+    scene.m_dimensions.size   = sceneMax - sceneMin;
+    scene.m_dimensions.center = (sceneMin + sceneMax) * 0.5f;
+    scene.m_dimensions.radius = nvmath::length(scene.m_dimensions.size) * 0.5f;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "nvh/gltfscene.hpp"
+#include "obj_loader.h"
+
+//--------------------------------------------------------------------------------------------------
+// Converts an OBJ model into the layout of the glTF importer, so it takes the same path to the GPU
+// (optimization, LODs, scene cache, vertex buffers and BLASes)
+// - One primitive mesh per material, drawn by one node with an identity transform. The vertices
+//   are renumbered per primitive mesh, the ones shared by two materials are duplicated
+// - The diffuse color and dissolve become the base color, the shininess the roughness (Blinn-Phong
+//   exponent to GGX), the emission is kept; the textures are not imported
+// - Tangents are computed from the uvs, the vertex colors are dropped
+//
+void importObjScene(const ObjLoader& obj, nvh::GltfScene& scene);
@@ -0,0 +1,249 @@
+#include "regression.h"
+
+#include <filesystem>
+#include <fstream>
+
+#include "hello_vulkan.h"
+#include "image_metrics.h"
+#include "scene_manager.h"
+#include "nvh/cameramanipulator.hpp"
+#include "nvh/nvprint.hpp"
+
+#include <json.hpp>
+
+void RegressionHarness::init(HelloVulkan* app, SceneManager* sceneManager, const std::vector<RegressionCase>& cases,
+                             const std::string& referenceDir, double rmseTolerance, double flipTolerance)
+{
+    m_app           = app;
+    m_sceneManager  = sceneManager;
+    m_cases         = cases;
+    m_referenceDir  = referenceDir;
+    m_rmseTolerance = rmseTolerance;
+    m_flipTolerance = flipTolerance;
+}
+
+bool RegressionHarness::hasFailed() const
+{
+    for (const auto& result : m_results)
+    {
+        if (!result.passed)
+            return true;
+    }
+    return false;
+}
+
+void RegressionHarness::start(bool updateReferences)
+{
+    m_update = updateReferences;
+    m_done   = false;
+    m_results.clear();
+    if (m_cases.empty())
+    {
+        LOGW("No regression cases in config.json\n");
+        m_done = true;
+        return;
+    }
+    if (m_update)
+    {
+        std::error_code error;
+        std::filesystem::create_directories(m_referenceDir, error);
+    }
+    startCase(0);
+}
+
+void RegressionHarness::startCase(size_t index)
+{
+    m_current                = index;
+    const RegressionCase& rc = m_cases[index];
+    LOGI("Regression case %zu / %zu: %s\n", index + 1, m_cases.size(), rc.name.c_str());
+
+    if (rc.scene >= m_sceneManager->getSceneCount())
+    {
+        Result result;
+        result.name    = rc.name;
+        result.message = "no such scene";
+        m_results.push_back(result);
+        finishCase();
+        return;
+    }
+
+    // With the cache on, the scene is imported cold even if current, so the reference never depends on
+    // the load path. The import rewrites the cache that the warm render then loads
+    const bool cache = m_app->m_useSceneCache;
+    if (cache || rc.scene != m_sceneManager->getCurrent() || m_app->m_loadStage == HelloVulkan::eLoadIdle)
+    {
+        m_app->m_refreshSceneCache = cache;
+        m_sceneManager->load(rc.scene);
+    }
+    m_warm  = false;
+    m_stage = eLoading;
+}
+
+void RegressionHarness::startWarm(std::vector<nvmath::vec4f>&& coldPixels)
+{
+    m_coldPixels = std::move(coldPixels);
+    m_warm       = true;
+    m_sceneManager->load(m_cases[m_current].scene);
+    m_stage = eLoading;
+}
+
+void RegressionHarness::compareWarm(const std::vector<nvmath::vec4f>& pixels)
+{
+    const VkExtent2D size = m_app->getSize();
+    Result           result;
+    result.name         = m_cases[m_current].name + " (warm)";
+    result.relativeRmse = computeRelativeRmse(pixels, m_coldPixels);
+    result.flipError    = computeFlipError(pixels, m_coldPixels, size.width, size.height);
+    result.passed       = result.relativeRmse <= m_rmseTolerance && result.flipError <= m_flipTolerance;
+    if (!result.passed)
+        result.message = "differs from the cold import";
+    m_results.push_back(result);
+    m_coldPixels.clear();
+    LOGI("Regression case %s: %s%s%s\n", result.name.c_str(), result.passed ? "passed" : "FAILED",
+         result.message.empty() ? "" : ", ", result.message.c_str());
+}
+
+void RegressionHarness::update()
+{
+    if (m_stage == eLoading)
+    {
+        // Streamed BLASes and textures restart the accumulation, the case starts once all are in
+        if (m_app->m_loadStage != HelloVulkan::eLoadDone)
+            return;
+
+        const RegressionCase& rc = m_cases[m_current];
+        if (!loadCamera(rc.camera))
+            LOGW("Could not read the camera file %s, keeping the current camera\n", rc.camera.c_str());
+        m_app->m_pcPost.rtMode          = 1;
+        m_app->m_pcRay.samples          = rc.samples;
+        m_app->m_pcRay.sampler          = rc.sampler;
+        m_app->m_pcRay.adaptiveSampling = 0;
+        m_app->m_stopAtMaxFrames        = true;
+        m_app->m_maxFrames              = rc.frames;
+        m_app->resetFrame();
+        m_stage = eRendering;
+        return;
+    }
+
+    if (m_stage == eRendering && m_app->isPathTraceDone())
+    {
+        const RegressionCase&      rc   = m_cases[m_current];
+        const VkExtent2D           size = m_app->getSize();
+        std::vector<nvmath::vec4f> pixels;
+        m_app->readOffscreenImage(pixels);
+        if (m_warm)
+        {
+            compareWarm(pixels);
+            finishCase();
+            return;
+        }
+
+        Result            result;
+        result.name                 = rc.name;
+        const std::string reference = m_referenceDir + "/" + rc.name + ".pfm";
+        if (m_update)
+        {
+            result.passed  = writePfm(reference, size.width, size.height, pixels);
+            result.message = result.passed ? "written to " + reference : "could not write " + reference;
+        }
+        else
+        {
+            uint32_t                   width  = 0;
+            uint32_t                   height = 0;
+            std::vector<nvmath::vec4f> referencePixels;
+            if (!readPfm(reference, width, height, referencePixels))
+            {
+                result.message = "no reference " + reference + ", run with --update-references";
+            }
+            else if (width != size.width || height != size.height)
+            {
+                result.message = "reference is " + std::to_string(width) + "x" + std::to_string(height);
+            }
+            else
+            {
+                result.relativeRmse = computeRelativeRmse(pixels, referencePixels);
+                result.flipError    = computeFlipError(pixels, referencePixels, width, height);
+                result.passed       = result.relativeRmse <= m_rmseTolerance && result.flipError <= m_flipTolerance;
+                if (!result.passed)
+                    result.message = "above tolerance";
+            }
+        }
+        m_results.push_back(result);
+        LOGI("Regression case %s: %s%s%s\n", result.name.c_str(), result.passed ? "passed" : "FAILED",
+             result.message.empty() ? "" : ", ", result.message.c_str());
+        if (m_app->m_useSceneCache)
+            startWarm(std::move(pixels));
+        else
+            finishCase();
+    }
+}
+
+void RegressionHarness::finishCase()
+{
+    if (m_current + 1 < m_cases.size())
+    {
+        startCase(m_current + 1);
+        return;
+    }
+    m_stage = eIdle;
+    m_done  = true;
+    logResults();
+}
+
+void RegressionHarness::logResults() const
+{
+    LOGI("Regression %s, tolerances: relative RMSE %.4f, FLIP %.4f\n", m_update ? "references updated" : "results",
+         m_rmseTolerance, m_flipTolerance);
+    LOGI("  %-32s %12s %10s %8s\n", "case", "rel. RMSE", "FLIP", "result");
+    for (const auto& result : m_results)
+    {
+        LOGI("  %-32s %12.5f %10.5f %8s\n", result.name.c_str(), result.relativeRmse, result.flipError,
+             result.passed ? "pass" : "FAIL");
+    }
+}
+
+bool loadCamera(const std::string& filename)
+{
+    using json = nlohmann::json;
+    std::ifstream file(filename);
+    if (!file)
+        return false;
+    try
+    {
+        const json               data   = json::parse(file);
+        const std::vector<float> eye    = data.at("eye").get<std::vector<float>>();
+        const std::vector<float> center = data.at("center").get<std::vector<float>>();
+        const std::vector<float> up     = data.value("up", std::vector<float>{0.0f, 1.0f, 0.0f});
+        if (eye.size() != 3 || center.size() != 3 || up.size() != 3)
+            return false;
+        CameraManip.setLookat(nvmath::vec3f(eye[0], eye[1], eye[2]), nvmath::vec3f(center[0], center[1], center[2]),
+                              nvmath::vec3f(up[0], up[1], up[2]), true);
+        CameraManip.setFov(data.value("fov", CameraManip.getFov()));
+    }
+    catch (const json::exception& e)
+    {
+        LOGW("%s: %s\n", filename.c_str(), e.what());
+        return false;
+    }
+    return true;
+}
+
+bool saveCamera(const std::string& filename)
+{
+    using json = nlohmann::json;
+    nvmath::vec3f eye, center, up;
+    CameraManip.getLookat(eye, center, up);
+
+    json data;
+    data["eye"]    = {eye.x, eye.y, eye.z};
+    data["center"] = {center.x, center.y, center.z};
+    data["up"]     = {up.x, up.y, up.z};
+    data["fov"]    = CameraManip.getFov();
+
+    std::ofstream file(filename);
+    if (!file)
+        return false;
+    file << data.dump(4) << "\n";
+    LOGI("Camera saved to %s\n", filename.c_str());
+    return true;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "nvmath/nvmath.h"
+#include "shaders/host_device.h"
+
+class HelloVulkan;
+class SceneManager;
+
+//--------------------------------------------------------------------------------------------------
+// Golden-image regression tests of the path tracer
+// - Each case renders a scene of config.json from a camera file, with a fixed number of frames and
+//   samples per frame and adaptive sampling off. The seeds only depend on the pixel and the sample
+//   index, so the same build on the same GPU renders the same image every run
+// - The accumulated radiance is read back as floats and compared to <referenceDir>/<name>.pfm by
+//   its relative RMSE and a FLIP-like perceptual error, see image_metrics.h. Either above its
+//   tolerance fails the case. In update mode the images are written as the new references
+// - With the scene cache on, each case is rendered from a cold import that rewrites the cache, then
+//   from a warm load of that cache. The cold image is the one compared to the reference, and the
+//   warm one must match it within the same tolerances
+//
+struct RegressionCase
+{
+    std::string name;
+    size_t      scene{0};  // Index in the scenes of config.json
+    std::string camera;    // Camera file, see loadCamera()
+    int         frames{16};
+    int         samples{4};  // Per pixel and frame
+    uint32_t    sampler{SAMPLER_SOBOL};
+};
+
+class RegressionHarness
+{
+public:
+    struct Result
+    {
+        std::string name;
+        double      relativeRmse{-1.0};  // Negative when not compared
+        double      flipError{-1.0};
+        bool        passed{false};
+        std::string message;  // Why it failed, or where the reference was written
+    };
+
+    void init(HelloVulkan* app, SceneManager* sceneManager, const std::vector<RegressionCase>& cases,
+              const std::string& referenceDir, double rmseTolerance, double flipTolerance);
+
+    // Renders every case in turn, updateReferences writes the images instead of comparing them
+    void start(bool updateReferences);
+
+    // Once per frame, after SceneManager::update()
+    void update();
+
+    bool isRunning() const { return m_stage != eIdle; }
+    bool isDone() const { return m_done; }
+    bool hasFailed() const;
+
+    size_t                     getCaseCount() const { return m_cases.size(); }
+    size_t                     getCurrent() const { return m_current; }
+    const std::vector<Result>& getResults() const { return m_results; }
+
+private:
+    enum Stage
+    {
+        eIdle,
+        eLoading,    // Until the scene of the case is fully loaded
+        eRendering,  // Until the path tracer has rendered its frames
+    };
+
+    void startCase(size_t index);
+    void startWarm(std::vector<nvmath::vec4f>&& coldPixels);
+    void compareWarm(const std::vector<nvmath::vec4f>& pixels);
+    void finishCase();
+    void logResults() const;
+
+    HelloVulkan*                m_app{nullptr};
+    SceneManager*               m_sceneManager{nullptr};
+    std::vector<RegressionCase> m_cases;
+    std::string                 m_referenceDir;
+    double                      m_rmseTolerance{0.0};
+    double                      m_flipTolerance{0.0};
+
+    Stage                      m_stage{eIdle};
+    bool                       m_update{false};
+    bool                       m_done{false};
+    size_t                     m_current{0};
+    std::vector<Result>        m_results;
+    bool                       m_warm{false};  // Rendering the case from the scene cache
+    std::vector<nvmath::vec4f> m_coldPixels;   // Image of the cold import of the case
+};
+
+// Camera files: JSON with the "eye", "center" and "up" vectors and the vertical "fov" in degrees.
+// Loading sets the camera at once, without the animation of the manipulator
+bool loadCamera(const std::string& filename);
+bool saveCamera(const std::string& filename);
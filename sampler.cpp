@@ -0,0 +1,290 @@
+#include "sampler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <random>
+
+// Degree s, coefficients a and initial numbers m of the primitive polynomials of the Sobol
+// dimensions after the first, from new-joe-kuo-6.21201
+struct SobolPolynomial
+{
+    uint32_t s;
+    uint32_t a;
+    uint32_t m[5];
+};
+
+static const SobolPolynomial kSobolPolynomials[] = {
+    { 1, 0, { 1 } },
+    { 2, 1, { 1, 3 } },
+    { 3, 1, { 1, 3, 1 } },
+    { 3, 2, { 1, 1, 1 } },
+    { 4, 1, { 1, 1, 3, 3 } },
+    { 4, 4, { 1, 3, 5, 13 } },
+    { 5, 2, { 1, 1, 5, 5, 17 } },
+};
+
+std::vector<uint32_t> buildSobolDirections(uint32_t dimensions)
+{
+    assert(dimensions <= 1 + sizeof(kSobolPolynomials) / sizeof(kSobolPolynomials[0]));
+    std::vector<uint32_t> directions(size_t(dimensions) * SOBOL_BITS);
+
+    // The first dimension is the van der Corput sequence
+    for (uint32_t i = 0; i < SOBOL_BITS && dimensions > 0; i++)
+        directions[i] = 1u << (31 - i);
+
+    for (uint32_t d = 1; d < dimensions; d++)
+    {
+        const SobolPolynomial& p = kSobolPolynomials[d - 1];
+        uint32_t*              v = &directions[size_t(d) * SOBOL_BITS];
+        for (uint32_t i = 0; i < SOBOL_BITS; i++)
+        {
+            if (i < p.s)
+            {
+                v[i] = p.m[i] << (31 - i);
+                continue;
+            }
+            v[i] = v[i - p.s] ^ (v[i - p.s] >> p.s);
+            for (uint32_t k = 1; k < p.s; k++)
+            {
+                if ((p.a >> (p.s - 1 - k)) & 1)
+                    v[i] ^= v[i - k];
+            }
+        }
+    }
+    return directions;
+}
+
+// Energy of the void-and-cluster method: a Gaussian of every set pixel, wrapped around the tile
+class BlueNoiseEnergy
+{
+public:
+    BlueNoiseEnergy(uint32_t size)
+        : m_size(size)
+        , m_energy(size_t(size) * size, 0.0f)
+        , m_set(size_t(size) * size, 0)
+    {
+        const float sigma = 1.5f;
+        for (int y = -kRadius; y <= kRadius; y++)
+        {
+            for (int x = -kRadius; x <= kRadius; x++)
+                m_kernel.push_back(std::exp(-float(x * x + y * y) / (2.0f * sigma * sigma)));
+        }
+    }
+
+    void set(uint32_t pixel, bool value)
+    {
+        m_set[pixel]     = value;
+        const float sign = value ? 1.0f : -1.0f;
+        const int   px   = int(pixel % m_size);
+        const int   py   = int(pixel / m_size);
+        const int   size = int(m_size);
+        for (int y = -kRadius; y <= kRadius; y++)
+        {
+            const size_t row = size_t((py + y + size) % size) * m_size;
+            for (int x = -kRadius; x <= kRadius; x++)
+                m_energy[row + (px + x + size) % size] += sign * m_kernel[(y + kRadius) * (2 * kRadius + 1) + x + kRadius];
+        }
+    }
+
+    bool isSet(uint32_t pixel) const { return m_set[pixel] != 0; }
+
+    // Set pixel of highest energy
+    uint32_t getTightestCluster() const
+    {
+        uint32_t best = 0;
+        float    max  = -1.0f;
+        for (uint32_t i = 0; i < m_energy.size(); i++)
+        {
+            if (m_set[i] && m_energy[i] > max)
+            {
+                max  = m_energy[i];
+                best = i;
+            }
+        }
+        return best;
+    }
+
+    // Free pixel of lowest energy
+    uint32_t getLargestVoid() const
+    {
+        uint32_t best = 0;
+        float    min  = INFINITY;
+        for (uint32_t i = 0; i < m_energy.size(); i++)
+        {
+            if (!m_set[i] && m_energy[i] < min)
+            {
+                min  = m_energy[i];
+                best = i;
+            }
+        }
+        return best;
+    }
+
+private:
+    // The Gaussian is under 1e-3 of its peak beyond
+    static constexpr int kRadius = 6;
+
+    uint32_t             m_size;
+    std::vector<float>   m_kernel;
+    std::vector<float>   m_energy;
+    std::vector<uint8_t> m_set;
+};
+
+std::vector<uint32_t> buildBlueNoise(uint32_t size, uint32_t seed)
+{
+    assert(size > 0 && (size & (size - 1)) == 0);
+    const uint32_t count = size * size;
+
+    // Initial binary pattern: a tenth of the pixels at random, then the tightest cluster moved to
+    // the largest void until it is the same pixel
+    BlueNoiseEnergy                         prototype(size);
+    std::mt19937                            rng(seed);
+    std::uniform_int_distribution<uint32_t> pixel(0, count - 1);
+    const uint32_t                          setCount = std::max(count / 10, 1u);
+    for (uint32_t i = 0; i < setCount;)
+    {
+        const uint32_t p = pixel(rng);
+        if (!prototype.isSet(p))
+        {
+            prototype.set(p, true);
+            i++;
+        }
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const uint32_t cluster = prototype.getTightestCluster();
+        prototype.set(cluster, false);
+        const uint32_t largestVoid = prototype.getLargestVoid();
+        prototype.set(largestVoid, true);
+        if (largestVoid == cluster)
+            break;
+    }
+
+    std::vector<uint32_t> ranks(count);
+
+    // Ranks below the pattern, removing its tightest clusters
+    BlueNoiseEnergy energy = prototype;
+    for (uint32_t rank = setCount; rank-- > 0;)
+    {
+        const uint32_t cluster = energy.getTightestCluster();
+        energy.set(cluster, false);
+        ranks[cluster] = rank;
+    }
+
+    // Ranks above, filling its largest voids. Past half the pixels this is also the tightest
+    // cluster of the free pixels, the energy being linear
+    energy = prototype;
+    for (uint32_t rank = setCount; rank < count; rank++)
+    {
+        const uint32_t largestVoid = energy.getLargestVoid();
+        energy.set(largestVoid, true);
+        ranks[largestVoid] = rank;
+    }
+
+    std::vector<uint32_t> noise(count);
+    for (uint32_t i = 0; i < count; i++)
+        noise[i] = static_cast<uint32_t>(((2 * uint64_t(ranks[i]) + 1) << 31) / count);
+    return noise;
+}
+
+std::vector<uint32_t> buildSamplerTables()
+{
+    std::vector<uint32_t>       tables = buildSobolDirections(SOBOL_DIMENSIONS);
+    const std::vector<uint32_t> noise  = buildBlueNoise(BLUE_NOISE_SIZE, 1);
+    tables.insert(tables.end(), noise.begin(), noise.end());
+    return tables;
+}
+
+uint32_t hashSample(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x21f0aaadu;
+    x ^= x >> 15;
+    x *= 0x735a2d97u;
+    x ^= x >> 15;
+    return x;
+}
+
+uint32_t hashCombine(uint32_t seed, uint32_t v)
+{
+    return seed ^ (hashSample(v) + (seed << 6) + (seed >> 2));
+}
+
+static uint32_t reverseBits(uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+uint32_t nestedUniformScramble(uint32_t x, uint32_t seed)
+{
+    x = reverseBits(x);
+    x ^= x * 0x3d20adeau;
+    x += seed;
+    x *= (seed >> 16) | 1u;
+    x ^= x * 0x05526c56u;
+    x ^= x * 0x53a22864u;
+    return reverseBits(x);
+}
+
+uint32_t getSobol(const uint32_t* directions, uint32_t index, uint32_t dimension)
+{
+    uint32_t x = 0;
+    for (uint32_t bit = 0; index != 0; index >>= 1, bit++)
+    {
+        if (index & 1)
+            x ^= directions[dimension * SOBOL_BITS + bit];
+    }
+    return x;
+}
+
+uint32_t getScrambledSobol(const uint32_t* directions, uint32_t seed, uint32_t sampleIndex, uint32_t dimension)
+{
+    const uint32_t groupSeed = hashCombine(seed, dimension / SOBOL_DIMENSIONS);
+    const uint32_t index     = nestedUniformScramble(sampleIndex, groupSeed);
+    const uint32_t component = dimension % SOBOL_DIMENSIONS;
+    return nestedUniformScramble(getSobol(directions, index, component), hashCombine(groupSeed, component + 1));
+}
+
+float getSample(const std::vector<uint32_t>& tables, uint32_t sampler, uint32_t x, uint32_t y, uint32_t width,
+                uint32_t sampleIndex, uint32_t dimension)
+{
+    uint32_t value;
+    if (sampler == SAMPLER_SOBOL)
+    {
+        value = getScrambledSobol(tables.data(), hashSample(y * width + x), sampleIndex, dimension);
+    }
+    else
+    {
+        const uint32_t offset = hashSample(dimension);
+        const uint32_t tx     = (x + offset) % BLUE_NOISE_SIZE;
+        const uint32_t ty     = (y + (offset >> 16)) % BLUE_NOISE_SIZE;
+        value = getScrambledSobol(tables.data(), 0, sampleIndex, dimension)
+                + tables[SOBOL_DIMENSIONS * SOBOL_BITS + ty * BLUE_NOISE_SIZE + tx];
+    }
+    return float(value >> 8) / float(0x01000000);
+}
+
+uint32_t tea(uint32_t val0, uint32_t val1)
+{
+    uint32_t v0 = val0;
+    uint32_t v1 = val1;
+    uint32_t s0 = 0;
+    for (uint32_t n = 0; n < 16; n++)
+    {
+        s0 += 0x9e3779b9;
+        v0 += ((v1 << 4) + 0xa341316c) ^ (v1 + s0) ^ ((v1 >> 5) + 0xc8013ea4);
+        v1 += ((v0 << 4) + 0xad90777d) ^ (v0 + s0) ^ ((v0 >> 5) + 0x7e95761e);
+    }
+    return v0;
+}
+
+float rnd(uint32_t& prev)
+{
+    prev = 1664525u * prev + 1013904223u;
+    return float(prev & 0x00FFFFFF) / float(0x01000000);
+}
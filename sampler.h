@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "shaders/host_device.h"
+
+//--------------------------------------------------------------------------------------------------
+// Tables of the low-discrepancy samplers of the path tracer (shaders/sampler.glsl), built at load
+// - Sobol direction numbers of the first SOBOL_DIMENSIONS dimensions, from the primitive
+//   polynomials and initial numbers of Joe and Kuo (new-joe-kuo-6.21201)
+// - A BLUE_NOISE_SIZE x BLUE_NOISE_SIZE blue-noise tile, by the void-and-cluster method (Ulichney
+//   1993): the pixels are ranked by inserting each one in the largest void of the ones before it,
+//   measured with a Gaussian on the torus, so the tile repeats without seams. Values are the ranks
+//   as 32-bit fractions, (rank + 0.5) / size^2
+// - The sequences themselves, as the shaders compute them, for the tools
+//
+
+// SOBOL_BITS direction numbers per dimension, dimensions up to 8
+std::vector<uint32_t> buildSobolDirections(uint32_t dimensions);
+
+// Row major, size a power of 2. The same seed gives the same tile
+std::vector<uint32_t> buildBlueNoise(uint32_t size, uint32_t seed);
+
+// Buffer of the shaders, PushConstantRay::samplerAddress: the direction numbers of
+// SOBOL_DIMENSIONS dimensions, then the blue-noise tile
+std::vector<uint32_t> buildSamplerTables();
+
+uint32_t hashSample(uint32_t x);
+uint32_t hashCombine(uint32_t seed, uint32_t v);
+uint32_t nestedUniformScramble(uint32_t x, uint32_t seed);
+uint32_t getSobol(const uint32_t* directions, uint32_t index, uint32_t dimension);
+
+// 32-bit fraction, padded by shuffling beyond SOBOL_DIMENSIONS, see shaders/sampler.glsl
+uint32_t getScrambledSobol(const uint32_t* directions, uint32_t seed, uint32_t sampleIndex, uint32_t dimension);
+
+// Sample of dimension for pixel (x, y) of an image width wide, with SAMPLER_SOBOL or
+// SAMPLER_BLUE_NOISE, from the tables of buildSamplerTables()
+float getSample(const std::vector<uint32_t>& tables, uint32_t sampler, uint32_t x, uint32_t y, uint32_t width,
+                uint32_t sampleIndex, uint32_t dimension);
+
+// SAMPLER_RANDOM, random.glsl: the seed hash and the 24-bit numbers of the LCG
+uint32_t tea(uint32_t val0, uint32_t val1);
+float    rnd(uint32_t& prev);
@@ -0,0 +1,394 @@
+#include "scene_cache.h"
+
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include <json.hpp>
+
+#include "nvh/fileoperations.hpp"
+#include "nvh/nvprint.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+//--------------------------------------------------------------------------------------------------
+// MappedFile
+//
+#ifdef _WIN32
+bool MappedFile::open(const std::string& filename)
+{
+    close();
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    m_data    = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    m_size    = static_cast<size_t>(size.QuadPart);
+    m_file    = file;
+    m_mapping = mapping;
+    if (!m_data)
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    if (m_mapping)
+        CloseHandle(m_mapping);
+    if (m_file)
+        CloseHandle(m_file);
+    m_data    = nullptr;
+    m_size    = 0;
+    m_file    = nullptr;
+    m_mapping = nullptr;
+}
+#else
+bool MappedFile::open(const std::string& filename)
+{
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    m_data = static_cast<const uint8_t*>(data);
+    m_size = static_cast<size_t>(st.st_size);
+    m_fd   = fd;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (m_data)
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+    if (m_fd >= 0)
+        ::close(m_fd);
+    m_data = nullptr;
+    m_size = 0;
+    m_fd   = -1;
+}
+#endif
+
+//--------------------------------------------------------------------------------------------------
+// SceneCache
+//
+static uint64_t fnv1a(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+template <typename T>
+static uint64_t fnv1a(const T& value, uint64_t hash)
+{
+    return fnv1a(&value, sizeof(T), hash);
+}
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+std::string SceneCache::getCachePath(const std::string& sourceFile)
+{
+    return sourceFile + ".vkcache";
+}
+
+uint64_t SceneCache::computeSourceHash(const std::string& sourceFile, uint32_t importFlags)
+{
+    std::ifstream file(sourceFile, std::ios::binary);
+    if (!file)
+        return 0;
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    // Layout of everything we store, a change in any of the structures invalidates the cache
+    uint64_t hash = fnv1a(kVersion, 0xcbf29ce484222325ull);
+    hash          = fnv1a(sizeof(CachedPrimMesh) ^ (sizeof(CachedNode) << 16) ^ (sizeof(CachedImage) << 32), hash);
+    hash          = fnv1a(sizeof(GltfPBRMaterial) ^ (sizeof(GltfLight) << 16), hash);
+    hash          = fnv1a(importFlags, hash);
+    hash          = fnv1a(content.data(), content.size(), hash);
+
+    // External buffers and images of a .gltf are not hashed byte by byte, their size and
+    // modification time are enough to notice an edit
+    if (!nvh::endsWith(sourceFile, ".gltf"))
+        return hash;
+
+    nlohmann::json json = nlohmann::json::parse(content, nullptr, false);
+    if (json.is_discarded())
+        return hash;
+
+    fs::path baseDir = fs::path(sourceFile).parent_path();
+    for (const char* key : {"buffers", "images"})
+    {
+        if (!json.contains(key))
+            continue;
+        for (const auto& entry : json[key])
+        {
+            std::string uri = entry.value("uri", std::string());
+            if (uri.empty() || uri.rfind("data:", 0) == 0)
+                continue;
+
+            std::error_code ec;
+            fs::path        path = baseDir / fs::u8path(uri);
+            uint64_t        size = fs::file_size(path, ec);
+            int64_t         time = ec ? 0 : fs::last_write_time(path, ec).time_since_epoch().count();
+            hash                 = fnv1a(uri.data(), uri.size(), hash);
+            hash                 = fnv1a(size, hash);
+            hash                 = fnv1a(time, hash);
+        }
+    }
+    return hash;
+}
+
+bool SceneCache::open(const std::string& sourceFile, uint32_t importFlags)
+{
+    if (!m_file.open(getCachePath(sourceFile)))
+        return false;
+
+    const Header* header = getHeader();
+    bool          valid  = m_file.size() >= sizeof(Header) && header->magic == kMagic && header->version == kVersion;
+    for (uint32_t s = 0; valid && s < eSectionCount; s++)
+        valid = header->sections[s].offset + header->sections[s].size <= m_file.size();
+
+    if (!valid || header->sourceHash != computeSourceHash(sourceFile, importFlags))
+    {
+        LOGI("Scene cache %s is stale, ignoring it\n", getCachePath(sourceFile).c_str());
+        m_file.close();
+        return false;
+    }
+    return true;
+}
+
+void SceneCache::restoreScene(nvh::GltfScene& scene) const
+{
+    scene.m_positions  = read<nvmath::vec3f>(ePositions);
+    scene.m_normals    = read<nvmath::vec3f>(eNormals);
+    scene.m_tangents   = read<nvmath::vec4f>(eTangents);
+    scene.m_texcoords0 = read<nvmath::vec2f>(eTexcoords0);
+    scene.m_indices    = read<uint32_t>(eIndices);
+
+    scene.m_primMeshes.clear();
+    for (const auto& cached : read<CachedPrimMesh>(ePrimMeshes))
+    {
+        nvh::GltfPrimMesh primMesh;
+        primMesh.firstIndex    = cached.firstIndex;
+        primMesh.indexCount    = cached.indexCount;
+        primMesh.vertexOffset  = cached.vertexOffset;
+        primMesh.vertexCount   = cached.vertexCount;
+        primMesh.materialIndex = cached.materialIndex;
+        primMesh.posMin        = cached.posMin;
+        primMesh.posMax        = cached.posMax;
+        scene.m_primMeshes.emplace_back(primMesh);
+    }
+
+    scene.m_nodes.clear();
+    for (const auto& cached : read<CachedNode>(eNodes))
+    {
+        nvh::GltfNode node;
+        node.worldMatrix = cached.worldMatrix;
+        node.primMesh    = cached.primMesh;
+        scene.m_nodes.emplace_back(node);
+    }
+
+    const Header* header       = getHeader();
+    scene.m_dimensions.min    = header->sceneMin;
+    scene.m_dimensions.max    = header->sceneMax;
+    scene.m_dimensions.size   = header->sceneMax - header->sceneMin;
+    scene.m_dimensions.center = (header->sceneMin + header->sceneMax) * 0.5f;
+    scene.m_dimensions.radius = nvmath::length(scene.m_dimensions.size) * 0.5f;
+}
+
+std::vector<TextureView> SceneCache::getImages() const
+{
+    std::vector<TextureView> images;
+    const uint8_t*           imageData = getSection(eImageData);
+    for (const auto& cached : read<CachedImage>(eImages))
+    {
+        TextureView view;
+        view.width     = cached.width;
+        view.height    = cached.height;
+        view.mipLevels = cached.mipLevels;
+        view.format    = static_cast<VkFormat>(cached.format);
+        view.swizzle   = {static_cast<VkComponentSwizzle>(cached.swizzle[0]), static_cast<VkComponentSwizzle>(cached.swizzle[1]),
+                          static_cast<VkComponentSwizzle>(cached.swizzle[2]), static_cast<VkComponentSwizzle>(cached.swizzle[3])};
+        view.data      = cached.size > 0 ? imageData + cached.offset : nullptr;
+        view.size      = cached.size;
+        images.emplace_back(view);
+    }
+    return images;
+}
+
+bool SceneCache::write(const std::string& sourceFile, const Contents& contents)
+{
+    const nvh::GltfScene& scene = *contents.scene;
+
+    std::vector<CachedPrimMesh> primMeshes;
+    for (const auto& p : scene.m_primMeshes)
+        primMeshes.push_back({p.firstIndex, p.indexCount, p.vertexOffset, p.vertexCount, p.materialIndex, p.posMin, p.posMax});
+
+    std::vector<CachedNode> nodes;
+    for (const auto& n : scene.m_nodes)
+        nodes.push_back({n.worldMatrix, n.primMesh});
+
+    std::vector<CachedImage> images;
+    uint64_t                 imageDataSize = 0;
+    for (const auto& view : *contents.images)
+    {
+        CachedImage cached{view.width,
+                           view.height,
+                           view.mipLevels,
+                           static_cast<uint32_t>(view.data ? view.format : 0),
+                           {static_cast<uint8_t>(view.swizzle.r), static_cast<uint8_t>(view.swizzle.g),
+                            static_cast<uint8_t>(view.swizzle.b), static_cast<uint8_t>(view.swizzle.a)},
+                           0,
+                           imageDataSize,
+                           view.data ? view.size : 0};
+        imageDataSize = alignUp(imageDataSize + cached.size, kAlignment);
+        images.emplace_back(cached);
+    }
+
+    struct Payload
+    {
+        const void* data;
+        uint64_t    size;
+    };
+    std::array<Payload, eSectionCount> payloads{};
+    payloads[ePositions]   = {scene.m_positions.data(), scene.m_positions.size() * sizeof(nvmath::vec3f)};
+    payloads[eNormals]     = {scene.m_normals.data(), scene.m_normals.size() * sizeof(nvmath::vec3f)};
+    payloads[eTangents]    = {scene.m_tangents.data(), scene.m_tangents.size() * sizeof(nvmath::vec4f)};
+    payloads[eTexcoords0]  = {scene.m_texcoords0.data(), scene.m_texcoords0.size() * sizeof(nvmath::vec2f)};
+    payloads[eIndices]     = {scene.m_indices.data(), scene.m_indices.size() * sizeof(uint32_t)};
+    payloads[ePrimMeshes]  = {primMeshes.data(), primMeshes.size() * sizeof(CachedPrimMesh)};
+    payloads[eNodes]       = {nodes.data(), nodes.size() * sizeof(CachedNode)};
+    payloads[eMaterials]   = {contents.materials->data(), contents.materials->size() * sizeof(GltfPBRMaterial)};
+    payloads[eLights]      = {contents.lights->data(), contents.lights->size() * sizeof(GltfLight)};
+    payloads[eLods]        = {contents.lods->data(), contents.lods->size() * sizeof(LodChain)};
+    payloads[eTextures]    = {contents.textureSources->data(), contents.textureSources->size() * sizeof(int32_t)};
+    payloads[eImages]      = {images.data(), images.size() * sizeof(CachedImage)};
+    payloads[eImageData]   = {nullptr, imageDataSize};
+
+    Header header{};
+    header.magic                 = kMagic;
+    header.version               = kVersion;
+    header.sourceHash            = computeSourceHash(sourceFile, contents.importFlags);
+    header.sceneMin              = scene.m_dimensions.min;
+    header.sceneMax              = scene.m_dimensions.max;
+    header.emissiveTriangleCount = contents.emissiveTriangleCount;
+
+    uint64_t offset = alignUp(sizeof(Header), kAlignment);
+    for (uint32_t s = 0; s < eSectionCount; s++)
+    {
+        header.sections[s] = {offset, payloads[s].size};
+        offset             = alignUp(offset + payloads[s].size, kAlignment);
+    }
+
+    // Write to a temporary file first, a crash while writing must not leave a truncated cache behind
+    const std::string cachePath = getCachePath(sourceFile);
+    const std::string tmpPath   = cachePath + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            LOGW("Cannot write scene cache %s\n", cachePath.c_str());
+            return false;
+        }
+
+        static const char zeros[kAlignment] = {};
+        auto              padTo          = [&](uint64_t target) {
+            uint64_t pos = static_cast<uint64_t>(out.tellp());
+            out.write(zeros, static_cast<std::streamsize>(target - pos));
+        };
+
+        out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+        for (uint32_t s = 0; s < eSectionCount; s++)
+        {
+            padTo(header.sections[s].offset);
+            if (s == eImageData)
+            {
+                for (size_t i = 0; i < images.size(); i++)
+                {
+                    if (images[i].size == 0)
+                        continue;
+                    padTo(header.sections[s].offset + images[i].offset);
+                    out.write(reinterpret_cast<const char*>((*contents.images)[i].data), static_cast<std::streamsize>(images[i].size));
+                }
+                padTo(header.sections[s].offset + header.sections[s].size);
+            }
+            else if (payloads[s].size > 0)
+            {
+                out.write(static_cast<const char*>(payloads[s].data), static_cast<std::streamsize>(payloads[s].size));
+            }
+        }
+        if (!out)
+        {
+            LOGW("Error while writing scene cache %s\n", cachePath.c_str());
+            out.close();
+            fs::remove(tmpPath);
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    fs::remove(cachePath, ec);
+    fs::rename(tmpPath, cachePath, ec);
+    if (ec)
+    {
+        LOGW("Cannot write scene cache %s: %s\n", cachePath.c_str(), ec.message().c_str());
+        return false;
+    }
+    return true;
+}
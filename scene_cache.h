@@ -0,0 +1,160 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "mesh_simplifier.h"
+#include "nvh/gltfscene.hpp"
+#include "shaders/host_device.h"
+#include "texture_utils.h"
+
+//--------------------------------------------------------------------------------------------------
+// Read-only memory mapping of a whole file
+//
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& filename);
+    void close();
+
+    const uint8_t* data() const { return m_data; }
+    size_t         size() const { return m_size; }
+
+private:
+    const uint8_t* m_data{nullptr};
+    size_t         m_size{0};
+#ifdef _WIN32
+    void* m_file{nullptr};
+    void* m_mapping{nullptr};
+#else
+    int m_fd{-1};
+#endif
+};
+
+//--------------------------------------------------------------------------------------------------
+// Binary cache of an imported glTF scene, stored next to the source asset as <scene>.vkcache
+// - Holds the flattened vertex/index data, prim meshes, nodes, shading materials, lights and
+//   the decoded textures with their full mip chain, and the LOD chains of the prim meshes
+// - Keyed on a hash of the source file (and the files it references), on kVersion and on the
+//   import flags that change the stored geometry
+// - Every section starts on a kAlignment boundary, so the mapped file can be copied straight
+//   into staging memory
+//
+class SceneCache
+{
+public:
+    static constexpr uint32_t kMagic     = 0x43534b56;  // "VKSC"
+    static constexpr uint32_t kVersion   = 5;
+    static constexpr uint64_t kAlignment = 256;
+
+    enum Section : uint32_t
+    {
+        ePositions,
+        eNormals,
+        eTangents,
+        eTexcoords0,
+        eIndices,
+        ePrimMeshes,
+        eNodes,
+        eMaterials,
+        eLights,
+        eLods,       // LodChain of each original primitive mesh
+        eTextures,   // gltf texture -> image index
+        eImages,     // CachedImage table
+        eImageData,  // Texel payloads, offsets in CachedImage are relative to this section
+        eSectionCount
+    };
+
+    struct CachedPrimMesh
+    {
+        uint32_t      firstIndex;
+        uint32_t      indexCount;
+        uint32_t      vertexOffset;
+        uint32_t      vertexCount;
+        int32_t       materialIndex;
+        nvmath::vec3f posMin;
+        nvmath::vec3f posMax;
+    };
+
+    struct CachedNode
+    {
+        nvmath::mat4f worldMatrix;
+        int32_t       primMesh;
+    };
+
+    struct CachedImage
+    {
+        uint32_t width;
+        uint32_t height;
+        uint32_t mipLevels;
+        uint32_t format;      // VkFormat, 0 when the image could not be decoded
+        uint8_t  swizzle[4];  // VkComponentSwizzle of r, g, b, a
+        uint32_t padding;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    // Everything the renderer needs to rebuild the GPU scene
+    struct Contents
+    {
+        const nvh::GltfScene*               scene{nullptr};
+        const std::vector<GltfPBRMaterial>* materials{nullptr};
+        const std::vector<GltfLight>*       lights{nullptr};
+        const std::vector<LodChain>*        lods{nullptr};
+        const std::vector<int32_t>*         textureSources{nullptr};
+        const std::vector<TextureView>*     images{nullptr};
+        uint32_t                            importFlags{0};
+        uint32_t                            emissiveTriangleCount{0};  // Of the cold import, checked by warm loads
+    };
+
+    static std::string getCachePath(const std::string& sourceFile);
+    static uint64_t    computeSourceHash(const std::string& sourceFile, uint32_t importFlags);
+
+    // Maps the cache of 'sourceFile', fails when it is missing, from another version, stale or
+    // imported with other flags
+    bool open(const std::string& sourceFile, uint32_t importFlags);
+    void     close() { m_file.close(); }
+    bool     isOpen() const { return m_file.data() != nullptr; }
+    uint32_t getEmissiveTriangleCount() const { return getHeader()->emissiveTriangleCount; }
+
+    void                     restoreScene(nvh::GltfScene& scene) const;
+    std::vector<TextureView> getImages() const;
+
+    template <typename T>
+    std::vector<T> read(Section section) const
+    {
+        const T* first = reinterpret_cast<const T*>(getSection(section));
+        return std::vector<T>(first, first + getSectionSize(section) / sizeof(T));
+    }
+
+    static bool write(const std::string& sourceFile, const Contents& contents);
+
+private:
+    struct SectionEntry
+    {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct Header
+    {
+        uint32_t      magic;
+        uint32_t      version;
+        uint64_t      sourceHash;
+        nvmath::vec3f sceneMin;
+        nvmath::vec3f sceneMax;
+        uint32_t      emissiveTriangleCount;
+        SectionEntry  sections[eSectionCount];
+    };
+
+    const Header*  getHeader() const { return reinterpret_cast<const Header*>(m_file.data()); }
+    const uint8_t* getSection(Section section) const { return m_file.data() + getHeader()->sections[section].offset; }
+    uint64_t       getSectionSize(Section section) const { return getHeader()->sections[section].size; }
+
+    MappedFile m_file;
+};
@@ -0,0 +1,86 @@
+#include "scene_manager.h"
+
+#include <algorithm>
+
+#include "hello_vulkan.h"
+#include "nvh/fileoperations.hpp"
+#include "nvh/nvprint.hpp"
+
+void SceneManager::init(HelloVulkan* app, const std::vector<std::string>& scenes)
+{
+    m_app    = app;
+    m_scenes = scenes;
+    m_names.clear();
+    for (const auto& scene : m_scenes)
+        m_names.push_back(nvh::getFileName(scene));
+}
+
+void SceneManager::load(size_t index)
+{
+    m_sweeping = false;
+    loadScene(index);
+}
+
+void SceneManager::loadScene(size_t index)
+{
+    m_current    = index;
+    m_frameCount = 0;
+    LOGI("Loading scene %zu / %zu: %s\n", index + 1, m_scenes.size(), m_names[index].c_str());
+    m_app->switchScene(m_scenes[index]);
+}
+
+void SceneManager::startSweep(uint32_t framesPerScene)
+{
+    if (m_scenes.empty())
+        return;
+    m_results.clear();
+    m_framesPerScene = std::max(framesPerScene, 1u);
+    loadScene(0);
+    m_sweeping = true;
+}
+
+void SceneManager::update()
+{
+    if (!m_sweeping || m_app->m_loadStage != HelloVulkan::eLoadDone)
+        return;
+
+    // Frames are timed from the first one after the scene is fully loaded
+    if (m_frameCount++ == 0)
+    {
+        m_frameTimer.reset();
+        return;
+    }
+    if (m_frameCount <= m_framesPerScene)
+        return;
+
+    Result result;
+    result.name           = m_names[m_current];
+    result.unloadTime     = m_app->m_unloadTime;
+    result.firstFrameTime = m_app->m_unloadTime + m_app->m_timeToFirstFrame;
+    result.fullLoadTime   = m_app->m_unloadTime + m_app->m_fullLoadTime;
+    result.frameTime      = static_cast<float>(m_frameTimer.elapsed()) / m_framesPerScene;
+    m_results.push_back(result);
+    LOGI("Scene %s: switched in %.1f ms (%.1f ms unload), fully loaded in %.1f ms, %.3f ms/frame\n", result.name.c_str(),
+         result.firstFrameTime, result.unloadTime, result.fullLoadTime, result.frameTime);
+
+    if (m_current + 1 < m_scenes.size())
+    {
+        loadScene(m_current + 1);
+    }
+    else
+    {
+        m_sweeping = false;
+        logResults();
+    }
+}
+
+void SceneManager::logResults() const
+{
+    LOGI("Scene sweep, %u frames per scene (ms):\n", m_framesPerScene);
+    LOGI("  %-32s %10s %12s %12s %10s\n", "scene", "unload", "first frame", "full load", "frame");
+    for (const auto& result : m_results)
+    {
+        LOGI("  %-32s %10.1f %12.1f %12.1f %10.3f\n", result.name.c_str(), result.unloadTime, result.firstFrameTime,
+             result.fullLoadTime, result.frameTime);
+    }
+}
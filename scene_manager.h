@@ -0,0 +1,59 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "nvh/timesampler.hpp"
+
+class HelloVulkan;
+
+//--------------------------------------------------------------------------------------------------
+// The scenes of config.json, switched at runtime without recreating the renderer
+// - load() frees the current scene and loads another in the background, see HelloVulkan::switchScene()
+// - A sweep loads every scene in turn, renders a number of frames once each is fully loaded and
+//   logs its switch latency and average frame time
+//
+class SceneManager
+{
+public:
+    struct Result
+    {
+        std::string name;
+        float       unloadTime{0.0f};      // ms to free the previous scene
+        float       firstFrameTime{0.0f};  // ms from the switch to the first frame showing geometry
+        float       fullLoadTime{0.0f};    // ms from the switch until every BLAS and mip is on the GPU
+        float       frameTime{0.0f};       // Average ms per frame once loaded
+    };
+
+    void init(HelloVulkan* app, const std::vector<std::string>& scenes);
+    void load(size_t index);
+
+    // Once per frame, after HelloVulkan::updateSceneLoad()
+    void update();
+
+    // Starts from the first scene, a manual load() stops the sweep
+    void startSweep(uint32_t framesPerScene);
+    void stopSweep() { m_sweeping = false; }
+    bool isSweeping() const { return m_sweeping; }
+
+    size_t             getSceneCount() const { return m_scenes.size(); }
+    size_t             getCurrent() const { return m_current; }
+    const std::string& getSceneName(size_t index) const { return m_names[index]; }
+    // Results of the last sweep, one per scene measured so far
+    const std::vector<Result>& getResults() const { return m_results; }
+
+private:
+    void loadScene(size_t index);
+    void logResults() const;
+
+    HelloVulkan*             m_app{nullptr};
+    std::vector<std::string> m_scenes;
+    std::vector<std::string> m_names;  // File names, for the UI and the log
+    size_t                   m_current{0};
+
+    bool                m_sweeping{false};
+    uint32_t            m_framesPerScene{0};
+    uint32_t            m_frameCount{0};  // Frames rendered since the current scene is fully loaded
+    nvh::Stopwatch      m_frameTimer;
+    std::vector<Result> m_results;
+};
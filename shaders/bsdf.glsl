@@ -0,0 +1,153 @@
+#ifndef BSDF
+#define BSDF
+
+// BSDF of the metallic-roughness materials of the path tracer: a Lambertian lobe and a GGX
+// microfacet lobe, evaluated, sampled and given a pdf for any pair of directions so the light
+// samples and the BSDF samples can be weighted by multiple importance sampling
+// - The specular lobe is sampled from the distribution of the visible normals (Heitz, "Sampling
+//   the GGX Distribution of Visible Normals", JCGT 2018), its masking-shadowing is the height
+//   correlated Smith term
+// - One lobe is sampled, picked by its estimated albedo; the pdf is that of the mixture
+// - All directions point away from the surface, N is the shading normal
+#include "globals.glsl"
+#include "random.glsl"
+
+struct Bsdf
+{
+  vec3  diffuseColor;  // Base color of the dielectric part
+  float alpha;         // GGX roughness, perceptual roughness squared
+  vec3  F0;            // Specular reflectance at normal incidence
+  float specularProb;  // Probability to sample the specular lobe, set by makeBsdf()
+};
+
+vec3 getFresnelSchlick(vec3 F0, float cosTheta)
+{
+  return F0 + (1.0f - F0) * pow(1.0f - clamp(cosTheta, 0.0f, 1.0f), 5.0f);
+}
+
+float getLuminance(vec3 color)
+{
+  return dot(color, vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+Bsdf makeBsdf(vec3 baseColor, float metalness, float roughness, vec3 N, vec3 V)
+{
+  Bsdf bsdf;
+  bsdf.diffuseColor = (1.0f - metalness) * baseColor;
+  bsdf.alpha        = max(roughness * roughness, 1e-4f);
+  bsdf.F0           = mix(vec3(0.04f), baseColor, metalness);
+
+  // Each lobe by its reflectance seen from V, never below 10% so neither is starved
+  float specular    = getLuminance(getFresnelSchlick(bsdf.F0, dot(N, V)));
+  float diffuse     = getLuminance(bsdf.diffuseColor) * (1.0f - specular);
+  bsdf.specularProb = specular + diffuse > 0.0f ? clamp(specular / (specular + diffuse), 0.1f, 0.9f) : 0.5f;
+  return bsdf;
+}
+
+float getGgxD(float NH, float alpha)
+{
+  float a2 = alpha * alpha;
+  float d  = NH * NH * (a2 - 1.0f) + 1.0f;
+  return a2 * M_INV_PI / (d * d);
+}
+
+// Smith Lambda of GGX for a direction at cos(theta) from the normal
+float getGgxLambda(float cosTheta, float alpha)
+{
+  float cos2 = cosTheta * cosTheta;
+  float tan2 = max(1.0f - cos2, 0.0f) / max(cos2, 1e-8f);
+  return 0.5f * (sqrt(1.0f + alpha * alpha * tan2) - 1.0f);
+}
+
+float getGgxG1(float cosTheta, float alpha)
+{
+  return 1.0f / (1.0f + getGgxLambda(cosTheta, alpha));
+}
+
+float getGgxG2(float NV, float NL, float alpha)
+{
+  return 1.0f / (1.0f + getGgxLambda(NV, alpha) + getGgxLambda(NL, alpha));
+}
+
+// Visible normal in the tangent space of the surface (z up) for the view direction Ve
+vec3 sampleGgxVndf(vec3 Ve, float alpha, vec2 u)
+{
+  // Hemisphere configuration: stretched view, orthonormal basis around it
+  vec3  Vh    = normalize(vec3(alpha * Ve.x, alpha * Ve.y, Ve.z));
+  float lensq = Vh.x * Vh.x + Vh.y * Vh.y;
+  vec3  T1    = lensq > 0.0f ? vec3(-Vh.y, Vh.x, 0.0f) * inversesqrt(lensq) : vec3(1.0f, 0.0f, 0.0f);
+  vec3  T2    = cross(Vh, T1);
+
+  // Point on the projected area of the hemisphere
+  float r   = sqrt(u.x);
+  float phi = 2.0f * M_PI * u.y;
+  float t1  = r * cos(phi);
+  float t2  = r * sin(phi);
+  float s   = 0.5f * (1.0f + Vh.z);
+  t2        = (1.0f - s) * sqrt(1.0f - t1 * t1) + s * t2;
+
+  // Back to the ellipsoid configuration
+  vec3 Nh = t1 * T1 + t2 * T2 + sqrt(max(0.0f, 1.0f - t1 * t1 - t2 * t2)) * Vh;
+  return normalize(vec3(alpha * Nh.x, alpha * Nh.y, max(0.0f, Nh.z)));
+}
+
+// f(V, L), without the cosine
+vec3 evalBsdf(Bsdf bsdf, vec3 N, vec3 V, vec3 L)
+{
+  float NV = dot(N, V);
+  float NL = dot(N, L);
+  if (NV <= 0.0f || NL <= 0.0f)
+    return vec3(0.0f);
+
+  vec3  H  = normalize(V + L);
+  vec3  F  = getFresnelSchlick(bsdf.F0, dot(V, H));
+  float D  = getGgxD(max(dot(N, H), 0.0f), bsdf.alpha);
+  float G2 = getGgxG2(NV, NL, bsdf.alpha);
+
+  vec3 specular = F * D * G2 / (4.0f * NV * NL);
+  vec3 diffuse  = (1.0f - F) * bsdf.diffuseColor * M_INV_PI;
+  return diffuse + specular;
+}
+
+// Solid angle pdf of sampleBsdf() for L
+float pdfBsdf(Bsdf bsdf, vec3 N, vec3 V, vec3 L)
+{
+  float NV = dot(N, V);
+  float NL = dot(N, L);
+  if (NV <= 0.0f || NL <= 0.0f)
+    return 0.0f;
+
+  // Visible normal pdf G1(V) max(0, VH) D(H) / NV, times the Jacobian of the reflection 1 / (4 VH)
+  vec3  H        = normalize(V + L);
+  float specular = getGgxG1(NV, bsdf.alpha) * getGgxD(max(dot(N, H), 0.0f), bsdf.alpha) / (4.0f * NV);
+  float diffuse  = NL * M_INV_PI;
+  return mix(diffuse, specular, bsdf.specularProb);
+}
+
+// Direction L from one lobe and the weight f cos / pdf of the mixture, u.x picks the lobe and
+// u.yz the direction. T and B complete the shading frame. Returns false when the sample goes below
+// the surface
+bool sampleBsdf(Bsdf bsdf, vec3 N, vec3 T, vec3 B, vec3 V, vec3 u, out vec3 L, out vec3 weight, out float pdf,
+                out bool isSpecular)
+{
+  isSpecular = u.x < bsdf.specularProb;
+  if (isSpecular)
+  {
+    vec3 Ve = vec3(dot(V, T), dot(V, B), dot(V, N));
+    vec3 H  = mat3(T, B, N) * sampleGgxVndf(Ve, bsdf.alpha, u.yz);
+    L       = reflect(-V, H);
+  }
+  else
+  {
+    L = normalize(samplingHemisphere(u.yz, T, B, N));
+  }
+
+  weight = vec3(0.0f);
+  pdf    = pdfBsdf(bsdf, N, V, L);
+  if (pdf <= 0.0f)
+    return false;
+  weight = evalBsdf(bsdf, N, V, L) * dot(N, L) / pdf;
+  return true;
+}
+
+#endif // BSDF
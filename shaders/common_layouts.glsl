@@ -8,6 +8,10 @@
 
 layout(buffer_reference, scalar) readonly buffer GltfMaterials { GltfPBRMaterial m[]; };
 layout(buffer_reference, scalar) readonly buffer GltfLights    { GltfLight       l[]; };
+layout(buffer_reference, scalar) readonly buffer Instances     { InstanceInfo    i[]; };
+layout(buffer_reference, scalar) readonly buffer EmissiveTriangles { EmissiveTriangle t[]; };
+layout(buffer_reference, scalar) readonly buffer LightBvhNodes { LightBvhNode n[]; };
+layout(buffer_reference, scalar) readonly buffer AliasTable    { AliasEntry      e[]; };
 
 layout(binding = eSceneDesc, set = 0) readonly buffer SceneDesc_ { SceneDesc sceneDesc; };
 layout(binding = eTextures, set = 0) uniform sampler2D[] textureSamplers;
@@ -0,0 +1,89 @@
+#ifndef ENVIRONMENT
+#define ENVIRONMENT
+
+// Equirectangular environment map and its importance sampling (environment_map.h)
+#include "host_device.h"
+#include "raycommon.glsl"
+#include "common_layouts.glsl"
+#include "random.glsl"
+
+layout(binding = eEnvironment, set = 0) uniform sampler2D environmentMap;
+
+// Far enough for the shadow rays to cross the scene, the tMax of the path
+const float ENVIRONMENT_DISTANCE = 10000.0f;
+
+vec2 getEnvironmentUv(vec3 dir)
+{
+  return vec2(atan(dir.z, dir.x) * (0.5f * M_INV_PI) + 0.5f, acos(clamp(dir.y, -1.0f, 1.0f)) * M_INV_PI);
+}
+
+vec3 getEnvironmentDirection(vec2 uv)
+{
+  float phi      = 2.0f * M_PI * (uv.x - 0.5f);
+  float theta    = M_PI * uv.y;
+  float sinTheta = sin(theta);
+  return vec3(sinTheta * cos(phi), cos(theta), sinTheta * sin(phi));
+}
+
+vec3 getEnvironmentRadiance(vec3 dir)
+{
+  return textureLod(environmentMap, getEnvironmentUv(dir), 0.0f).rgb * pcRay.environmentIntensity;
+}
+
+// Probability of the next event estimation to sample the environment rather than the other lights
+float getEnvironmentLightProb()
+{
+  return (pcRay.environmentLights != 0 && sceneDesc.environmentAliasCount > 0) ? 0.5f : 0.0f;
+}
+
+// Solid angle pdf of sampleEnvironment() for dir: the probability of its texel over the solid
+// angle of the texel, sin(theta) dtheta dphi
+float getEnvironmentPdf(vec3 dir)
+{
+  if (sceneDesc.environmentAliasCount == 0)
+    return 0.0f;
+  float sinTheta = sqrt(max(1.0f - dir.y * dir.y, 0.0f));
+  if (sinTheta <= 0.0f)
+    return 0.0f;
+
+  uvec2 size  = uvec2(sceneDesc.environmentWidth, sceneDesc.environmentHeight);
+  uvec2 texel = min(uvec2(getEnvironmentUv(dir) * vec2(size)), size - 1);
+  float pdf   = AliasTable(sceneDesc.environmentAliasAddress).e[texel.y * size.x + texel.x].pdf;
+  return pdf * float(sceneDesc.environmentAliasCount) / (2.0f * M_PI * M_PI * sinTheta);
+}
+
+// Direction towards a texel picked by luminance from the alias table, uniform within the texel:
+// u.x picks the entry, u.w decides between it and its alias, u.yz is the position in the texel.
+// Returns false when the environment cannot be sampled
+bool sampleEnvironment(vec4 u, out vec3 L, out vec3 Li, out float pdf)
+{
+  L   = vec3(0.0f, 1.0f, 0.0f);
+  Li  = vec3(0.0f);
+  pdf = 0.0f;
+  if (sceneDesc.environmentAliasCount == 0)
+    return false;
+
+  // The table has millions of entries, too many for the fraction of one float to decide between
+  // the texel and its alias
+  AliasTable table = AliasTable(sceneDesc.environmentAliasAddress);
+  uint       texel = min(uint(u.x * float(sceneDesc.environmentAliasCount)), sceneDesc.environmentAliasCount - 1);
+  if (u.w >= table.e[texel].threshold)
+    texel = table.e[texel].alias;
+
+  uvec2 size     = uvec2(sceneDesc.environmentWidth, sceneDesc.environmentHeight);
+  vec2  uv       = (vec2(texel % size.x, texel / size.x) + u.yz) / vec2(size);
+  L              = getEnvironmentDirection(uv);
+  float sinTheta = sqrt(max(1.0f - L.y * L.y, 0.0f));  // As in getEnvironmentPdf()
+  Li             = textureLod(environmentMap, uv, 0.0f).rgb * pcRay.environmentIntensity;
+  pdf            = table.e[texel].pdf * float(sceneDesc.environmentAliasCount) / (2.0f * M_PI * M_PI * max(sinTheta, 1e-6f));
+  return pdf > 0.0f && sinTheta > 0.0f;
+}
+
+// Multiple importance sampling weight of the strategy with the pdf a against the one with b
+float powerHeuristic(float a, float b)
+{
+  float a2 = a * a;
+  return a2 / (a2 + b * b);
+}
+
+#endif // ENVIRONMENT
@@ -44,7 +44,7 @@ layout(location = 3) in vec3 i_worldTag;
 layout(location = 4) in vec3 i_worldBin;
 layout(location = 5) in vec3 i_viewDir;
 layout(location = 6) in vec2 i_texCoord;
-//layout(location = 7) in mat3 i_tbn;
+layout(location = 7) flat in int i_materialId;
 // Outgoing
 layout(location = 0) out vec4 o_color;
 layout(location = 1) out vec4 o_position;
@@ -108,8 +108,7 @@ vec3 getNormal(int normTexId)
     mat3 tbn = mat3(T, B, N);
     //mat3 tbn = getTBN(); // generate tangent and binormal using surface derivatives, can show incorrect results if the tangents in the buffer are not "ordinary"
 
-    vec3 nrm = texture(textureSamplers[nonuniformEXT(normTexId)], i_texCoord).xyz * 2.0f - 1.0f;
-    nrm = normalize(nrm);
+    vec3 nrm = getTangentSpaceNormal(normTexId, i_texCoord);
     nrm = normalize(tbn * nrm);
     
     N = nrm;
@@ -123,7 +122,7 @@ void main()
 {
   // Material of the object
   GltfMaterials   gltfMat = GltfMaterials(sceneDesc.materialAddress);
-  GltfPBRMaterial mat     = gltfMat.m[pcRaster.materialId];
+  GltfPBRMaterial mat     = gltfMat.m[i_materialId];
   GltfLights      lights  = GltfLights(sceneDesc.lightAddress);
 
   vec3 N = getNormal(mat.normalTexture);
@@ -133,7 +132,7 @@ void main()
   pbrGetMetallicRoughness(mat, i_texCoord, metalness, roughness);
 
   o_motionVector = vec4(0.0f);
-  o_normalRoughness = NRD_FrontEnd_PackNormalAndRoughness(N, roughness, float(pcRaster.materialId));
+  o_normalRoughness = NRD_FrontEnd_PackNormalAndRoughness(N, roughness, float(i_materialId));
   o_viewZ = (pcRaster.viewMatrix * vec4(i_worldPos, 1.0f)).z;
   o_diffRadianceHitD = vec4(0.0f);
   
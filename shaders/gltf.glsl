@@ -44,6 +44,13 @@ void pbrGetMetallicRoughness(GltfPBRMaterial mat, vec2 texCoord, out float metal
   }
 }
 
+// Tangent space normal, z is rebuilt so two channel (BC5) normal maps work as well
+vec3 getTangentSpaceNormal(int normalTexture, vec2 texCoord)
+{
+  vec2 xy = texture(textureSamplers[nonuniformEXT(normalTexture)], texCoord).xy * 2.0f - 1.0f;
+  return vec3(xy, sqrt(max(1.0f - dot(xy, xy), 0.0f)));
+}
+
 vec3 pbrGetEmissive(GltfPBRMaterial mat, vec2 texCoord)
 {
   vec3 emittance = mat.emissiveFactor;
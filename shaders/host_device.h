@@ -45,7 +45,8 @@ using uint = unsigned int;
 START_BINDING(SceneBindings)
   eGlobals   = 0,  // Global uniform containing camera matrices
   eSceneDesc = 1,
-  eTextures  = 2  // Access to textures
+  eTextures  = 2,  // Access to textures
+  eEnvironment = 3  // Equirectangular environment map (environment_map.h)
 END_BINDING();
 
 START_BINDING(RtxBindings)
@@ -59,30 +60,73 @@ START_BINDING(RtxBindings)
   eInMV       = 7,
   eInNormRough= 8,
   eInViewZ    = 9,
-  eInRadHitD  = 10
+  eInRadHitD  = 10,
+  eSampleSum  = 11,  // Sum of the path tracer samples of each pixel (adaptive_sampling.comp)
+  eSampleSumSq = 12, // Sum of their squares
+  eSampleCount = 13  // Number of samples
 END_BINDING();
 // clang-format on
 
 
+// Irradiance probe volume of the hybrid GI, a grid of probes over the scene bounds updated by
+// probe_trace.rgen and probe_update.comp, sampled with probe_volume.glsl
+#define PROBE_RAYS 128               // Traced per probe and update, whatever the resolution
+#define PROBE_IRRADIANCE_TEXELS 8    // On a side of the octahedral irradiance of a probe, without its border
+#define PROBE_DEPTH_TEXELS 16        // Same for its distance and squared distance
+#define PROBE_HYSTERESIS 0.97f       // Weight of the previous update in the blend
+#define PROBE_DEPTH_SHARPNESS 50.0f  // Exponent of the cosine weight of the rays in the depth texels
+
+struct ProbeVolume
+{
+  mat4     rayRotation;        // Random rotation of the ray directions of this update
+  vec4     origin;             // Position of the first probe, spacing between the probes in w
+  int      countX;             // Probes along each axis
+  int      countY;
+  int      countZ;
+  uint     updates;            // Since the probes were placed, the first update overwrites them
+  uint64_t rayAddress;         // ProbeRay, PROBE_RAYS per probe
+  uint64_t irradianceAddress;  // vec4 texels, (PROBE_IRRADIANCE_TEXELS + 2)^2 per probe with the border
+  uint64_t depthAddress;       // vec2 texels, (PROBE_DEPTH_TEXELS + 2)^2 per probe
+  float    hysteresis;
+  float    maxDistance;        // Of the rays in the depth texels, the misses are clamped to it
+};
+
+struct ProbeRay
+{
+  vec3  radiance;
+  float distance;
+};
+
 // Uniform buffer set at each frame
 struct GlobalUniforms
 {
   mat4 viewProj;     // Camera view * projection
   mat4 viewInverse;  // Camera inverse view matrix
   mat4 projInverse;  // Camera inverse projection matrix
+  mat4 prevViewProj; // Of the previous frame, to reproject the reservoirs of the hybrid renderer
+  uint64_t restirAddress;      // RestirReservoir per pixel, written this frame
+  uint64_t restirPrevAddress;  // Written the previous frame
+  uint64_t restirGIAddress;      // RestirGIReservoir per pixel, written this frame
+  uint64_t restirGIPrevAddress;  // Written the previous frame
+  ProbeVolume probes;
 };
 
-// Push constant structure for the raster
+// Push constant structure for the raster, per-node data is in InstanceInfo
 struct PushConstantRaster
 {
-  mat4  modelMatrix;  // matrix of the instance
-  mat4  inverseTransposeMatrix;
   mat4  viewMatrix;
-  uint  objIndex;
-  int   materialId;
   int   lightsCount;
 };
 
+// Raster data of a node, indexed with gl_InstanceIndex (firstInstance of its draws)
+struct InstanceInfo
+{
+  mat4 modelMatrix;   // World matrix, with the position dequantization of its primitive mesh
+  mat4 normalMatrix;  // Inverse transpose of the world matrix
+  uint primMesh;
+  int  materialId;
+};
+
 
 // Push constant structure for the ray tracer
 struct PushConstantRay
@@ -95,15 +139,113 @@ struct PushConstantRay
   int  useShadows;
   int  useAO;
   int  useGI;
+  uint shadowMask;  // Instances hit by shadow and AO rays, RAY_MASK_SHADOW_*
+  int  emissiveLights;  // Next event estimation of the emissive triangles, otherwise they are only hit
+  uint lightSampling;   // LIGHT_SAMPLING_*, selection of the punctual light of the next event estimation
+  float environmentIntensity;  // Scale of the environment map radiance
+  int   environmentLights;     // Next event estimation of the environment map, otherwise it is only hit
+  int   rouletteDepth;         // Russian roulette on the paths from this depth on, 0 disables it
+  int   adaptiveSampling;      // Samples of each tile from the AdaptiveTile buffer, otherwise `samples` everywhere
+  uint  sampler;               // SAMPLER_*, sequence of the random numbers of the paths
+  uint64_t tileAddress;        // AdaptiveTile, one per tile of ADAPTIVE_TILE_SIZE pixels
+  uint64_t samplerAddress;     // Sobol direction numbers then the blue-noise tile (sampler.h)
+  int   restirDI;              // Direct lighting of the hybrid renderer by ReSTIR, instead of the raster and shadow ray
+  uint  restirCandidates;      // Lights streamed through the reservoir of each pixel per frame
+  int   restirGI;              // Diffuse indirect light of the hybrid renderer resampled by ReSTIR GI
+  int   probeGI;               // Diffuse indirect light of the hybrid renderer from the probe volume instead of rays
+};
+
+#define LIGHT_SAMPLING_UNIFORM 0
+#define LIGHT_SAMPLING_BVH 1  // By estimated contribution, traversing the light BVH (light_bvh.h)
+#define LIGHT_SAMPLING_POWER 2  // By power, from an alias table (alias_table.h)
+
+// Random numbers of the paths, by sample index and dimension (sampler.h, shaders/sampler.glsl)
+#define SAMPLER_RANDOM 0      // LCG seeded per pixel and sample, the dimensions are drawn in order
+#define SAMPLER_SOBOL 1       // Owen-scrambled Sobol, scrambled per pixel
+#define SAMPLER_BLUE_NOISE 2  // Owen-scrambled Sobol shared by the pixels, shifted per pixel by a blue-noise tile
+#define SOBOL_DIMENSIONS 4    // Dimensions of the Sobol points, the others are padded by shuffling them
+#define SOBOL_BITS 32         // Direction numbers per dimension
+#define BLUE_NOISE_SIZE 64    // Pixels on a side of the blue-noise tile, a power of 2
+
+// Instance masks of the TLAS: each node has its full geometry, and a proxy instance of one of its
+// LOD levels when it has any. Shadow and AO rays trace either the full geometry or the proxies
+#define RAY_MASK_PRIMARY 0x01
+#define RAY_MASK_SHADOW_PROXY 0x02
+#define RAY_MASK_SHADOW_FULL 0x04
+
+// Adaptive sampling of the path tracer: after each frame, the error of every tile of the image sets
+// its samples for the next one, until it is under the threshold
+#define ADAPTIVE_TILE_SIZE 16
+
+struct AdaptiveTile
+{
+  uint  samples;  // Per pixel in the next frame, 0 once converged
+  float error;    // Relative standard error of the mean, RMS over the pixels
+};
+
+// Counters of the tile scheduling of one frame, read back by the host
+struct AdaptiveCounts
+{
+  uint activeTiles;  // Tiles still sampled
+  uint sampleSum;    // Sum over the tiles of their average samples per pixel
+};
+
+// Push constant structure for the tile scheduling
+struct PushConstantAdaptive
+{
+  uint64_t tileAddress;
+  uint64_t countAddress;  // AdaptiveCounts of this frame
+  float    threshold;     // Relative error under which a tile is converged
+  uint     minSamples;    // Per pixel before the error is trusted
+  uint     maxSamples;    // Per pixel, a tile stops there even above the threshold
+  uint     samples;       // Per pixel and frame of the tiles not yet estimated
+  uint     tileCountX;
+  uint     padding;
+};
+
+// ReSTIR direct lighting of the hybrid renderer (shaders/restir.glsl): the reservoir of each pixel
+// keeps one punctual light, reused by the next frame around the reprojected pixel
+#define RESTIR_MAX_HISTORY 20  // Sample count of a reused reservoir, in candidates of a frame
+#define RESTIR_SPATIAL_SAMPLES 4
+#define RESTIR_SPATIAL_RADIUS 16.0f  // Pixels
+
+struct RestirReservoir
+{
+  vec3  position;  // Surface of the pixel, to reject the reservoirs of other surfaces
+  int   light;
+  vec3  normal;
+  float weight;    // Unbiased contribution weight of the light, 0 when it was occluded
+  float M;         // Candidates seen
+};
+
+#define RESTIR_GI_MAX_HISTORY 30      // Sample count of a reused reservoir, one path per frame
+#define RESTIR_GI_MAX_JACOBIAN 10.0f  // Reused samples whose solid angle changes more are rejected
+
+struct RestirGIReservoir
+{
+  vec3  position;        // Visible point of the pixel, the sample is reused from there
+  float weight;          // Unbiased contribution weight of the sample, 0 when it was occluded
+  vec3  normal;
+  float M;               // Paths seen
+  vec3  samplePosition;  // Secondary hit, or far along the ray when it left the scene
+  vec3  sampleNormal;    // Facing the visible point
+  vec3  radiance;        // Leaving the secondary hit toward the visible point
 };
 
 struct PrimMeshInfo
 {
-  uint indexOffset;
+  uint indexOffset;   // First index, in units of indexSize
   uint vertexOffset;
   int  materialIndex;
+  uint indexSize;     // 2 or 4 bytes
+  vec4 posOffset;     // Quantized positions: position = posOffset + snorm * posScale (xyz)
+  vec4 posScale;
 };
 
+// SceneDesc::vertexFlags
+#define VERTEX_COMPRESSED 1           // Octahedral normals and tangents, half UVs (vertex_compression.h)
+#define VERTEX_QUANTIZED_POSITIONS 2  // snorm16x4 positions
+
 struct SceneDesc
 {
   uint64_t vertexAddress;
@@ -114,6 +256,120 @@ struct SceneDesc
   uint64_t materialAddress;
   uint64_t lightAddress;
   uint64_t primInfoAddress;
+  uint64_t instanceAddress;
+  uint64_t emissiveTriangleAddress;  // EmissiveTriangle
+  uint64_t lightBvhAddress;          // LightBvhNode
+  uint64_t lightAliasAddress;        // AliasEntry, one per light
+  uint64_t environmentAliasAddress;  // AliasEntry, one per texel of the environment map
+  uint     vertexFlags;
+  uint     emissiveTriangleCount;
+  uint     lightBvhNodeCount;
+  uint     lightAliasCount;          // 0 when no light has power
+  uint     environmentWidth;         // 0 without environment map, the misses keep the clear color
+  uint     environmentHeight;
+  uint     environmentAliasCount;    // 0 when the environment map is black
+  float    emissivePower;            // Sum of the luminance times the area of the emissive triangles
+};
+
+// Cluster of consecutive triangles of a primitive mesh (meshlet_builder.h)
+struct Meshlet
+{
+  vec4 boundingSphere;  // Object space center and radius
+  vec4 cone;            // Normal cone axis and cutoff, the cone is unusable when the cutoff is 1
+  uint firstIndex;      // In units of the index size of its primitive mesh
+  uint indexCount;
+  int  vertexOffset;
+  uint drawList;        // DRAW_LIST_*, by the index size of its primitive mesh
+};
+
+// Meshlets of one LOD level of a primitive mesh (mesh_simplifier.h)
+struct MeshLod
+{
+  uint  firstMeshlet;
+  uint  meshletCount;
+  float error;     // Object space, 0 for level 0
+  uint  primMesh;  // Primitive mesh of the level
+};
+
+// A node as seen by the cluster culling, the visible meshlets of its selected LOD level are
+// appended to one of the two draw lists, by index type
+struct CullNode
+{
+  mat4 worldMatrix;
+  vec4 boundingSphere;  // World space, for the LOD selection
+  uint firstLod;        // MeshLod of level 0, the coarser levels follow
+  uint lodCount;
+  uint drawList;        // DRAW_LIST_* of level 0
+  uint flags;           // CULL_NODE_*
+};
+
+#define DRAW_LIST_INDEX16 0
+#define DRAW_LIST_INDEX32 1
+
+#define CULL_NODE_CONE 1  // Rigid transform with uniform scale, the normal cones can be transformed
+
+// CullUniforms::flags
+#define CULL_FRUSTUM 1
+#define CULL_BACKFACE 2     // Normal cones, only valid for single sided geometry
+#define CULL_OCCLUSION 4    // Two phases against the Hi-Z pyramid
+#define CULL_HIZ_HISTORY 8  // The pyramid holds the previous frame, the first phase can test against it
+#define CULL_LOD 16          // Coarsest LOD level whose error stays under lodPixelError, level 0 otherwise
+
+#define HIZ_MAX_LEVELS 16
+
+// Bindings of the Hi-Z pyramid, shared by its build and the cluster culling
+START_BINDING(HizBindings)
+  eHizDepth   = 0,  // Depth buffer, the source of mip 0
+  eHizPyramid = 1,  // All mips, sampled
+  eHizMips    = 2   // One storage image per mip
+END_BINDING();
+
+// Parameters of the cluster culling, updated once per frame
+struct CullUniforms
+{
+  mat4     viewProj;
+  mat4     hizViewProj;  // Camera the Hi-Z pyramid was built with
+  vec3     cameraPosition;
+  uint     nodeCount;
+  uint64_t meshletAddress;
+  uint64_t nodeAddress;
+  uint64_t drawAddress;      // VkDrawIndexedIndirectCommand per visible meshlet instance
+  uint64_t countAddress;     // CullCounts
+  uint64_t nodeListAddress;  // Indices of the nodes to cull, all nodes when 0
+  uint64_t occludedAddress;  // (node, meshlet) pairs rejected by the first phase, meshlet indices are absolute
+  uint     flags;
+  uint     drawList32Offset;  // First command of DRAW_LIST_INDEX32, the 16-bit list starts at 0
+  uint     drawPhaseOffset;   // First command of the second phase
+  uint     occludedCapacity;
+  uint     hizWidth;          // Mip 0, the size of the depth buffer
+  uint     hizHeight;
+  uint     hizLevels;
+  float    lodPixelError;       // Largest error of a LOD level on screen, in pixels
+  uint64_t lodAddress;          // MeshLod
+  float    lodPixelsPerRadian;  // height / (2 tan(fovy / 2))
+  uint     padding;
+};
+
+// Counters of the cluster culling, reset every frame
+struct CullCounts
+{
+  uint drawCounts[4];  // [phase * 2 + DRAW_LIST_*]
+  uint occludedCount;
+  uint dispatch[3];  // VkDispatchIndirectCommand of the second phase
+};
+
+// Push constant structure for the cluster culling
+struct PushConstantCull
+{
+  uint64_t uniformAddress;  // CullUniforms
+  uint     phase;           // 0: visible nodes, 1: what phase 0 found occluded
+  uint     padding;
+};
+
+// Push constant structure for the Hi-Z pyramid build
+struct PushConstantHiz
+{
+  uint level;
 };
 
 struct GltfPBRMaterial
@@ -128,6 +384,44 @@ struct GltfPBRMaterial
   int   emissiveTexture;
 };
 
+// Emissive triangle of a node, in world space (light_sampling.h)
+struct EmissiveTriangle
+{
+  vec3  v0;
+  float pdf;  // Probability to pick it, proportional to its power
+  vec3  v1;
+  float cdf;  // Sum of the pdfs up to this triangle included
+  vec3  v2;
+  float area;
+  vec2  uv0;
+  vec2  uv1;
+  vec2  uv2;
+  int   materialIndex;
+};
+
+// Entry i of a Walker alias table (alias_table.h): i is picked with the probability 'threshold',
+// otherwise 'alias' is
+struct AliasEntry
+{
+  float threshold;
+  int   alias;
+  float pdf;  // Probability of i in the distribution
+};
+
+// Node of the light BVH over the punctual lights (light_bvh.h). The two children of an interior
+// node are adjacent, a leaf holds one light
+struct LightBvhNode
+{
+  vec3  boundsMin;
+  float power;       // Of the lights below
+  vec3  boundsMax;
+  float cosTheta_o;  // Bounding cone of the emission: spread of the normals around the axis
+  vec3  axis;
+  float cosTheta_e;  // and spread of the emission around each normal
+  int   child;       // Interior: first child, leaf: -1
+  int   light;       // Leaf: index in the light buffer
+};
+
 struct GltfLight
 {
     vec3  position;
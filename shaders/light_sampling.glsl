@@ -0,0 +1,184 @@
+#ifndef LIGHT_SAMPLING
+#define LIGHT_SAMPLING
+
+// Needs gltf.glsl and raycommon.glsl, included before
+#include "host_device.h"
+#include "common_layouts.glsl"
+#include "random.glsl"
+#include "environment.glsl"
+
+// Probability of the next event estimation to sample the emissive triangles: half of what the
+// environment leaves when the scene has any. The punctual lights get the rest
+float getEmissiveLightProb()
+{
+  bool sampled = pcRay.emissiveLights != 0 && sceneDesc.emissiveTriangleCount > 0;
+  return sampled ? 0.5f * (1.0f - getEnvironmentLightProb()) : 0.0f;
+}
+
+// Sampled point of a light, as seen from the shaded point
+struct LightSample
+{
+  vec3  L;         // Direction to the light
+  float distance;
+  vec3  Li;        // Incoming radiance
+  float pdf;       // Solid angle, including the pick of the light
+};
+
+// Triangle whose cdf interval holds u, see buildEmissiveTriangles()
+uint pickEmissiveTriangle(float u)
+{
+  EmissiveTriangles triangles = EmissiveTriangles(sceneDesc.emissiveTriangleAddress);
+  uint first = 0;
+  uint last  = sceneDesc.emissiveTriangleCount - 1;
+  while (first < last)
+  {
+    uint middle = (first + last) / 2;
+    if (u < triangles.t[middle].cdf)
+      last = middle;
+    else
+      first = middle + 1;
+  }
+  return first;
+}
+
+// Uniform point on an emissive triangle picked by power, u.x picks the triangle and u.yz the point.
+// Both sides emit, like the hits of the emissive surfaces. Returns false when the triangle is seen
+// edge-on
+bool sampleEmissiveTriangle(vec3 u, vec3 P, out LightSample ls)
+{
+  EmissiveTriangle tri = EmissiveTriangles(sceneDesc.emissiveTriangleAddress).t[pickEmissiveTriangle(u.x)];
+
+  float su = sqrt(u.y);
+  vec3  barycentrics = vec3(1.0 - su, u.z * su, 0.0);
+  barycentrics.z     = 1.0 - barycentrics.x - barycentrics.y;
+
+  vec3 position = tri.v0 * barycentrics.x + tri.v1 * barycentrics.y + tri.v2 * barycentrics.z;
+  vec2 texCoord = tri.uv0 * barycentrics.x + tri.uv1 * barycentrics.y + tri.uv2 * barycentrics.z;
+  vec3 normal   = normalize(cross(tri.v1 - tri.v0, tri.v2 - tri.v0));
+
+  vec3 toLight = position - P;
+  ls.distance  = length(toLight);
+  ls.L         = toLight / ls.distance;
+  float cosLight = abs(dot(normal, ls.L));
+  if (cosLight < 1e-4 || ls.distance < 1e-4)
+    return false;
+
+  GltfPBRMaterial mat = GltfMaterials(sceneDesc.materialAddress).m[tri.materialIndex];
+  ls.Li  = pbrGetEmissive(mat, texCoord);
+  ls.pdf = tri.pdf * ls.distance * ls.distance / (cosLight * tri.area);
+  return true;
+}
+
+// cos(max(0, a - b)) from the sines and cosines of the angles a and b
+float cosSubClamped(float sinA, float cosA, float sinB, float cosB)
+{
+  return cosA > cosB ? 1.0 : cosA * cosB + sinA * sinB;
+}
+
+float sinSubClamped(float sinA, float cosA, float sinB, float cosB)
+{
+  return cosA > cosB ? 0.0 : sinA * cosB - cosA * sinB;
+}
+
+// Estimated contribution of the lights of a node at P with the normal N, see getLightBvhImportance()
+float getLightBvhImportance(LightBvhNode node, vec3 P, vec3 N)
+{
+  vec3  center = (node.boundsMin + node.boundsMax) * 0.5;
+  vec3  diag   = node.boundsMax - node.boundsMin;
+  vec3  toP    = P - center;
+  float dist2  = dot(toP, toP);
+  float d2     = max(dist2, length(diag) * 0.5);
+  if (d2 <= 0.0)
+    return 0.0;
+  vec3 wi = toP * inversesqrt(max(dist2, 1e-12));
+
+  // Angle of the bounds seen from P
+  float radius2    = dot(diag, diag) * 0.25;
+  float cosTheta_b = dist2 > radius2 ? sqrt(max(1.0 - radius2 / dist2, 0.0)) : -1.0;
+  float sinTheta_b = sqrt(max(1.0 - cosTheta_b * cosTheta_b, 0.0));
+
+  // Smallest angle between the direction to P and the emission of the lights
+  float cosTheta_w = dot(node.axis, wi);
+  float sinTheta_w = sqrt(max(1.0 - cosTheta_w * cosTheta_w, 0.0));
+  float sinTheta_o = sqrt(max(1.0 - node.cosTheta_o * node.cosTheta_o, 0.0));
+  float cosTheta_x = cosSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, node.cosTheta_o);
+  float sinTheta_x = sinSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, node.cosTheta_o);
+  float cosThetap  = cosSubClamped(sinTheta_x, cosTheta_x, sinTheta_b, cosTheta_b);
+  if (cosThetap <= node.cosTheta_e)
+    return 0.0;
+
+  // Smallest incident angle at the receiver
+  float cosTheta_i  = abs(dot(wi, N));
+  float sinTheta_i  = sqrt(max(1.0 - cosTheta_i * cosTheta_i, 0.0));
+  float cosThetap_i = cosSubClamped(sinTheta_i, cosTheta_i, sinTheta_b, cosTheta_b);
+  return max(node.power * cosThetap / d2 * cosThetap_i, 0.0);
+}
+
+// Descends the light BVH from the root, picking each child by its importance. pmf is the
+// probability of the light reached, see sampleLightBvh()
+bool sampleLightBvh(float u, vec3 P, vec3 N, out int lightIndex, out float pmf)
+{
+  lightIndex = 0;
+  pmf        = 1.0;
+  if (sceneDesc.lightBvhNodeCount == 0)
+    return false;
+
+  LightBvhNodes nodes = LightBvhNodes(sceneDesc.lightBvhAddress);
+  int           index = 0;
+  while (nodes.n[index].child >= 0)
+  {
+    int   child = nodes.n[index].child;
+    float left  = getLightBvhImportance(nodes.n[child], P, N);
+    float right = getLightBvhImportance(nodes.n[child + 1], P, N);
+    if (left + right <= 0.0)
+      return false;
+
+    float pLeft = left / (left + right);
+    if (u < pLeft)
+    {
+      index = child;
+      u     = min(u / pLeft, 0.99999994);
+      pmf *= pLeft;
+    }
+    else
+    {
+      index = child + 1;
+      u     = min((u - pLeft) / (1.0 - pLeft), 0.99999994);
+      pmf *= 1.0 - pLeft;
+    }
+  }
+  lightIndex = nodes.n[index].light;
+  return pmf > 0.0;
+}
+
+// Light picked by power from the alias table, in constant time, see sampleAliasTable()
+bool sampleLightAlias(float u, out int lightIndex, out float pmf)
+{
+  lightIndex = 0;
+  pmf        = 0.0;
+  if (sceneDesc.lightAliasCount == 0)
+    return false;
+
+  AliasTable table  = AliasTable(sceneDesc.lightAliasAddress);
+  float      scaled = u * float(sceneDesc.lightAliasCount);
+  uint       bucket = min(uint(scaled), sceneDesc.lightAliasCount - 1);
+  AliasEntry entry  = table.e[bucket];
+  lightIndex        = (scaled - float(bucket)) < entry.threshold ? int(bucket) : entry.alias;
+  pmf               = table.e[lightIndex].pdf;
+  return pmf > 0.0;
+}
+
+// Punctual light of the next event estimation at P, by pcRay.lightSampling, for the uniform number u
+bool samplePunctualLight(float u, vec3 P, vec3 N, out int lightIndex, out float pmf)
+{
+  if (pcRay.lightSampling == LIGHT_SAMPLING_BVH)
+    return sampleLightBvh(u, P, N, lightIndex, pmf);
+  if (pcRay.lightSampling == LIGHT_SAMPLING_POWER)
+    return sampleLightAlias(u, lightIndex, pmf);
+
+  lightIndex = min(int(u * float(pcRay.lightsCount)), pcRay.lightsCount - 1);
+  pmf        = 1.0 / float(pcRay.lightsCount);
+  return pcRay.lightsCount > 0;
+}
+
+#endif  // LIGHT_SAMPLING
@@ -23,6 +23,7 @@ layout(location = 0) out vec4 fragColor;
 
 layout(set = 0, binding = 0) uniform sampler2D noisyTxt;
 layout(set = 0, binding = 1) uniform sampler2D rtTxt;
+layout(set = 0, binding = 2) uniform usampler2D sampleCountTxt;  // Samples per pixel of the path tracer
 
 layout(push_constant) uniform shaderInformation
 {
@@ -30,13 +31,29 @@ layout(push_constant) uniform shaderInformation
   int rtMode;
   int viewAccumulated;
   int useGI;
+  int viewSampleCount;
+  float maxSampleCount;
 }
 pushc;
 
+// Blue for few samples, through green and yellow, to red at the top of the scale
+vec3 getHeatColor(float t)
+{
+  t = clamp(t, 0.0f, 1.0f);
+  return clamp(vec3(4.0f * t - 2.0f, t < 0.5f ? 4.0f * t - 0.5f : 3.5f - 4.0f * t, 2.0f - 4.0f * t), 0.0f, 1.0f);
+}
+
 void main()
 {
   vec2  uv    = outUV;
   float gamma = 1. / 2.2;
+  if (pushc.rtMode == 1 && pushc.viewSampleCount == 1)
+  {
+    // Logarithmic, the adaptive sampling spreads the counts over orders of magnitude
+    float count = float(texture(sampleCountTxt, uv).r);
+    fragColor   = vec4(getHeatColor(log2(1.0f + count) / log2(1.0f + max(pushc.maxSampleCount, 1.0f))), 1.0f);
+    return;
+  }
   vec4 mainImg = texture(noisyTxt, uv);
   if (pushc.rtMode == 0)
   {
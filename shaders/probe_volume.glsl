@@ -0,0 +1,178 @@
+#ifndef PROBE_VOLUME
+#define PROBE_VOLUME
+
+// Irradiance probe volume (Majercik et al., "Dynamic Diffuse Global Illumination with Ray-Traced
+// Irradiance Fields", JCGT 2019)
+// - A grid of probes over the scene bounds. Each update traces PROBE_RAYS rays from every probe
+//   (probe_trace.rgen), so the cost does not depend on the resolution
+// - probe_update.comp blends the rays into two octahedral maps per probe with hysteresis: the
+//   irradiance, as the cosine weighted mean of the radiance, and the mean distance to the geometry
+//   and its square. The maps keep a border of one texel, copied from the opposite edges, so they can
+//   be filtered bilinearly
+// - A point is lit by the 8 probes around it: trilinear weights, reduced for the probes behind the
+//   surface and for those that do not see the point by the Chebyshev test of the depth moments
+// Needs the global uniforms `uni` declared before
+#include "host_device.h"
+#include "globals.glsl"
+
+layout(buffer_reference, scalar) buffer ProbeRays { ProbeRay r[]; };
+layout(buffer_reference, scalar) buffer ProbeIrradiance { vec4 t[]; };
+layout(buffer_reference, scalar) buffer ProbeDepth { vec2 t[]; };
+
+int getProbeCount()
+{
+  return uni.probes.countX * uni.probes.countY * uni.probes.countZ;
+}
+
+ivec3 getProbeCoords(int probe)
+{
+  return ivec3(probe % uni.probes.countX, (probe / uni.probes.countX) % uni.probes.countY,
+               probe / (uni.probes.countX * uni.probes.countY));
+}
+
+int getProbeIndex(ivec3 coords)
+{
+  return coords.x + uni.probes.countX * (coords.y + uni.probes.countY * coords.z);
+}
+
+vec3 getProbePosition(ivec3 coords)
+{
+  return uni.probes.origin.xyz + vec3(coords) * uni.probes.origin.w;
+}
+
+// Directions of the rays of an update: a spherical Fibonacci set, rotated at random
+vec3 getProbeRayDirection(uint ray)
+{
+  const float goldenAngle = M_PI * (3.0f - sqrt(5.0f));
+  float       z           = 1.0f - (2.0f * float(ray) + 1.0f) / float(PROBE_RAYS);
+  float       r           = sqrt(max(1.0f - z * z, 0.0f));
+  float       phi         = goldenAngle * float(ray);
+  return mat3(uni.probes.rayRotation) * vec3(r * cos(phi), r * sin(phi), z);
+}
+
+vec2 signNotZero(vec2 v)
+{
+  return vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+}
+
+// Octahedral mapping of the unit sphere to [-1, 1]^2
+vec2 encodeOctahedral(vec3 n)
+{
+  n /= abs(n.x) + abs(n.y) + abs(n.z);
+  return n.z >= 0.0f ? n.xy : (1.0f - abs(n.yx)) * signNotZero(n.xy);
+}
+
+vec3 decodeOctahedral(vec2 e)
+{
+  vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+  if (n.z < 0.0f)
+    n.xy = (1.0f - abs(n.yx)) * signNotZero(n.xy);
+  return normalize(n);
+}
+
+// Texel of a map with its border, from a texel of the map without it. The border rows and
+// columns repeat the opposite edge mirrored, the corners the opposite corner
+ivec2 getProbeBorderSource(ivec2 texel, int size)
+{
+  int  last    = size + 1;
+  bool borderX = texel.x == 0 || texel.x == last;
+  bool borderY = texel.y == 0 || texel.y == last;
+  if (borderX && borderY)
+    return ivec2(texel.x == 0 ? size : 1, texel.y == 0 ? size : 1);
+  if (borderY)
+    return ivec2(last - texel.x, texel.y == 0 ? 1 : size);
+  if (borderX)
+    return ivec2(texel.x == 0 ? 1 : size, last - texel.y);
+  return texel;
+}
+
+// Position in texels, with the border, of a direction in the map of a probe
+vec2 getProbeTexelPosition(vec3 dir, int size)
+{
+  return (encodeOctahedral(dir) * 0.5f + 0.5f) * float(size) + 0.5f;
+}
+
+vec3 loadProbeIrradiance(int probe, vec3 dir)
+{
+  const int       size   = PROBE_IRRADIANCE_TEXELS + 2;
+  ProbeIrradiance texels = ProbeIrradiance(uni.probes.irradianceAddress);
+  int             first  = probe * size * size;
+  vec2            p      = getProbeTexelPosition(dir, PROBE_IRRADIANCE_TEXELS);
+  ivec2           t      = clamp(ivec2(floor(p)), ivec2(0), ivec2(size - 2));
+  vec2            f      = clamp(p - vec2(t), 0.0f, 1.0f);
+  vec3            t00    = texels.t[first + t.y * size + t.x].rgb;
+  vec3            t10    = texels.t[first + t.y * size + t.x + 1].rgb;
+  vec3            t01    = texels.t[first + (t.y + 1) * size + t.x].rgb;
+  vec3            t11    = texels.t[first + (t.y + 1) * size + t.x + 1].rgb;
+  return mix(mix(t00, t10, f.x), mix(t01, t11, f.x), f.y);
+}
+
+vec2 loadProbeDepth(int probe, vec3 dir)
+{
+  const int  size   = PROBE_DEPTH_TEXELS + 2;
+  ProbeDepth texels = ProbeDepth(uni.probes.depthAddress);
+  int        first  = probe * size * size;
+  vec2       p      = getProbeTexelPosition(dir, PROBE_DEPTH_TEXELS);
+  ivec2      t      = clamp(ivec2(floor(p)), ivec2(0), ivec2(size - 2));
+  vec2       f      = clamp(p - vec2(t), 0.0f, 1.0f);
+  vec2       t00    = texels.t[first + t.y * size + t.x];
+  vec2       t10    = texels.t[first + t.y * size + t.x + 1];
+  vec2       t01    = texels.t[first + (t.y + 1) * size + t.x];
+  vec2       t11    = texels.t[first + (t.y + 1) * size + t.x + 1];
+  return mix(mix(t00, t10, f.x), mix(t01, t11, f.x), f.y);
+}
+
+// Irradiance over pi at P: the diffuse light reflected toward V is the albedo times it. V is the
+// direction to the viewer, it moves the lookup off the surface with N to avoid self-shadowing
+vec3 sampleProbeVolume(vec3 P, vec3 N, vec3 V)
+{
+  if (uni.probes.updates == 0u)
+    return vec3(0.0f);
+
+  float spacing = uni.probes.origin.w;
+  vec3  biased  = P + (0.2f * N + 0.8f * V) * (0.3f * spacing);
+  vec3  grid    = (biased - uni.probes.origin.xyz) / spacing;
+  ivec3 last    = ivec3(uni.probes.countX, uni.probes.countY, uni.probes.countZ) - 1;
+  ivec3 base    = clamp(ivec3(floor(grid)), ivec3(0), max(last - 1, ivec3(0)));
+  vec3  alpha   = clamp(grid - vec3(base), 0.0f, 1.0f);
+
+  vec3  irradiance = vec3(0.0f);
+  float weightSum  = 0.0f;
+  for (int i = 0; i < 8; i++)
+  {
+    ivec3 offset = ivec3(i, i >> 1, i >> 2) & 1;
+    ivec3 coords = min(base + offset, last);
+    int   probe  = getProbeIndex(coords);
+
+    // Probes behind the surface count less, without a hard cut at the horizon
+    vec3  toProbe = normalize(getProbePosition(coords) - P);
+    float facing  = (dot(toProbe, N) + 1.0f) * 0.5f;
+    float weight  = facing * facing + 0.2f;
+
+    // Chebyshev upper bound of the probability that the probe sees the point
+    vec3  probeToPoint  = biased - getProbePosition(coords);
+    float probeDistance = max(length(probeToPoint), 1e-4f);
+    vec2  moments       = loadProbeDepth(probe, probeToPoint / probeDistance);
+    if (probeDistance > moments.x)
+    {
+      float variance  = abs(moments.y - moments.x * moments.x);
+      float d         = probeDistance - moments.x;
+      float chebyshev = variance / (variance + d * d);
+      weight *= max(chebyshev * chebyshev * chebyshev, 0.05f);
+    }
+
+    // Very small weights are crushed so light does not leak through thin walls
+    weight = max(weight, 1e-6f);
+    if (weight < 0.2f)
+      weight *= weight * weight / (0.2f * 0.2f);
+
+    vec3 trilinear = mix(1.0f - alpha, alpha, vec3(offset));
+    weight *= trilinear.x * trilinear.y * trilinear.z;
+
+    irradiance += weight * loadProbeIrradiance(probe, N);
+    weightSum += weight;
+  }
+  return weightSum > 0.0f ? irradiance / weightSum : vec3(0.0f);
+}
+
+#endif  // PROBE_VOLUME
@@ -32,10 +32,11 @@ float rnd(inout uint prev)
   return (float(lcg(prev)) / float(0x01000000));
 }
 
-vec3 samplingHemisphere(inout uint seed, in vec3 x, in vec3 y, in vec3 z)
+// Cosine weighted direction around z, from the uniform numbers u
+vec3 samplingHemisphere(vec2 u, in vec3 x, in vec3 y, in vec3 z)
 {
-  float r1 = rnd(seed);
-  float r2 = rnd(seed);
+  float r1 = u.x;
+  float r2 = u.y;
   float sq = sqrt(r1);
 
   vec3 direction = vec3(cos(2 * M_PI * r2) * sq, sin(2 * M_PI * r2) * sq, sqrt(1 - r1));
@@ -44,6 +45,13 @@ vec3 samplingHemisphere(inout uint seed, in vec3 x, in vec3 y, in vec3 z)
   return direction;
 }
 
+vec3 samplingHemisphere(inout uint seed, in vec3 x, in vec3 y, in vec3 z)
+{
+  float r1 = rnd(seed);
+  float r2 = rnd(seed);
+  return samplingHemisphere(vec2(r1, r2), x, y, z);
+}
+
 void createCoordinateSystem(in vec3 N, out vec3 Nt, out vec3 Nb)
 {
   if(abs(N.x) > abs(N.y))
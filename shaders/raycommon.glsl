@@ -8,14 +8,18 @@ layout(push_constant) uniform _PushConstantRay { PushConstantRay pcRay; };
 struct hitPayload
 {
     vec3 hitValue;
-    uint seed;
+    uint seed;         // State of SAMPLER_RANDOM
+    uint sampleIndex;  // Of the pixel, with the depth it indexes the dimensions of the sampler
     uint depth;
     vec3 rayOrigin;
+    vec3 hitNormal;   // Shading normal at rayOrigin, facing the ray that hit it
     vec3 rayDirection;
     vec3 weight;
     bool isSpecular;
     float lightDist;
     vec3 shadowRayDir;
+    vec3 lightValue;  // Sampled light, only added when the shadow ray reaches it
+  float bsdfPdf;    // Solid angle pdf of rayDirection for the MIS with the environment, 0 without
 };
 
 struct shadowPayload
@@ -0,0 +1,179 @@
+#ifndef RESTIR
+#define RESTIR
+
+// Direct lighting of the hybrid renderer by reservoir-based spatiotemporal importance resampling
+// of the punctual lights (Bitterli et al., "Spatiotemporal reservoir resampling for real-time ray
+// tracing with dynamic direct lighting", SIGGRAPH 2020), at the G-buffer surface of each pixel
+// - pcRay.restirCandidates lights from samplePunctualLight() are streamed through a reservoir,
+//   weighted by their unshadowed contribution over the probability they were picked with
+// - The reservoirs of the previous frame at the reprojected pixel and at a few pixels around it are
+//   merged in when their surface is close to this one. The previous frame is complete, so the
+//   temporal and the spatial reuse are fused in one pass, as the spatiotemporal resampling of RTXDI.
+//   A reused reservoir counts for at most RESTIR_MAX_HISTORY frames of candidates, so lights that
+//   move or go out fade from the history
+// - One shadow ray tests the light that remains. An occluded light is not shaded and its weight is
+//   stored as 0, so the next frame does not reuse it
+// The target of the resampling has no visibility, and the reservoirs are merged by their sample
+// counts: biased at shadow edges, but one shadow ray per pixel whatever the number of lights
+// Needs light_sampling.glsl, bsdf.glsl and sampler.glsl, included before
+#include "host_device.h"
+#include "environment.glsl"
+
+layout(buffer_reference, scalar) buffer RestirReservoirs { RestirReservoir r[]; };
+
+// Reservoir being built, the light kept and the sum of the candidate weights
+struct Reservoir
+{
+  int   light;
+  float weightSum;
+  float M;
+  float targetPdf;  // Of the light kept, at this pixel
+};
+
+// Direction, distance and unshadowed radiance of a punctual light at P. Point lights fall off with
+// the square of the distance, the others are directional, as the raster shades them
+void getPunctualLight(int lightIndex, vec3 P, out vec3 L, out float dist, out vec3 Li)
+{
+  GltfLight light = GltfLights(sceneDesc.lightAddress).l[lightIndex];
+  if (light.type == 0)
+  {
+    vec3 toLight = light.position - P;
+    dist         = max(length(toLight), 1e-4f);
+    L            = toLight / dist;
+    Li           = light.color * light.intensity / (dist * dist);
+  }
+  else
+  {
+    L    = normalize(light.position);
+    dist = ENVIRONMENT_DISTANCE;
+    Li   = light.color * light.intensity;
+  }
+}
+
+// Unshadowed contribution f Li cos of a light
+vec3 getRestirContribution(int lightIndex, vec3 P, vec3 N, vec3 V, Bsdf bsdf)
+{
+  vec3  L, Li;
+  float dist;
+  getPunctualLight(lightIndex, P, L, dist, Li);
+  return evalBsdf(bsdf, N, V, L) * Li * max(dot(N, L), 0.0f);
+}
+
+bool updateReservoir(inout Reservoir r, int light, float weight, float targetPdf, float M, float u)
+{
+  r.weightSum += weight;
+  r.M += M;
+  if (weight <= 0.0f || u * r.weightSum >= weight)
+    return false;
+  r.light     = light;
+  r.targetPdf = targetPdf;
+  return true;
+}
+
+// Whether a reservoir of the previous frame was built on about the same surface as P, N
+bool isRestirSurfaceSimilar(vec3 position, vec3 normal, vec3 P, vec3 N, float viewDistance)
+{
+  return dot(normal, N) > 0.9f && abs(dot(position - P, N)) < 0.05f * viewDistance;
+}
+
+bool isRestirReusable(RestirReservoir q, vec3 P, vec3 N, float viewDistance)
+{
+  return q.M > 0.0f && q.light >= 0 && q.light < pcRay.lightsCount
+         && isRestirSurfaceSimilar(q.position, q.normal, P, N, viewDistance);
+}
+
+// Pixel of P in the previous frame, false behind its camera
+bool getRestirPreviousPixel(vec3 P, out vec2 pixel)
+{
+  vec4 prevClip = uni.prevViewProj * vec4(P, 1.0f);
+  pixel         = (prevClip.xy / prevClip.w * 0.5f + 0.5f) * vec2(gl_LaunchSizeEXT.xy);
+  return prevClip.w > 0.0f;
+}
+
+// Pixel of the previous frame reused by the k-th merge, the reprojected one then random ones around
+// it. -1 when outside the image
+int getRestirNeighbor(vec2 prevPixel, int k, inout uint seed)
+{
+  vec2 offset = vec2(0.0f);
+  if (k > 0)
+  {
+    float radius = RESTIR_SPATIAL_RADIUS * sqrt(rnd(seed));
+    float angle  = 2.0f * M_PI * rnd(seed);
+    offset       = radius * vec2(cos(angle), sin(angle));
+  }
+  ivec2 q = ivec2(prevPixel + offset);
+  if (any(lessThan(q, ivec2(0))) || any(greaterThanEqual(q, ivec2(gl_LaunchSizeEXT.xy))))
+    return -1;
+  return q.y * int(gl_LaunchSizeEXT.x) + q.x;
+}
+
+// Merges a reservoir of the previous frame, re-weighted by its target at this pixel
+void mergeRestirReservoir(inout Reservoir r, RestirReservoir q, vec3 P, vec3 N, vec3 V, Bsdf bsdf, float u)
+{
+  float M         = min(q.M, float(RESTIR_MAX_HISTORY) * float(pcRay.restirCandidates));
+  float targetPdf = getLuminance(getRestirContribution(q.light, P, N, V, bsdf));
+  updateReservoir(r, q.light, targetPdf * q.weight * M, targetPdf, M, u);
+}
+
+// Light of the pixel after the resampling, and its unbiased contribution weight. The shading
+// is f Li cos times that weight, when the light is visible
+void resampleRestirLight(vec3 P, vec3 N, vec3 V, Bsdf bsdf, vec3 eye, inout uint seed, uint sampleIndex,
+                         out int light, out float weight, out float M)
+{
+  Reservoir r;
+  r.light     = -1;
+  r.weightSum = 0.0f;
+  r.M         = 0.0f;
+  r.targetPdf = 0.0f;
+
+  // Candidates of this frame, consecutive samples of the light pick dimension
+  uint candidates = max(pcRay.restirCandidates, 1u);
+  uint pickDim    = getBounceDimension(0u, SAMPLE_LIGHT + 1);
+  for (uint i = 0; i < candidates; i++)
+  {
+    int   lightIndex;
+    float pmf;
+    float u = getSample(seed, sampleIndex * candidates + i, pickDim);
+    if (samplePunctualLight(u, P, N, lightIndex, pmf))
+    {
+      float targetPdf = getLuminance(getRestirContribution(lightIndex, P, N, V, bsdf));
+      updateReservoir(r, lightIndex, targetPdf / pmf, targetPdf, 1.0f, rnd(seed));
+    }
+    else
+      r.M += 1.0f;
+  }
+
+  // Previous frame, at the reprojected pixel then around it
+  vec2 prevPixel;
+  if (getRestirPreviousPixel(P, prevPixel))
+  {
+    float            viewDistance = length(P - eye);
+    RestirReservoirs previous     = RestirReservoirs(uni.restirPrevAddress);
+    for (int k = 0; k <= RESTIR_SPATIAL_SAMPLES; k++)
+    {
+      int q = getRestirNeighbor(prevPixel, k, seed);
+      if (q < 0)
+        continue;
+      RestirReservoir reservoir = previous.r[q];
+      if (isRestirReusable(reservoir, P, N, viewDistance))
+        mergeRestirReservoir(r, reservoir, P, N, V, bsdf, rnd(seed));
+    }
+  }
+
+  light  = r.light;
+  M      = r.M;
+  weight = (r.light >= 0 && r.targetPdf > 0.0f) ? r.weightSum / (r.M * r.targetPdf) : 0.0f;
+}
+
+void storeRestirReservoir(vec3 P, vec3 N, int light, float weight, float M)
+{
+  RestirReservoir reservoir;
+  reservoir.position = P;
+  reservoir.light    = light;
+  reservoir.normal   = N;
+  reservoir.weight   = weight;
+  reservoir.M        = M;
+  RestirReservoirs(uni.restirAddress).r[gl_LaunchIDEXT.y * gl_LaunchSizeEXT.x + gl_LaunchIDEXT.x] = reservoir;
+}
+
+#endif  // RESTIR
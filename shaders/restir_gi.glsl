@@ -0,0 +1,118 @@
+#ifndef RESTIR_GI
+#define RESTIR_GI
+
+// Diffuse indirect light of the hybrid renderer by reservoir-based path resampling (Ouyang et al.,
+// "ReSTIR GI: Path resampling for real-time path tracing", HPG 2021)
+// - The path traced from the G-buffer surface of a pixel gives a sample: its secondary hit and the
+//   radiance that leaves it toward the surface
+// - The reservoirs of the previous frame at the reprojected pixel and around it are merged in, as
+//   for the direct lighting in restir.glsl. A sample found from another visible point is seen under
+//   another solid angle: its weight is scaled by the Jacobian of that change, and samples whose
+//   Jacobian is too far from 1 are left out
+// - The surface is shaded from the sample that remains. A sample of another pixel is only shaded
+//   when a shadow ray reaches it from this surface, otherwise its weight is stored as 0
+// The target of the resampling is the luminance of the radiance times the cosine at the surface
+// Needs restir.glsl, included before
+#include "host_device.h"
+
+layout(buffer_reference, scalar) buffer RestirGIReservoirs { RestirGIReservoir r[]; };
+
+struct GISample
+{
+  vec3 position;
+  vec3 normal;
+  vec3 radiance;
+};
+
+float getRestirGITarget(vec3 P, vec3 N, GISample s)
+{
+  return getLuminance(s.radiance) * max(dot(N, normalize(s.position - P)), 0.0f);
+}
+
+// Ratio of the solid angles an area around the sample subtends at P and at Q, where it was found
+float getRestirGIJacobian(vec3 P, vec3 Q, GISample s)
+{
+  vec3  toP    = P - s.position;
+  vec3  toQ    = Q - s.position;
+  float distP2 = dot(toP, toP);
+  float distQ2 = dot(toQ, toQ);
+  float cosP   = dot(s.normal, toP) * inversesqrt(max(distP2, 1e-8f));
+  float cosQ   = dot(s.normal, toQ) * inversesqrt(max(distQ2, 1e-8f));
+  if (cosP <= 0.0f || cosQ <= 0.0f)
+    return 0.0f;
+  return cosP * distQ2 / (cosQ * max(distP2, 1e-8f));
+}
+
+bool isRestirGIReusable(RestirGIReservoir q, vec3 P, vec3 N, float viewDistance)
+{
+  return q.M > 0.0f && isRestirSurfaceSimilar(q.position, q.normal, P, N, viewDistance);
+}
+
+// Sample of the pixel after the resampling and its unbiased contribution weight, from the path of
+// this frame and its solid angle pdf. The shading is f Lo cos times that weight, when the sample
+// is visible; reused tells whether it comes from the previous frame
+void resampleRestirGI(vec3 P, vec3 N, vec3 eye, inout uint seed, GISample initial, float initialPdf, out GISample s,
+                      out float weight, out float M, out bool reused)
+{
+  s                 = initial;
+  reused            = false;
+  float targetPdf   = getRestirGITarget(P, N, initial);
+  float weightSum   = initialPdf > 0.0f ? targetPdf / initialPdf : 0.0f;
+  float sampleCount = 1.0f;
+
+  // Previous frame, at the reprojected pixel then around it
+  vec2 prevPixel;
+  if (getRestirPreviousPixel(P, prevPixel))
+  {
+    float              viewDistance = length(P - eye);
+    RestirGIReservoirs previous     = RestirGIReservoirs(uni.restirGIPrevAddress);
+    for (int k = 0; k <= RESTIR_SPATIAL_SAMPLES; k++)
+    {
+      int q = getRestirNeighbor(prevPixel, k, seed);
+      if (q < 0)
+        continue;
+      RestirGIReservoir reservoir = previous.r[q];
+      if (!isRestirGIReusable(reservoir, P, N, viewDistance))
+        continue;
+
+      GISample candidate;
+      candidate.position = reservoir.samplePosition;
+      candidate.normal   = reservoir.sampleNormal;
+      candidate.radiance = reservoir.radiance;
+      float jacobian     = getRestirGIJacobian(P, reservoir.position, candidate);
+      if (jacobian < 1.0f / RESTIR_GI_MAX_JACOBIAN || jacobian > RESTIR_GI_MAX_JACOBIAN)
+        continue;
+
+      // The contribution weight is per solid angle at the pixel the sample was found from
+      float candidateM      = min(reservoir.M, float(RESTIR_GI_MAX_HISTORY));
+      float candidateTarget = getRestirGITarget(P, N, candidate);
+      float w               = candidateTarget * reservoir.weight * jacobian * candidateM;
+      weightSum += w;
+      sampleCount += candidateM;
+      if (w > 0.0f && rnd(seed) * weightSum < w)
+      {
+        s         = candidate;
+        targetPdf = candidateTarget;
+        reused    = true;
+      }
+    }
+  }
+
+  M      = sampleCount;
+  weight = targetPdf > 0.0f ? weightSum / (sampleCount * targetPdf) : 0.0f;
+}
+
+void storeRestirGIReservoir(vec3 P, vec3 N, GISample s, float weight, float M)
+{
+  RestirGIReservoir reservoir;
+  reservoir.position       = P;
+  reservoir.weight         = weight;
+  reservoir.normal         = N;
+  reservoir.M              = M;
+  reservoir.samplePosition = s.position;
+  reservoir.sampleNormal   = s.normal;
+  reservoir.radiance       = s.radiance;
+  RestirGIReservoirs(uni.restirGIAddress).r[gl_LaunchIDEXT.y * gl_LaunchSizeEXT.x + gl_LaunchIDEXT.x] = reservoir;
+}
+
+#endif  // RESTIR_GI
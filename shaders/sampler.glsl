@@ -0,0 +1,128 @@
+#ifndef SAMPLER
+#define SAMPLER
+
+// Random numbers of the path tracer, by the sample index of the pixel and a dimension, in the
+// ray tracing stages. Same sequences as sampler.cpp, pcRay.sampler picks one
+// - SAMPLER_RANDOM: the LCG of random.glsl, seeded from the pixel and the sample index. The
+//   dimension is ignored, the numbers come in the order they are drawn
+// - SAMPLER_SOBOL: 4D Sobol points, Owen-scrambled with a hash (Laine-Karras permutation). The
+//   dimensions are padded 4 at a time by shuffling the index with another scramble, every group and
+//   pixel has its own seeds (Burley, "Practical Hash-based Owen Scrambling", JCGT 2020)
+// - SAMPLER_BLUE_NOISE: the same points with one seed for all pixels, each dimension shifted modulo
+//   1 by a blue-noise tile at its own offset. Every sample index puts a blue-noise pattern on the
+//   screen, and every pixel still gets a low-discrepancy sequence over the sample indices
+#include "host_device.h"
+#include "raycommon.glsl"
+#include "common_layouts.glsl"
+#include "random.glsl"
+
+layout(buffer_reference, scalar) readonly buffer SamplerTables { uint t[]; };
+
+// Dimensions of a path: the camera, then SAMPLE_BOUNCE_DIMENSIONS per bounce, in groups of
+// SOBOL_DIMENSIONS so the 2D samples fall on 2 dimensions of the same Sobol points
+const uint SAMPLE_CAMERA            = 0;  // Subpixel position
+const uint SAMPLE_BOUNCE_BASE       = 4;
+const uint SAMPLE_BOUNCE_DIMENSIONS = 12;
+// Offsets in a bounce
+const uint SAMPLE_BSDF     = 0;  // Lobe, then the direction
+const uint SAMPLE_ROULETTE = 3;
+const uint SAMPLE_LIGHT    = 4;  // Light type, then up to 4 for the light sample
+const uint SAMPLE_AO       = 9;  // Direction of the ambient occlusion of the hybrid renderer
+
+uint getBounceDimension(uint depth, uint offset)
+{
+  return SAMPLE_BOUNCE_BASE + depth * SAMPLE_BOUNCE_DIMENSIONS + offset;
+}
+
+// Integer finalizer, https://nullprogram.com/blog/2018/07/31/
+uint hashSample(uint x)
+{
+  x ^= x >> 16;
+  x *= 0x21f0aaadu;
+  x ^= x >> 15;
+  x *= 0x735a2d97u;
+  x ^= x >> 15;
+  return x;
+}
+
+uint hashCombine(uint seed, uint v)
+{
+  return seed ^ (hashSample(v) + (seed << 6) + (seed >> 2));
+}
+
+// Owen scrambling of the bits of x, from the most significant one
+uint nestedUniformScramble(uint x, uint seed)
+{
+  x = bitfieldReverse(x);
+  x ^= x * 0x3d20adeau;
+  x += seed;
+  x *= (seed >> 16) | 1u;
+  x ^= x * 0x05526c56u;
+  x ^= x * 0x53a22864u;
+  return bitfieldReverse(x);
+}
+
+uint getSobol(SamplerTables tables, uint index, uint dimension)
+{
+  uint x = 0;
+  for (uint bit = 0; index != 0; index >>= 1, bit++)
+  {
+    if ((index & 1u) != 0)
+      x ^= tables.t[dimension * SOBOL_BITS + bit];
+  }
+  return x;
+}
+
+// 32-bit fraction of dimension for the sample index, scrambled from seed
+uint getScrambledSobol(SamplerTables tables, uint seed, uint sampleIndex, uint dimension)
+{
+  uint groupSeed = hashCombine(seed, dimension / SOBOL_DIMENSIONS);
+  uint index     = nestedUniformScramble(sampleIndex, groupSeed);
+  uint component = dimension % SOBOL_DIMENSIONS;
+  return nestedUniformScramble(getSobol(tables, index, component), hashCombine(groupSeed, component + 1));
+}
+
+// State of SAMPLER_RANDOM at the start of a sample
+uint initSampleSeed(uint sampleIndex)
+{
+  return tea(gl_LaunchIDEXT.y * gl_LaunchSizeEXT.x + gl_LaunchIDEXT.x, sampleIndex);
+}
+
+float getSample(inout uint seed, uint sampleIndex, uint dimension)
+{
+  if (pcRay.sampler == SAMPLER_RANDOM)
+    return rnd(seed);
+
+  SamplerTables tables = SamplerTables(pcRay.samplerAddress);
+  uint          x;
+  if (pcRay.sampler == SAMPLER_SOBOL)
+  {
+    x = getScrambledSobol(tables, hashSample(gl_LaunchIDEXT.y * gl_LaunchSizeEXT.x + gl_LaunchIDEXT.x), sampleIndex, dimension);
+  }
+  else
+  {
+    uint  offset = hashSample(dimension);
+    uvec2 texel  = (gl_LaunchIDEXT.xy + uvec2(offset, offset >> 16)) % BLUE_NOISE_SIZE;
+    x = getScrambledSobol(tables, 0u, sampleIndex, dimension)
+        + tables.t[SOBOL_DIMENSIONS * SOBOL_BITS + texel.y * BLUE_NOISE_SIZE + texel.x];
+  }
+  // 24 bits, as the LCG, so the float stays under 1
+  return float(x >> 8) / float(0x01000000);
+}
+
+vec2 getSample2(inout uint seed, uint sampleIndex, uint dimension)
+{
+  return vec2(getSample(seed, sampleIndex, dimension), getSample(seed, sampleIndex, dimension + 1));
+}
+
+vec3 getSample3(inout uint seed, uint sampleIndex, uint dimension)
+{
+  return vec3(getSample2(seed, sampleIndex, dimension), getSample(seed, sampleIndex, dimension + 2));
+}
+
+vec4 getSample4(inout uint seed, uint sampleIndex, uint dimension)
+{
+  return vec4(getSample3(seed, sampleIndex, dimension), getSample(seed, sampleIndex, dimension + 3));
+}
+
+#endif // SAMPLER
@@ -23,8 +23,10 @@
 #extension GL_GOOGLE_include_directive : enable
 
 #extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
+#extension GL_EXT_buffer_reference2 : require
 
 #include "gltf.glsl"
+#include "vertex_format.glsl"
 
 layout(binding = 0) uniform _GlobalUniforms
 {
@@ -36,6 +38,8 @@ layout(push_constant) uniform _PushConstantRaster
   PushConstantRaster pcRaster;
 };
 
+// Compressed vertices hold octahedral normals and tangents in .xy, and their position
+// dequantization is part of the model matrix
 layout(location = 0) in vec3 i_position;
 layout(location = 1) in vec3 i_normal;
 layout(location = 2) in vec4 i_tangent;
@@ -49,7 +53,7 @@ layout(location = 3) out vec3 o_worldTag;
 layout(location = 4) out vec3 o_worldBin;
 layout(location = 5) out vec3 o_viewDir;
 layout(location = 6) out vec2 o_texCoord;
-//layout(location = 7) out mat3 o_tbn;
+layout(location = 7) flat out int o_materialId;
 
 out gl_PerVertex
 {
@@ -59,16 +63,28 @@ out gl_PerVertex
 
 void main()
 {
+  // Every draw of a node has its index as firstInstance
+  InstanceInfo instance = Instances(sceneDesc.instanceAddress).i[gl_InstanceIndex];
+  o_materialId          = instance.materialId;
+
   vec3 origin = vec3(uni.viewInverse * vec4(0, 0, 0, 1));
 
-  o_worldPos = vec3(pcRaster.modelMatrix * vec4(i_position, 1.0));
+  vec3 normal  = i_normal;
+  vec4 tangent = i_tangent;
+  if ((sceneDesc.vertexFlags & VERTEX_COMPRESSED) != 0)
+  {
+    normal  = octDecode(i_normal.xy);
+    tangent = decodeTangent(i_tangent.xy);
+  }
+
+  o_worldPos = vec3(instance.modelMatrix * vec4(i_position, 1.0));
   o_viewDir  = vec3(o_worldPos - origin);
   o_texCoord = i_texCoord;
-  o_worldNrm = normalize(mat3(pcRaster.inverseTransposeMatrix) * i_normal);
-  o_worldTag = normalize(mat3(pcRaster.inverseTransposeMatrix) * i_tangent.xyz);
+  o_worldNrm = normalize(mat3(instance.normalMatrix) * normal);
+  o_worldTag = normalize(mat3(instance.normalMatrix) * tangent.xyz);
   o_worldTag = normalize(o_worldTag - dot(o_worldTag, o_worldNrm) * o_worldNrm); // GramSchmidt
 
-  o_worldBin = cross(o_worldNrm, o_worldTag) * i_tangent.w;
+  o_worldBin = cross(o_worldNrm, o_worldTag) * tangent.w;
   //o_tbn = mat3(o_worldTg, o_worldBin, o_worldNrm);
   gl_Position = uni.viewProj * vec4(o_worldPos, 1.0);
 }
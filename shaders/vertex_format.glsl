@@ -0,0 +1,28 @@
+#ifndef VERTEX_FORMAT_GLSL
+#define VERTEX_FORMAT_GLSL
+
+// Decoding of the compressed vertex layout (vertex_compression.h)
+
+// Octahedral encoded unit vector
+vec3 octDecode(vec2 e)
+{
+  vec3  n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.x += n.x >= 0.0 ? -t : t;
+  n.y += n.y >= 0.0 ? -t : t;
+  return normalize(n);
+}
+
+// Octahedral tangent, y is stored in [0, 1] with the handedness as its sign
+vec4 decodeTangent(vec2 e)
+{
+  float w = e.y < 0.0 ? -1.0 : 1.0;
+  return vec4(octDecode(vec2(e.x, abs(e.y) * 2.0 - 1.0)), w);
+}
+
+vec3 dequantizePosition(vec3 q, PrimMeshInfo pinfo)
+{
+  return pinfo.posOffset.xyz + q * pinfo.posScale.xyz;
+}
+
+#endif
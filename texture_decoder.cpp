@@ -0,0 +1,184 @@
+#include "texture_decoder.h"
+
+#include "ktx2.h"
+#include "nvh/nvprint.hpp"
+#include "nvh/parallel_work.hpp"
+#include "nvh/timesampler.hpp"
+#include "stb_image.h"
+
+bool TextureDecoder::deferImageLoad(tinygltf::Image* image, const int imageIdx, std::string* err, std::string* warn,
+                                    int reqWidth, int reqHeight, const unsigned char* bytes, int size, void* userData)
+{
+    (void)image;
+    (void)err;
+    (void)warn;
+    (void)reqWidth;
+    (void)reqHeight;
+
+    // tinygltf loads the images one after the other, no locking needed here
+    auto* decoder = static_cast<TextureDecoder*>(userData);
+    if (decoder->m_encoded.size() <= static_cast<size_t>(imageIdx))
+        decoder->m_encoded.resize(imageIdx + 1);
+    decoder->m_encoded[imageIdx].assign(bytes, bytes + size);
+    return true;
+}
+
+void TextureDecoder::start(const std::vector<VkFormat>& formats, bool generateMips)
+{
+    m_encoded.resize(formats.size());
+    m_images.clear();
+    m_images.resize(formats.size());
+    m_completed.clear();
+    m_handedOut = 0;
+
+    m_thread = std::thread([this, formats, generateMips]() {
+        nvh::parallel_batches<1>(formats.size(), [&](uint64_t i) { decode(i, formats[i], generateMips); });
+    });
+}
+
+void TextureDecoder::decode(size_t index, VkFormat format, bool generateMips)
+{
+    nvh::Stopwatch        sw;
+    std::vector<uint8_t>& encoded = m_encoded[index];
+    TextureData&          texture = m_images[index];
+
+    if (isKtx2(encoded.data(), encoded.size()))
+    {
+        // Already in its GPU format, with its own mips
+        std::string error;
+        if (loadKtx2(encoded.data(), encoded.size(), texture, error))
+        {
+            LOGI("Image %zu (%ux%u, %u mips, KTX2) loaded in %.1f ms\n", index, texture.width, texture.height,
+                 texture.mipLevels, sw.elapsed());
+        }
+        else
+        {
+            LOGW("Cannot load KTX2 image %zu: %s\n", index, error.c_str());
+            texture = TextureData{};
+        }
+    }
+    else if (!encoded.empty())
+    {
+        int      width = 0, height = 0, comp = 0;
+        stbi_uc* pixels = stbi_load_from_memory(encoded.data(), static_cast<int>(encoded.size()), &width, &height, &comp,
+                                                STBI_rgb_alpha);
+        if (pixels != nullptr)
+        {
+            texture.width  = static_cast<uint32_t>(width);
+            texture.height = static_cast<uint32_t>(height);
+            texture.format = format;
+            texture.pixels.assign(pixels, pixels + size_t(width) * height * 4);
+            stbi_image_free(pixels);
+            if (generateMips)
+                generateMipmapsCpu(texture);
+            LOGI("Image %zu (%dx%d, %u mips) decoded in %.1f ms\n", index, width, height, texture.mipLevels, sw.elapsed());
+        }
+        else
+        {
+            LOGW("Cannot decode image %zu: %s\n", index, stbi_failure_reason());
+        }
+    }
+    std::vector<uint8_t>().swap(encoded);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_completed.push_back(index);
+    }
+    m_cond.notify_one();
+}
+
+bool TextureDecoder::next(size_t& index)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_handedOut == m_images.size())
+        return false;
+
+    m_cond.wait(lock, [this]() { return !m_completed.empty(); });
+    index = m_completed.front();
+    m_completed.pop_front();
+    m_handedOut++;
+    return true;
+}
+
+bool TextureDecoder::tryNext(size_t& index)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_completed.empty())
+        return false;
+
+    index = m_completed.front();
+    m_completed.pop_front();
+    m_handedOut++;
+    return true;
+}
+
+void TextureDecoder::wait()
+{
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+std::vector<int32_t> TextureDecoder::selectTextureSources(const tinygltf::Model& gltfModel)
+{
+    std::vector<int32_t> sources;
+    std::vector<bool>    used(m_encoded.size(), false);
+    for (size_t i = 0; i < gltfModel.textures.size(); i++)
+    {
+        int32_t source = getBasisuSource(gltfModel.textures[i]);
+        if (source >= 0 && source < static_cast<int32_t>(m_encoded.size()))
+        {
+            std::string reason;
+            const auto& encoded = m_encoded[source];
+            if (!isKtx2Supported(encoded.data(), encoded.size(), &reason))
+            {
+                LOGW("Texture %zu: cannot use KTX2 image %d (%s), using the fallback image\n", i, source, reason.c_str());
+                source = gltfModel.textures[i].source;
+            }
+        }
+        else
+        {
+            source = gltfModel.textures[i].source;
+        }
+
+        sources.push_back(source);
+        if (source >= 0 && source < static_cast<int32_t>(used.size()))
+            used[source] = true;
+    }
+
+    // Images no texture refers to, e.g. fallbacks of KTX2 images, are not decoded
+    for (size_t i = 0; i < m_encoded.size(); i++)
+    {
+        if (!used[i])
+            std::vector<uint8_t>().swap(m_encoded[i]);
+    }
+    return sources;
+}
+
+int32_t getBasisuSource(const tinygltf::Texture& texture)
+{
+    auto it = texture.extensions.find("KHR_texture_basisu");
+    if (it == texture.extensions.end() || !it->second.Has("source"))
+        return -1;
+    return it->second.Get("source").GetNumberAsInt();
+}
+
+std::vector<VkFormat> getImageFormats(const tinygltf::Model& gltfModel)
+{
+    std::vector<VkFormat> formats(gltfModel.images.size(), VK_FORMAT_R8G8B8A8_UNORM);
+
+    auto markSrgb = [&](int texId) {
+        if (texId < 0 || texId >= static_cast<int>(gltfModel.textures.size()))
+            return;
+        for (int source : {gltfModel.textures[texId].source, getBasisuSource(gltfModel.textures[texId])})
+        {
+            if (source >= 0 && source < static_cast<int>(formats.size()))
+                formats[source] = VK_FORMAT_R8G8B8A8_SRGB;
+        }
+    };
+    for (const auto& material : gltfModel.materials)
+    {
+        markSrgb(material.pbrMetallicRoughness.baseColorTexture.index);
+        markSrgb(material.emissiveTexture.index);
+    }
+    return formats;
+}
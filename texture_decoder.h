@@ -0,0 +1,65 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tiny_gltf.h"
+#include "texture_utils.h"
+
+//--------------------------------------------------------------------------------------------------
+// Decodes the images of a glTF on all cores
+// - tinygltf is told to keep the encoded bytes (deferImageLoad) instead of decoding them serially
+// - start() returns immediately, next() hands out the images in completion order so they can be
+//   uploaded while the others are still decoding, tryNext() does the same from a render loop
+//
+class TextureDecoder
+{
+public:
+    TextureDecoder() = default;
+    TextureDecoder(const TextureDecoder&) = delete;
+    TextureDecoder& operator=(const TextureDecoder&) = delete;
+    ~TextureDecoder() { wait(); }
+
+    // tinygltf::LoadImageDataFunction, userData must point to the decoder
+    static bool deferImageLoad(tinygltf::Image* image, const int imageIdx, std::string* err, std::string* warn, int reqWidth,
+                               int reqHeight, const unsigned char* bytes, int size, void* userData);
+
+    // Image used by each texture: the KHR_texture_basisu source when it can be loaded, the regular source otherwise.
+    // Must be called before start(), images that end up unused are skipped
+    std::vector<int32_t> selectTextureSources(const tinygltf::Model& gltfModel);
+
+    // One format per glTF image (see getImageFormats), CPU mips are optional as the GPU can generate them.
+    // KTX2 images keep the format stored in the file
+    void start(const std::vector<VkFormat>& formats, bool generateMips);
+    // Blocks until an image is decoded, returns false once all of them were handed out
+    bool next(size_t& index);
+    // Returns false when no image finished decoding since the last call, without waiting
+    bool tryNext(size_t& index);
+    // Frees the pixels of an image that is no longer needed
+    void release(size_t index) { std::vector<uint8_t>().swap(m_images[index].pixels); }
+    void wait();
+
+    std::vector<TextureData>&       getImages() { return m_images; }
+    const std::vector<TextureData>& getImages() const { return m_images; }
+
+private:
+    void decode(size_t index, VkFormat format, bool generateMips);
+
+    std::vector<std::vector<uint8_t>> m_encoded;
+    std::vector<TextureData>          m_images;
+
+    std::thread             m_thread;
+    std::mutex              m_mutex;
+    std::condition_variable m_cond;
+    std::deque<size_t>      m_completed;
+    size_t                  m_handedOut{0};
+};
+
+// Albedo and emissive maps are sRGB, everything else is linear
+std::vector<VkFormat> getImageFormats(const tinygltf::Model& gltfModel);
+// Image index of the KHR_texture_basisu extension, -1 without it
+int32_t getBasisuSource(const tinygltf::Texture& texture);
@@ -0,0 +1,204 @@
+#include "texture_streamer.h"
+
+#include <algorithm>
+#include <cfloat>
+
+#include "nvvk/images_vk.hpp"
+
+static constexpr uint32_t kTailSize = 64;  // Mips up to this size are uploaded with the first step
+
+void TextureStreamer::init(VkDevice device, nvvk::ResourceAllocator* alloc, UploadService* upload)
+{
+    m_device = device;
+    m_alloc  = alloc;
+    m_upload = upload;
+
+    // TODO: sampler data should be take from gltfModel
+    VkSamplerCreateInfo samplerCreateInfo{VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+    samplerCreateInfo.minFilter        = VK_FILTER_LINEAR;
+    samplerCreateInfo.magFilter        = VK_FILTER_LINEAR;
+    samplerCreateInfo.mipmapMode       = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerCreateInfo.anisotropyEnable = VK_TRUE;
+    samplerCreateInfo.maxAnisotropy    = 4;
+    samplerCreateInfo.maxLod           = FLT_MAX;
+    m_sampler                          = m_alloc->acquireSampler(samplerCreateInfo);
+}
+
+void TextureStreamer::deinit()
+{
+    if (m_device == VK_NULL_HANDLE)
+        return;
+    clear();
+    m_alloc->releaseSampler(m_sampler);
+    m_device = VK_NULL_HANDLE;
+}
+
+void TextureStreamer::clear()
+{
+    destroyRetiredViews(m_retiredViews.size());
+    for (auto& image : m_images)
+    {
+        vkDestroyImageView(m_device, image.view, nullptr);
+        m_alloc->destroy(image.image);
+    }
+    m_images.clear();
+    m_textureSources.clear();
+    m_completeCount = 0;
+    m_memory        = 0;
+    m_rgba8Memory   = 0;
+}
+
+void TextureStreamer::setTextures(const std::vector<int32_t>& textureSources, size_t imageCount)
+{
+    clear();
+    m_textureSources = textureSources;
+    m_images.resize(imageCount);
+}
+
+void TextureStreamer::addImage(size_t index, const TextureView& view)
+{
+    Image& image    = m_images[index];
+    image.payload   = view;
+    image.available = true;
+
+    // Nothing to upload, the textures using it keep the fallback
+    if (view.data == nullptr)
+    {
+        m_completeCount++;
+        return;
+    }
+
+    // Block compressed images come with their mips, they cannot be generated with blits
+    const bool        compressed      = isBlockCompressed(view.format);
+    VkImageCreateInfo imageCreateInfo = nvvk::makeImage2DCreateInfo(VkExtent2D{view.width, view.height}, view.format,
+                                                                    VK_IMAGE_USAGE_SAMPLED_BIT, !compressed);
+    if (compressed)
+        imageCreateInfo.mipLevels = view.mipLevels;
+
+    image.image               = m_alloc->createImage(imageCreateInfo);
+    image.mipLevels           = imageCreateInfo.mipLevels;
+    image.residentLevel       = image.mipLevels;
+    image.generateMips        = view.mipLevels < image.mipLevels;
+    image.viewInfo            = nvvk::makeImageViewCreateInfo(image.image.image, imageCreateInfo);
+    image.viewInfo.components = view.swizzle;
+
+    m_memory += getMipLevelOffset(view.format, view.width, view.height, image.mipLevels);
+    m_rgba8Memory += getMipLevelOffset(VK_FORMAT_R8G8B8A8_UNORM, view.width, view.height, image.mipLevels);
+}
+
+uint32_t TextureStreamer::getNextLevel(const Image& image) const
+{
+    if (image.generateMips)
+        return 0;
+    if (image.residentLevel < image.mipLevels)
+        return image.residentLevel - 1;
+
+    // First step: every mip of at most kTailSize texels on its largest side
+    uint32_t level = 0;
+    while (level + 1 < image.mipLevels && std::max(image.payload.width >> level, image.payload.height >> level) > kTailSize)
+        level++;
+    return level;
+}
+
+VkDeviceSize TextureStreamer::getStepSize(const Image& image) const
+{
+    const TextureView& payload = image.payload;
+    if (image.generateMips)
+        return getMipLevelSize(payload.format, payload.width, payload.height, 0);
+    return getMipLevelOffset(payload.format, payload.width, payload.height, image.residentLevel)
+           - getMipLevelOffset(payload.format, payload.width, payload.height, getNextLevel(image));
+}
+
+void TextureStreamer::uploadStep(Image& image)
+{
+    const TextureView&      payload    = image.payload;
+    const bool              compressed = isBlockCompressed(payload.format);
+    const uint32_t          first      = getNextLevel(image);
+    const uint32_t          last       = image.generateMips ? 1 : image.residentLevel;
+    const VkImageSubresourceRange range{VK_IMAGE_ASPECT_COLOR_BIT, first, image.residentLevel - first, 0, 1};
+
+    // The resident mips stay in SHADER_READ_ONLY, only the new ones are transitioned
+    nvvk::cmdBarrierImageLayout(m_upload->getCommandBuffer(), image.image.image, VK_IMAGE_LAYOUT_UNDEFINED,
+                                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, range);
+    for (uint32_t level = first; level < last; level++)
+    {
+        VkExtent3D   extent{std::max(payload.width >> level, 1u), std::max(payload.height >> level, 1u), 1};
+        VkDeviceSize offset = getMipLevelOffset(payload.format, payload.width, payload.height, level);
+        VkDeviceSize size   = getMipLevelSize(payload.format, payload.width, payload.height, level);
+        m_upload->uploadImage(image.image.image, VkOffset3D{}, extent, VkImageSubresourceLayers{VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1},
+                              size, payload.data + offset, compressed ? 4 : 1);
+    }
+
+    if (image.generateMips)
+    {
+        nvvk::cmdGenerateMipmaps(m_upload->getCommandBuffer(), image.image.image, payload.format, VkExtent2D{payload.width, payload.height},
+                                 image.mipLevels, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    }
+    else
+    {
+        nvvk::cmdBarrierImageLayout(m_upload->getCommandBuffer(), image.image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, range);
+    }
+
+    if (image.view != VK_NULL_HANDLE)
+        m_retiredViews.push_back(image.view);
+    image.residentLevel                          = first;
+    image.viewInfo.subresourceRange.baseMipLevel = first;
+    image.viewInfo.subresourceRange.levelCount   = image.mipLevels - first;
+    vkCreateImageView(m_device, &image.viewInfo, nullptr, &image.view);
+}
+
+bool TextureStreamer::update(VkDeviceSize byteBudget, std::vector<size_t>& completed)
+{
+    bool         changed = false;
+    VkDeviceSize staged  = 0;
+    while (!changed || staged < byteBudget)
+    {
+        // Smallest step first
+        size_t       next     = m_images.size();
+        VkDeviceSize nextSize = 0;
+        for (size_t i = 0; i < m_images.size(); i++)
+        {
+            if (!isPending(m_images[i]))
+                continue;
+            const VkDeviceSize size = getStepSize(m_images[i]);
+            if (next == m_images.size() || size < nextSize)
+            {
+                next     = i;
+                nextSize = size;
+            }
+        }
+        if (next == m_images.size())
+            break;
+
+        uploadStep(m_images[next]);
+        staged += nextSize;
+        changed = true;
+        if (m_images[next].residentLevel == 0)
+        {
+            completed.push_back(next);
+            m_completeCount++;
+        }
+    }
+    return changed;
+}
+
+void TextureStreamer::getDescriptors(const VkDescriptorImageInfo& fallback, std::vector<VkDescriptorImageInfo>& descriptors) const
+{
+    descriptors.clear();
+    for (int32_t source : m_textureSources)
+    {
+        if (source < 0 || source >= static_cast<int32_t>(m_images.size()) || m_images[source].view == VK_NULL_HANDLE)
+            descriptors.push_back(fallback);
+        else
+            descriptors.push_back({m_sampler, m_images[source].view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL});
+    }
+}
+
+void TextureStreamer::destroyRetiredViews(size_t count)
+{
+    count = std::min(count, m_retiredViews.size());
+    for (size_t i = 0; i < count; i++)
+        vkDestroyImageView(m_device, m_retiredViews[i], nullptr);
+    m_retiredViews.erase(m_retiredViews.begin(), m_retiredViews.begin() + count);
+}
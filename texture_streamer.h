@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "nvvk/resourceallocator_vk.hpp"
+#include "texture_utils.h"
+#include "upload_service.h"
+
+//--------------------------------------------------------------------------------------------------
+// Uploads the images of a scene a few mips at a time, from the smallest to the full resolution
+// - Each image first gets its mips up to 64x64 in one step, then one larger mip per step. The
+//   steps of all images are ordered by size, so every texture is coarse before any is sharp
+// - Images without the mips in their payload are uploaded whole and their mips generated on the GPU
+// - The view of an image only covers its resident mips (baseMipLevel), it is recreated when a mip
+//   arrives; the replaced views are kept until destroyRetiredViews()
+// - Uses the staging ring of the UploadService, all calls must come from the same thread
+//
+class TextureStreamer
+{
+public:
+    void init(VkDevice device, nvvk::ResourceAllocator* alloc, UploadService* upload);
+    void deinit();
+    // Destroys all images, the streamer can be reused for another scene
+    void clear();
+
+    // Texture i of the scene samples image textureSources[i]
+    void setTextures(const std::vector<int32_t>& textureSources, size_t imageCount);
+    // The payload of an image is available, it must stay valid until the image is complete
+    void addImage(size_t index, const TextureView& view);
+
+    // Records the next upload steps until 'byteBudget' bytes are staged, at least one step. Returns
+    // true when views changed and the descriptors must be rewritten. Images that became complete are
+    // appended to 'completed'
+    bool update(VkDeviceSize byteBudget, std::vector<size_t>& completed);
+
+    // Sampler and view of each texture, 'fallback' for the ones without a resident mip
+    void getDescriptors(const VkDescriptorImageInfo& fallback, std::vector<VkDescriptorImageInfo>& descriptors) const;
+    // The views replaced by update() are retired in order. Destroys the first 'count' of them, once
+    // no descriptor set or frame in flight uses them
+    size_t getRetiredViewCount() const { return m_retiredViews.size(); }
+    void   destroyRetiredViews(size_t count);
+
+    size_t getImageCount() const { return m_images.size(); }
+    size_t getCompleteCount() const { return m_completeCount; }
+    bool   isComplete() const { return m_completeCount == m_images.size(); }
+    // VRAM of the images, and of the same images and mips as uncompressed RGBA8
+    VkDeviceSize getMemory() const { return m_memory; }
+    VkDeviceSize getRgba8Memory() const { return m_rgba8Memory; }
+
+private:
+    struct Image
+    {
+        TextureView           payload;
+        bool                  available{false};
+        nvvk::Image           image;
+        VkImageViewCreateInfo viewInfo{VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
+        VkImageView           view{VK_NULL_HANDLE};
+        uint32_t              mipLevels{0};
+        uint32_t              residentLevel{0};  // Finest resident mip, mipLevels when none is
+        bool                  generateMips{false};
+    };
+
+    bool         isPending(const Image& image) const { return image.available && image.residentLevel > 0; }
+    uint32_t     getNextLevel(const Image& image) const;
+    VkDeviceSize getStepSize(const Image& image) const;
+    void         uploadStep(Image& image);
+
+    VkDevice                 m_device{VK_NULL_HANDLE};
+    nvvk::ResourceAllocator* m_alloc{nullptr};
+    UploadService*           m_upload{nullptr};
+    VkSampler                m_sampler{VK_NULL_HANDLE};
+
+    std::vector<Image>       m_images;
+    std::vector<int32_t>     m_textureSources;
+    std::vector<VkImageView> m_retiredViews;
+    size_t                   m_completeCount{0};
+    VkDeviceSize             m_memory{0};
+    VkDeviceSize             m_rgba8Memory{0};
+};
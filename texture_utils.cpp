@@ -0,0 +1,123 @@
+#include "texture_utils.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+
+uint32_t getMipLevelCount(uint32_t width, uint32_t height)
+{
+    return static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+}
+
+bool isBlockCompressed(VkFormat format)
+{
+    return format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_BC7_SRGB_BLOCK;
+}
+
+uint32_t getBlockByteSize(VkFormat format)
+{
+    switch (format)
+    {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+    case VK_FORMAT_BC4_SNORM_BLOCK:
+        return 8;
+    default:
+        return isBlockCompressed(format) ? 16 : 4;
+    }
+}
+
+VkDeviceSize getMipLevelSize(VkFormat format, uint32_t width, uint32_t height, uint32_t level)
+{
+    VkDeviceSize w = std::max(width >> level, 1u);
+    VkDeviceSize h = std::max(height >> level, 1u);
+    if (isBlockCompressed(format))
+        return ((w + 3) / 4) * ((h + 3) / 4) * getBlockByteSize(format);
+    return w * h * 4;
+}
+
+VkDeviceSize getMipLevelOffset(VkFormat format, uint32_t width, uint32_t height, uint32_t level)
+{
+    VkDeviceSize offset = 0;
+    for (uint32_t l = 0; l < level; l++)
+        offset += getMipLevelSize(format, width, height, l);
+    return offset;
+}
+
+static float srgbToLinear(float c)
+{
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static uint8_t linearToSrgb8(float c)
+{
+    c = std::clamp(c, 0.0f, 1.0f);
+    c = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+    return static_cast<uint8_t>(c * 255.0f + 0.5f);
+}
+
+void generateMipmapsCpu(TextureData& texture)
+{
+    assert(texture.format == VK_FORMAT_R8G8B8A8_UNORM || texture.format == VK_FORMAT_R8G8B8A8_SRGB);
+
+    static const std::array<float, 256> srgbTable = [] {
+        std::array<float, 256> table{};
+        for (int i = 0; i < 256; i++)
+            table[i] = srgbToLinear(i / 255.0f);
+        return table;
+    }();
+
+    const bool     isSrgb    = texture.format == VK_FORMAT_R8G8B8A8_SRGB;
+    const uint32_t mipLevels = getMipLevelCount(texture.width, texture.height);
+    texture.pixels.resize(getMipLevelOffset(texture.format, texture.width, texture.height, mipLevels));
+
+    for (uint32_t level = 1; level < mipLevels; level++)
+    {
+        const uint32_t srcW = std::max(texture.width >> (level - 1), 1u);
+        const uint32_t srcH = std::max(texture.height >> (level - 1), 1u);
+        const uint32_t dstW = std::max(texture.width >> level, 1u);
+        const uint32_t dstH = std::max(texture.height >> level, 1u);
+
+        const uint8_t* src = texture.pixels.data() + getMipLevelOffset(texture.format, texture.width, texture.height, level - 1);
+        uint8_t*       dst = texture.pixels.data() + getMipLevelOffset(texture.format, texture.width, texture.height, level);
+
+        for (uint32_t y = 0; y < dstH; y++)
+        {
+            // Odd sizes fold the last row/column onto itself
+            const uint32_t y0 = std::min(2 * y, srcH - 1);
+            const uint32_t y1 = std::min(2 * y + 1, srcH - 1);
+            for (uint32_t x = 0; x < dstW; x++)
+            {
+                const uint32_t x0 = std::min(2 * x, srcW - 1);
+                const uint32_t x1 = std::min(2 * x + 1, srcW - 1);
+                const uint8_t* p[4] = {src + 4 * (y0 * srcW + x0), src + 4 * (y0 * srcW + x1), src + 4 * (y1 * srcW + x0),
+                                       src + 4 * (y1 * srcW + x1)};
+                uint8_t*       out  = dst + 4 * (y * dstW + x);
+                for (int c = 0; c < 4; c++)
+                {
+                    if (isSrgb && c < 3)
+                    {
+                        float sum = srgbTable[p[0][c]] + srgbTable[p[1][c]] + srgbTable[p[2][c]] + srgbTable[p[3][c]];
+                        out[c]    = linearToSrgb8(sum * 0.25f);
+                    }
+                    else
+                    {
+                        out[c] = static_cast<uint8_t>((p[0][c] + p[1][c] + p[2][c] + p[3][c] + 2) / 4);
+                    }
+                }
+            }
+        }
+    }
+    texture.mipLevels = mipLevels;
+}
+
+TextureView makeTextureView(const TextureData& texture)
+{
+    // A texture that failed to decode has no pixels and gives a null view
+    return TextureView{texture.width, texture.height, texture.mipLevels, texture.format, texture.swizzle,
+                       texture.pixels.empty() ? nullptr : texture.pixels.data(), static_cast<VkDeviceSize>(texture.pixels.size())};
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+//--------------------------------------------------------------------------------------------------
+// CPU side texture payload: level 0 followed by its mip chain, tightly packed
+//
+struct TextureData
+{
+    uint32_t             width{0};
+    uint32_t             height{0};
+    uint32_t             mipLevels{1};
+    VkFormat             format{VK_FORMAT_R8G8B8A8_UNORM};
+    VkComponentMapping   swizzle{};  // Applied by the image view, e.g. to read two channel BC5 data as metallic-roughness
+    std::vector<uint8_t> pixels;
+};
+
+// Non-owning view on a texture payload, used to upload from memory we do not own (e.g. a mapped cache)
+struct TextureView
+{
+    uint32_t       width{0};
+    uint32_t       height{0};
+    uint32_t       mipLevels{1};
+    VkFormat           format{VK_FORMAT_R8G8B8A8_UNORM};
+    VkComponentMapping swizzle{};
+    const uint8_t*     data{nullptr};
+    VkDeviceSize   size{0};
+};
+
+uint32_t     getMipLevelCount(uint32_t width, uint32_t height);
+// BC formats are stored in 4x4 blocks, everything else is treated as RGBA8
+bool         isBlockCompressed(VkFormat format);
+uint32_t     getBlockByteSize(VkFormat format);
+VkDeviceSize getMipLevelSize(VkFormat format, uint32_t width, uint32_t height, uint32_t level);
+VkDeviceSize getMipLevelOffset(VkFormat format, uint32_t width, uint32_t height, uint32_t level);
+
+// Appends the full mip chain to a texture holding only level 0 (RGBA8, sRGB aware box filter)
+void generateMipmapsCpu(TextureData& texture);
+
+TextureView makeTextureView(const TextureData& texture);
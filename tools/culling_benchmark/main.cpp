@@ -0,0 +1,77 @@
+//--------------------------------------------------------------------------------------------------
+// Throughput of the CPU frustum culling of the raster nodes (frustum_culling.h)
+// - 10k, 100k and 1M random boxes around a camera looking down -z
+// - Scalar, SIMD on one thread and SIMD on all threads, best of several runs
+//
+// Usage: culling_benchmark [runs]
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include "frustum_culling.h"
+#include "nvh/parallel_work.hpp"
+
+static void makeBoxes(size_t count, BoundsSoA& bounds)
+{
+    std::mt19937                          rng(1234);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> extent(0.1f, 5.0f);
+
+    bounds.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        const nvmath::vec3f center(position(rng), position(rng), position(rng));
+        const nvmath::vec3f half(extent(rng), extent(rng), extent(rng));
+        bounds.set(i, center - half, center + half);
+    }
+}
+
+// Best time of 'runs' in ms
+static double measure(const BoundsSoA& bounds, const Frustum& frustum, CullingPath path, uint32_t threads, int runs,
+                      std::vector<uint32_t>& visible)
+{
+    visible.reserve(bounds.size());
+    double best = 1e30;
+    for (int r = 0; r < runs; r++)
+    {
+        const auto start = std::chrono::high_resolution_clock::now();
+        cullBounds(bounds, frustum, visible, path, threads);
+        const auto end = std::chrono::high_resolution_clock::now();
+        best           = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+    const int runs = argc > 1 ? std::max(1, atoi(argv[1])) : 20;
+
+    // Camera at the origin looking down -z, as in the renderer
+    const Frustum frustum = makeFrustum(nvmath::perspectiveVK(60.0f, 16.0f / 9.0f, 0.1f, 1000.0f));
+
+    printf("SIMD path: %s, %u threads, best of %d runs\n", getCullingSimdName(), nvh::get_thread_pool_size(), runs);
+    printf("%10s %10s %16s %16s %16s\n", "boxes", "visible", "scalar", "simd", "simd threads");
+    for (size_t count : {size_t(10000), size_t(100000), size_t(1000000)})
+    {
+        BoundsSoA bounds;
+        makeBoxes(count, bounds);
+
+        std::vector<uint32_t> visible[3];
+        const double          scalar  = measure(bounds, frustum, CullingPath::eScalar, 1, runs, visible[0]);
+        const double          simd    = measure(bounds, frustum, CullingPath::eSimd, 1, runs, visible[1]);
+        const double          threads = measure(bounds, frustum, CullingPath::eSimd, 0, runs, visible[2]);
+        // All paths round the distances alike and list the boxes in order, they must keep the same ones
+        if (visible[1] != visible[0] || visible[2] != visible[0])
+        {
+            fprintf(stderr, "Mismatch between the culling paths: %zu, %zu, %zu visible\n", visible[0].size(), visible[1].size(),
+                    visible[2].size());
+            return 1;
+        }
+        printf("%10zu %10zu %10.0f /ms %10.0f /ms %10.0f /ms\n", count, visible[0].size(), count / scalar, count / simd, count / threads);
+    }
+    return 0;
+}
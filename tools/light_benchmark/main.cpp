@@ -0,0 +1,296 @@
+//--------------------------------------------------------------------------------------------------
+// Light selection of the next event estimation (light_bvh.h, alias_table.h)
+// - Checks the alias table: the probabilities its entries imply and the frequencies of many
+//   samples match the weights it was built from
+// - On the fallback lights of the renderer and on random point lights above a ground plane: for
+//   random shading points, the exact variance of the one-sample estimator of the direct light of a
+//   white diffuse surface, unshadowed, with the uniform selection, by power and with the light BVH,
+//   from the pmf of every light. Also checks that the BVH pmfs sum to 1 and that no reachable light
+//   has pmf 0
+// - Optionally writes the random lights as a glTF scene with KHR_lights_punctual, to load it in
+//   the renderer
+// - Returns 1 when a check fails
+//
+// Usage: light_benchmark [lightCount] [output.gltf]
+//
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+#include "alias_table.h"
+#include "light_bvh.h"
+#include "light_sampling.h"
+
+static constexpr float kGroundSize = 200.0f;
+
+static std::vector<GltfLight> makeLights(size_t count)
+{
+    std::mt19937                          rng(1234);
+    std::uniform_real_distribution<float> position(-kGroundSize / 2, kGroundSize / 2);
+    std::uniform_real_distribution<float> height(0.5f, 4.0f);
+    std::uniform_real_distribution<float> color(0.2f, 1.0f);
+    std::lognormal_distribution<float>    intensity(1.0f, 1.0f);
+
+    std::vector<GltfLight> lights(count);
+    for (auto& light : lights)
+    {
+        light.position  = nvmath::vec3f(position(rng), height(rng), position(rng));
+        light.color     = nvmath::vec3f(color(rng), color(rng), color(rng));
+        light.intensity = intensity(rng);
+        light.type      = 0;
+    }
+    return lights;
+}
+
+// Direct light of a white diffuse surface at p from one light, unshadowed
+static float getContribution(const GltfLight& light, const nvmath::vec3f& p, const nvmath::vec3f& n)
+{
+    const nvmath::vec3f toLight = light.position - p;
+    const float         d2      = nvmath::dot(toLight, toLight);
+    const float         cosine  = nvmath::dot(n, toLight) / std::sqrt(d2);
+    if (cosine <= 0.0f)
+        return 0.0f;
+    return getLightPower(light) * cosine / d2;
+}
+
+// A ground quad and one node per light
+static bool writeScene(const std::string& path, const std::vector<GltfLight>& lights)
+{
+    const std::string binPath = path.substr(0, path.find_last_of('.')) + ".bin";
+    const std::string binName = binPath.substr(binPath.find_last_of("/\\") + 1);
+
+    const float    h            = kGroundSize / 2;
+    const float    positions[]  = {-h, 0, -h, h, 0, -h, h, 0, h, -h, 0, h};
+    const float    normals[]    = {0, 1, 0, 0, 1, 0, 0, 1, 0, 0, 1, 0};
+    const uint16_t indices[]    = {0, 2, 1, 0, 3, 2};
+    FILE*          bin          = fopen(binPath.c_str(), "wb");
+    if (bin == nullptr)
+        return false;
+    fwrite(positions, sizeof(positions), 1, bin);
+    fwrite(normals, sizeof(normals), 1, bin);
+    fwrite(indices, sizeof(indices), 1, bin);
+    fclose(bin);
+
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr)
+        return false;
+    fprintf(file, "{\n  \"asset\": {\"version\": \"2.0\"},\n  \"extensionsUsed\": [\"KHR_lights_punctual\"],\n");
+    fprintf(file, "  \"buffers\": [{\"uri\": \"%s\", \"byteLength\": %zu}],\n", binName.c_str(),
+            sizeof(positions) + sizeof(normals) + sizeof(indices));
+    fprintf(file, "  \"bufferViews\": [{\"buffer\": 0, \"byteOffset\": 0, \"byteLength\": 48}, {\"buffer\": 0, \"byteOffset\": 48, \"byteLength\": 48},"
+                  " {\"buffer\": 0, \"byteOffset\": 96, \"byteLength\": 12}],\n");
+    fprintf(file, "  \"accessors\": [{\"bufferView\": 0, \"componentType\": 5126, \"count\": 4, \"type\": \"VEC3\", \"min\": [%g, 0, %g], \"max\": [%g, 0, %g]},"
+                  " {\"bufferView\": 1, \"componentType\": 5126, \"count\": 4, \"type\": \"VEC3\"},"
+                  " {\"bufferView\": 2, \"componentType\": 5123, \"count\": 6, \"type\": \"SCALAR\"}],\n", -h, -h, h, h);
+    fprintf(file, "  \"materials\": [{\"pbrMetallicRoughness\": {\"baseColorFactor\": [0.8, 0.8, 0.8, 1], \"metallicFactor\": 0, \"roughnessFactor\": 1}}],\n");
+    fprintf(file, "  \"meshes\": [{\"primitives\": [{\"attributes\": {\"POSITION\": 0, \"NORMAL\": 1}, \"indices\": 2, \"material\": 0}]}],\n");
+
+    fprintf(file, "  \"extensions\": {\"KHR_lights_punctual\": {\"lights\": [\n");
+    for (size_t i = 0; i < lights.size(); i++)
+    {
+        const GltfLight& l = lights[i];
+        fprintf(file, "    {\"type\": \"point\", \"color\": [%.4f, %.4f, %.4f], \"intensity\": %.4f}%s\n", l.color.x, l.color.y,
+                l.color.z, l.intensity, i + 1 < lights.size() ? "," : "");
+    }
+    fprintf(file, "  ]}},\n  \"nodes\": [\n    {\"mesh\": 0}");
+    for (size_t i = 0; i < lights.size(); i++)
+    {
+        const GltfLight& l = lights[i];
+        fprintf(file, ",\n    {\"translation\": [%.4f, %.4f, %.4f], \"extensions\": {\"KHR_lights_punctual\": {\"light\": %zu}}}",
+                l.position.x, l.position.y, l.position.z, i);
+    }
+    fprintf(file, "\n  ],\n  \"scenes\": [{\"nodes\": [");
+    for (size_t i = 0; i <= lights.size(); i++)
+        fprintf(file, "%s%zu", i > 0 ? ", " : "", i);
+    fprintf(file, "]}],\n  \"scene\": 0\n}\n");
+    fclose(file);
+    return true;
+}
+
+// Exact variance of the selections of one set of lights at random points of the floor (y = 0)
+// between pointMin and pointMax, relative to the squared mean and averaged over the points.
+// Returns false when a check fails
+static bool compareSelections(const char* name, const std::vector<GltfLight>& lights, float pointMin[2], float pointMax[2], size_t pointCount)
+{
+    const auto                      buildStart = std::chrono::high_resolution_clock::now();
+    const std::vector<LightBvhNode> nodes      = buildLightBvh(lights);
+    const auto                      buildEnd   = std::chrono::high_resolution_clock::now();
+
+    std::vector<float> powers;
+    for (const auto& light : lights)
+        powers.push_back(getLightPower(light));
+    const std::vector<AliasEntry> aliasTable = buildAliasTable(powers);
+
+    printf("%s: %zu lights, %zu BVH nodes built in %.2f ms\n", name, lights.size(), nodes.size(),
+           std::chrono::duration<double, std::milli>(buildEnd - buildStart).count());
+
+    std::mt19937                          rng(5678);
+    std::uniform_real_distribution<float> x(pointMin[0], pointMax[0]);
+    std::uniform_real_distribution<float> z(pointMin[1], pointMax[1]);
+    std::uniform_real_distribution<float> uniform(0.0f, 0.99999994f);
+    const nvmath::vec3f                   normal(0.0f, 1.0f, 0.0f);
+
+    double             uniformVariance = 0.0, powerVariance = 0.0, bvhVariance = 0.0;
+    double             worstPmfError = 0.0, missed = 0.0;
+    size_t             sampleMismatches = 0;
+    std::vector<float> pmfs;
+    for (size_t i = 0; i < pointCount; i++)
+    {
+        const nvmath::vec3f p(x(rng), 0.0f, z(rng));
+        getLightBvhPmfs(nodes, p, normal, lights.size(), pmfs);
+
+        // E[X] is the same for all, the second moments differ
+        double expected = 0.0, uniformSecond = 0.0, powerSecond = 0.0, bvhSecond = 0.0, pmfSum = 0.0;
+        for (size_t l = 0; l < lights.size(); l++)
+        {
+            const double c = getContribution(lights[l], p, normal);
+            expected += c;
+            uniformSecond += c * c * lights.size();
+            if (c > 0.0)
+                powerSecond += c * c / aliasTable[l].pdf;
+            pmfSum += pmfs[l];
+            if (pmfs[l] > 0.0f)
+                bvhSecond += c * c / pmfs[l];
+            else
+                missed += c;
+        }
+        if (expected <= 0.0)
+            continue;
+        const double e2 = expected * expected;
+        uniformVariance += (uniformSecond - e2) / e2;
+        powerVariance += (powerSecond - e2) / e2;
+        bvhVariance += (bvhSecond - e2) / e2;
+        worstPmfError = std::max(worstPmfError, std::abs(pmfSum - 1.0));
+
+        // The traversal reaches a light with the pmf of the full distribution
+        uint32_t light;
+        float    pmf;
+        if (sampleLightBvh(nodes, p, normal, uniform(rng), light, pmf) && std::abs(pmf - pmfs[light]) > 1e-3f * pmfs[light])
+            sampleMismatches++;
+    }
+
+    // Selection cost, one shading point per sample
+    const size_t samples  = 1000000;
+    float        checksum = 0.0f;
+    auto         start    = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < samples; i++)
+    {
+        const nvmath::vec3f p(x(rng), 0.0f, z(rng));
+        uint32_t            light;
+        float               pmf;
+        if (sampleLightBvh(nodes, p, normal, uniform(rng), light, pmf))
+            checksum += pmf;
+    }
+    const double bvhTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    start                = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < samples; i++)
+    {
+        float pmf;
+        sampleAliasTable(aliasTable, uniform(rng), pmf);
+        checksum += pmf;
+    }
+    const double aliasTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    printf("  relative variance per sample, average over %zu points (unshadowed, diffuse):\n", pointCount);
+    printf("    uniform         %12.2f\n", uniformVariance / pointCount);
+    printf("    power (alias)   %12.2f (%.1fx lower)\n", powerVariance / pointCount, uniformVariance / std::max(powerVariance, 1e-30));
+    printf("    light BVH       %12.2f (%.1fx lower)\n", bvhVariance / pointCount, uniformVariance / std::max(bvhVariance, 1e-30));
+    printf("  samples/ms on one thread: light BVH %.0f, alias table %.0f (checksum %g)\n", samples / bvhTime, samples / aliasTime, checksum);
+    printf("  largest |sum of pmfs - 1|: %.2e, contribution of the lights never picked: %g, traversal mismatches: %zu\n",
+           worstPmfError, missed, sampleMismatches);
+    return worstPmfError < 1e-3 && missed == 0.0 && sampleMismatches == 0;
+}
+
+// The alias table reproduces the distribution of its weights: exactly from its entries, and within
+// a few standard deviations over many samples
+static bool checkAliasTable(const char* name, const std::vector<float>& weights, size_t samples)
+{
+    const std::vector<AliasEntry> table = buildAliasTable(weights);
+    double                        sum   = 0.0;
+    for (float w : weights)
+        sum += w;
+
+    // Outcome i comes from its own bucket and from the buckets aliasing it
+    std::vector<double> implied(weights.size(), 0.0);
+    for (size_t i = 0; i < table.size(); i++)
+    {
+        implied[i] += table[i].threshold / table.size();
+        implied[table[i].alias] += (1.0 - table[i].threshold) / table.size();
+    }
+
+    std::mt19937                          rng(91011);
+    std::uniform_real_distribution<float> uniform(0.0f, 0.99999994f);
+    std::vector<size_t>                   counts(weights.size(), 0);
+    bool                                  pdfMatches = true;
+    for (size_t s = 0; s < samples; s++)
+    {
+        float          pdf;
+        const uint32_t i = sampleAliasTable(table, uniform(rng), pdf);
+        counts[i]++;
+        pdfMatches &= pdf == table[i].pdf;
+    }
+
+    double worstImplied = 0.0, worstSigma = 0.0;
+    for (size_t i = 0; i < weights.size(); i++)
+    {
+        const double p = weights[i] / sum;
+        worstImplied   = std::max(worstImplied, std::abs(implied[i] - p));
+        if (p > 0.0)
+        {
+            const double sigma = std::sqrt(samples * p * (1.0 - p));
+            worstSigma         = std::max(worstSigma, std::abs(counts[i] - samples * p) / std::max(sigma, 1e-30));
+        }
+        else if (counts[i] > 0)
+        {
+            worstSigma = 1e30;
+        }
+    }
+    const bool ok = worstImplied < 1e-6 && worstSigma < 5.0 && pdfMatches;
+    printf("Alias table, %s: %zu outcomes, largest error of the implied probabilities %.2e, of %zu samples %.2f sigma%s\n", name,
+           weights.size(), worstImplied, samples, worstSigma, ok ? "" : " FAILED");
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    const size_t lightCount = argc > 1 ? std::max(1, atoi(argv[1])) : 10000;
+
+    const std::vector<GltfLight> lights = makeLights(lightCount);
+    if (argc > 2)
+    {
+        if (!writeScene(argv[2], lights))
+        {
+            fprintf(stderr, "Cannot write %s\n", argv[2]);
+            return 1;
+        }
+        printf("Scene written to %s\n", argv[2]);
+    }
+
+    bool ok = true;
+    {
+        std::mt19937                       rng(1213);
+        std::lognormal_distribution<float> weight(0.0f, 2.0f);
+        std::vector<float>                 weights(1000);
+        for (auto& w : weights)
+            w = weight(rng);
+        weights[17] = 0.0f;  // Never picked
+        ok &= checkAliasTable("1000 lognormal weights", weights, 10000000);
+    }
+
+    std::vector<float> fallbackPowers;
+    for (const auto& light : makeFallbackLights())
+        fallbackPowers.push_back(getLightPower(light));
+    ok &= checkAliasTable("fallback lights", fallbackPowers, 10000000);
+
+    // The fallback lights hang over z in [-1.3, 67], x in [-6.2, 2.4]
+    float fallbackMin[2] = {-10.0f, -5.0f}, fallbackMax[2] = {6.0f, 70.0f};
+    ok &= compareSelections("Fallback lights", makeFallbackLights(), fallbackMin, fallbackMax, 1000);
+
+    float groundMin[2] = {-kGroundSize / 2, -kGroundSize / 2}, groundMax[2] = {kGroundSize / 2, kGroundSize / 2};
+    ok &= compareSelections("Random lights", lights, groundMin, groundMax, 1000);
+    return ok ? 0 : 1;
+}
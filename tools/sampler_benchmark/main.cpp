@@ -0,0 +1,283 @@
+//--------------------------------------------------------------------------------------------------
+// Samplers of the path tracer (sampler.h, shaders/sampler.glsl)
+// - Checks the Sobol points: the first 2^m of each dimension and of the first two dimensions fall
+//   one per elementary interval, before and after the scrambles, and the blue-noise tile holds
+//   every rank once
+// - Integrates test functions in every pixel of a small image, with the dimensions the path
+//   tracer uses for 3 bounces, and prints the MSE against the exact integrals by sample count for
+//   the former RNG (tea seeded with y * x + x and a clock, then the LCG), the LCG seeded per pixel
+//   and sample, the Owen-scrambled Sobol points and the blue-noise sampler. The MSE after a 3x3
+//   box filter of the error shows how much of it is high frequency, which the eye and the
+//   denoisers average out
+// - Returns 1 when a check fails
+//
+// Usage: sampler_benchmark [maxSamples]
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+#include "sampler.h"
+
+static constexpr uint32_t kImageSize = 32;
+static constexpr uint32_t kBounces   = 3;
+static constexpr double   kPi        = 3.14159265358979323846;
+
+// Former seeding of random.glsl, the clock of a frame is the same for all its pixels
+#define SAMPLER_FORMER 3
+
+// Dimensions read by a path of kBounces, see shaders/sampler.glsl
+static std::vector<uint32_t> getPathDimensions()
+{
+    std::vector<uint32_t> dims = {0, 1};
+    for (uint32_t bounce = 0; bounce < kBounces; bounce++)
+    {
+        for (uint32_t offset = 0; offset < 8; offset++)
+            dims.push_back(4 + bounce * 12 + offset);
+    }
+    return dims;
+}
+
+// Integral of exp(-(x - c)^2 / (2 s^2)) over [0, 1]
+static double integrateGaussian(double c, double s)
+{
+    return s * std::sqrt(kPi / 2.0) * (std::erf((1.0 - c) / (s * std::sqrt(2.0))) - std::erf(-c / (s * std::sqrt(2.0))));
+}
+
+// Function of the pixel over its random numbers, and its exact integral
+struct Integrand
+{
+    const char*                                                   name;
+    uint32_t                                                      dimensions;  // First ones of getPathDimensions()
+    std::function<double(uint32_t x, uint32_t y, const float* u)> eval;
+    std::function<double(uint32_t x, uint32_t y)>                 reference;
+};
+
+// Parameters vary smoothly over the image, as the shading of neighboring pixels
+static double getCenter(uint32_t p, double offset)
+{
+    return 0.3 + 0.4 * std::fmod(p / double(kImageSize) + offset, 1.0);
+}
+
+static std::vector<Integrand> makeIntegrands()
+{
+    std::vector<Integrand> integrands;
+    integrands.push_back({"smooth 2D (Gaussian)", 2,
+                          [](uint32_t x, uint32_t y, const float* u) {
+                              const double dx = u[0] - getCenter(x, 0.0), dy = u[1] - getCenter(y, 0.5);
+                              return std::exp(-(dx * dx + dy * dy) / (2.0 * 0.15 * 0.15));
+                          },
+                          [](uint32_t x, uint32_t y) {
+                              return integrateGaussian(getCenter(x, 0.0), 0.15) * integrateGaussian(getCenter(y, 0.5), 0.15);
+                          }});
+    integrands.push_back({"discontinuous 2D (disk)", 2,
+                          [](uint32_t x, uint32_t y, const float* u) {
+                              const double dx = u[0] - getCenter(x, 0.0), dy = u[1] - getCenter(y, 0.5);
+                              return dx * dx + dy * dy < 0.25 * 0.25 ? 1.0 : 0.0;
+                          },
+                          [](uint32_t, uint32_t) { return kPi * 0.25 * 0.25; }});
+
+    // One factor of mean 1 per dimension: a Gaussian bump on the pixel, the directions and the
+    // light position, a step on the lobe, roulette and light choices. Each bounce varies half as
+    // much as the one before, as the throughput of a path falls
+    const uint32_t pathDims = static_cast<uint32_t>(getPathDimensions().size());
+    integrands.push_back({"path, 3 bounces (26D)", pathDims,
+                          [pathDims](uint32_t x, uint32_t y, const float* u) {
+                              double f = 1.0;
+                              for (uint32_t d = 0; d < pathDims; d++)
+                              {
+                                  const double   c      = getCenter(d % 2 ? y : x, 0.1 * d);
+                                  const uint32_t offset = d < 2 ? 1 : (d - 2) % 8;
+                                  const double   scale  = d < 2 ? 1.0 : std::ldexp(1.0, -1 - int((d - 2) / 8));
+                                  double         h, mean;
+                                  if (offset == 0 || offset == 3 || offset == 4)
+                                  {
+                                      h    = u[d] < c ? 1.0 : 0.0;
+                                      mean = c;
+                                  }
+                                  else
+                                  {
+                                      h    = std::exp(-(u[d] - c) * (u[d] - c) / (2.0 * 0.2 * 0.2));
+                                      mean = integrateGaussian(c, 0.2);
+                                  }
+                                  f *= 1.0 + scale * (h - mean) / mean;
+                              }
+                              return f;
+                          },
+                          [](uint32_t, uint32_t) { return 1.0; }});
+    return integrands;
+}
+
+// Relative MSE over the image at each power of 2 of the samples, plain and after the box filter
+static void measure(const std::vector<uint32_t>& tables, uint32_t sampler, const Integrand& integrand, uint32_t maxSamples,
+                    std::vector<double>& mse, std::vector<double>& filteredMse)
+{
+    const std::vector<uint32_t> dims       = getPathDimensions();
+    const uint32_t              pixelCount = kImageSize * kImageSize;
+    std::vector<std::vector<double>> errors;  // Per power of 2, per pixel
+    std::vector<double>              references(pixelCount);
+    std::vector<float>               u(dims.size());
+
+    for (uint32_t y = 0; y < kImageSize; y++)
+    {
+        for (uint32_t x = 0; x < kImageSize; x++)
+        {
+            const uint32_t pixel = y * kImageSize + x;
+            references[pixel]    = integrand.reference(x, y);
+            double   sum         = 0.0;
+            uint32_t checkpoint  = 0;
+            for (uint32_t s = 0; s < maxSamples; s++)
+            {
+                uint32_t seed = sampler == SAMPLER_FORMER ? tea(y * x + x, 0x9e3779b9u * (s + 1)) : tea(pixel, s);
+                for (uint32_t d = 0; d < integrand.dimensions; d++)
+                {
+                    if (sampler == SAMPLER_RANDOM || sampler == SAMPLER_FORMER)
+                        u[d] = rnd(seed);
+                    else
+                        u[d] = getSample(tables, sampler, x, y, kImageSize, s, dims[d]);
+                }
+                sum += integrand.eval(x, y, u.data());
+
+                if (((s + 1) & s) == 0)
+                {
+                    if (errors.size() <= checkpoint)
+                        errors.emplace_back(pixelCount);
+                    errors[checkpoint++][pixel] = sum / (s + 1) - references[pixel];
+                }
+            }
+        }
+    }
+
+    double referenceSq = 0.0;
+    for (double r : references)
+        referenceSq += r * r / pixelCount;
+
+    mse.assign(errors.size(), 0.0);
+    filteredMse.assign(errors.size(), 0.0);
+    for (size_t c = 0; c < errors.size(); c++)
+    {
+        for (uint32_t y = 0; y < kImageSize; y++)
+        {
+            for (uint32_t x = 0; x < kImageSize; x++)
+            {
+                double filtered = 0.0;
+                for (int dy = -1; dy <= 1; dy++)
+                {
+                    for (int dx = -1; dx <= 1; dx++)
+                        filtered += errors[c][((y + dy + kImageSize) % kImageSize) * kImageSize + (x + dx + kImageSize) % kImageSize] / 9.0;
+                }
+                const double e = errors[c][y * kImageSize + x];
+                mse[c] += e * e / pixelCount / referenceSq;
+                filteredMse[c] += filtered * filtered / pixelCount / referenceSq;
+            }
+        }
+    }
+}
+
+// One point of the first 2^m per elementary interval, of each dimension and of the first two
+static bool checkStratification(const std::vector<uint32_t>& tables)
+{
+    bool ok = true;
+    for (uint32_t seed : {0u, 1u, 0x1234567u})
+    {
+        for (uint32_t m = 1; m <= 10; m++)
+        {
+            const uint32_t n = 1u << m;
+            for (uint32_t d = 0; d < SOBOL_DIMENSIONS; d++)
+            {
+                std::vector<int> cells(n, 0);
+                for (uint32_t i = 0; i < n; i++)
+                {
+                    const uint32_t x = seed == 0 ? getSobol(tables.data(), i, d) : getScrambledSobol(tables.data(), seed, i, d);
+                    cells[x >> (32 - m)]++;
+                }
+                for (int c : cells)
+                    ok &= c == 1;
+            }
+            if (m % 2 == 0)
+            {
+                const uint32_t   side = m / 2;
+                std::vector<int> cells(n, 0);
+                for (uint32_t i = 0; i < n; i++)
+                {
+                    const uint32_t x = seed == 0 ? getSobol(tables.data(), i, 0) : getScrambledSobol(tables.data(), seed, i, 0);
+                    const uint32_t y = seed == 0 ? getSobol(tables.data(), i, 1) : getScrambledSobol(tables.data(), seed, i, 1);
+                    cells[(y >> (32 - side)) * (1u << side) + (x >> (32 - side))]++;
+                }
+                for (int c : cells)
+                    ok &= c == 1;
+            }
+        }
+    }
+    printf("Sobol stratification of the first 2^m points, m up to 10, unscrambled and scrambled: %s\n", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+static bool checkBlueNoise(const std::vector<uint32_t>& tables)
+{
+    const uint32_t       count = BLUE_NOISE_SIZE * BLUE_NOISE_SIZE;
+    std::vector<uint8_t> seen(count, 0);
+    bool                 ok    = true;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const uint32_t rank = static_cast<uint32_t>((uint64_t(tables[SOBOL_DIMENSIONS * SOBOL_BITS + i]) * count) >> 32);
+        ok &= seen[rank] == 0;
+        seen[rank] = 1;
+    }
+
+    // Mean squared difference of horizontal neighbors, 1/6 for white noise, higher for blue noise
+    double neighbors = 0.0;
+    for (uint32_t y = 0; y < BLUE_NOISE_SIZE; y++)
+    {
+        for (uint32_t x = 0; x < BLUE_NOISE_SIZE; x++)
+        {
+            const double a = tables[SOBOL_DIMENSIONS * SOBOL_BITS + y * BLUE_NOISE_SIZE + x] / 4294967296.0;
+            const double b = tables[SOBOL_DIMENSIONS * SOBOL_BITS + y * BLUE_NOISE_SIZE + (x + 1) % BLUE_NOISE_SIZE] / 4294967296.0;
+            neighbors += (a - b) * (a - b) / count;
+        }
+    }
+    printf("Blue-noise tile %ux%u: every rank once %s, mean squared difference of neighbors %.3f (white noise 0.167)\n",
+           BLUE_NOISE_SIZE, BLUE_NOISE_SIZE, ok ? "ok" : "FAILED", neighbors);
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    const uint32_t maxSamples = argc > 1 ? std::max(1, atoi(argv[1])) : 256;
+
+    const auto                  start  = std::chrono::steady_clock::now();
+    const std::vector<uint32_t> tables = buildSamplerTables();
+    printf("Sampler tables built in %.1f ms\n",
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+    bool ok = checkStratification(tables);
+    ok &= checkBlueNoise(tables);
+
+    const uint32_t    samplers[] = {SAMPLER_FORMER, SAMPLER_RANDOM, SAMPLER_SOBOL, SAMPLER_BLUE_NOISE};
+    const char* const names[]    = {"former", "random", "sobol", "blue noise"};
+    for (const Integrand& integrand : makeIntegrands())
+    {
+        std::vector<std::vector<double>> mse(4), filteredMse(4);
+        for (int i = 0; i < 4; i++)
+            measure(tables, samplers[i], integrand, maxSamples, mse[i], filteredMse[i]);
+
+        printf("\n%s, %ux%u pixels, relative MSE (after the 3x3 box filter)\n", integrand.name, kImageSize, kImageSize);
+        printf("  samples");
+        for (const char* name : names)
+            printf(" %23s", name);
+        printf("\n");
+        for (size_t c = 0; c < mse[0].size(); c++)
+        {
+            printf("  %7u", 1u << c);
+            for (int i = 0; i < 4; i++)
+                printf("   %9.2e (%9.2e)", mse[i][c], filteredMse[i][c]);
+            printf("\n");
+        }
+    }
+    return ok ? 0 : 1;
+}
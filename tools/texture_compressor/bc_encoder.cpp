@@ -0,0 +1,286 @@
+#include "bc_encoder.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+static const int kBC7Weights4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+// 128-bit block written LSB first
+struct BitWriter
+{
+    uint8_t* out;
+    uint32_t pos{0};
+
+    void put(uint32_t value, uint32_t count)
+    {
+        for (uint32_t i = 0; i < count; i++, pos++)
+        {
+            if (value & (1u << i))
+                out[pos >> 3] |= uint8_t(1u << (pos & 7));
+        }
+    }
+};
+
+static int bc7Interpolate(int e0, int e1, int index)
+{
+    return ((64 - kBC7Weights4[index]) * e0 + kBC7Weights4[index] * e1 + 32) >> 6;
+}
+
+// Quantizes float endpoints to 7 bits + shared p-bit, assigns the indices and returns the squared error
+static uint32_t bc7QuantizeAndFit(const uint8_t px[64], const float e[2][4], const int pbits[2], int q[2][4], int indices[16])
+{
+    int ep[2][4];
+    for (int i = 0; i < 2; i++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            q[i][c]  = std::clamp(int(std::floor((e[i][c] - pbits[i]) * 0.5f + 0.5f)), 0, 127);
+            ep[i][c] = (q[i][c] << 1) | pbits[i];
+        }
+    }
+
+    int palette[16][4];
+    for (int k = 0; k < 16; k++)
+        for (int c = 0; c < 4; c++)
+            palette[k][c] = bc7Interpolate(ep[0][c], ep[1][c], k);
+
+    uint32_t error = 0;
+    for (int p = 0; p < 16; p++)
+    {
+        uint32_t best = UINT32_MAX;
+        for (int k = 0; k < 16; k++)
+        {
+            uint32_t d = 0;
+            for (int c = 0; c < 4; c++)
+            {
+                int diff = palette[k][c] - px[p * 4 + c];
+                d += uint32_t(diff * diff);
+            }
+            if (d < best)
+            {
+                best       = d;
+                indices[p] = k;
+            }
+        }
+        error += best;
+    }
+    return error;
+}
+
+void encodeBlockBC7(const uint8_t px[64], uint8_t out[16])
+{
+    // Principal axis of the block colors
+    float mean[4] = {};
+    for (int p = 0; p < 16; p++)
+        for (int c = 0; c < 4; c++)
+            mean[c] += px[p * 4 + c] / 16.0f;
+
+    float cov[4][4] = {};
+    for (int p = 0; p < 16; p++)
+    {
+        float d[4];
+        for (int c = 0; c < 4; c++)
+            d[c] = px[p * 4 + c] - mean[c];
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 4; j++)
+                cov[i][j] += d[i] * d[j];
+    }
+
+    float axis[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    for (int iter = 0; iter < 8; iter++)
+    {
+        float next[4] = {};
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 4; j++)
+                next[i] += cov[i][j] * axis[j];
+        float len = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2] + next[3] * next[3]);
+        if (len < 1e-6f)
+            break;
+        for (int i = 0; i < 4; i++)
+            axis[i] = next[i] / len;
+    }
+
+    float tMin = FLT_MAX, tMax = -FLT_MAX;
+    for (int p = 0; p < 16; p++)
+    {
+        float t = 0.0f;
+        for (int c = 0; c < 4; c++)
+            t += (px[p * 4 + c] - mean[c]) * axis[c];
+        tMin = std::min(tMin, t);
+        tMax = std::max(tMax, t);
+    }
+
+    float e[2][4];
+    for (int c = 0; c < 4; c++)
+    {
+        e[0][c] = std::clamp(mean[c] + axis[c] * tMin, 0.0f, 255.0f);
+        e[1][c] = std::clamp(mean[c] + axis[c] * tMax, 0.0f, 255.0f);
+    }
+
+    int      bestQ[2][4], bestIndices[16], bestP[2] = {0, 0};
+    uint32_t bestError = UINT32_MAX;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int pb = 0; pb < 4; pb++)
+        {
+            int      pbits[2] = {pb & 1, pb >> 1};
+            int      q[2][4], indices[16];
+            uint32_t error = bc7QuantizeAndFit(px, e, pbits, q, indices);
+            if (error < bestError)
+            {
+                bestError = error;
+                memcpy(bestQ, q, sizeof(q));
+                memcpy(bestIndices, indices, sizeof(indices));
+                bestP[0] = pbits[0];
+                bestP[1] = pbits[1];
+            }
+        }
+        if (pass == 1 || bestError == 0)
+            break;
+
+        // Least squares refit of the endpoints for the chosen indices
+        float a = 0, b = 0, d = 0, rhs0[4] = {}, rhs1[4] = {};
+        for (int p = 0; p < 16; p++)
+        {
+            float w = kBC7Weights4[bestIndices[p]] / 64.0f;
+            a += (1 - w) * (1 - w);
+            b += (1 - w) * w;
+            d += w * w;
+            for (int c = 0; c < 4; c++)
+            {
+                rhs0[c] += (1 - w) * px[p * 4 + c];
+                rhs1[c] += w * px[p * 4 + c];
+            }
+        }
+        float det = a * d - b * b;
+        if (std::fabs(det) < 1e-6f)
+            break;
+        for (int c = 0; c < 4; c++)
+        {
+            e[0][c] = std::clamp((d * rhs0[c] - b * rhs1[c]) / det, 0.0f, 255.0f);
+            e[1][c] = std::clamp((a * rhs1[c] - b * rhs0[c]) / det, 0.0f, 255.0f);
+        }
+    }
+
+    // The anchor index is stored with 3 bits, its top bit must be 0
+    if (bestIndices[0] & 8)
+    {
+        for (int c = 0; c < 4; c++)
+            std::swap(bestQ[0][c], bestQ[1][c]);
+        std::swap(bestP[0], bestP[1]);
+        for (int p = 0; p < 16; p++)
+            bestIndices[p] = 15 - bestIndices[p];
+    }
+
+    memset(out, 0, 16);
+    BitWriter bits{out};
+    bits.put(1u << 6, 7);  // Mode 6
+    for (int c = 0; c < 4; c++)
+    {
+        bits.put(uint32_t(bestQ[0][c]), 7);
+        bits.put(uint32_t(bestQ[1][c]), 7);
+    }
+    bits.put(uint32_t(bestP[0]), 1);
+    bits.put(uint32_t(bestP[1]), 1);
+    bits.put(uint32_t(bestIndices[0]), 3);
+    for (int p = 1; p < 16; p++)
+        bits.put(uint32_t(bestIndices[p]), 4);
+}
+
+void encodeBlockBC4(const uint8_t values[16], uint8_t out[8])
+{
+    const uint8_t r0 = *std::max_element(values, values + 16);
+    const uint8_t r1 = *std::min_element(values, values + 16);
+
+    memset(out, 0, 8);
+    out[0] = r0;
+    out[1] = r1;
+    if (r0 == r1)
+        return;
+
+    // r0 > r1: codes 2..7 interpolate from r0 to r1 in sevenths
+    float palette[8] = {float(r0), float(r1)};
+    for (int k = 2; k < 8; k++)
+        palette[k] = ((8 - k) * r0 + (k - 1) * r1) / 7.0f;
+
+    uint64_t bits = 0;
+    for (int p = 0; p < 16; p++)
+    {
+        int   best  = 0;
+        float bestD = FLT_MAX;
+        for (int k = 0; k < 8; k++)
+        {
+            float d = std::fabs(palette[k] - values[p]);
+            if (d < bestD)
+            {
+                bestD = d;
+                best  = k;
+            }
+        }
+        bits |= uint64_t(best) << (3 * p);
+    }
+    for (int i = 0; i < 6; i++)
+        out[2 + i] = uint8_t(bits >> (8 * i));
+}
+
+TextureData compressTexture(const TextureData& rgba8, VkFormat format, const int channels[2])
+{
+    TextureData result;
+    result.width     = rgba8.width;
+    result.height    = rgba8.height;
+    result.mipLevels = rgba8.mipLevels;
+    result.format    = format;
+    result.pixels.resize(getMipLevelOffset(format, rgba8.width, rgba8.height, rgba8.mipLevels));
+
+    const uint32_t blockBytes = getBlockByteSize(format);
+    for (uint32_t level = 0; level < rgba8.mipLevels; level++)
+    {
+        const uint32_t w   = std::max(rgba8.width >> level, 1u);
+        const uint32_t h   = std::max(rgba8.height >> level, 1u);
+        const uint8_t* src = rgba8.pixels.data() + getMipLevelOffset(rgba8.format, rgba8.width, rgba8.height, level);
+        uint8_t*       dst = result.pixels.data() + getMipLevelOffset(format, rgba8.width, rgba8.height, level);
+
+        for (uint32_t by = 0; by < (h + 3) / 4; by++)
+        {
+            for (uint32_t bx = 0; bx < (w + 3) / 4; bx++)
+            {
+                // Gather the block, clamping at the edges of small or odd sized levels
+                uint8_t block[64];
+                for (uint32_t y = 0; y < 4; y++)
+                    for (uint32_t x = 0; x < 4; x++)
+                    {
+                        uint32_t sx = std::min(bx * 4 + x, w - 1);
+                        uint32_t sy = std::min(by * 4 + y, h - 1);
+                        memcpy(block + (y * 4 + x) * 4, src + (sy * w + sx) * 4, 4);
+                    }
+
+                switch (format)
+                {
+                case VK_FORMAT_BC7_UNORM_BLOCK:
+                case VK_FORMAT_BC7_SRGB_BLOCK:
+                    encodeBlockBC7(block, dst);
+                    break;
+                case VK_FORMAT_BC4_UNORM_BLOCK:
+                case VK_FORMAT_BC5_UNORM_BLOCK: {
+                    const int planes = format == VK_FORMAT_BC5_UNORM_BLOCK ? 2 : 1;
+                    for (int plane = 0; plane < planes; plane++)
+                    {
+                        uint8_t values[16];
+                        for (int p = 0; p < 16; p++)
+                            values[p] = block[p * 4 + channels[plane]];
+                        encodeBlockBC4(values, dst + plane * 8);
+                    }
+                    break;
+                }
+                default:
+                    assert(!"Unsupported block format");
+                }
+                dst += blockBytes;
+            }
+        }
+    }
+    return result;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+#include "texture_utils.h"
+
+//--------------------------------------------------------------------------------------------------
+// Simple CPU block compression encoders
+// - BC7 uses mode 6 only (one subset, RGBA 7.7.7.7 endpoints with p-bits, 4-bit indices):
+//   principal axis endpoints refined by one least squares pass
+// - BC4/BC5 use the 8 interpolant mode with min/max endpoints
+//
+void encodeBlockBC7(const uint8_t rgba[64], uint8_t out[16]);
+void encodeBlockBC4(const uint8_t values[16], uint8_t out[8]);
+
+// Compresses every mip level of an RGBA8 texture.
+// BC4 reads the channel channels[0], BC5 reads channels[0] and channels[1] into its red and green.
+TextureData compressTexture(const TextureData& rgba8, VkFormat format, const int channels[2]);
@@ -0,0 +1,218 @@
+//--------------------------------------------------------------------------------------------------
+// Offline conversion of the textures of a glTF scene to block compressed KTX2
+// - base color / emissive -> BC7 sRGB, normal -> BC5, metallic-roughness -> BC5 (roughness, metallic)
+//   read back through the KTXswizzle key, occlusion -> BC4, anything else -> BC7
+// - Mips are generated before compression
+// - The KTX2 images are referenced through KHR_texture_basisu, the original images stay as fallback
+//
+// Usage: texture_compressor <scene.gltf> [<output.gltf>]
+//
+
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "bc_encoder.h"
+#include "json.hpp"
+#include "ktx2.h"
+
+namespace fs = std::filesystem;
+using json   = nlohmann::json;
+
+enum ImageUsage : uint32_t
+{
+    eColor             = 1 << 0,
+    eNormal            = 1 << 1,
+    eMetallicRoughness = 1 << 2,
+    eOcclusion         = 1 << 3,
+};
+
+struct ImageJob
+{
+    uint32_t    usage{0};
+    std::string sourcePath;
+    std::string ktxUri;
+    uint64_t    rgba8Size{0};
+    uint64_t    compressedSize{0};
+    bool        done{false};
+};
+
+static void markUsage(const json& textureInfo, const json& textures, std::vector<ImageJob>& jobs, uint32_t usage)
+{
+    if (!textureInfo.is_object() || !textureInfo.contains("index"))
+        return;
+    int texture = textureInfo["index"];
+    if (texture < 0 || texture >= static_cast<int>(textures.size()) || !textures[texture].contains("source"))
+        return;
+    int source = textures[texture]["source"];
+    if (source >= 0 && source < static_cast<int>(jobs.size()))
+        jobs[source].usage |= usage;
+}
+
+static void convertImage(ImageJob& job)
+{
+    int      width, height, comp;
+    stbi_uc* pixels = stbi_load(job.sourcePath.c_str(), &width, &height, &comp, STBI_rgb_alpha);
+    if (pixels == nullptr)
+    {
+        fprintf(stderr, "Cannot load %s: %s\n", job.sourcePath.c_str(), stbi_failure_reason());
+        return;
+    }
+
+    TextureData rgba8;
+    rgba8.width  = static_cast<uint32_t>(width);
+    rgba8.height = static_cast<uint32_t>(height);
+    rgba8.format = (job.usage & eColor) ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+    rgba8.pixels.assign(pixels, pixels + size_t(width) * height * 4);
+    stbi_image_free(pixels);
+    generateMipmapsCpu(rgba8);
+
+    // Packed occlusion-metallic-roughness and mixed usages keep all channels
+    VkFormat    format      = VK_FORMAT_BC7_UNORM_BLOCK;
+    int         channels[2] = {0, 1};
+    const char* swizzle     = "rgba";
+    if (job.usage == eColor)
+        format = VK_FORMAT_BC7_SRGB_BLOCK;
+    else if (job.usage == eNormal)
+        format = VK_FORMAT_BC5_UNORM_BLOCK;
+    else if (job.usage == eMetallicRoughness)
+    {
+        format      = VK_FORMAT_BC5_UNORM_BLOCK;
+        channels[0] = 1;  // roughness
+        channels[1] = 2;  // metallic
+        swizzle     = "rrg1";
+    }
+    else if (job.usage == eOcclusion)
+        format = VK_FORMAT_BC4_UNORM_BLOCK;
+
+    TextureData compressed = compressTexture(rgba8, format, channels);
+    const fs::path outPath = fs::path(job.sourcePath).parent_path() / fs::path(job.ktxUri).filename();
+    if (!writeKtx2(outPath.string(), compressed, swizzle))
+    {
+        fprintf(stderr, "Cannot write %s\n", outPath.string().c_str());
+        return;
+    }
+
+    job.rgba8Size      = rgba8.pixels.size();
+    job.compressedSize = compressed.pixels.size();
+    job.done           = true;
+    printf("%s: %ux%u, %u mips, %.2f MB -> %.2f MB\n", outPath.filename().string().c_str(), rgba8.width, rgba8.height,
+           rgba8.mipLevels, job.rgba8Size / (1024.0 * 1024.0), job.compressedSize / (1024.0 * 1024.0));
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s <scene.gltf> [<output.gltf>]\n", argv[0]);
+        return 1;
+    }
+
+    const fs::path input  = argv[1];
+    const fs::path output = argc > 2 ? fs::path(argv[2]) : input.parent_path() / (input.stem().string() + ".bc.gltf");
+    if (input.extension() != ".gltf" || output.parent_path() != input.parent_path())
+    {
+        fprintf(stderr, "Only .gltf files are supported, and the output must be next to the input\n");
+        return 1;
+    }
+
+    json gltf;
+    {
+        std::ifstream f(input);
+        if (!f)
+        {
+            fprintf(stderr, "Cannot open %s\n", input.string().c_str());
+            return 1;
+        }
+        gltf = json::parse(f);
+    }
+
+    json&                 images   = gltf["images"];
+    json&                 textures = gltf["textures"];
+    std::vector<ImageJob> jobs(images.size());
+    for (const auto& material : gltf.value("materials", json::array()))
+    {
+        const json& pbr = material.value("pbrMetallicRoughness", json::object());
+        markUsage(pbr.value("baseColorTexture", json()), textures, jobs, eColor);
+        markUsage(pbr.value("metallicRoughnessTexture", json()), textures, jobs, eMetallicRoughness);
+        markUsage(material.value("emissiveTexture", json()), textures, jobs, eColor);
+        markUsage(material.value("normalTexture", json()), textures, jobs, eNormal);
+        markUsage(material.value("occlusionTexture", json()), textures, jobs, eOcclusion);
+    }
+
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        std::string uri = images[i].value("uri", "");
+        if (jobs[i].usage == 0 || uri.empty() || uri.rfind("data:", 0) == 0 || fs::path(uri).extension() == ".ktx2")
+        {
+            jobs[i].usage = 0;  // Embedded images are not handled
+            continue;
+        }
+        jobs[i].sourcePath = (input.parent_path() / uri).string();
+        jobs[i].ktxUri     = fs::path(uri).replace_extension(".ktx2").generic_string();
+    }
+
+    // One image per thread
+    std::atomic<size_t>      next{0};
+    std::vector<std::thread> threads(std::max(1u, std::thread::hardware_concurrency()));
+    for (auto& t : threads)
+    {
+        t = std::thread([&]() {
+            for (size_t i = next++; i < jobs.size(); i = next++)
+            {
+                if (jobs[i].usage != 0)
+                    convertImage(jobs[i]);
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    // Reference the KTX2 images through KHR_texture_basisu, keeping the original source as fallback
+    uint64_t rgba8Total = 0, compressedTotal = 0;
+    for (auto& texture : textures)
+    {
+        if (!texture.contains("source"))
+            continue;
+        const ImageJob& job = jobs[texture["source"].get<size_t>()];
+        if (!job.done)
+            continue;
+
+        size_t ktxImage = images.size();
+        for (size_t i = 0; i < images.size(); i++)
+        {
+            if (images[i].value("uri", "") == job.ktxUri)
+                ktxImage = i;
+        }
+        if (ktxImage == images.size())
+            images.push_back({{"uri", job.ktxUri}, {"mimeType", "image/ktx2"}});
+        texture["extensions"]["KHR_texture_basisu"]["source"] = ktxImage;
+    }
+    for (const auto& job : jobs)
+    {
+        rgba8Total += job.rgba8Size;
+        compressedTotal += job.compressedSize;
+    }
+
+    json& used = gltf["extensionsUsed"];
+    if (std::find(used.begin(), used.end(), "KHR_texture_basisu") == used.end())
+        used.push_back("KHR_texture_basisu");
+
+    std::ofstream out(output);
+    out << gltf.dump(2);
+    if (!out)
+    {
+        fprintf(stderr, "Cannot write %s\n", output.string().c_str());
+        return 1;
+    }
+
+    printf("Textures with mips: %.1f MB as RGBA8, %.1f MB compressed\n", rgba8Total / (1024.0 * 1024.0),
+           compressedTotal / (1024.0 * 1024.0));
+    printf("Wrote %s\n", output.string().c_str());
+    return 0;
+}
@@ -0,0 +1,265 @@
+#include "upload_service.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "nvh/nvprint.hpp"
+
+static constexpr VkDeviceSize kCopyAlignment = 16;  // Satisfies the offset rules of buffer and (block compressed) image copies
+
+void UploadService::init(VkDevice device, uint32_t queueFamilyIndex, nvvk::ResourceAllocator* alloc, VkDeviceSize stagingBudget)
+{
+    m_device = device;
+    m_alloc  = alloc;
+    m_budget = stagingBudget;
+    vkGetDeviceQueue(m_device, queueFamilyIndex, 0, &m_queue);
+
+    VkCommandPoolCreateInfo poolInfo{VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+    poolInfo.flags            = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
+    vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_cmdPool);
+
+    VkSemaphoreTypeCreateInfo timelineInfo{VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+    timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    VkSemaphoreCreateInfo semInfo{VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+    semInfo.pNext = &timelineInfo;
+    vkCreateSemaphore(m_device, &semInfo, nullptr, &m_timeline);
+
+    m_ring = m_alloc->createBuffer(m_budget, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    m_ringMapped = static_cast<uint8_t*>(m_alloc->map(m_ring));
+}
+
+void UploadService::deinit()
+{
+    if (m_device == VK_NULL_HANDLE)
+        return;
+
+    waitIdle();
+    m_alloc->unmap(m_ring);
+    m_alloc->destroy(m_ring);
+    vkDestroySemaphore(m_device, m_timeline, nullptr);
+    vkDestroyCommandPool(m_device, m_cmdPool, nullptr);
+    m_freeCmdBufs.clear();
+    m_device = VK_NULL_HANDLE;
+}
+
+nvvk::Buffer UploadService::createBuffer(VkDeviceSize size, const void* data, VkBufferUsageFlags usage)
+{
+    nvvk::Buffer buffer = m_alloc->createBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    if (size > 0 && data != nullptr)
+        uploadBuffer(buffer.buffer, 0, size, data);
+    return buffer;
+}
+
+void UploadService::uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size, const void* data)
+{
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+    while (size > 0)
+    {
+        VkDeviceSize chunk  = std::min(size, getMaxChunk());
+        VkDeviceSize offset = allocate(chunk, kCopyAlignment);
+        memcpy(m_ringMapped + offset, src, chunk);
+
+        VkBufferCopy region{offset, dstOffset, chunk};
+        vkCmdCopyBuffer(getCommandBuffer(), m_ring.buffer, dst, 1, &region);
+
+        src += chunk;
+        dstOffset += chunk;
+        size -= chunk;
+        m_totalUploaded += chunk;
+    }
+}
+
+void UploadService::uploadImage(VkImage                         dst,
+                                const VkOffset3D&               offset,
+                                const VkExtent3D&               extent,
+                                const VkImageSubresourceLayers& subresource,
+                                VkDeviceSize                    size,
+                                const void*                     data,
+                                uint32_t                        blockHeight)
+{
+    // Large images are split in bands of whole block rows
+    const uint32_t     blockRows   = (extent.height + blockHeight - 1) / blockHeight;
+    const VkDeviceSize rowSize     = size / (VkDeviceSize(blockRows) * extent.depth);
+    const uint32_t     rowsInChunk = static_cast<uint32_t>(std::max<VkDeviceSize>(getMaxChunk() / rowSize, 1)) * blockHeight;
+    assert(extent.depth == 1 || rowsInChunk >= extent.height);
+
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+    for (uint32_t row = 0; row < extent.height; row += rowsInChunk)
+    {
+        const uint32_t     rows      = std::min(rowsInChunk, extent.height - row);
+        const VkDeviceSize chunk     = rowSize * ((rows + blockHeight - 1) / blockHeight) * extent.depth;
+        const VkDeviceSize ringOffset = allocate(chunk, kCopyAlignment);
+        memcpy(m_ringMapped + ringOffset, src, chunk);
+
+        VkBufferImageCopy region{};
+        region.bufferOffset     = ringOffset;
+        region.imageSubresource = subresource;
+        region.imageOffset      = {offset.x, offset.y + static_cast<int32_t>(row), offset.z};
+        region.imageExtent      = {extent.width, rows, extent.depth};
+        vkCmdCopyBufferToImage(getCommandBuffer(), m_ring.buffer, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+        src += chunk;
+        m_totalUploaded += chunk;
+    }
+}
+
+VkCommandBuffer UploadService::getCommandBuffer()
+{
+    if (m_current.cmdBuf != VK_NULL_HANDLE)
+        return m_current.cmdBuf;
+
+    if (!m_freeCmdBufs.empty())
+    {
+        m_current.cmdBuf = m_freeCmdBufs.back();
+        m_freeCmdBufs.pop_back();
+    }
+    else
+    {
+        VkCommandBufferAllocateInfo allocInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+        allocInfo.commandPool        = m_cmdPool;
+        allocInfo.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+        vkAllocateCommandBuffers(m_device, &allocInfo, &m_current.cmdBuf);
+    }
+
+    VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(m_current.cmdBuf, &beginInfo);
+    return m_current.cmdBuf;
+}
+
+uint64_t UploadService::flush()
+{
+    if (m_current.cmdBuf == VK_NULL_HANDLE)
+        return m_timelineValue;
+
+    // Make the copies visible to whatever is submitted after this batch
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    vkCmdPipelineBarrier(m_current.cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier,
+                         0, nullptr, 0, nullptr);
+    vkEndCommandBuffer(m_current.cmdBuf);
+
+    m_current.timelineValue = ++m_timelineValue;
+    m_current.ringEnd       = m_head;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues    = &m_current.timelineValue;
+
+    VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    submitInfo.pNext                = &timelineInfo;
+    submitInfo.commandBufferCount   = 1;
+    submitInfo.pCommandBuffers      = &m_current.cmdBuf;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores    = &m_timeline;
+    vkQueueSubmit(m_queue, 1, &submitInfo, VK_NULL_HANDLE);
+
+    m_inFlight.push_back(m_current);
+    m_current = Batch{};
+    m_batchCount++;
+    return m_timelineValue;
+}
+
+bool UploadService::isComplete(uint64_t value)
+{
+    retire(false);
+    uint64_t completed = 0;
+    vkGetSemaphoreCounterValue(m_device, m_timeline, &completed);
+    return completed >= value;
+}
+
+void UploadService::waitIdle()
+{
+    flush();
+    while (!m_inFlight.empty())
+        retire(true);
+}
+
+void UploadService::retire(bool waitOldest)
+{
+    if (waitOldest && !m_inFlight.empty())
+    {
+        VkSemaphoreWaitInfo waitInfo{VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores    = &m_timeline;
+        waitInfo.pValues        = &m_inFlight.front().timelineValue;
+        vkWaitSemaphores(m_device, &waitInfo, UINT64_MAX);
+    }
+
+    uint64_t completed = 0;
+    vkGetSemaphoreCounterValue(m_device, m_timeline, &completed);
+    while (!m_inFlight.empty() && m_inFlight.front().timelineValue <= completed)
+    {
+        const Batch& batch = m_inFlight.front();
+        m_tail             = batch.ringEnd;
+        m_used -= batch.ringUsed;
+        vkResetCommandBuffer(batch.cmdBuf, 0);
+        m_freeCmdBufs.push_back(batch.cmdBuf);
+        m_inFlight.pop_front();
+    }
+}
+
+bool UploadService::tryAllocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
+{
+    if (m_used == 0)
+        m_head = m_tail = 0;
+
+    // Free space is [head, budget) + [0, tail) until the head wraps, then [head, tail)
+    const bool   wrapped = m_head < m_tail || (m_head == m_tail && m_used > 0);
+    VkDeviceSize aligned = (m_head + alignment - 1) & ~(alignment - 1);
+    VkDeviceSize newHead = 0;
+    if (!wrapped && aligned + size <= m_budget)
+    {
+        offset  = aligned;
+        newHead = aligned + size;
+    }
+    else if (!wrapped && size <= m_tail)
+    {
+        offset  = 0;  // The end of the ring is skipped, and accounted as used until the batch retires
+        newHead = size;
+    }
+    else if (wrapped && aligned + size <= m_tail)
+    {
+        offset  = aligned;
+        newHead = aligned + size;
+    }
+    else
+    {
+        return false;
+    }
+
+    const VkDeviceSize consumed = newHead > m_head ? newHead - m_head : (m_budget - m_head) + newHead;
+    m_used += consumed;
+    m_current.ringUsed += consumed;
+    m_head     = newHead;
+    m_peakUsed = std::max(m_peakUsed, m_used);
+    return true;
+}
+
+VkDeviceSize UploadService::allocate(VkDeviceSize size, VkDeviceSize alignment)
+{
+    assert(size <= m_budget);
+
+    VkDeviceSize offset = 0;
+    while (!tryAllocate(size, alignment, offset))
+    {
+        // Free the oldest batch, submitting the current one first if nothing else is in flight
+        if (m_inFlight.empty())
+        {
+            if (m_current.cmdBuf == VK_NULL_HANDLE)
+            {
+                LOGE("UploadService: %llu bytes do not fit in the staging ring\n", static_cast<unsigned long long>(size));
+                assert(false);
+                return 0;
+            }
+            flush();
+        }
+        retire(true);
+    }
+    return offset;
+}
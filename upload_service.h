@@ -0,0 +1,92 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include "nvvk/resourceallocator_vk.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// Streams data to device local buffers and images through a fixed-size staging ring
+// - Copies are recorded into batches, a batch is submitted when the ring runs out of space
+//   or on flush(), and retired through a timeline semaphore
+// - Uploads larger than the ring are split, so peak staging memory never exceeds the budget
+// - Not thread safe, all calls must come from the same thread
+//
+class UploadService
+{
+public:
+    void init(VkDevice device, uint32_t queueFamilyIndex, nvvk::ResourceAllocator* alloc, VkDeviceSize stagingBudget);
+    void deinit();
+
+    // Device local buffer filled with 'data', TRANSFER_DST is added to the usage
+    nvvk::Buffer createBuffer(VkDeviceSize size, const void* data, VkBufferUsageFlags usage);
+    template <typename T>
+    nvvk::Buffer createBuffer(const std::vector<T>& data, VkBufferUsageFlags usage)
+    {
+        return createBuffer(sizeof(T) * data.size(), data.data(), usage);
+    }
+
+    void uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size, const void* data);
+    // The image must be in TRANSFER_DST_OPTIMAL, 'data' is tightly packed. Large images are split in bands of
+    // 'blockHeight' texel rows (4 for block compressed formats)
+    void uploadImage(VkImage                         dst,
+                     const VkOffset3D&               offset,
+                     const VkExtent3D&               extent,
+                     const VkImageSubresourceLayers& subresource,
+                     VkDeviceSize                    size,
+                     const void*                     data,
+                     uint32_t                        blockHeight = 1);
+
+    // Command buffer of the current batch, for layout transitions and mip generation around the copies
+    VkCommandBuffer getCommandBuffer();
+
+    // Submits the current batch without waiting for it. Returns the timeline value signaled once the
+    // batches submitted so far are done
+    uint64_t flush();
+    // Whether the batches up to 'value' are done, without waiting. Retires them
+    bool isComplete(uint64_t value);
+    // Submits the current batch and waits for all of them, the uploaded data is then visible to any later submission
+    void waitIdle();
+
+    VkDeviceSize getBudget() const { return m_budget; }
+    VkDeviceSize getPeakUsage() const { return m_peakUsed; }
+    VkDeviceSize getTotalUploaded() const { return m_totalUploaded; }
+    uint32_t     getBatchCount() const { return m_batchCount; }
+
+private:
+    struct Batch
+    {
+        VkCommandBuffer cmdBuf{VK_NULL_HANDLE};
+        uint64_t        timelineValue{0};
+        VkDeviceSize    ringEnd{0};   // Ring head after the last allocation of the batch
+        VkDeviceSize    ringUsed{0};  // Bytes of the ring held by the batch, padding included
+    };
+
+    // Returns the ring offset of 'size' bytes, submitting and waiting on batches until they fit
+    VkDeviceSize allocate(VkDeviceSize size, VkDeviceSize alignment);
+    bool         tryAllocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+    void         retire(bool waitOldest);
+    VkDeviceSize getMaxChunk() const { return m_budget / 4; }
+
+    VkDevice                 m_device{VK_NULL_HANDLE};
+    VkQueue                  m_queue{VK_NULL_HANDLE};
+    VkCommandPool            m_cmdPool{VK_NULL_HANDLE};
+    VkSemaphore              m_timeline{VK_NULL_HANDLE};
+    uint64_t                 m_timelineValue{0};
+    nvvk::ResourceAllocator* m_alloc{nullptr};
+
+    nvvk::Buffer m_ring;
+    uint8_t*     m_ringMapped{nullptr};
+    VkDeviceSize m_budget{0};
+    VkDeviceSize m_head{0};
+    VkDeviceSize m_tail{0};
+    VkDeviceSize m_used{0};
+
+    Batch                        m_current;
+    std::deque<Batch>            m_inFlight;
+    std::vector<VkCommandBuffer> m_freeCmdBufs;
+
+    VkDeviceSize m_peakUsed{0};
+    VkDeviceSize m_totalUploaded{0};
+    uint32_t     m_batchCount{0};
+};
@@ -0,0 +1,240 @@
+#include "vertex_compression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+
+static int16_t toSnorm16(float v)
+{
+    return static_cast<int16_t>(std::lround(std::clamp(v, -1.0f, 1.0f) * 32767.0f));
+}
+
+static float fromSnorm16(int16_t v)
+{
+    return std::max(v / 32767.0f, -1.0f);
+}
+
+static uint32_t packSnorm16(int16_t x, int16_t y)
+{
+    return uint32_t(uint16_t(x)) | (uint32_t(uint16_t(y)) << 16);
+}
+
+static float signNotZero(float v)
+{
+    return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+static nvmath::vec2f octEncode(const nvmath::vec3f& n)
+{
+    const float   l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+    nvmath::vec2f p(n.x / l1, n.y / l1);
+    if (n.z < 0.0f)
+        p = nvmath::vec2f((1.0f - std::fabs(p.y)) * signNotZero(p.x), (1.0f - std::fabs(p.x)) * signNotZero(p.y));
+    return p;
+}
+
+// Same as octDecode() in vertex_format.glsl
+static nvmath::vec3f octDecode(float x, float y)
+{
+    nvmath::vec3f n(x, y, 1.0f - std::fabs(x) - std::fabs(y));
+    const float   t = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return nvmath::normalize(n);
+}
+
+uint32_t packOctSnorm16(const nvmath::vec3f& n)
+{
+    const float len = nvmath::length(n);
+    if (len == 0.0f)
+        return packSnorm16(0, 32767);  // +Z
+    const nvmath::vec3f dir = n / len;
+    const nvmath::vec2f e   = octEncode(dir);
+
+    // Keep the rounding of x and y that decodes closest to the input
+    int16_t bestX = 0, bestY = 0;
+    float   bestDot = -2.0f;
+    for (int i = 0; i < 4; i++)
+    {
+        const int16_t x = static_cast<int16_t>(std::clamp((i & 1) ? std::ceil(e.x * 32767.0f) : std::floor(e.x * 32767.0f), -32767.0f, 32767.0f));
+        const int16_t y = static_cast<int16_t>(std::clamp((i & 2) ? std::ceil(e.y * 32767.0f) : std::floor(e.y * 32767.0f), -32767.0f, 32767.0f));
+        const float   d = nvmath::dot(octDecode(fromSnorm16(x), fromSnorm16(y)), dir);
+        if (d > bestDot)
+        {
+            bestDot = d;
+            bestX   = x;
+            bestY   = y;
+        }
+    }
+    return packSnorm16(bestX, bestY);
+}
+
+uint32_t packTangentSnorm16(const nvmath::vec4f& t)
+{
+    const nvmath::vec3f dir(t.x, t.y, t.z);
+    if (nvmath::length(dir) == 0.0f)
+        return packSnorm16(32767, t.w < 0.0f ? -16384 : 16384);  // +X
+
+    // y is remapped to [0, 1] to carry the handedness in its sign, it can never be 0
+    const nvmath::vec2f e = octEncode(nvmath::normalize(dir));
+    const int16_t       y = std::max<int16_t>(toSnorm16(e.y * 0.5f + 0.5f), 1);
+    return packSnorm16(toSnorm16(e.x), t.w < 0.0f ? -y : y);
+}
+
+uint16_t floatToHalf(float value)
+{
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+    const uint32_t sign = (f >> 16) & 0x8000;
+    const uint32_t abs  = f & 0x7fffffff;
+    if (abs >= 0x7f800000)
+        return static_cast<uint16_t>(sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0));  // Inf, NaN
+
+    const int32_t exponent = int32_t(abs >> 23) - 127 + 15;
+    uint32_t      mantissa = abs & 0x7fffff;
+    if (exponent <= 0)
+    {
+        // Denormal, or zero below the smallest denormal
+        if (exponent < -10)
+            return static_cast<uint16_t>(sign);
+        mantissa |= 0x800000;
+        const uint32_t shift = uint32_t(14 - exponent);
+        uint32_t       half  = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1)
+            half++;
+        return static_cast<uint16_t>(sign | half);
+    }
+
+    uint32_t half = (uint32_t(exponent) << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000)
+        half++;  // Round to nearest, may carry into the exponent
+    return static_cast<uint16_t>(sign | std::min(half, 0x7bffu));  // Clamped to the largest finite half
+}
+
+uint32_t packHalf2(const nvmath::vec2f& v)
+{
+    return uint32_t(floatToHalf(v.x)) | (uint32_t(floatToHalf(v.y)) << 16);
+}
+
+uint64_t getFloatGeometrySize(const nvh::GltfScene& scene)
+{
+    return scene.m_positions.size() * sizeof(nvmath::vec3f) + scene.m_normals.size() * sizeof(nvmath::vec3f)
+           + scene.m_tangents.size() * sizeof(nvmath::vec4f) + scene.m_texcoords0.size() * sizeof(nvmath::vec2f)
+           + scene.m_indices.size() * sizeof(uint32_t);
+}
+
+PrimMeshInfo makePrimMeshInfo(const nvh::GltfPrimMesh& primMesh)
+{
+    PrimMeshInfo info{};
+    info.indexOffset   = primMesh.firstIndex;
+    info.vertexOffset  = primMesh.vertexOffset;
+    info.materialIndex = primMesh.materialIndex;
+    info.indexSize     = sizeof(uint32_t);
+    info.posOffset     = nvmath::vec4f(0.0f);
+    info.posScale      = nvmath::vec4f(1.0f);
+    return info;
+}
+
+CompressedGeometry compressGeometry(const nvh::GltfScene& scene, bool quantizePositions)
+{
+    CompressedGeometry geometry;
+    geometry.quantizedPositions = quantizePositions;
+
+    const size_t vertexCount = scene.m_positions.size();
+    geometry.normals.resize(vertexCount, packOctSnorm16({0.0f, 0.0f, 1.0f}));
+    geometry.tangents.resize(vertexCount, packTangentSnorm16({1.0f, 0.0f, 0.0f, 1.0f}));
+    geometry.texcoords.resize(vertexCount, 0);
+    for (size_t i = 0; i < std::min(vertexCount, scene.m_normals.size()); i++)
+        geometry.normals[i] = packOctSnorm16(scene.m_normals[i]);
+    for (size_t i = 0; i < std::min(vertexCount, scene.m_tangents.size()); i++)
+        geometry.tangents[i] = packTangentSnorm16(scene.m_tangents[i]);
+    for (size_t i = 0; i < std::min(vertexCount, scene.m_texcoords0.size()); i++)
+        geometry.texcoords[i] = packHalf2(scene.m_texcoords0[i]);
+
+    geometry.positions.resize(vertexCount * geometry.getPositionStride());
+    if (!quantizePositions)
+        memcpy(geometry.positions.data(), scene.m_positions.data(), geometry.positions.size());
+
+    // Primitive meshes reusing the vertices and indices of another one share its ranges
+    std::map<std::pair<uint32_t, uint32_t>, size_t> packed;
+    // The positions are quantized once per vertex range, also when the index ranges differ, so the
+    // primitive meshes sharing vertices dequantize them the same
+    std::map<std::pair<uint32_t, uint32_t>, std::pair<nvmath::vec4f, nvmath::vec4f>> quantized;
+    for (const auto& primMesh : scene.m_primMeshes)
+    {
+        auto it = packed.find({primMesh.firstIndex, primMesh.vertexOffset});
+        if (it != packed.end())
+        {
+            PrimMeshInfo info  = geometry.primInfos[it->second];
+            info.materialIndex = primMesh.materialIndex;
+            geometry.primInfos.push_back(info);
+            continue;
+        }
+        packed[{primMesh.firstIndex, primMesh.vertexOffset}] = geometry.primInfos.size();
+
+        PrimMeshInfo    info       = makePrimMeshInfo(primMesh);
+        const uint32_t* srcIndices = scene.m_indices.data() + primMesh.firstIndex;
+        const uint32_t  maxIndex   = primMesh.indexCount > 0 ? *std::max_element(srcIndices, srcIndices + primMesh.indexCount) : 0;
+
+        info.indexSize      = maxIndex <= 0xffff ? sizeof(uint16_t) : sizeof(uint32_t);
+        const size_t offset = (geometry.indices.size() + 3) & ~size_t(3);
+        info.indexOffset    = static_cast<uint32_t>(offset / info.indexSize);
+        geometry.indices.resize(offset + size_t(primMesh.indexCount) * info.indexSize);
+        if (info.indexSize == sizeof(uint16_t))
+        {
+            uint16_t* dst = reinterpret_cast<uint16_t*>(geometry.indices.data() + offset);
+            for (uint32_t i = 0; i < primMesh.indexCount; i++)
+                dst[i] = static_cast<uint16_t>(srcIndices[i]);
+            geometry.index16Count += primMesh.indexCount;
+        }
+        else
+        {
+            memcpy(geometry.indices.data() + offset, srcIndices, size_t(primMesh.indexCount) * sizeof(uint32_t));
+        }
+
+        const auto range  = std::make_pair(primMesh.vertexOffset, primMesh.vertexCount);
+        auto       bounds = quantized.find(range);
+        if (bounds != quantized.end())
+        {
+            info.posOffset = bounds->second.first;
+            info.posScale  = bounds->second.second;
+        }
+        else if (quantizePositions && primMesh.vertexCount > 0)
+        {
+            const nvmath::vec3f* src  = scene.m_positions.data() + primMesh.vertexOffset;
+            nvmath::vec3f        bmin = src[0];
+            nvmath::vec3f        bmax = src[0];
+            for (uint32_t i = 1; i < primMesh.vertexCount; i++)
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    bmin[c] = std::min(bmin[c], src[i][c]);
+                    bmax[c] = std::max(bmax[c], src[i][c]);
+                }
+            }
+            nvmath::vec3f center, half;
+            for (int c = 0; c < 3; c++)
+            {
+                center[c] = (bmin[c] + bmax[c]) * 0.5f;
+                half[c]   = std::max((bmax[c] - bmin[c]) * 0.5f, 1e-8f);
+            }
+            info.posOffset   = nvmath::vec4f(center.x, center.y, center.z, 0.0f);
+            info.posScale    = nvmath::vec4f(half.x, half.y, half.z, 0.0f);
+            quantized[range] = {info.posOffset, info.posScale};
+
+            int16_t* dst = reinterpret_cast<int16_t*>(geometry.positions.data()) + size_t(primMesh.vertexOffset) * 4;
+            for (uint32_t i = 0; i < primMesh.vertexCount; i++)
+            {
+                for (int c = 0; c < 3; c++)
+                    dst[i * 4 + c] = toSnorm16((src[i][c] - center[c]) / half[c]);
+                dst[i * 4 + 3] = 32767;
+            }
+        }
+        geometry.primInfos.push_back(info);
+    }
+
+    // The hit shader reads the indices as 32-bit words
+    geometry.indices.resize((geometry.indices.size() + 3) & ~size_t(3));
+    return geometry;
+}
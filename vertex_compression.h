@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "nvh/gltfscene.hpp"
+#include "shaders/host_device.h"
+
+//--------------------------------------------------------------------------------------------------
+// Compressed vertex layout, produced at load time from the float arrays of the scene
+// - Normals: octahedral, 2 x snorm16
+// - Tangents: octahedral, 2 x snorm16, the handedness is the sign of the second component
+// - UVs: 2 x half
+// - Positions (optional): 4 x snorm16 relative to the bounds of each primitive mesh
+// - Indices: 16-bit for the primitive meshes with at most 65536 vertices
+// The matching decoding is in shaders/vertex_format.glsl
+//
+struct CompressedGeometry
+{
+    bool                  quantizedPositions{false};
+    std::vector<uint8_t>  positions;  // float3, or snorm16x4 when quantized
+    std::vector<uint32_t> normals;
+    std::vector<uint32_t> tangents;
+    std::vector<uint32_t> texcoords;
+    std::vector<uint8_t>  indices;  // 16 and 32-bit ranges, each starting on 4 bytes
+
+    // Per primitive mesh: first index in units of its index size, and the position dequantization
+    std::vector<PrimMeshInfo> primInfos;
+    uint64_t                  index16Count{0};
+
+    uint32_t getPositionStride() const { return quantizedPositions ? 4 * sizeof(int16_t) : sizeof(nvmath::vec3f); }
+    uint64_t getSize() const
+    {
+        return positions.size() + indices.size() + (normals.size() + tangents.size() + texcoords.size()) * sizeof(uint32_t);
+    }
+};
+
+CompressedGeometry compressGeometry(const nvh::GltfScene& scene, bool quantizePositions);
+
+// Vertex and index bytes of the float layout
+uint64_t getFloatGeometrySize(const nvh::GltfScene& scene);
+// Info of a primitive mesh in the float layout: 32-bit indices, no dequantization
+PrimMeshInfo makePrimMeshInfo(const nvh::GltfPrimMesh& primMesh);
+
+uint32_t packOctSnorm16(const nvmath::vec3f& n);
+uint32_t packTangentSnorm16(const nvmath::vec4f& t);
+uint32_t packHalf2(const nvmath::vec2f& v);
+uint16_t floatToHalf(float value);